@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include "bench.h"
+
+#include <chiaki/time.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int cmp_double(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static double percentile(const double *sorted, size_t count, double p)
+{
+	size_t i = (size_t)(p / 100.0 * (double)(count - 1) + 0.5);
+	return sorted[i];
+}
+
+void bench_report(const char *name, double *ns, size_t count, size_t ops_per_batch, size_t bytes_per_op)
+{
+	if(!count)
+		return;
+	qsort(ns, count, sizeof(double), cmp_double);
+	double p50 = percentile(ns, count, 50.0);
+	printf("{\"name\": \"%s\", \"batches\": %llu, \"ops_per_batch\": %llu, "
+			"\"ns_per_op\": {\"min\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+			"\"ops_per_sec\": %.0f",
+			name, (unsigned long long)count, (unsigned long long)ops_per_batch,
+			ns[0], p50, percentile(ns, count, 99.0), ns[count - 1],
+			p50 > 0.0 ? 1e9 / p50 : 0.0);
+	if(bytes_per_op)
+		printf(", \"mbytes_per_sec\": %.1f", p50 > 0.0 ? (double)bytes_per_op * 1e3 / p50 : 0.0);
+	printf("}\n");
+	fflush(stdout);
+}
+
+static void measure(const Bench *bench, unsigned long batches, double *ns)
+{
+	// warm up caches, lazily built tables and the branch predictor
+	bench->run(bench->user, bench->ops);
+	for(unsigned long b=0; b<batches; b++)
+	{
+		uint64_t start_us = chiaki_time_now_monotonic_us();
+		bench->run(bench->user, bench->ops);
+		ns[b] = (double)(chiaki_time_now_monotonic_us() - start_us) * 1000.0 / bench->ops;
+	}
+	bench_report(bench->name, ns, batches, bench->ops, bench->bytes);
+}
+
+bool bench_run(const Bench *benches, size_t count, unsigned long batches, const char *filter, bool list)
+{
+	double *ns = malloc(batches * sizeof(double));
+	if(!ns)
+		return false;
+	for(size_t i=0; i<count; i++)
+	{
+		if(filter && !strstr(benches[i].name, filter))
+			continue;
+		if(list)
+		{
+			printf("%s\n", benches[i].name);
+			continue;
+		}
+		measure(&benches[i], batches, ns);
+	}
+	free(ns);
+	return true;
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_BENCH_H
+#define CHIAKI_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct bench_t
+{
+	const char *name;
+	size_t ops; // per batch
+	size_t bytes; // per op, 0 if throughput in bytes is meaningless
+	void (*run)(void *user, size_t ops);
+	void *user;
+} Bench;
+
+/**
+ * Summarize the time per op of count batches as one JSON object on a line of stdout,
+ * the format shared by all benchmarks, so their output can be diffed or fed into scripts.
+ *
+ * @param ns time per op of every batch, sorted in place
+ */
+void bench_report(const char *name, double *ns, size_t count, size_t ops_per_batch, size_t bytes_per_op);
+
+/**
+ * Run a warmup and the given number of timed batches for every benchmark whose name contains filter
+ *
+ * @param filter NULL to run all
+ * @param list only print the names instead of running
+ * @return false if the results could not be allocated
+ */
+bool bench_run(const Bench *benches, size_t count, unsigned long batches, const char *filter, bool list);
+
+#endif // CHIAKI_BENCH_H
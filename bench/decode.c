@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Decodes a captured raw H.264/H.265 elementary stream with ChiakiFfmpegDecoder in software
+ * and reports the latency from pushing an access unit until its frame can be pulled,
+ * in the same JSON line format as the other benchmarks, one op being one frame.
+ *
+ * A capture can be produced by writing every sample passed to the session's video sample callback to a file.
+ */
+
+#include "bench.h"
+
+#include <chiaki/ffmpegdecoder.h>
+#include <chiaki/time.h>
+
+#include <libavcodec/avcodec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARSE_CHUNK_SIZE (1024 * 1024)
+
+typedef struct access_unit_t
+{
+	size_t offset;
+	size_t size;
+} AccessUnit;
+
+typedef struct stream_t
+{
+	uint8_t *buf;
+	size_t buf_size;
+	size_t buf_alloc;
+	AccessUnit *aus;
+	size_t aus_count;
+	size_t aus_alloc;
+} Stream;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [OPTIONS] FILE\n"
+			"  --h265          Stream is H.265 instead of H.264\n"
+			"  --default       Use the FFmpeg default configuration instead of the low latency one\n"
+			"  --threads N     Number of slice threads, 0 for one per core (default)\n"
+			"  --loops N       Decode the stream N times (default 1)\n"
+			"  --warmup N      Exclude the first N frames from the statistics (default 10)\n",
+			name);
+}
+
+static void frame_available(ChiakiFfmpegDecoder *decoder, void *user)
+{
+}
+
+static bool read_file(const char *path, uint8_t **buf, size_t *buf_size)
+{
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if(size <= 0)
+	{
+		fclose(f);
+		return false;
+	}
+	*buf = malloc(size);
+	if(!*buf || fread(*buf, 1, size, f) != (size_t)size)
+	{
+		free(*buf);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	*buf_size = size;
+	return true;
+}
+
+static bool stream_append(Stream *stream, const uint8_t *data, size_t size)
+{
+	if(stream->aus_count == stream->aus_alloc)
+	{
+		size_t aus_alloc = stream->aus_alloc ? stream->aus_alloc * 2 : 1024;
+		AccessUnit *aus = realloc(stream->aus, aus_alloc * sizeof(AccessUnit));
+		if(!aus)
+			return false;
+		stream->aus = aus;
+		stream->aus_alloc = aus_alloc;
+	}
+	if(stream->buf_size + size + AV_INPUT_BUFFER_PADDING_SIZE > stream->buf_alloc)
+	{
+		size_t buf_alloc = stream->buf_alloc ? stream->buf_alloc : PARSE_CHUNK_SIZE;
+		while(stream->buf_size + size + AV_INPUT_BUFFER_PADDING_SIZE > buf_alloc)
+			buf_alloc *= 2;
+		uint8_t *buf = realloc(stream->buf, buf_alloc);
+		if(!buf)
+			return false;
+		stream->buf = buf;
+		stream->buf_alloc = buf_alloc;
+	}
+	memcpy(stream->buf + stream->buf_size, data, size);
+	memset(stream->buf + stream->buf_size + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	stream->aus[stream->aus_count].offset = stream->buf_size;
+	stream->aus[stream->aus_count].size = size;
+	stream->aus_count++;
+	stream->buf_size += size;
+	return true;
+}
+
+/**
+ * Split a raw elementary stream into access units, so each one can be pushed like a sample from the session
+ */
+static bool stream_parse(Stream *stream, AVCodecContext *codec_context, enum AVCodecID codec_id, const uint8_t *in, size_t in_size)
+{
+	AVCodecParserContext *parser = av_parser_init(codec_id);
+	if(!parser)
+		return false;
+
+	bool flushed = false;
+	while(!flushed)
+	{
+		// an empty input flushes the last access unit out of the parser
+		int chunk_size = in_size > PARSE_CHUNK_SIZE ? PARSE_CHUNK_SIZE : (int)in_size;
+		flushed = chunk_size == 0;
+		uint8_t *data = NULL;
+		int data_size = 0;
+		int used = av_parser_parse2(parser, codec_context, &data, &data_size,
+				in, chunk_size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+		if(used < 0)
+			break;
+		in += used;
+		in_size -= used;
+		if(data_size && !stream_append(stream, data, data_size))
+			break;
+	}
+
+	av_parser_close(parser);
+	return flushed;
+}
+
+int main(int argc, char *argv[])
+{
+	ChiakiCodec codec = CHIAKI_CODEC_H264;
+	bool low_latency_enabled = true;
+	int threads = 0;
+	unsigned long loops = 1;
+	unsigned long warmup = 10;
+	const char *path = NULL;
+
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "--h265") == 0)
+			codec = CHIAKI_CODEC_H265;
+		else if(strcmp(argv[i], "--default") == 0)
+			low_latency_enabled = false;
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+			loops = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+			warmup = strtoul(argv[++i], NULL, 0);
+		else if(argv[i][0] != '-' && !path)
+			path = argv[i];
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(!path || !loops)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	uint8_t *file_buf;
+	size_t file_size;
+	if(!read_file(path, &file_buf, &file_size))
+	{
+		fprintf(stderr, "Failed to read %s\n", path);
+		return 1;
+	}
+
+	ChiakiLog log;
+	chiaki_log_init(&log, CHIAKI_LOG_ALL & ~CHIAKI_LOG_VERBOSE, chiaki_log_cb_print, NULL);
+
+	ChiakiFfmpegDecoderLowLatency low_latency;
+	chiaki_ffmpeg_decoder_low_latency_default(&low_latency);
+	low_latency.slice_threads = threads;
+
+	ChiakiFfmpegDecoder decoder;
+	if(chiaki_ffmpeg_decoder_init(&decoder, &log, codec, NULL, NULL,
+			low_latency_enabled ? &low_latency : NULL, frame_available, NULL) != CHIAKI_ERR_SUCCESS)
+	{
+		free(file_buf);
+		return 1;
+	}
+
+	Stream stream = { 0 };
+	bool parsed = stream_parse(&stream, decoder.codec_context,
+			chiaki_codec_is_h265(codec) ? AV_CODEC_ID_H265 : AV_CODEC_ID_H264, file_buf, file_size);
+	free(file_buf);
+	if(!parsed || !stream.aus_count)
+	{
+		fprintf(stderr, "Failed to split %s into access units\n", path);
+		goto error;
+	}
+
+	double *latencies = malloc(stream.aus_count * loops * sizeof(double));
+	if(!latencies)
+		goto error;
+	AVFrame *frame = av_frame_alloc();
+	if(!frame)
+	{
+		free(latencies);
+		goto error;
+	}
+	size_t latencies_count = 0;
+	size_t frames = 0;
+	uint64_t decode_us = 0;
+
+	for(unsigned long loop=0; loop<loops; loop++)
+	{
+		for(size_t i=0; i<stream.aus_count; i++)
+		{
+			AccessUnit *au = &stream.aus[i];
+			uint64_t start_us = chiaki_time_now_monotonic_us();
+			chiaki_ffmpeg_decoder_video_sample_cb(stream.buf + au->offset, au->size, 0, false, &decoder);
+			int32_t frames_lost;
+			bool pulled = chiaki_ffmpeg_decoder_pull_frame_into(&decoder, frame, &frames_lost);
+			uint64_t latency_us = chiaki_time_now_monotonic_us() - start_us;
+			if(!pulled)
+				continue;
+			if(frames++ < warmup)
+				continue;
+			latencies[latencies_count++] = (double)latency_us * 1000.0;
+			decode_us += latency_us;
+		}
+	}
+
+	// only the results go to stdout, so it can be collected with the output of chiaki-bench-lib
+	fprintf(stderr, "%s %dx%d, %s, %d threads (%s)\n",
+			chiaki_codec_name(codec), decoder.codec_context->width, decoder.codec_context->height,
+			low_latency_enabled ? "low latency" : "ffmpeg defaults",
+			decoder.codec_context->thread_count,
+			decoder.codec_context->active_thread_type == FF_THREAD_SLICE ? "slice" :
+			(decoder.codec_context->active_thread_type == FF_THREAD_FRAME ? "frame" : "none"));
+	fprintf(stderr, "access units: %llu, frames: %llu, measured: %llu\n",
+			(unsigned long long)(stream.aus_count * loops), (unsigned long long)frames, (unsigned long long)latencies_count);
+
+	if(latencies_count)
+		fprintf(stderr, "mean throughput: %.1f frames/s\n", (double)latencies_count * 1000000.0 / (double)decode_us);
+	// with low latency decoding, every access unit should produce its frame immediately
+	if(frames < stream.aus_count * loops)
+		fprintf(stderr, "%llu access units did not produce a frame right away\n",
+				(unsigned long long)(stream.aus_count * loops - frames));
+
+	char name[64];
+	snprintf(name, sizeof(name), "ffmpeg_decode/%s/%s",
+			chiaki_codec_is_h265(codec) ? "h265" : "h264", low_latency_enabled ? "low_latency" : "default");
+	bench_report(name, latencies, latencies_count, 1, 0);
+
+	av_frame_free(&frame);
+	free(latencies);
+	free(stream.buf);
+	free(stream.aus);
+	chiaki_ffmpeg_decoder_fini(&decoder);
+	return 0;
+error:
+	free(stream.buf);
+	free(stream.aus);
+	chiaki_ffmpeg_decoder_fini(&decoder);
+	return 1;
+}
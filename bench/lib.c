@@ -0,0 +1,590 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Microbenchmarks for the hot paths of the library that run for every received packet or frame:
+ * gkcrypt decryption and GMAC, FEC decoding, reorder queue push/pull, bitstream slice parsing,
+ * Takion AV packet parsing, Opus frame decoding and haptics processing.
+ *
+ * Every benchmark is run for a number of timed batches and summarized as one JSON object per line,
+ * so the output can be diffed or fed into scripts to catch regressions.
+ */
+
+#include "bench.h"
+
+#include <chiaki/gkcrypt.h>
+#include <chiaki/fec.h>
+#include <chiaki/reorderqueue.h>
+#include <chiaki/bitmapreorderqueue.h>
+#include <chiaki/bitstream.h>
+#include <chiaki/takion.h>
+#include <chiaki/opusdecoder.h>
+#include <chiaki/haptics.h>
+
+#if CHIAKI_LIB_ENABLE_OPUS
+#include <opus/opus.h>
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACKET_SIZE 1400
+#define FEC_K 20
+#define FEC_M 5
+#define FEC_STRIDE (((PACKET_SIZE + 0xf) / 0x10) * 0x10)
+#define OPUS_RATE 48000
+#define OPUS_CHANNELS 2
+#define OPUS_FRAME_SIZE 480 // 10 ms, as sent by the console
+#define OPUS_FRAME_BUF_SIZE 0x200
+#define OPUS_FRAMES 100
+#define HAPTICS_PACKET_FRAMES 30 // 10 ms, as sent by the console
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [OPTIONS]\n"
+			"  --batches N     Number of timed batches per benchmark (default 200)\n"
+			"  --filter S      Only run benchmarks whose name contains S\n"
+			"  --list          List the benchmarks and exit\n",
+			name);
+}
+
+static void fill_pattern(uint8_t *buf, size_t size, uint32_t seed)
+{
+	for(size_t i=0; i<size; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+// gkcrypt
+
+typedef struct gkcrypt_bench_t
+{
+	ChiakiGKCrypt gkcrypt;
+	uint64_t key_pos;
+	size_t size;
+	uint8_t buf[PACKET_SIZE];
+	uint8_t gmac[CHIAKI_GKCRYPT_GMAC_SIZE];
+} GKCryptBench;
+
+static ChiakiErrorCode gkcrypt_bench_init(GKCryptBench *bench, ChiakiLog *log, size_t size)
+{
+	static const uint8_t handshake_key[] = { 0x54, 0x65, 0x4c, 0x34, 0x5c, 0xac, 0x56, 0xb8, 0xea, 0xe6, 0x15, 0x2a, 0xde, 0x1c, 0xe2, 0xe8 };
+	static const uint8_t ecdh_secret[] = { 0x00, 0x34, 0xf8, 0x21, 0xc7, 0xd9, 0xde, 0xa9, 0xe9, 0x11, 0xca, 0x5a, 0xd6, 0x7d, 0x11, 0xce, 0x4f, 0x02, 0xb1, 0xce, 0x1e, 0xe7, 0xc3, 0x8d, 0x54, 0x39, 0xfa, 0x64, 0xe3, 0xdb, 0xd8, 0x0d };
+	bench->key_pos = 0;
+	bench->size = size;
+	fill_pattern(bench->buf, sizeof(bench->buf), 1);
+	// no key buffer, so every packet generates its key stream like when the key buffer thread falls behind
+	return chiaki_gkcrypt_init(&bench->gkcrypt, log, 0, 2, handshake_key, ecdh_secret);
+}
+
+static void run_gkcrypt_decrypt(void *user, size_t ops)
+{
+	GKCryptBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		chiaki_gkcrypt_decrypt(&bench->gkcrypt, bench->key_pos, bench->buf, bench->size);
+		bench->key_pos += bench->size;
+	}
+}
+
+static void run_gkcrypt_gmac(void *user, size_t ops)
+{
+	GKCryptBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		chiaki_gkcrypt_gmac(&bench->gkcrypt, bench->key_pos, bench->buf, bench->size, bench->gmac);
+		bench->key_pos += bench->size;
+	}
+}
+
+// fec
+
+typedef struct fec_bench_t
+{
+	ChiakiFecDecoder decoder;
+	const unsigned int *erasures;
+	size_t erasures_count;
+	uint8_t ref[(FEC_K + FEC_M) * FEC_STRIDE];
+	uint8_t frame[(FEC_K + FEC_M) * FEC_STRIDE];
+	uint64_t decodes;
+	bool failed;
+} FecBench;
+
+static const unsigned int fec_erasures_single[] = { 3 };
+static const unsigned int fec_erasures_scattered[] = { 1, 8, 15 };
+static const unsigned int fec_erasures_burst[] = { 10, 11, 12, 13, 14 };
+
+static ChiakiErrorCode fec_bench_init(FecBench *bench, const unsigned int *erasures, size_t erasures_count)
+{
+	memset(bench->ref, 0, sizeof(bench->ref));
+	for(size_t i=0; i<FEC_K; i++)
+		fill_pattern(bench->ref + i * FEC_STRIDE, PACKET_SIZE, (uint32_t)i + 1);
+	ChiakiErrorCode err = chiaki_fec_encode(bench->ref, PACKET_SIZE, FEC_STRIDE, FEC_K, FEC_M);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	memcpy(bench->frame, bench->ref, sizeof(bench->frame));
+	for(size_t i=0; i<erasures_count; i++)
+		memset(bench->frame + erasures[i] * FEC_STRIDE, 0x42, PACKET_SIZE);
+	bench->erasures = erasures;
+	bench->erasures_count = erasures_count;
+	bench->decodes = 0;
+	bench->failed = false;
+	chiaki_fec_decoder_init(&bench->decoder);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static bool fec_bench_check(FecBench *bench)
+{
+	if(!bench->decodes)
+		return true;
+	for(size_t i=0; i<FEC_K; i++)
+	{
+		if(memcmp(bench->frame + i * FEC_STRIDE, bench->ref + i * FEC_STRIDE, PACKET_SIZE) != 0)
+			return false;
+	}
+	return !bench->failed;
+}
+
+// the erased units are rebuilt in place, decoding them again on the next op yields the same work
+
+static void run_fec_decode(void *user, size_t ops)
+{
+	FecBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		if(chiaki_fec_decode(bench->frame, PACKET_SIZE, FEC_STRIDE, FEC_K, FEC_M, bench->erasures, bench->erasures_count) != CHIAKI_ERR_SUCCESS)
+			bench->failed = true;
+	}
+	bench->decodes += ops;
+}
+
+static void run_fec_decoder_decode(void *user, size_t ops)
+{
+	FecBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		if(chiaki_fec_decoder_decode(&bench->decoder, bench->frame, PACKET_SIZE, FEC_STRIDE, FEC_K, FEC_M, bench->erasures, bench->erasures_count) != CHIAKI_ERR_SUCCESS)
+			bench->failed = true;
+	}
+	bench->decodes += ops;
+}
+
+// reorder queue
+
+#define REORDER_QUEUE_SIZE_EXP 4 // same as Takion
+
+typedef struct reorder_queue_bench_t
+{
+	bool bitmap;
+	ChiakiReorderQueue queue;
+	ChiakiBitmapReorderQueue bitmap_queue;
+	ChiakiSeqNum32 seq_num;
+	size_t reverse_group; // every group of this many packets arrives reversed, 1 for in order
+	uint64_t checksum;
+} ReorderQueueBench;
+
+/**
+ * @param reverse_group must divide the ops per batch, so every batch starts at a group boundary
+ */
+static ChiakiErrorCode reorder_queue_bench_init(ReorderQueueBench *bench, bool bitmap, size_t reverse_group)
+{
+	// start close to the wraparound so it is crossed during the run
+	bench->bitmap = bitmap;
+	bench->seq_num = 0xffffff00;
+	bench->reverse_group = reverse_group;
+	bench->checksum = 0;
+	if(bitmap)
+		return chiaki_bitmap_reorder_queue_init_32(&bench->bitmap_queue, REORDER_QUEUE_SIZE_EXP, bench->seq_num);
+	return chiaki_reorder_queue_init_32(&bench->queue, REORDER_QUEUE_SIZE_EXP, bench->seq_num);
+}
+
+static void reorder_queue_bench_fini(ReorderQueueBench *bench)
+{
+	if(bench->bitmap)
+		chiaki_bitmap_reorder_queue_fini(&bench->bitmap_queue);
+	else
+		chiaki_reorder_queue_fini(&bench->queue);
+}
+
+static inline ChiakiSeqNum32 reorder_queue_bench_next(ReorderQueueBench *bench, size_t i)
+{
+	// e.g. 1, 0, 3, 2, ... for groups of 2
+	size_t group = bench->reverse_group;
+	return bench->seq_num + (ChiakiSeqNum32)(i - i % group + group - 1 - i % group);
+}
+
+static void run_reorder_queue(void *user, size_t ops)
+{
+	ReorderQueueBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		ChiakiSeqNum32 seq_num = reorder_queue_bench_next(bench, i);
+		chiaki_reorder_queue_push(&bench->queue, seq_num, (void *)(size_t)seq_num);
+		uint64_t pulled_seq_num;
+		void *pulled;
+		while(chiaki_reorder_queue_pull(&bench->queue, &pulled_seq_num, &pulled))
+			bench->checksum += (size_t)pulled;
+	}
+	bench->seq_num += (ChiakiSeqNum32)ops;
+}
+
+static void run_bitmap_reorder_queue(void *user, size_t ops)
+{
+	ReorderQueueBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		ChiakiSeqNum32 seq_num = reorder_queue_bench_next(bench, i);
+		chiaki_bitmap_reorder_queue_push_32(&bench->bitmap_queue, seq_num, (void *)(size_t)seq_num);
+		void *pulled[1 << REORDER_QUEUE_SIZE_EXP];
+		uint64_t pulled_seq_num;
+		size_t count = chiaki_bitmap_reorder_queue_pull_all_32(&bench->bitmap_queue, &pulled_seq_num, pulled, ARRAY_SIZE(pulled));
+		for(size_t k=0; k<count; k++)
+			bench->checksum += (size_t)pulled[k];
+	}
+	bench->seq_num += (ChiakiSeqNum32)ops;
+}
+
+// bitstream
+
+typedef struct bitstream_bench_t
+{
+	ChiakiBitstream bitstream;
+	uint8_t *slice;
+	size_t slice_size;
+	size_t p_slices;
+} BitstreamBench;
+
+static uint8_t h264_header[] = {
+	0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+	0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+	0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+};
+
+static uint8_t h264_slice_p[] = {
+	0x00, 0x00, 0x00, 0x01, 0x41, 0x9b, 0xfd, 0x98, 0x89, 0xdf, 0x00, 0x03, 0x24, 0x60, 0x47, 0x1a,
+	0x90, 0x10, 0xb3, 0x2c, 0x4e, 0x45, 0xfc, 0xff, 0x45, 0x24, 0x8c, 0x79, 0xec, 0x12, 0xe5, 0x9b,
+};
+
+static uint8_t h265_header[] = {
+	0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
+	0xb0, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x96, 0x0a, 0xc0, 0x90, 0x00, 0x00, 0x00, 0x01,
+	0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0xb0, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+	0x00, 0x96, 0xa0, 0x03, 0xc0, 0x80, 0x11, 0x07, 0xcb, 0xc2, 0xb9, 0x24, 0x29, 0x52, 0x70, 0x16,
+	0xa0, 0x20, 0x20, 0x20, 0x80, 0x00, 0x07, 0xd2, 0x00, 0x01, 0xd4, 0xc0, 0x20, 0xe5, 0xa1, 0xe3,
+	0xd0, 0x00, 0x00, 0x00, 0x01, 0x44, 0x01, 0xc0, 0xf3, 0xc0, 0x4c, 0x90,
+};
+
+static uint8_t h265_slice_p[] = {
+	0x00, 0x00, 0x00, 0x01, 0x02, 0x01, 0xd7, 0x85, 0x6a, 0xae, 0xa6, 0x11, 0x80, 0x95, 0x80, 0x0a,
+	0xec, 0x5e, 0xdf, 0x39, 0x86, 0xe6, 0xd9, 0x07, 0x49, 0x17, 0xe2, 0x62, 0x57, 0x14, 0xd7, 0x08,
+};
+
+static bool bitstream_bench_init(BitstreamBench *bench, ChiakiLog *log, ChiakiCodec codec,
+		uint8_t *header, size_t header_size, uint8_t *slice, size_t slice_size)
+{
+	chiaki_bitstream_init(&bench->bitstream, log, codec);
+	bench->slice = slice;
+	bench->slice_size = slice_size;
+	bench->p_slices = 0;
+	return chiaki_bitstream_header(&bench->bitstream, header, (unsigned)header_size);
+}
+
+static void run_bitstream_slice(void *user, size_t ops)
+{
+	BitstreamBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		ChiakiBitstreamSlice slice;
+		if(chiaki_bitstream_slice(&bench->bitstream, bench->slice, (unsigned)bench->slice_size, &slice)
+				&& slice.slice_type == CHIAKI_BITSTREAM_SLICE_P)
+			bench->p_slices++;
+	}
+}
+
+// takion
+
+typedef struct takion_bench_t
+{
+	ChiakiKeyState key_state;
+	uint8_t packet[PACKET_SIZE];
+	size_t packet_size;
+	size_t video_packets;
+} TakionBench;
+
+static ChiakiErrorCode takion_bench_init(TakionBench *bench)
+{
+	chiaki_key_state_init(&bench->key_state);
+	bench->video_packets = 0;
+
+	// v7 and v9 share the header layout, so format a full size video packet with the v7 helper
+	ChiakiTakionAVPacket packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.is_video = true;
+	packet.packet_index = 45;
+	packet.frame_index = 5;
+	packet.unit_index = 6;
+	packet.units_in_frame_total = 8;
+	packet.units_in_frame_fec = 1;
+	packet.codec = 3;
+	size_t header_size;
+	ChiakiErrorCode err = chiaki_takion_v7_av_packet_format_header(bench->packet, sizeof(bench->packet), &header_size, &packet);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	fill_pattern(bench->packet + header_size, sizeof(bench->packet) - header_size, 2);
+	bench->packet_size = sizeof(bench->packet);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void run_takion_av_packet_parse(void *user, size_t ops)
+{
+	TakionBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		ChiakiTakionAVPacket packet;
+		if(chiaki_takion_v9_av_packet_parse(&packet, &bench->key_state, bench->packet, bench->packet_size) == CHIAKI_ERR_SUCCESS
+				&& packet.is_video)
+			bench->video_packets++;
+	}
+}
+
+// opus
+
+#if CHIAKI_LIB_ENABLE_OPUS
+typedef struct opus_bench_t
+{
+	ChiakiOpusDecoder decoder;
+	ChiakiAudioSink sink;
+	uint8_t frames[OPUS_FRAMES][OPUS_FRAME_BUF_SIZE];
+	size_t frame_sizes[OPUS_FRAMES];
+	size_t frame_index;
+	uint64_t samples;
+} OpusBench;
+
+static void opus_bench_frame(int16_t *buf, size_t samples_count, void *user)
+{
+	OpusBench *bench = user;
+	bench->samples += samples_count;
+}
+
+static bool opus_bench_init(OpusBench *bench, ChiakiLog *log)
+{
+	int error;
+	OpusEncoder *encoder = opus_encoder_create(OPUS_RATE, OPUS_CHANNELS, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error);
+	if(error != OPUS_OK)
+		return false;
+	// a few tones so the frames are not trivially silent
+	int16_t pcm[OPUS_FRAME_SIZE * OPUS_CHANNELS];
+	uint32_t phase = 0;
+	for(size_t f=0; f<OPUS_FRAMES; f++)
+	{
+		uint32_t step = 0x1000000 + (uint32_t)(f / 10) * 0x400000;
+		for(size_t i=0; i<OPUS_FRAME_SIZE; i++)
+		{
+			phase += step;
+			int16_t v = (int16_t)((int32_t)(phase >> 16) - 0x8000) / 4; // sawtooth
+			pcm[i * OPUS_CHANNELS] = v;
+			pcm[i * OPUS_CHANNELS + 1] = (int16_t)-v;
+		}
+		int r = opus_encode(encoder, pcm, OPUS_FRAME_SIZE, bench->frames[f], OPUS_FRAME_BUF_SIZE);
+		if(r < 1)
+		{
+			opus_encoder_destroy(encoder);
+			return false;
+		}
+		bench->frame_sizes[f] = (size_t)r;
+	}
+	opus_encoder_destroy(encoder);
+
+	chiaki_opus_decoder_init(&bench->decoder, log);
+	chiaki_opus_decoder_set_cb(&bench->decoder, NULL, opus_bench_frame, bench);
+	chiaki_opus_decoder_get_sink(&bench->decoder, &bench->sink);
+	ChiakiAudioHeader header;
+	chiaki_audio_header_set(&header, OPUS_CHANNELS, 16, OPUS_RATE, OPUS_FRAME_SIZE);
+	bench->sink.header_cb(&header, bench->sink.user);
+	bench->frame_index = 0;
+	bench->samples = 0;
+	return bench->decoder.opus_decoder != NULL;
+}
+
+static void run_opus_decode(void *user, size_t ops)
+{
+	OpusBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		bench->sink.frame_cb(bench->frames[bench->frame_index], bench->frame_sizes[bench->frame_index], bench->sink.user);
+		bench->frame_index = (bench->frame_index + 1) % OPUS_FRAMES;
+	}
+}
+#endif
+
+// haptics
+
+typedef struct haptics_bench_t
+{
+	ChiakiHapticsUpsampler upsampler;
+	ChiakiHapticsEnvelope envelope;
+	uint8_t packet[HAPTICS_PACKET_FRAMES * CHIAKI_HAPTICS_CHANNELS_IN * sizeof(int16_t)];
+	int16_t out[HAPTICS_PACKET_FRAMES * CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_CHANNELS_OUT];
+	uint64_t checksum;
+} HapticsBench;
+
+static void haptics_bench_init(HapticsBench *bench)
+{
+	// 160 Hz left, 320 Hz right, a typical range for haptics effects
+	for(size_t i=0; i<HAPTICS_PACKET_FRAMES; i++)
+	{
+		int16_t l = (int16_t)(16000.0 * sin(2.0 * 3.14159265358979 * 160.0 * (double)i / CHIAKI_HAPTICS_RATE_IN));
+		int16_t r = (int16_t)(16000.0 * sin(2.0 * 3.14159265358979 * 320.0 * (double)i / CHIAKI_HAPTICS_RATE_IN));
+		bench->packet[i * 4 + 0] = (uint8_t)((uint16_t)l & 0xff);
+		bench->packet[i * 4 + 1] = (uint8_t)((uint16_t)l >> 8);
+		bench->packet[i * 4 + 2] = (uint8_t)((uint16_t)r & 0xff);
+		bench->packet[i * 4 + 3] = (uint8_t)((uint16_t)r >> 8);
+	}
+	chiaki_haptics_upsampler_init(&bench->upsampler);
+	chiaki_haptics_envelope_init(&bench->envelope, 1.0f, 50.0f);
+	bench->checksum = 0;
+}
+
+static void run_haptics_upsample(void *user, size_t ops)
+{
+	HapticsBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		chiaki_haptics_upsampler_process(&bench->upsampler, bench->packet, HAPTICS_PACKET_FRAMES,
+				bench->out, ARRAY_SIZE(bench->out) / CHIAKI_HAPTICS_CHANNELS_OUT);
+		bench->checksum += (uint16_t)bench->out[i % ARRAY_SIZE(bench->out)];
+	}
+}
+
+static void run_haptics_envelope(void *user, size_t ops)
+{
+	HapticsBench *bench = user;
+	for(size_t i=0; i<ops; i++)
+	{
+		uint16_t left, right;
+		chiaki_haptics_envelope_process(&bench->envelope, bench->packet, HAPTICS_PACKET_FRAMES, &left, &right);
+		bench->checksum += left + right;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long batches = 200;
+	const char *filter = NULL;
+	bool list = false;
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "--batches") == 0 && i + 1 < argc)
+			batches = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			filter = argv[++i];
+		else if(strcmp(argv[i], "--list") == 0)
+			list = true;
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(!batches)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	ChiakiLog log;
+	chiaki_log_init(&log, CHIAKI_LOG_ERROR, chiaki_log_cb_print, NULL);
+
+	static GKCryptBench gkcrypt_small, gkcrypt_large;
+	static FecBench fec_single, fec_scattered, fec_burst;
+	static ReorderQueueBench reorder_in_order, reorder_swapped, reorder_reversed, bitmap_reorder_in_order, bitmap_reorder_swapped, bitmap_reorder_reversed;
+	static BitstreamBench bitstream_h264, bitstream_h265;
+	static TakionBench takion;
+	static HapticsBench haptics;
+#if CHIAKI_LIB_ENABLE_OPUS
+	static OpusBench opus;
+#endif
+
+	if(gkcrypt_bench_init(&gkcrypt_small, &log, 64) != CHIAKI_ERR_SUCCESS
+			|| gkcrypt_bench_init(&gkcrypt_large, &log, PACKET_SIZE) != CHIAKI_ERR_SUCCESS
+			|| fec_bench_init(&fec_single, fec_erasures_single, ARRAY_SIZE(fec_erasures_single)) != CHIAKI_ERR_SUCCESS
+			|| fec_bench_init(&fec_scattered, fec_erasures_scattered, ARRAY_SIZE(fec_erasures_scattered)) != CHIAKI_ERR_SUCCESS
+			|| fec_bench_init(&fec_burst, fec_erasures_burst, ARRAY_SIZE(fec_erasures_burst)) != CHIAKI_ERR_SUCCESS
+			|| reorder_queue_bench_init(&reorder_in_order, false, 1) != CHIAKI_ERR_SUCCESS
+			|| reorder_queue_bench_init(&reorder_swapped, false, 2) != CHIAKI_ERR_SUCCESS
+			|| reorder_queue_bench_init(&reorder_reversed, false, 4) != CHIAKI_ERR_SUCCESS
+			|| reorder_queue_bench_init(&bitmap_reorder_in_order, true, 1) != CHIAKI_ERR_SUCCESS
+			|| reorder_queue_bench_init(&bitmap_reorder_swapped, true, 2) != CHIAKI_ERR_SUCCESS
+			|| reorder_queue_bench_init(&bitmap_reorder_reversed, true, 4) != CHIAKI_ERR_SUCCESS
+			|| !bitstream_bench_init(&bitstream_h264, &log, CHIAKI_CODEC_H264, h264_header, sizeof(h264_header), h264_slice_p, sizeof(h264_slice_p))
+			|| !bitstream_bench_init(&bitstream_h265, &log, CHIAKI_CODEC_H265, h265_header, sizeof(h265_header), h265_slice_p, sizeof(h265_slice_p))
+			|| takion_bench_init(&takion) != CHIAKI_ERR_SUCCESS
+#if CHIAKI_LIB_ENABLE_OPUS
+			|| !opus_bench_init(&opus, &log)
+#endif
+			)
+	{
+		fprintf(stderr, "Failed to set up benchmarks\n");
+		return 1;
+	}
+	haptics_bench_init(&haptics);
+
+	const Bench benches[] = {
+		{ "gkcrypt_decrypt/64", 10000, 64, run_gkcrypt_decrypt, &gkcrypt_small },
+		{ "gkcrypt_decrypt/1400", 2000, PACKET_SIZE, run_gkcrypt_decrypt, &gkcrypt_large },
+		{ "gkcrypt_gmac/64", 10000, 64, run_gkcrypt_gmac, &gkcrypt_small },
+		{ "gkcrypt_gmac/1400", 2000, PACKET_SIZE, run_gkcrypt_gmac, &gkcrypt_large },
+		{ "fec_decode/k20m5/single", 100, FEC_K * PACKET_SIZE, run_fec_decode, &fec_single },
+		{ "fec_decode/k20m5/scattered3", 100, FEC_K * PACKET_SIZE, run_fec_decode, &fec_scattered },
+		{ "fec_decode/k20m5/burst5", 100, FEC_K * PACKET_SIZE, run_fec_decode, &fec_burst },
+		{ "fec_decoder_decode/k20m5/single", 100, FEC_K * PACKET_SIZE, run_fec_decoder_decode, &fec_single },
+		{ "fec_decoder_decode/k20m5/scattered3", 100, FEC_K * PACKET_SIZE, run_fec_decoder_decode, &fec_scattered },
+		{ "fec_decoder_decode/k20m5/burst5", 100, FEC_K * PACKET_SIZE, run_fec_decoder_decode, &fec_burst },
+		{ "reorder_queue/in_order", 20000, 0, run_reorder_queue, &reorder_in_order },
+		{ "reorder_queue/swapped_pairs", 20000, 0, run_reorder_queue, &reorder_swapped },
+		{ "reorder_queue/reversed4", 20000, 0, run_reorder_queue, &reorder_reversed },
+		{ "bitmap_reorder_queue/in_order", 20000, 0, run_bitmap_reorder_queue, &bitmap_reorder_in_order },
+		{ "bitmap_reorder_queue/swapped_pairs", 20000, 0, run_bitmap_reorder_queue, &bitmap_reorder_swapped },
+		{ "bitmap_reorder_queue/reversed4", 20000, 0, run_bitmap_reorder_queue, &bitmap_reorder_reversed },
+		{ "bitstream_slice/h264_p", 20000, 0, run_bitstream_slice, &bitstream_h264 },
+		{ "bitstream_slice/h265_p", 20000, 0, run_bitstream_slice, &bitstream_h265 },
+		{ "takion_av_packet_parse/v9_video", 50000, 0, run_takion_av_packet_parse, &takion },
+		{ "haptics_upsample/10ms", 1000, 0, run_haptics_upsample, &haptics },
+		{ "haptics_envelope/10ms", 1000, 0, run_haptics_envelope, &haptics },
+#if CHIAKI_LIB_ENABLE_OPUS
+		{ "opus_decode/48k_stereo_10ms", 200, 0, run_opus_decode, &opus },
+#endif
+	};
+
+	if(!bench_run(benches, ARRAY_SIZE(benches), batches, filter, list))
+		return 1;
+
+	// a broken decoder should not look fast
+	int res = 0;
+	if(!fec_bench_check(&fec_single) || !fec_bench_check(&fec_scattered) || !fec_bench_check(&fec_burst))
+	{
+		fprintf(stderr, "FEC decoding produced wrong data\n");
+		res = 1;
+	}
+
+	chiaki_gkcrypt_fini(&gkcrypt_small.gkcrypt);
+	chiaki_gkcrypt_fini(&gkcrypt_large.gkcrypt);
+	chiaki_fec_decoder_fini(&fec_single.decoder);
+	chiaki_fec_decoder_fini(&fec_scattered.decoder);
+	chiaki_fec_decoder_fini(&fec_burst.decoder);
+	reorder_queue_bench_fini(&reorder_in_order);
+	reorder_queue_bench_fini(&reorder_swapped);
+	reorder_queue_bench_fini(&reorder_reversed);
+	reorder_queue_bench_fini(&bitmap_reorder_in_order);
+	reorder_queue_bench_fini(&bitmap_reorder_swapped);
+	reorder_queue_bench_fini(&bitmap_reorder_reversed);
+#if CHIAKI_LIB_ENABLE_OPUS
+	chiaki_opus_decoder_fini(&opus.decoder);
+	opus_decoder_destroy(opus.decoder.opus_decoder);
+#endif
+	return res;
+}
@@ -0,0 +1,891 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki-cli.h>
+
+#include <chiaki/session.h>
+#include <chiaki/opusdecoder.h>
+#include <chiaki/time.h>
+#include <chiaki/metrics.h>
+#include <chiaki/spscring.h>
+
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+#include <chiaki/ffmpegdecoder.h>
+#endif
+
+#include <argp.h>
+
+#include <ctype.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char doc[] =
+	"Stream from a registered PS4 or PS5 without any display.\n"
+	"The video elementary stream and audio are written to files or pipes (\"-\" for stdout) "
+	"and stats are printed periodically."
+	"\v"
+	"A config file contains one \"option = value\" per line, using the long option names, "
+	"with flags given without a value. Lines starting with # are ignored. "
+	"Options after --config override the ones from the file.";
+
+#define ARG_KEY_HOST 'h'
+#define ARG_KEY_REGISTKEY 'r'
+#define ARG_KEY_MORNING 'm'
+#define ARG_KEY_PS4 '4'
+#define ARG_KEY_PS5 '5'
+#define ARG_KEY_CONFIG 'c'
+#define ARG_KEY_RESOLUTION 's'
+#define ARG_KEY_FPS 'f'
+#define ARG_KEY_BITRATE 'b'
+#define ARG_KEY_H265 0x100
+#define ARG_KEY_LOGIN_PIN 'p'
+#define ARG_KEY_VIDEO 'o'
+#define ARG_KEY_AUDIO 'a'
+#define ARG_KEY_AUDIO_FORMAT 0x101
+#define ARG_KEY_STATS_INTERVAL 'i'
+#define ARG_KEY_DURATION 'd'
+#define ARG_KEY_DECODE 0x102
+#define ARG_KEY_METRICS_PORT 0x103
+#define ARG_KEY_THREAD 0x104
+
+#define VIDEO_RING_SIZE_EXP 23 // 8 MiB, a few seconds even at the highest bitrates
+#define VIDEO_DRAIN_CHUNK_SIZE 0x10000
+#define DECODE_QUEUE_SIZE 4
+
+static struct argp_option options[] = {
+	{ "host", ARG_KEY_HOST, "Host", 0, "Host to connect to", 0 },
+	{ "registkey", ARG_KEY_REGISTKEY, "RegistKey", 0, "Remote Play registration key (plaintext)", 0 },
+	{ "morning", ARG_KEY_MORNING, "Key", 0, "Remote Play key from registration (32 hex digits)", 0 },
+	{ "ps4", ARG_KEY_PS4, NULL, 0, "PlayStation 4", 0 },
+	{ "ps5", ARG_KEY_PS5, NULL, 0, "PlayStation 5 (default)", 0 },
+	{ "config", ARG_KEY_CONFIG, "File", 0, "Read options from File", 0 },
+	{ "resolution", ARG_KEY_RESOLUTION, "Resolution", 0, "360p, 540p, 720p (default) or 1080p", 1 },
+	{ "fps", ARG_KEY_FPS, "FPS", 0, "30 or 60 (default)", 1 },
+	{ "bitrate", ARG_KEY_BITRATE, "kbit/s", 0, "Bitrate instead of the default of the resolution", 1 },
+	{ "h265", ARG_KEY_H265, NULL, 0, "Request H.265 instead of H.264 (PS5 only)", 1 },
+	{ "login-pin", ARG_KEY_LOGIN_PIN, "PIN", 0, "Login PIN to answer a request for one with", 1 },
+	{ "video", ARG_KEY_VIDEO, "File", 0, "Write the raw H.264/H.265 elementary stream to File", 2 },
+	{ "audio", ARG_KEY_AUDIO, "File", 0, "Write the audio to File", 2 },
+	{ "audio-format", ARG_KEY_AUDIO_FORMAT, "Format", 0,
+		"pcm for interleaved signed 16 bit samples (default), "
+		"opus for Opus packets, each prefixed with its size as 16 bit big endian", 2 },
+	{ "stats-interval", ARG_KEY_STATS_INTERVAL, "Seconds", 0, "Interval of the stats output, 0 to disable (default 1)", 3 },
+	{ "duration", ARG_KEY_DURATION, "Seconds", 0, "Stop after this long, 0 to stream until interrupted (default)", 3 },
+	{ "metrics-port", ARG_KEY_METRICS_PORT, "Port", 0,
+		"Serve the session metrics on http://127.0.0.1:Port/metrics (Prometheus) and /metrics.json, 0 to disable (default)", 3 },
+	{ "thread", ARG_KEY_THREAD, "Role=Sched", 0,
+		"Scheduling of a session thread, may be given multiple times. "
+		"Role is takion, video-decode (the thread of --decode), audio, feedback or ctrl, "
+		"Sched is low, normal, high or realtime, "
+		"optionally followed by @ and a mask of allowed CPUs, e.g. takion=realtime@0x4", 4 },
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	{ "decode", ARG_KEY_DECODE, NULL, 0, "Decode the video in software and report the decode time", 3 },
+#endif
+	{ 0 }
+};
+
+typedef enum audio_format_t
+{
+	AUDIO_FORMAT_PCM,
+	AUDIO_FORMAT_OPUS
+} AudioFormat;
+
+typedef struct arguments
+{
+	const char *host;
+	const char *registkey;
+	const char *morning;
+	bool ps5;
+	const char *config;
+	char *config_buf; // backs the strings read from config
+	ChiakiVideoResolutionPreset resolution;
+	ChiakiVideoFPSPreset fps;
+	unsigned int bitrate;
+	bool h265;
+	const char *login_pin;
+	const char *video;
+	const char *audio;
+	AudioFormat audio_format;
+	double stats_interval;
+	double duration;
+	bool decode;
+	unsigned int metrics_port;
+	ChiakiThreadSchedConfig thread_sched[CHIAKI_THREAD_ROLE_COUNT];
+} Arguments;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void sigint_handler(int sig)
+{
+	interrupted = 1;
+}
+
+static bool parse_hex(const char *str, uint8_t *buf, size_t buf_size)
+{
+	if(strlen(str) != buf_size * 2)
+		return false;
+	for(size_t i=0; i<buf_size; i++)
+	{
+		char byte_str[3] = { str[i * 2], str[i * 2 + 1], '\0' };
+		if(!isxdigit((unsigned char)byte_str[0]) || !isxdigit((unsigned char)byte_str[1]))
+			return false;
+		buf[i] = (uint8_t)strtoul(byte_str, NULL, 16);
+	}
+	return true;
+}
+
+static error_t parse_config(Arguments *arguments, const char *path, struct argp_state *state);
+
+static error_t set_argument(Arguments *arguments, int key, char *arg, struct argp_state *state)
+{
+	switch(key)
+	{
+		case ARG_KEY_HOST:
+			arguments->host = arg;
+			break;
+		case ARG_KEY_REGISTKEY:
+			arguments->registkey = arg;
+			break;
+		case ARG_KEY_MORNING:
+			arguments->morning = arg;
+			break;
+		case ARG_KEY_PS4:
+			arguments->ps5 = false;
+			break;
+		case ARG_KEY_PS5:
+			arguments->ps5 = true;
+			break;
+		case ARG_KEY_CONFIG:
+			return parse_config(arguments, arg, state);
+		case ARG_KEY_RESOLUTION:
+			if(strcmp(arg, "360p") == 0)
+				arguments->resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_360p;
+			else if(strcmp(arg, "540p") == 0)
+				arguments->resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_540p;
+			else if(strcmp(arg, "720p") == 0)
+				arguments->resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_720p;
+			else if(strcmp(arg, "1080p") == 0)
+				arguments->resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_1080p;
+			else
+				argp_error(state, "Invalid resolution \"%s\"", arg);
+			break;
+		case ARG_KEY_FPS:
+			if(strcmp(arg, "30") == 0)
+				arguments->fps = CHIAKI_VIDEO_FPS_PRESET_30;
+			else if(strcmp(arg, "60") == 0)
+				arguments->fps = CHIAKI_VIDEO_FPS_PRESET_60;
+			else
+				argp_error(state, "Invalid fps \"%s\"", arg);
+			break;
+		case ARG_KEY_BITRATE:
+			arguments->bitrate = (unsigned int)strtoul(arg, NULL, 0);
+			break;
+		case ARG_KEY_H265:
+			arguments->h265 = true;
+			break;
+		case ARG_KEY_LOGIN_PIN:
+			arguments->login_pin = arg;
+			break;
+		case ARG_KEY_VIDEO:
+			arguments->video = arg;
+			break;
+		case ARG_KEY_AUDIO:
+			arguments->audio = arg;
+			break;
+		case ARG_KEY_AUDIO_FORMAT:
+			if(strcmp(arg, "pcm") == 0)
+				arguments->audio_format = AUDIO_FORMAT_PCM;
+			else if(strcmp(arg, "opus") == 0)
+				arguments->audio_format = AUDIO_FORMAT_OPUS;
+			else
+				argp_error(state, "Invalid audio format \"%s\"", arg);
+			break;
+		case ARG_KEY_STATS_INTERVAL:
+			arguments->stats_interval = atof(arg);
+			break;
+		case ARG_KEY_DURATION:
+			arguments->duration = atof(arg);
+			break;
+		case ARG_KEY_DECODE:
+			arguments->decode = true;
+			break;
+		case ARG_KEY_METRICS_PORT:
+		{
+			char *end;
+			unsigned long port = strtoul(arg, &end, 0);
+			if(*end || port > UINT16_MAX)
+				argp_error(state, "Invalid metrics port \"%s\"", arg);
+			arguments->metrics_port = (unsigned int)port;
+			break;
+		}
+		case ARG_KEY_THREAD:
+		{
+			char *sched = strchr(arg, '=');
+			ChiakiThreadRole role = CHIAKI_THREAD_ROLE_COUNT;
+			if(sched)
+			{
+				for(role = 0; role < CHIAKI_THREAD_ROLE_COUNT; role++)
+				{
+					const char *name = chiaki_thread_role_string(role);
+					if(strlen(name) == (size_t)(sched - arg) && strncmp(name, arg, (size_t)(sched - arg)) == 0)
+						break;
+				}
+			}
+			if(role == CHIAKI_THREAD_ROLE_COUNT)
+				argp_error(state, "Invalid thread role in \"%s\"", arg);
+			else if(chiaki_thread_sched_config_parse(&arguments->thread_sched[role], sched + 1) != CHIAKI_ERR_SUCCESS)
+				argp_error(state, "Invalid thread scheduling in \"%s\"", arg);
+			break;
+		}
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static char *trim(char *str)
+{
+	while(isspace((unsigned char)*str))
+		str++;
+	size_t len = strlen(str);
+	while(len && isspace((unsigned char)str[len - 1]))
+		str[--len] = '\0';
+	return str;
+}
+
+static error_t parse_config(Arguments *arguments, const char *path, struct argp_state *state)
+{
+	if(arguments->config_buf)
+		argp_error(state, "Only one config file is supported");
+
+	FILE *f = fopen(path, "rb");
+	if(!f)
+	{
+		argp_failure(state, 1, 0, "Failed to open config file %s", path);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *buf = size >= 0 ? malloc((size_t)size + 1) : NULL;
+	if(!buf || fread(buf, 1, (size_t)size, f) != (size_t)size)
+	{
+		free(buf);
+		fclose(f);
+		argp_failure(state, 1, 0, "Failed to read config file %s", path);
+		return 1;
+	}
+	fclose(f);
+	buf[size] = '\0';
+	arguments->config = path;
+	arguments->config_buf = buf;
+
+	// strings point into buf, so it is kept until the end
+	unsigned int line_number = 0;
+	for(char *line = buf, *next; line; line = next)
+	{
+		line_number++;
+		next = strchr(line, '\n');
+		if(next)
+			*next++ = '\0';
+		line = trim(line);
+		if(!*line || *line == '#')
+			continue;
+
+		char *value = strchr(line, '=');
+		if(value)
+		{
+			*value++ = '\0';
+			value = trim(value);
+		}
+		const char *name = trim(line);
+
+		const struct argp_option *option;
+		for(option = options; option->name; option++)
+		{
+			if(strcmp(option->name, name) == 0)
+				break;
+		}
+		if(!option->name || option->key == ARG_KEY_CONFIG)
+		{
+			argp_failure(state, 1, 0, "%s:%u: Unknown option \"%s\"", path, line_number, name);
+			return 1;
+		}
+		if(option->arg && (!value || !*value))
+		{
+			argp_failure(state, 1, 0, "%s:%u: Option \"%s\" requires a value", path, line_number, name);
+			return 1;
+		}
+		error_t r = set_argument(arguments, option->key, value, state);
+		if(r != 0)
+			return r;
+	}
+	return 0;
+}
+
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+	Arguments *arguments = state->input;
+
+	switch(key)
+	{
+		case ARGP_KEY_ARG:
+			argp_usage(state);
+			break;
+		default:
+			return set_argument(arguments, key, arg, state);
+	}
+
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
+
+/**
+ * Counters that are reset after every stats output
+ */
+typedef struct interval_stats_t
+{
+	uint64_t frames;
+	uint64_t frame_interval_us_sum;
+	uint64_t frame_interval_us_max;
+	uint64_t audio_frames;
+	uint64_t decoded_frames;
+	uint64_t decode_us_sum;
+	uint64_t decode_us_max;
+} IntervalStats;
+
+typedef struct context
+{
+	ChiakiLog *log;
+	ChiakiSession session;
+	Arguments *arguments;
+
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool quit;
+	ChiakiQuitReason quit_reason;
+
+	// only accessed by the main thread, the video callback passes the stream through video_ring,
+	// so a slow reader never holds a lock the Takion thread waits for
+	FILE *video_file;
+	ChiakiSpscRing video_ring; // bytes, written by the video callback, drained by the main thread
+	uint64_t video_dropped; // samples that did not fit into video_ring, video callback only
+	// only accessed from the audio callbacks, which all run on the audio dispatch thread
+	FILE *audio_file;
+	bool audio_pcm;
+#if CHIAKI_LIB_ENABLE_OPUS
+	ChiakiOpusDecoder opus_decoder;
+	ChiakiAudioSink opus_sink;
+#endif
+	uint32_t audio_channels;
+	uint64_t frame_last_us; // video callback only
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	ChiakiFfmpegDecoder ffmpeg_decoder;
+	bool ffmpeg_decoder_initialized;
+	AVFrame *decoded_frame; // decode thread only
+#endif
+
+	// protected by mutex
+	IntervalStats interval;
+} Context;
+
+static void event_cb(ChiakiEvent *event, void *user)
+{
+	Context *ctx = user;
+	switch(event->type)
+	{
+		case CHIAKI_EVENT_CONNECTED:
+			CHIAKI_LOGI(ctx->log, "Connected");
+			break;
+		case CHIAKI_EVENT_LOGIN_PIN_REQUEST:
+			if(ctx->arguments->login_pin && !event->login_pin_request.pin_incorrect)
+			{
+				chiaki_session_set_login_pin(&ctx->session, (const uint8_t *)ctx->arguments->login_pin, strlen(ctx->arguments->login_pin));
+				break;
+			}
+			CHIAKI_LOGE(ctx->log, event->login_pin_request.pin_incorrect ? "Login PIN was incorrect" : "Console requested a login PIN, see --login-pin");
+			chiaki_session_stop(&ctx->session);
+			break;
+		case CHIAKI_EVENT_QUIT:
+			CHIAKI_LOGI(ctx->log, "Session quit: %s%s%s", chiaki_quit_reason_string(event->quit.reason),
+					event->quit.reason_str ? ", " : "", event->quit.reason_str ? event->quit.reason_str : "");
+			chiaki_mutex_lock(&ctx->mutex);
+			ctx->quit = true;
+			ctx->quit_reason = event->quit.reason;
+			chiaki_cond_signal(&ctx->cond);
+			chiaki_mutex_unlock(&ctx->mutex);
+			break;
+		default:
+			break;
+	}
+}
+
+static bool video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+{
+	Context *ctx = user;
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	uint64_t frame_interval_us = ctx->frame_last_us ? now_us - ctx->frame_last_us : 0;
+	ctx->frame_last_us = now_us;
+
+	if(ctx->video_file)
+	{
+		// all or nothing, a partial sample would corrupt the rest of the stream
+		if(chiaki_spsc_ring_size(&ctx->video_ring) - chiaki_spsc_ring_count(&ctx->video_ring) >= buf_size)
+			chiaki_spsc_ring_write(&ctx->video_ring, buf, buf_size);
+		else if(!ctx->video_dropped++)
+			CHIAKI_LOGW(ctx->log, "Video output can not keep up, dropping samples");
+	}
+
+	chiaki_mutex_lock(&ctx->mutex);
+	ctx->interval.frames++;
+	ctx->interval.frame_interval_us_sum += frame_interval_us;
+	if(frame_interval_us > ctx->interval.frame_interval_us_max)
+		ctx->interval.frame_interval_us_max = frame_interval_us;
+	chiaki_mutex_unlock(&ctx->mutex);
+
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	// only queues the sample for the decode thread
+	if(ctx->ffmpeg_decoder_initialized)
+		return chiaki_ffmpeg_decoder_video_sample_cb(buf, buf_size, frames_lost, frame_recovered, &ctx->ffmpeg_decoder);
+#endif
+	return true;
+}
+
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+/**
+ * Called on the decode thread after every decoded sample
+ */
+static void frame_available(ChiakiFfmpegDecoder *decoder, void *user)
+{
+	Context *ctx = user;
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	int32_t frames_lost;
+	if(!chiaki_ffmpeg_decoder_pull_frame_into(decoder, ctx->decoded_frame, &frames_lost))
+		return;
+	uint64_t decode_us = decoder->decode_us + (chiaki_time_now_monotonic_us() - start_us);
+
+	chiaki_mutex_lock(&ctx->mutex);
+	ctx->interval.decoded_frames++;
+	ctx->interval.decode_us_sum += decode_us;
+	if(decode_us > ctx->interval.decode_us_max)
+		ctx->interval.decode_us_max = decode_us;
+	chiaki_mutex_unlock(&ctx->mutex);
+}
+#endif
+
+static void count_audio_frame(Context *ctx)
+{
+	chiaki_mutex_lock(&ctx->mutex);
+	ctx->interval.audio_frames++;
+	chiaki_mutex_unlock(&ctx->mutex);
+}
+
+#if CHIAKI_LIB_ENABLE_OPUS
+static void pcm_frame_cb(int16_t *buf, size_t samples_count, void *user)
+{
+	Context *ctx = user;
+	fwrite(buf, sizeof(int16_t) * ctx->audio_channels, samples_count, ctx->audio_file);
+	fflush(ctx->audio_file);
+}
+#endif
+
+static void audio_header_cb(ChiakiAudioHeader *header, void *user)
+{
+	Context *ctx = user;
+	ctx->audio_channels = header->channels;
+	CHIAKI_LOGI(ctx->log, "Audio: %u channels, %u Hz, %u samples per frame",
+			(unsigned int)header->channels, (unsigned int)header->rate, (unsigned int)header->frame_size);
+#if CHIAKI_LIB_ENABLE_OPUS
+	if(ctx->audio_pcm)
+		ctx->opus_sink.header_cb(header, ctx->opus_sink.user);
+#endif
+}
+
+static void audio_frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	Context *ctx = user;
+	count_audio_frame(ctx);
+	if(!ctx->audio_file)
+		return;
+#if CHIAKI_LIB_ENABLE_OPUS
+	if(ctx->audio_pcm)
+	{
+		ctx->opus_sink.frame_cb(buf, buf_size, ctx->opus_sink.user);
+		return;
+	}
+#endif
+	uint8_t size_buf[2] = { (uint8_t)(buf_size >> 8), (uint8_t)buf_size };
+	fwrite(size_buf, 1, sizeof(size_buf), ctx->audio_file);
+	fwrite(buf, 1, buf_size, ctx->audio_file);
+	fflush(ctx->audio_file);
+}
+
+static void audio_frame_lost_cb(uint8_t *fec_buf, size_t fec_buf_size, void *user)
+{
+	Context *ctx = user;
+#if CHIAKI_LIB_ENABLE_OPUS
+	// only the decoder can conceal a lost frame, the Opus output just misses it
+	if(ctx->audio_file && ctx->audio_pcm)
+		ctx->opus_sink.frame_lost_cb(fec_buf, fec_buf_size, ctx->opus_sink.user);
+#endif
+}
+
+/**
+ * Write out everything the video callback has queued, only called from the main thread
+ */
+static void video_drain(Context *ctx)
+{
+	static uint8_t buf[VIDEO_DRAIN_CHUNK_SIZE];
+	size_t count;
+	while((count = chiaki_spsc_ring_read(&ctx->video_ring, buf, sizeof(buf))))
+		fwrite(buf, 1, count, ctx->video_file);
+	fflush(ctx->video_file);
+}
+
+static FILE *open_output(const char *path)
+{
+	if(strcmp(path, "-") == 0)
+		return stdout;
+	return fopen(path, "wb");
+}
+
+static void close_output(FILE *f)
+{
+	if(f && f != stdout)
+		fclose(f);
+}
+
+typedef struct totals
+{
+	ChiakiVideoReceiverStats video;
+	uint64_t frames;
+	uint64_t audio_frames;
+} Totals;
+
+static void fill_metrics(ChiakiSessionMetrics *metrics, void *user)
+{
+	Context *ctx = user;
+	chiaki_session_get_metrics(&ctx->session, metrics);
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	if(ctx->ffmpeg_decoder_initialized)
+		chiaki_ffmpeg_decoder_get_metrics(&ctx->ffmpeg_decoder, &metrics->decoder);
+#endif
+}
+
+static void print_stats(Context *ctx, FILE *out, double elapsed_sec, double interval_sec, Totals *totals)
+{
+	chiaki_mutex_lock(&ctx->mutex);
+	IntervalStats interval = ctx->interval;
+	memset(&ctx->interval, 0, sizeof(ctx->interval));
+	chiaki_mutex_unlock(&ctx->mutex);
+
+	ChiakiStreamConnection *stream_connection = &ctx->session.stream_connection;
+	ChiakiVideoReceiverStats video;
+	chiaki_stream_connection_get_video_stats(stream_connection, &video);
+	// reset by congestion control whenever it reports, so this is the loss of the last few hundred ms
+	uint64_t packets_received, packets_lost;
+	chiaki_packet_stats_get(&stream_connection->packet_stats, false, &packets_received, &packets_lost);
+	uint64_t packets_total = packets_received + packets_lost;
+
+	uint64_t bytes = video.bytes - totals->video.bytes;
+	fprintf(out, "[%7.1fs] video %.2f Mbit/s, %.1f fps, frame interval avg %.1f max %.1f ms, "
+			"frames lost %llu, fec recovered %llu, incomplete %llu, packet loss %.2f%%, audio %.1f frames/s",
+			elapsed_sec,
+			interval_sec > 0.0 ? (double)bytes * 8.0 / interval_sec / 1e6 : 0.0,
+			interval_sec > 0.0 ? (double)interval.frames / interval_sec : 0.0,
+			interval.frames ? (double)interval.frame_interval_us_sum / (double)interval.frames / 1000.0 : 0.0,
+			(double)interval.frame_interval_us_max / 1000.0,
+			(unsigned long long)(video.frames_lost - totals->video.frames_lost),
+			(unsigned long long)(video.frames_fec_recovered - totals->video.frames_fec_recovered),
+			(unsigned long long)(video.frames_incomplete - totals->video.frames_incomplete),
+			packets_total ? (double)packets_lost * 100.0 / (double)packets_total : 0.0,
+			interval_sec > 0.0 ? (double)interval.audio_frames / interval_sec : 0.0);
+	if(interval.decoded_frames)
+		fprintf(out, ", decode avg %.2f max %.2f ms",
+				(double)interval.decode_us_sum / (double)interval.decoded_frames / 1000.0,
+				(double)interval.decode_us_max / 1000.0);
+	fprintf(out, "\n");
+	fflush(out);
+
+	totals->video = video;
+	totals->frames += interval.frames;
+	totals->audio_frames += interval.audio_frames;
+}
+
+CHIAKI_EXPORT int chiaki_cli_cmd_stream(ChiakiLog *log, int argc, char *argv[])
+{
+	Arguments arguments = { 0 };
+	arguments.ps5 = true;
+	arguments.resolution = CHIAKI_VIDEO_RESOLUTION_PRESET_720p;
+	arguments.fps = CHIAKI_VIDEO_FPS_PRESET_60;
+	arguments.audio_format = AUDIO_FORMAT_PCM;
+	arguments.stats_interval = 1.0;
+	error_t argp_r = argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, &arguments);
+	if(argp_r != 0)
+	{
+		free(arguments.config_buf);
+		return 1;
+	}
+
+	int ret = 1;
+	// the galois field for FEC is only set up here
+	ChiakiErrorCode err = chiaki_lib_init();
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Chiaki lib init failed: %s", chiaki_error_string(err));
+		free(arguments.config_buf);
+		return 1;
+	}
+
+	Context ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.log = log;
+	ctx.arguments = &arguments;
+
+	ChiakiConnectInfo connect_info;
+	memset(&connect_info, 0, sizeof(connect_info));
+	if(!arguments.host)
+	{
+		fprintf(stderr, "No host specified, see --help.\n");
+		goto error_arguments;
+	}
+	if(!arguments.registkey)
+	{
+		fprintf(stderr, "No registration key specified, see --help.\n");
+		goto error_arguments;
+	}
+	if(strlen(arguments.registkey) > sizeof(connect_info.regist_key))
+	{
+		fprintf(stderr, "Given registkey is too long.\n");
+		goto error_arguments;
+	}
+	if(!arguments.morning || !parse_hex(arguments.morning, connect_info.morning, sizeof(connect_info.morning)))
+	{
+		fprintf(stderr, "No or invalid morning specified, see --help.\n");
+		goto error_arguments;
+	}
+	if(arguments.h265 && !arguments.ps5)
+	{
+		fprintf(stderr, "H.265 is only supported by the PS5.\n");
+		goto error_arguments;
+	}
+	const ChiakiThreadSchedConfig *decode_sched = &arguments.thread_sched[CHIAKI_THREAD_ROLE_VIDEO_DECODE];
+	if((decode_sched->set_priority || decode_sched->cpu_mask) && !arguments.decode)
+	{
+		fprintf(stderr, "The video-decode thread only exists with --decode.\n");
+		goto error_arguments;
+	}
+#if !CHIAKI_LIB_ENABLE_OPUS
+	if(arguments.audio && arguments.audio_format == AUDIO_FORMAT_PCM)
+	{
+		fprintf(stderr, "PCM audio output requires Opus support, use --audio-format opus.\n");
+		goto error_arguments;
+	}
+#endif
+
+	connect_info.ps5 = arguments.ps5;
+	connect_info.host = arguments.host;
+	strncpy(connect_info.regist_key, arguments.registkey, sizeof(connect_info.regist_key));
+	chiaki_connect_video_profile_preset(&connect_info.video_profile, arguments.resolution, arguments.fps);
+	if(arguments.bitrate)
+		connect_info.video_profile.bitrate = arguments.bitrate;
+	if(arguments.h265)
+		connect_info.video_profile.codec = CHIAKI_CODEC_H265;
+	connect_info.video_profile_auto_downgrade = true;
+	memcpy(connect_info.thread_sched, arguments.thread_sched, sizeof(connect_info.thread_sched));
+
+	if(arguments.video)
+	{
+		ctx.video_file = open_output(arguments.video);
+		if(!ctx.video_file)
+		{
+			fprintf(stderr, "Failed to open %s for writing.\n", arguments.video);
+			goto error_arguments;
+		}
+		if(chiaki_spsc_ring_init(&ctx.video_ring, 1, VIDEO_RING_SIZE_EXP) != CHIAKI_ERR_SUCCESS)
+		{
+			fprintf(stderr, "Failed to allocate the video output buffer.\n");
+			close_output(ctx.video_file);
+			goto error_arguments;
+		}
+	}
+	if(arguments.audio)
+	{
+		ctx.audio_file = open_output(arguments.audio);
+		if(!ctx.audio_file)
+		{
+			fprintf(stderr, "Failed to open %s for writing.\n", arguments.audio);
+			goto error_video_file;
+		}
+		ctx.audio_pcm = arguments.audio_format == AUDIO_FORMAT_PCM;
+	}
+	// keep stdout clean if it carries a stream
+	FILE *stats_out = ctx.video_file == stdout || ctx.audio_file == stdout ? stderr : stdout;
+
+	if(chiaki_mutex_init(&ctx.mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_audio_file;
+	if(chiaki_cond_init(&ctx.cond, &ctx.mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+#if CHIAKI_LIB_ENABLE_OPUS
+	chiaki_opus_decoder_init(&ctx.opus_decoder, log);
+	chiaki_opus_decoder_set_cb(&ctx.opus_decoder, NULL, pcm_frame_cb, &ctx);
+	chiaki_opus_decoder_get_sink(&ctx.opus_decoder, &ctx.opus_sink);
+#endif
+
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	if(arguments.decode)
+	{
+		ChiakiFfmpegDecoderLowLatency low_latency;
+		chiaki_ffmpeg_decoder_low_latency_default(&low_latency);
+		ctx.decoded_frame = av_frame_alloc();
+		if(!ctx.decoded_frame || chiaki_ffmpeg_decoder_init(&ctx.ffmpeg_decoder, log, connect_info.video_profile.codec,
+				NULL, NULL, &low_latency, frame_available, &ctx) != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(log, "Failed to initialize FFmpeg decoder");
+			goto error_decoder;
+		}
+		ctx.ffmpeg_decoder_initialized = true;
+		// decoding on the Takion thread would stall packet reception and skew the measured receive times
+		err = chiaki_ffmpeg_decoder_start_thread(&ctx.ffmpeg_decoder, DECODE_QUEUE_SIZE, CHIAKI_FFMPEG_DECODER_DROP_NEWEST);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(log, "Failed to start FFmpeg decode thread");
+			goto error_decoder;
+		}
+	}
+#endif
+
+	err = chiaki_session_init(&ctx.session, &connect_info, log);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Session init failed: %s", chiaki_error_string(err));
+		goto error_decoder;
+	}
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	if(ctx.ffmpeg_decoder_initialized)
+		chiaki_session_apply_thread_role(&ctx.session, &ctx.ffmpeg_decoder.decode_thread, CHIAKI_THREAD_ROLE_VIDEO_DECODE);
+#endif
+
+	chiaki_session_set_event_cb(&ctx.session, event_cb, &ctx);
+	chiaki_session_set_video_sample_cb(&ctx.session, video_sample_cb, &ctx);
+	ChiakiAudioSink audio_sink = { 0 };
+	audio_sink.user = &ctx;
+	audio_sink.header_cb = audio_header_cb;
+	audio_sink.frame_cb = audio_frame_cb;
+	audio_sink.frame_lost_cb = audio_frame_lost_cb;
+	chiaki_session_set_audio_sink(&ctx.session, &audio_sink);
+
+	void (*sigint_prev)(int) = signal(SIGINT, sigint_handler);
+
+	err = chiaki_session_start(&ctx.session);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Session start failed: %s", chiaki_error_string(err));
+		goto error_session;
+	}
+
+	ChiakiMetricsServer metrics_server;
+	bool metrics_server_started = false;
+	if(arguments.metrics_port)
+	{
+		char labels[CHIAKI_METRICS_SERVER_LABELS_SIZE];
+		int labels_len = snprintf(labels, sizeof(labels), "host=\"%s\"", arguments.host);
+		err = chiaki_metrics_server_start(&metrics_server, log, (uint16_t)arguments.metrics_port,
+				labels_len > 0 && (size_t)labels_len < sizeof(labels) && !strpbrk(arguments.host, "\"\\") ? labels : NULL,
+				fill_metrics, &ctx);
+		if(err == CHIAKI_ERR_SUCCESS)
+			metrics_server_started = true;
+		else
+			CHIAKI_LOGE(log, "Failed to start metrics server, continuing without it");
+	}
+
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	uint64_t stats_last_us = start_us;
+	uint64_t stats_interval_us = (uint64_t)(arguments.stats_interval * 1e6);
+	uint64_t duration_us = (uint64_t)(arguments.duration * 1e6);
+	bool stop_requested = false;
+	Totals totals;
+	memset(&totals, 0, sizeof(totals));
+
+	chiaki_mutex_lock(&ctx.mutex);
+	while(!ctx.quit)
+	{
+		// short timeout, so an interrupt is noticed quickly
+		chiaki_cond_timedwait(&ctx.cond, &ctx.mutex, 100);
+		if(ctx.quit)
+			break;
+		chiaki_mutex_unlock(&ctx.mutex);
+
+		if(ctx.video_file)
+			video_drain(&ctx);
+
+		uint64_t now_us = chiaki_time_now_monotonic_us();
+		if(!stop_requested && (interrupted || (duration_us && now_us - start_us >= duration_us)))
+		{
+			CHIAKI_LOGI(log, "Stopping session");
+			chiaki_session_stop(&ctx.session);
+			stop_requested = true;
+		}
+		if(stats_interval_us && now_us - stats_last_us >= stats_interval_us)
+		{
+			print_stats(&ctx, stats_out, (double)(now_us - start_us) / 1e6, (double)(now_us - stats_last_us) / 1e6, &totals);
+			stats_last_us = now_us;
+		}
+
+		chiaki_mutex_lock(&ctx.mutex);
+	}
+	chiaki_mutex_unlock(&ctx.mutex);
+
+	chiaki_session_join(&ctx.session);
+	if(ctx.video_file)
+	{
+		video_drain(&ctx);
+		if(ctx.video_dropped)
+			CHIAKI_LOGW(log, "Dropped %llu video samples from the output", (unsigned long long)ctx.video_dropped);
+	}
+	if(metrics_server_started)
+		chiaki_metrics_server_stop(&metrics_server);
+
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	double elapsed_sec = (double)(now_us - start_us) / 1e6;
+	print_stats(&ctx, stats_out, elapsed_sec, (double)(now_us - stats_last_us) / 1e6, &totals);
+	fprintf(stats_out, "total: %.1fs, %llu frames (%.1f fps), %.2f Mbit/s, frames lost %llu, fec recovered %llu, incomplete %llu, %llu audio frames\n",
+			elapsed_sec,
+			(unsigned long long)totals.frames, elapsed_sec > 0.0 ? (double)totals.frames / elapsed_sec : 0.0,
+			elapsed_sec > 0.0 ? (double)totals.video.bytes * 8.0 / elapsed_sec / 1e6 : 0.0,
+			(unsigned long long)totals.video.frames_lost,
+			(unsigned long long)totals.video.frames_fec_recovered,
+			(unsigned long long)totals.video.frames_incomplete,
+			(unsigned long long)totals.audio_frames);
+	fflush(stats_out);
+
+	ret = stop_requested || !chiaki_quit_reason_is_error(ctx.quit_reason) ? 0 : 1;
+
+error_session:
+	signal(SIGINT, sigint_prev);
+	chiaki_session_fini(&ctx.session);
+error_decoder:
+#ifdef CHIAKI_CLI_ENABLE_FFMPEG_DECODER
+	if(ctx.ffmpeg_decoder_initialized)
+		chiaki_ffmpeg_decoder_fini(&ctx.ffmpeg_decoder);
+	av_frame_free(&ctx.decoded_frame);
+#endif
+#if CHIAKI_LIB_ENABLE_OPUS
+	chiaki_opus_decoder_fini(&ctx.opus_decoder);
+#endif
+	chiaki_cond_fini(&ctx.cond);
+error_mutex:
+	chiaki_mutex_fini(&ctx.mutex);
+error_audio_file:
+	close_output(ctx.audio_file);
+error_video_file:
+	if(ctx.video_file)
+		chiaki_spsc_ring_fini(&ctx.video_ring);
+	close_output(ctx.video_file);
+error_arguments:
+	free(arguments.config_buf);
+	return ret;
+}
@@ -94,6 +94,18 @@ class Settings : public QObject
 		bool GetStartMicUnmuted() const          { return settings.value("settings/start_mic_unmuted", false).toBool(); }
 		void SetStartMicUnmuted(bool unmuted) { return settings.setValue("settings/start_mic_unmuted", unmuted); }
 
+		/**
+		 * Port of the local metrics endpoint during a stream, 0 if disabled
+		 */
+		unsigned int GetMetricsPort() const      { return settings.value("settings/metrics_port", 0).toUInt(); }
+		void SetMetricsPort(unsigned int port)  { settings.setValue("settings/metrics_port", port); }
+
+		/**
+		 * Scheduling of a session thread as parsed by chiaki_thread_sched_config_parse(), e.g. "realtime@0x4", empty for the default
+		 */
+		QString GetThreadSched(ChiakiThreadRole role) const            { return settings.value(QString("settings/thread_sched_") + chiaki_thread_role_string(role)).toString(); }
+		void SetThreadSched(ChiakiThreadRole role, const QString &sched) { settings.setValue(QString("settings/thread_sched_") + chiaki_thread_role_string(role), sched); }
+
 #ifdef CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 		bool GetVerticalDeckEnabled() const       { return settings.value("settings/gyro_inverted", false).toBool(); }
 		void SetVerticalDeckEnabled(bool enabled) { settings.setValue("settings/gyro_inverted", enabled); }
@@ -6,7 +6,10 @@
 #include <chiaki/session.h>
 #include <chiaki/opusdecoder.h>
 #include <chiaki/opusencoder.h>
+#include <chiaki/audiooutputring.h>
+#include <chiaki/haptics.h>
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/metrics.h>
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 #include <chiaki/pidecoder.h>
@@ -84,6 +87,8 @@ struct StreamSessionConnectInfo
 	bool enable_dualsense;
 	bool buttons_by_pos;
 	bool start_mic_unmuted;
+	unsigned int metrics_port;
+	QString thread_sched[CHIAKI_THREAD_ROLE_COUNT];
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 	bool vertical_sdeck;
 	bool enable_steamdeck_haptics;
@@ -187,6 +192,10 @@ class StreamSession : public QObject
 
 		ChiakiFfmpegDecoder *ffmpeg_decoder;
 		void TriggerFfmpegFrameAvailable();
+
+		ChiakiMetricsServer metrics_server;
+		bool metrics_server_started;
+		void FillMetrics(ChiakiSessionMetrics *metrics);
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 		ChiakiPiDecoder *pi_decoder;
 #endif
@@ -196,7 +205,8 @@ class StreamSession : public QObject
 		SDL_AudioDeviceID audio_out;
 		SDL_AudioDeviceID audio_in;
 		size_t audio_out_sample_size;
-		bool audio_out_drain_queue;
+		ChiakiAudioOutputRing audio_out_ring;
+		bool audio_out_ring_valid;
 		unsigned int audio_buffer_size;
 		ChiakiHolepunchSession holepunch_session;
 #if CHIAKI_GUI_ENABLE_SPEEX
@@ -207,7 +217,9 @@ class StreamSession : public QObject
 		QQueue<int16_t *> echo_to_cancel;
 #endif
 		SDL_AudioDeviceID haptics_output;
-		uint8_t *haptics_resampler_buf;
+		int16_t *haptics_resampler_buf;
+		ChiakiHapticsUpsampler haptics_upsampler;
+		ChiakiHapticsEnvelope haptics_envelope;
 		MicBuf mic_buf;
 		QMap<Qt::Key, int> key_map;
 		QElapsedTimer connect_timer;
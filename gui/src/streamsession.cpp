@@ -20,6 +20,9 @@
 #define STEAMDECK_HAPTIC_INTERVAL_MS 10 // check every interval
 #define STEAMDECK_HAPTIC_PACKETS_PER_ANALYSIS 4 // send packets every interval * packets per analysis
 #define STEAMDECK_HAPTIC_SAMPLING_RATE 3000
+#define HAPTICS_RESAMPLER_FRAMES 64 // 3 kHz input frames converted at once, packets are 30
+#define HAPTICS_RUMBLE_ATTACK_MS 1.0f
+#define HAPTICS_RUMBLE_RELEASE_MS 50.0f
 // DualShock4 touchpad is 1920 x 942
 #define PS4_TOUCHPAD_MAX_X 1920.0f
 #define PS4_TOUCHPAD_MAX_Y 942.0f
@@ -72,6 +75,9 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 	this->enable_dualsense = settings->GetDualSenseEnabled();
 	this->buttons_by_pos = settings->GetButtonsByPosition();
 	this->start_mic_unmuted = settings->GetStartMicUnmuted();
+	this->metrics_port = settings->GetMetricsPort();
+	for(int role = 0; role < CHIAKI_THREAD_ROLE_COUNT; role++)
+		this->thread_sched[role] = settings->GetThreadSched((ChiakiThreadRole)role);
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 	this->enable_steamdeck_haptics = settings->GetSteamDeckHapticsEnabled();
 	this->vertical_sdeck = settings->GetVerticalDeckEnabled();
@@ -87,6 +93,7 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 }
 
 static void AudioSettingsCb(uint32_t channels, uint32_t rate, void *user);
+static void AudioOutCb(void *user, Uint8 *stream, int len);
 static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user);
 static void HapticsFrameCb(uint8_t *buf, size_t buf_size, void *user);
 #ifdef Q_OS_MACOS
@@ -94,6 +101,7 @@ static void MacMicRequestCb(Authorization authorization, void *user);
 #endif
 static void CantDisplayCb(void *user, bool cant_display);
 static void EventCb(ChiakiEvent *event, void *user);
+static void MetricsFillCb(ChiakiSessionMetrics *metrics, void *user);
 #if CHIAKI_GUI_ENABLE_SETSU
 static void SessionSetsuCb(SetsuEvent *event, void *user);
 #endif
@@ -111,8 +119,10 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 #endif
 	audio_out(0),
 	audio_in(0),
+	audio_out_ring_valid(false),
 	haptics_output(0),
 	session_started(false),
+	metrics_server_started(false),
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 	sdeck_haptics_senderl(nullptr),
 	sdeck_haptics_senderr(nullptr),
@@ -152,11 +162,13 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 		ffmpeg_decoder = new ChiakiFfmpegDecoder;
 		ChiakiLogSniffer sniffer;
 		chiaki_log_sniffer_init(&sniffer, CHIAKI_LOG_ALL, GetChiakiLog());
+		ChiakiFfmpegDecoderLowLatency low_latency;
+		chiaki_ffmpeg_decoder_low_latency_default(&low_latency);
 		err = chiaki_ffmpeg_decoder_init(ffmpeg_decoder,
 				chiaki_log_sniffer_get_log(&sniffer),
 				chiaki_target_is_ps5(connect_info.target) ? connect_info.video_profile.codec : CHIAKI_CODEC_H264,
 				connect_info.hw_decoder.isEmpty() ? NULL : connect_info.hw_decoder.toUtf8().constData(),
-				connect_info.hw_device_ctx, FfmpegFrameCb, this);
+				connect_info.hw_device_ctx, &low_latency, FfmpegFrameCb, this);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			QString log = QString::fromUtf8(chiaki_log_sniffer_get_buffer(&sniffer));
@@ -165,6 +177,10 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 		}
 		chiaki_log_sniffer_fini(&sniffer);
 		ffmpeg_decoder->log = GetChiakiLog();
+		// software decoding can be slow enough to stall packet reception, so decode on a separate thread
+		if(connect_info.hw_decoder.isEmpty()
+			&& chiaki_ffmpeg_decoder_start_thread(ffmpeg_decoder, 4, CHIAKI_FFMPEG_DECODER_DROP_NEWEST) != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGW(GetChiakiLog(), "Failed to start FFMPEG decode thread, decoding on the receive thread");
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	}
 #endif
@@ -202,6 +218,15 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_connect_info.host = host_str.constData();
 	chiaki_connect_info.video_profile = connect_info.video_profile;
 	chiaki_connect_info.video_profile_auto_downgrade = true;
+
+	for(int role = 0; role < CHIAKI_THREAD_ROLE_COUNT; role++)
+	{
+		if(connect_info.thread_sched[role].isEmpty())
+			continue;
+		QByteArray sched = connect_info.thread_sched[role].toUtf8();
+		if(chiaki_thread_sched_config_parse(&chiaki_connect_info.thread_sched[role], sched.constData()) != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGW(GetChiakiLog(), "Ignoring invalid scheduling \"%s\" for %s thread", sched.constData(), chiaki_thread_role_string((ChiakiThreadRole)role));
+	}
 	chiaki_connect_info.enable_keyboard = false;
 	chiaki_connect_info.enable_dualsense = connect_info.enable_dualsense;
 
@@ -255,6 +280,8 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	err = chiaki_session_init(&session, &chiaki_connect_info, GetChiakiLog());
 	if(err != CHIAKI_ERR_SUCCESS)
 		throw ChiakiException("Chiaki Session Init failed: " + QString::fromLocal8Bit(chiaki_error_string(err)));
+	if(ffmpeg_decoder && ffmpeg_decoder->threaded)
+		chiaki_session_apply_thread_role(&session, &ffmpeg_decoder->decode_thread, CHIAKI_THREAD_ROLE_VIDEO_DECODE);
 	ChiakiCtrlDisplaySink display_sink;
 	display_sink.user = this;
 	display_sink.cantdisplay_cb = CantDisplayCb;
@@ -269,7 +296,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 
 	if (connect_info.enable_dualsense)
 	{
-		ChiakiAudioSink haptics_sink;
+		ChiakiAudioSink haptics_sink = {};
 		haptics_sink.user = this;
 		haptics_sink.frame_cb = HapticsFrameCb;
 		chiaki_session_set_haptics_sink(&session, &haptics_sink);
@@ -377,12 +404,26 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 			emit AveragePacketLossChanged();
 		}
 	});
+
+	if(connect_info.metrics_port && connect_info.metrics_port <= UINT16_MAX)
+	{
+		if(chiaki_metrics_server_start(&metrics_server, GetChiakiLog(), (uint16_t)connect_info.metrics_port, nullptr,
+				MetricsFillCb, this) == CHIAKI_ERR_SUCCESS)
+			metrics_server_started = true;
+		else
+			CHIAKI_LOGE(GetChiakiLog(), "Failed to start metrics server on port %u", connect_info.metrics_port);
+	}
 }
 
 StreamSession::~StreamSession()
 {
+	// reads the session and the decoder
+	if(metrics_server_started)
+		chiaki_metrics_server_stop(&metrics_server);
 	if(audio_out)
 		SDL_CloseAudioDevice(audio_out);
+	if(audio_out_ring_valid)
+		chiaki_audio_output_ring_fini(&audio_out_ring);
 	if(audio_in)
 		SDL_CloseAudioDevice(audio_in);
 	if(session_started)
@@ -798,7 +839,15 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 	if(start_mic_unmuted)
 		ToggleMute();
 	if(audio_out)
+	{
 		SDL_CloseAudioDevice(audio_out);
+		audio_out = 0;
+	}
+	if(audio_out_ring_valid)
+	{
+		chiaki_audio_output_ring_fini(&audio_out_ring);
+		audio_out_ring_valid = false;
+	}
 
 	SDL_AudioSpec spec = {0};
 	spec.freq = rate;
@@ -806,6 +855,17 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 	spec.format = AUDIO_S16SYS;
 	audio_out_sample_size = sizeof(int16_t) * channels;
 	spec.samples = audio_buffer_size / audio_out_sample_size;
+	spec.callback = AudioOutCb;
+	spec.userdata = this;
+
+	// keep about one device buffer queued, latency beyond that is bled off by resampling instead of dropping audio
+	size_t buffer_frames = audio_buffer_size / audio_out_sample_size;
+	if(chiaki_audio_output_ring_init(&audio_out_ring, channels, buffer_frames, buffer_frames * 8) != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init Audio Output Ring");
+		return;
+	}
+	audio_out_ring_valid = true;
 
 	SDL_AudioSpec obtained;
 	audio_out = SDL_OpenAudioDevice(audio_out_device_name.isEmpty() ? nullptr : qUtf8Printable(audio_out_device_name), false, &spec, &obtained, false);
@@ -825,8 +885,6 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 	if(audio_out_device_name.isEmpty())
 		audio_out_device_name = "Auto";
 
-	audio_out_drain_queue = false;
-
 	SDL_PauseAudioDevice(audio_out, 0);
 
 	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device '%s' opened with %u channels @ %d Hz, buffer size %u",
@@ -1043,10 +1101,9 @@ void StreamSession::InitHaptics()
 	}
 #endif
 
-	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 4, 3000, AUDIO_S16LSB, 4, 48000);
-	cvt.len = 240;  // 10 16bit stereo samples
-	haptics_resampler_buf = (uint8_t*) calloc(cvt.len * cvt.len_mult, sizeof(uint8_t));
+	chiaki_haptics_upsampler_init(&haptics_upsampler);
+	chiaki_haptics_envelope_init(&haptics_envelope, HAPTICS_RUMBLE_ATTACK_MS, HAPTICS_RUMBLE_RELEASE_MS);
+	haptics_resampler_buf = (int16_t *)calloc(HAPTICS_RESAMPLER_FRAMES * CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_CHANNELS_OUT, sizeof(int16_t));
 	if(!haptics_resampler_buf)
 		CHIAKI_LOGE(log.GetChiakiLog(),"Haptics resampler buf could not be allocated");
 }
@@ -1217,20 +1274,6 @@ void StreamSession::PushAudioFrame(int16_t *buf, size_t samples_count)
 	if(!audio_out)
 		return;
 
-	// qDebug() << "Audio queue" << (SDL_GetQueuedAudioSize(audio_out) / audio_out_sample_size / samples_count) * 10 << "ms";
-
-	// Start draining queue when the latency gets too high
-	if(SDL_GetQueuedAudioSize(audio_out) > 3 * audio_buffer_size)
-		audio_out_drain_queue = true;
-
-	if(audio_out_drain_queue)
-	{
-		// Stop when the queue is smaller than configured buffer size
-		if(SDL_GetQueuedAudioSize(audio_out) >= audio_buffer_size)
-			return;
-		audio_out_drain_queue = false;
-	}
-
 #if CHIAKI_GUI_ENABLE_SPEEX
 	// change samples to mono for processing with SPEEX
 	if(echo_resampler_buf && speech_processing_enabled && !muted)
@@ -1250,7 +1293,7 @@ void StreamSession::PushAudioFrame(int16_t *buf, size_t samples_count)
 		echo_to_cancel.enqueue((int16_t *)echo_resampler_buf);
 	}
 #endif
-	SDL_QueueAudio(audio_out, buf, samples_count * audio_out_sample_size);
+	chiaki_audio_output_ring_push(&audio_out_ring, buf, samples_count);
 }
 
 #ifdef Q_OS_MACOS
@@ -1304,22 +1347,8 @@ void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 	if(rumbleHaptics && haptics_output == 0)
 	{
 
-		int16_t amplitudel = 0, amplituder = 0;
-		int32_t suml = 0, sumr = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
-
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++){
-			size_t cur = i * sample_size;
-
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			suml += amplitudel;
-			sumr += amplituder;
-		}
 		uint16_t left = 0, right = 0;
-		left = suml / buf_count;
-		right = sumr / buf_count;
+		chiaki_haptics_envelope_process(&haptics_envelope, buf, buf_size / (CHIAKI_HAPTICS_CHANNELS_IN * sizeof(int16_t)), &left, &right);
 		QMetaObject::invokeMethod(this, [this, left, right]() {
 			for(auto controller : controllers)
 			{
@@ -1337,28 +1366,19 @@ void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 	}
 	if(haptics_output == 0)
 		return;
-	SDL_AudioCVT cvt;
-	// Haptics samples are coming in at 3KHZ, but the DualSense expects 48KHZ
-	SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 4, 3000, AUDIO_S16LSB, 4, 48000);
-	cvt.len = buf_size * 2;
-	cvt.buf = haptics_resampler_buf;
-	// Remix to 4 channels
-	for (int i=0; i < buf_size; i+=4)
-	{
-		SDL_memset(haptics_resampler_buf + i * 2, 0, 4);
-		SDL_memcpy(haptics_resampler_buf + (i * 2) + 4, buf + i, 4);
-	}
-	// Resample to 48kHZ
-	if (SDL_ConvertAudio(&cvt) != 0)
-	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample haptics audio: %s", SDL_GetError());
-		return;
-	}
-
-	if (SDL_QueueAudio(haptics_output, cvt.buf, cvt.len_cvt) < 0)
+	// Haptics samples are coming in at 3KHZ stereo, but the DualSense expects 48KHZ on channels 3 and 4
+	const size_t sample_size = CHIAKI_HAPTICS_CHANNELS_IN * sizeof(int16_t);
+	size_t frames = buf_size / sample_size;
+	for(size_t done = 0; done < frames; done += HAPTICS_RESAMPLER_FRAMES)
 	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to device: %s", SDL_GetError());
-		return;
+		size_t chunk = frames - done < HAPTICS_RESAMPLER_FRAMES ? frames - done : HAPTICS_RESAMPLER_FRAMES;
+		size_t out_frames = chiaki_haptics_upsampler_process(&haptics_upsampler, buf + done * sample_size, chunk,
+				haptics_resampler_buf, HAPTICS_RESAMPLER_FRAMES * CHIAKI_HAPTICS_UPSAMPLE_FACTOR);
+		if (SDL_QueueAudio(haptics_output, haptics_resampler_buf, out_frames * CHIAKI_HAPTICS_CHANNELS_OUT * sizeof(int16_t)) < 0)
+		{
+			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to device: %s", SDL_GetError());
+			return;
+		}
 	}
 }
 
@@ -1653,6 +1673,13 @@ void StreamSession::TriggerFfmpegFrameAvailable()
 	}
 }
 
+void StreamSession::FillMetrics(ChiakiSessionMetrics *metrics)
+{
+	chiaki_session_get_metrics(&session, metrics);
+	if(ffmpeg_decoder)
+		chiaki_ffmpeg_decoder_get_metrics(ffmpeg_decoder, &metrics->decoder);
+}
+
 class StreamSessionPrivate
 {
 	public:
@@ -1667,6 +1694,10 @@ class StreamSessionPrivate
 		}
 
 		static void PushAudioFrame(StreamSession *session, int16_t *buf, size_t samples_count)	{ session->PushAudioFrame(buf, samples_count); }
+		static void PullAudio(StreamSession *session, uint8_t *buf, size_t buf_size)
+		{
+			chiaki_audio_output_ring_pull(&session->audio_out_ring, reinterpret_cast<int16_t *>(buf), buf_size / session->audio_out_sample_size);
+		}
 		static void PushHapticsFrame(StreamSession *session, uint8_t *buf, size_t buf_size)	{ session->PushHapticsFrame(buf, buf_size); }
 #ifdef Q_OS_MACOS
 		static void SetMicAuthorization(StreamSession *session, Authorization authorization)                 { session->SetMicAuthorization(authorization); }
@@ -1680,6 +1711,7 @@ class StreamSessionPrivate
 		static void HandleSDeckEvent(StreamSession *session, SDeckEvent *event)					{ session->HandleSDeckEvent(event); }
 #endif
 		static void TriggerFfmpegFrameAvailable(StreamSession *session)							{ session->TriggerFfmpegFrameAvailable(); }
+		static void FillMetrics(StreamSession *session, ChiakiSessionMetrics *metrics)			{ session->FillMetrics(metrics); }
 };
 
 static void AudioSettingsCb(uint32_t channels, uint32_t rate, void *user)
@@ -1694,6 +1726,12 @@ static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user)
 	StreamSessionPrivate::PushAudioFrame(session, buf, samples_count);
 }
 
+static void AudioOutCb(void *user, Uint8 *stream, int len)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::PullAudio(session, stream, (size_t)len);
+}
+
 #ifdef Q_OS_MACOS
 static void MacMicRequestCb(Authorization authorization, void *user)
 {
@@ -1736,6 +1774,12 @@ static void SessionSDeckCb(SDeckEvent *event, void *user)
 }
 #endif
 
+static void MetricsFillCb(ChiakiSessionMetrics *metrics, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::FillMetrics(session, metrics);
+}
+
 static void FfmpegFrameCb(ChiakiFfmpegDecoder *decoder, void *user)
 {
 	auto session = reinterpret_cast<StreamSession *>(user);
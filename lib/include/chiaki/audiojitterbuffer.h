@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIOJITTERBUFFER_H
+#define CHIAKI_AUDIOJITTERBUFFER_H
+
+#include "common.h"
+#include "seqnum.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of frames the buffer can hold, must divide 2^16
+ */
+#define CHIAKI_AUDIO_JITTER_BUFFER_SLOTS 32
+
+/**
+ * Maximum size of a single encoded frame, audio units are at most 0xff bytes
+ */
+#define CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX 0x100
+
+typedef void (*ChiakiAudioJitterBufferFrameCb)(uint8_t *buf, size_t buf_size, void *user);
+
+/**
+ * Called instead of ChiakiAudioJitterBufferFrameCb for a frame that did not arrive in time.
+ *
+ * @param fec_buf the frame following the lost one if it is already buffered, so its in-band FEC data can be used,
+ * otherwise NULL and the frame must be concealed without it
+ */
+typedef void (*ChiakiAudioJitterBufferLostCb)(uint8_t *fec_buf, size_t fec_buf_size, void *user);
+
+typedef struct chiaki_audio_jitter_buffer_stats_t
+{
+	uint64_t frames_received;
+	uint64_t frames_duplicate; // includes redundant copies of frames that were already received
+	uint64_t frames_late; // arrived after they were concealed
+	uint64_t frames_concealed_fec;
+	uint64_t frames_concealed_plc;
+	uint64_t resyncs;
+	size_t depth; // frames between the next frame to be played out and the newest received one
+	size_t depth_max;
+	uint64_t jitter_us;
+	uint64_t target_delay_us;
+} ChiakiAudioJitterBufferStats;
+
+typedef struct chiaki_audio_jitter_buffer_slot_t
+{
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+	size_t buf_size;
+	uint64_t arrival_us;
+	ChiakiSeqNum16 index;
+	bool set;
+	bool concealed;
+} ChiakiAudioJitterBufferSlot;
+
+/**
+ * Reorders encoded audio frames by their index and conceals lost ones.
+ *
+ * Consecutive frames are passed through immediately. When there is a gap, later frames are held back until the oldest
+ * of them has waited for the target delay, which adapts to the interarrival jitter, before the missing frame is given up.
+ *
+ * Not thread-safe.
+ */
+typedef struct chiaki_audio_jitter_buffer_t
+{
+	ChiakiAudioJitterBufferSlot *slots;
+	bool started;
+	ChiakiSeqNum16 next; // index of the next frame to be played out
+	ChiakiSeqNum16 end; // index after the newest received frame
+
+	uint64_t frame_duration_us;
+	uint64_t target_delay_max_us;
+
+	bool arrival_prev_valid;
+	ChiakiSeqNum16 index_prev;
+	uint64_t arrival_prev_us;
+	uint64_t jitter_us_16; // interarrival jitter estimate scaled by 16 as in RFC 3550
+
+	ChiakiAudioJitterBufferStats stats;
+
+	ChiakiAudioJitterBufferFrameCb frame_cb;
+	ChiakiAudioJitterBufferLostCb lost_cb;
+	void *cb_user;
+} ChiakiAudioJitterBuffer;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_jitter_buffer_init(ChiakiAudioJitterBuffer *jb,
+		ChiakiAudioJitterBufferFrameCb frame_cb, ChiakiAudioJitterBufferLostCb lost_cb, void *cb_user);
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_fini(ChiakiAudioJitterBuffer *jb);
+
+/**
+ * Drop all buffered frames and start over with the next pushed one
+ */
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_reset(ChiakiAudioJitterBuffer *jb);
+
+/**
+ * @param rate sample rate in Hz
+ * @param frame_size samples per channel in one frame
+ */
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_set_frame_duration(ChiakiAudioJitterBuffer *jb, uint32_t rate, uint32_t frame_size);
+
+/**
+ * @param index frame index, frames are played out in ascending order
+ * @param now_us monotonic arrival time of the frame
+ */
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_push(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 index, uint8_t *buf, size_t buf_size, uint64_t now_us);
+
+static inline void chiaki_audio_jitter_buffer_get_stats(ChiakiAudioJitterBuffer *jb, ChiakiAudioJitterBufferStats *stats)
+{
+	*stats = jb->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIOJITTERBUFFER_H
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIOOUTPUTRING_H
+#define CHIAKI_AUDIOOUTPUTRING_H
+
+#include "common.h"
+#include "spscring.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum deviation of the playback speed from 1 used to compensate clock drift
+ */
+#define CHIAKI_AUDIO_OUTPUT_RING_STRETCH_MAX 0.005
+
+typedef struct chiaki_audio_output_ring_stats_t
+{
+	uint64_t frames_pushed;
+	uint64_t frames_overflow; // dropped by push because the ring was full
+	uint64_t frames_pulled;
+	uint64_t frames_silence; // pulled while there was nothing to play
+	uint64_t underruns;
+	size_t fill; // buffered frames as of the last pull
+	double ratio; // current playback speed, > 1 means the buffer is being drained faster than real time
+	double drift_ppm; // estimated clock drift between sender and audio device
+} ChiakiAudioOutputRingStats;
+
+/**
+ * Pull-model buffer between decoded PCM and an audio device callback.
+ *
+ * Decoded audio is pushed from one thread and pulled from the device callback on another, without locks.
+ * Instead of dropping audio when the two clocks drift apart, the pulled audio is resampled by up to
+ * CHIAKI_AUDIO_OUTPUT_RING_STRETCH_MAX to keep the buffer at its target fill.
+ *
+ * All samples are interleaved signed 16 bit, a frame is one sample for every channel.
+ */
+typedef struct chiaki_audio_output_ring_t
+{
+	ChiakiSpscRing ring;
+	size_t channels;
+	size_t target_frames;
+
+	// everything below is owned by the consumer
+	int16_t *in_buf; // frames taken out of the ring, in_buf[0] is the oldest not fully consumed one
+	size_t in_buf_frames_max;
+	size_t in_count;
+	uint64_t pos; // 32.32 fixed point read position in in_buf
+	bool playing; // false while prebuffering up to the target fill
+	double fill_avg;
+	double drift; // integral part of the controller, converges to the relative clock drift
+	double ratio;
+
+	ChiakiAudioOutputRingStats stats;
+} ChiakiAudioOutputRing;
+
+/**
+ * @param target_frames frames to keep buffered, in addition to what the audio device buffers itself
+ * @param capacity_frames frames the ring can hold before push starts dropping, should be a few times target_frames
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_output_ring_init(ChiakiAudioOutputRing *ring, size_t channels,
+		size_t target_frames, size_t capacity_frames);
+CHIAKI_EXPORT void chiaki_audio_output_ring_fini(ChiakiAudioOutputRing *ring);
+
+/**
+ * Called from the producer thread
+ *
+ * @return number of frames that fit into the ring, the rest is dropped
+ */
+CHIAKI_EXPORT size_t chiaki_audio_output_ring_push(ChiakiAudioOutputRing *ring, const int16_t *buf, size_t frames);
+
+/**
+ * Called from the consumer thread, usually the audio device callback.
+ * Always fills out completely, with silence while not enough audio is buffered.
+ */
+CHIAKI_EXPORT void chiaki_audio_output_ring_pull(ChiakiAudioOutputRing *ring, int16_t *out, size_t frames);
+
+/**
+ * Counters are updated by both threads, so the result is approximate while audio is running
+ */
+static inline void chiaki_audio_output_ring_get_stats(ChiakiAudioOutputRing *ring, ChiakiAudioOutputRingStats *stats)
+{
+	*stats = ring->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIOOUTPUTRING_H
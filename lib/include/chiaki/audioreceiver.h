@@ -6,6 +6,8 @@
 #include "common.h"
 #include "log.h"
 #include "audio.h"
+#include "audiojitterbuffer.h"
+#include "spscring.h"
 #include "takion.h"
 #include "thread.h"
 #include "packetstats.h"
@@ -17,6 +19,13 @@ extern "C" {
 typedef void (*ChiakiAudioSinkHeader)(ChiakiAudioHeader *header, void *user);
 typedef void (*ChiakiAudioSinkFrame)(uint8_t *buf, size_t buf_size, void *user);
 
+/**
+ * Called in place of ChiakiAudioSinkFrame for a frame that was lost
+ *
+ * @param fec_buf the following frame if available, for recovering the lost one from its in-band FEC data, otherwise NULL
+ */
+typedef void (*ChiakiAudioSinkFrameLost)(uint8_t *fec_buf, size_t fec_buf_size, void *user);
+
 /**
  * Sink that receives Audio encoded as Opus
  */
@@ -25,22 +34,41 @@ typedef struct chiaki_audio_sink_t
 	void *user;
 	ChiakiAudioSinkHeader header_cb;
 	ChiakiAudioSinkFrame frame_cb;
+	ChiakiAudioSinkFrameLost frame_lost_cb; // optional, lost frames are skipped if NULL
 } ChiakiAudioSink;
 
+/**
+ * Receives audio or haptics packets on the Takion thread and passes the frames to the session's sinks.
+ *
+ * All reordering and deduplication state is only touched by the receiving thread. The sink callbacks run on a
+ * separate dispatch thread, fed through a lock-free ring, so decoding or audio output can never stall the network.
+ */
 typedef struct chiaki_audio_receiver_t
 {
 	struct chiaki_session_t *session;
 	ChiakiLog *log;
-	ChiakiMutex mutex;
 	ChiakiSeqNum16 frame_index_prev;
 	bool frame_index_startup; // whether frame_index_prev has definitely not wrapped yet
+	ChiakiAudioJitterBuffer jitter_buffer; // audio only, haptics are passed through in order
 	ChiakiPacketStats *packet_stats;
+
+	ChiakiSpscRing dispatch_ring;
+	ChiakiBoolPredCond dispatch_cond; // only held to wake up the dispatch thread, never during sink callbacks
+	ChiakiThread dispatch_thread;
+	bool dispatch_should_stop;
+	bool dispatch_pending; // events were committed since the dispatch thread was last woken up
+	bool dispatch_overflow;
+	uint64_t events_dropped;
+
+	ChiakiMutex stats_mutex;
+	ChiakiAudioJitterBufferStats jitter_stats; // snapshot for chiaki_audio_receiver_get_jitter_stats()
 } ChiakiAudioReceiver;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
 CHIAKI_EXPORT void chiaki_audio_receiver_fini(ChiakiAudioReceiver *audio_receiver);
 CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_receiver, ChiakiAudioHeader *audio_header);
 CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_receiver, ChiakiTakionAVPacket *packet);
+CHIAKI_EXPORT void chiaki_audio_receiver_get_jitter_stats(ChiakiAudioReceiver *audio_receiver, ChiakiAudioJitterBufferStats *stats);
 
 static inline ChiakiAudioReceiver *chiaki_audio_receiver_new(struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
 {
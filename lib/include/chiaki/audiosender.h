@@ -9,30 +9,98 @@
 #include "takion.h"
 #include "thread.h"
 #include "session.h"
+#include "fec.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
+#define CHIAKI_AUDIO_SENDER_UNIT_SIZE 40 // size of every opus frame the console accepts
+#define CHIAKI_AUDIO_SENDER_FRAMES_PER_PACKET_MAX 4
+#define CHIAKI_AUDIO_SENDER_FEC_UNITS_MAX 8
+#define CHIAKI_AUDIO_SENDER_PARITY_FRAMES_MAX 8
+#define CHIAKI_AUDIO_SENDER_HISTORY_SIZE 16 // frames kept for redundancy, >= any window the config can ask for
+#define CHIAKI_AUDIO_SENDER_HEADER_SIZE_MAX 20
+
+typedef enum chiaki_audio_sender_redundancy_t
+{
+	/**
+	 * fec units carry copies of the frames preceding the source units.
+	 * This is what the console expects.
+	 */
+	CHIAKI_AUDIO_SENDER_REDUNDANCY_REPEAT,
+	/**
+	 * fec units carry Cauchy parity over the newest parity_frames frames,
+	 * so a receiver can rebuild any lost frame of that window with chiaki_fec_decode().
+	 * Not understood by the console, only for receivers that know about it.
+	 */
+	CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY
+} ChiakiAudioSenderRedundancy;
+
+typedef struct chiaki_audio_sender_config_t
+{
+	ChiakiAudioSenderRedundancy redundancy;
+	uint8_t fec_units; // redundant units per packet, 0 - CHIAKI_AUDIO_SENDER_FEC_UNITS_MAX
+	uint8_t frames_per_packet; // pacing: opus frames collected before a packet goes out
+	uint8_t parity_frames; // window covered by the parity, only for CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY
+} ChiakiAudioSenderConfig;
+
+/**
+ * 2 repeated frames per packet, one packet per frame, as sent by the official client
+ */
+CHIAKI_EXPORT void chiaki_audio_sender_config_default(ChiakiAudioSenderConfig *config);
+
+typedef struct chiaki_audio_sender_stats_t
+{
+	uint64_t frames_sent;
+	uint64_t frames_dropped; // not CHIAKI_AUDIO_SENDER_UNIT_SIZE bytes
+	uint64_t packets_sent;
+	uint64_t send_errors;
+} ChiakiAudioSenderStats;
+
+/**
+ * Called with every finished packet, buf is only valid during the call and may be modified (e.g. encrypted in place)
+ */
+typedef ChiakiErrorCode (*ChiakiAudioSenderPacketCb)(uint8_t *buf, size_t buf_size, void *user);
+
 typedef struct chiaki_audio_sender_t
 {
 	ChiakiLog *log;
 	ChiakiMutex mutex;
 	bool ps5;
 	ChiakiTakion *takion;
-	uint16_t buf_size_per_unit;
-	uint16_t buf_stride_per_unit;
-	uint8_t *frame_buf;
-	uint8_t *framea;
-	uint8_t *frameb;
-	size_t frame_buf_size;
-	uint8_t *filled_packet_buf;
-	ChiakiSeqNum16 frame_index;
+	ChiakiAudioSenderPacketCb packet_cb; // defaults to sending on takion
+	void *packet_cb_user;
+	ChiakiAudioSenderConfig config;
+
+	// the last CHIAKI_AUDIO_SENDER_HISTORY_SIZE frames, newest at history_pos - 1
+	uint8_t *history;
+	size_t history_pos;
+	size_t history_count;
+	size_t frames_pending; // frames in history that have not been sent as source yet
+
+	// packets are assembled here in place, then handed to packet_cb
+	uint8_t *packet_buf;
+	ChiakiFecEncoder fec_encoder; // parity_frames x fec_units, for CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY
+	bool fec_encoder_valid;
+	uint8_t *silence_unit; // stands in for frames before the stream started in the parity window
+
+	ChiakiSeqNum16 packet_index;
+	ChiakiSeqNum16 frame_index; // index of the next frame to be sent
+	ChiakiAudioSenderStats stats;
 } ChiakiAudioSender;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_sender_init(ChiakiAudioSender *audio_sender, ChiakiLog *log, ChiakiSession *session);
 CHIAKI_EXPORT void chiaki_audio_sender_fini(ChiakiAudioSender *audio_sender);
+
+/**
+ * Also drops any frames that are not sent yet.
+ * @return CHIAKI_ERR_INVALID_DATA if any value is out of range, the previous config stays in effect then
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_sender_set_config(ChiakiAudioSender *audio_sender, const ChiakiAudioSenderConfig *config);
+CHIAKI_EXPORT void chiaki_audio_sender_set_packet_cb(ChiakiAudioSender *audio_sender, ChiakiAudioSenderPacketCb cb, void *user);
+CHIAKI_EXPORT void chiaki_audio_sender_get_stats(ChiakiAudioSender *audio_sender, ChiakiAudioSenderStats *stats);
 CHIAKI_EXPORT void chiaki_audio_sender_opus_data(ChiakiAudioSender *audio_sender, uint8_t *opus_data, size_t opus_data_size);
 
 static inline ChiakiAudioSender *chiaki_audio_sender_new(ChiakiLog *log, ChiakiSession *session)
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_BITMAPREORDERQUEUE_H
+#define CHIAKI_BITMAPREORDERQUEUE_H
+
+#include <stdlib.h>
+
+#include "reorderqueue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reorder queue with the same semantics as ChiakiReorderQueue,
+ * specialized for ChiakiSeqNum16 and ChiakiSeqNum32.
+ *
+ * Sequence numbers are compared with inlined modular arithmetic instead of callbacks
+ * and occupied slots are tracked in a bitmap, so runs of available elements are found
+ * a word at a time.
+ * Use the _16/_32 variants of push/pull/pull_all on hot paths, the unsuffixed ones
+ * dispatch on the width given at init.
+ */
+typedef struct chiaki_bitmap_reorder_queue_t
+{
+	size_t size_exp;
+	void **users;
+	uint64_t *bitmap; // bit i set <=> users[i] holds an element, only ever set inside [begin, begin + count)
+	uint64_t begin;
+	uint64_t count;
+	unsigned int seq_num_bits; // 16 or 32
+	ChiakiReorderQueueDropStrategy drop_strategy;
+	ChiakiReorderQueueDropCb drop_cb;
+	void *drop_cb_user;
+} ChiakiBitmapReorderQueue;
+
+/**
+ * @param size_exp exponent for 2
+ * @param seq_num_start sequence number of the first expected element
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_bitmap_reorder_queue_init_16(ChiakiBitmapReorderQueue *queue, size_t size_exp, ChiakiSeqNum16 seq_num_start);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_bitmap_reorder_queue_init_32(ChiakiBitmapReorderQueue *queue, size_t size_exp, ChiakiSeqNum32 seq_num_start);
+
+/**
+ * Calls the drop callback for all elements that are still in the queue
+ */
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_fini(ChiakiBitmapReorderQueue *queue);
+
+static inline void chiaki_bitmap_reorder_queue_set_drop_strategy(ChiakiBitmapReorderQueue *queue, ChiakiReorderQueueDropStrategy drop_strategy)
+{
+	queue->drop_strategy = drop_strategy;
+}
+
+static inline void chiaki_bitmap_reorder_queue_set_drop_cb(ChiakiBitmapReorderQueue *queue, ChiakiReorderQueueDropCb cb, void *user)
+{
+	queue->drop_cb = cb;
+	queue->drop_cb_user = user;
+}
+
+static inline size_t chiaki_bitmap_reorder_queue_size(ChiakiBitmapReorderQueue *queue)
+{
+	return ((size_t)1) << queue->size_exp;
+}
+
+static inline uint64_t chiaki_bitmap_reorder_queue_count(ChiakiBitmapReorderQueue *queue)
+{
+	return queue->count;
+}
+
+/**
+ * Push an element into the queue, see chiaki_reorder_queue_push() for when elements are dropped.
+ */
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_push(ChiakiBitmapReorderQueue *queue, uint64_t seq_num, void *user);
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_push_16(ChiakiBitmapReorderQueue *queue, ChiakiSeqNum16 seq_num, void *user);
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_push_32(ChiakiBitmapReorderQueue *queue, ChiakiSeqNum32 seq_num, void *user);
+
+/**
+ * Pull the next element in order from the queue, see chiaki_reorder_queue_pull().
+ */
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_pull(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **user);
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_pull_16(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **user);
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_pull_32(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **user);
+
+/**
+ * Pull the whole run of elements that are available in order, up to users_max of them.
+ *
+ * @param seq_num pointer where the sequence number of the first pulled element is written, undefined contents if 0 is returned.
+ * The element users[i] has the sequence number *seq_num + i.
+ * @param users array of at least users_max entries to receive the user pointers of the pulled elements
+ * @return number of pulled elements
+ */
+CHIAKI_EXPORT size_t chiaki_bitmap_reorder_queue_pull_all(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **users, size_t users_max);
+CHIAKI_EXPORT size_t chiaki_bitmap_reorder_queue_pull_all_16(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **users, size_t users_max);
+CHIAKI_EXPORT size_t chiaki_bitmap_reorder_queue_pull_all_32(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **users, size_t users_max);
+
+/**
+ * Peek the element at a specific index inside the queue, see chiaki_reorder_queue_peek().
+ *
+ * @param index Offset to be added to the begin sequence number, this is NOT a sequence number itself! (0 <= index < count)
+ */
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_peek(ChiakiBitmapReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user);
+
+/**
+ * Drop a specific element from the queue, see chiaki_reorder_queue_drop().
+ * begin will not be changed.
+ *
+ * @param index Offset to be added to the begin sequence number, this is NOT a sequence number itself! (0 <= index < count)
+ */
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_drop(ChiakiBitmapReorderQueue *queue, uint64_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_BITMAPREORDERQUEUE_H
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_BITRATEMETER_H
+#define CHIAKI_BITRATEMETER_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_BITRATE_METER_FRAMES_MAX 512
+#define CHIAKI_BITRATE_METER_WINDOW_US_DEFAULT 1000000
+#define CHIAKI_BITRATE_METER_EWMA_US_DEFAULT 4000000
+
+typedef struct chiaki_bitrate_meter_stats_t
+{
+	uint64_t span_us; // time the window values below are taken over, shorter than the window right after a reset
+	uint64_t frames; // in the window
+	uint64_t bytes;
+	double bitrate; // bit/s over the window
+	double bitrate_ewma; // bit/s, exponentially weighted with the meter's time constant
+	double fps; // frames/s over the window
+	uint32_t frame_size_p50; // bytes, nearest rank percentiles of the frames in the window
+	uint32_t frame_size_p95;
+	uint32_t frame_size_p99;
+	uint32_t frame_size_max;
+} ChiakiBitrateMeterStats;
+
+/**
+ * Bitrate and frame rate of a stream of frames, measured over a sliding window of real time.
+ *
+ * Frames are kept in a ring, so adding one is constant time, while percentiles are only computed
+ * in chiaki_bitrate_meter_get_stats(). If more than CHIAKI_BITRATE_METER_FRAMES_MAX frames fall into the window,
+ * the oldest are dropped and the values are taken over the shorter time that is left.
+ * The first frame after a reset only marks the start, because the time it took to arrive is unknown.
+ *
+ * Not thread-safe, frames and stats must come from the same thread.
+ */
+typedef struct chiaki_bitrate_meter_t
+{
+	uint64_t window_us;
+	uint64_t ewma_us; // time constant
+
+	struct
+	{
+		uint64_t timestamp_us;
+		uint32_t size;
+	} frames[CHIAKI_BITRATE_METER_FRAMES_MAX];
+	size_t begin;
+	size_t count;
+	uint64_t bytes; // of all frames in the ring
+	uint64_t since_us; // every frame after this is in the ring
+
+	bool started;
+	uint64_t start_us; // first frame after the reset
+	uint64_t ewma_last_us;
+	double ewma_bits; // decaying sum of the frame sizes in bits
+
+	uint32_t sizes_sorted[CHIAKI_BITRATE_METER_FRAMES_MAX]; // scratch for the percentiles
+} ChiakiBitrateMeter;
+
+/**
+ * @param window_us length of the sliding window, e.g. CHIAKI_BITRATE_METER_WINDOW_US_DEFAULT
+ * @param ewma_us time constant of bitrate_ewma, e.g. CHIAKI_BITRATE_METER_EWMA_US_DEFAULT
+ */
+CHIAKI_EXPORT void chiaki_bitrate_meter_init(ChiakiBitrateMeter *meter, uint64_t window_us, uint64_t ewma_us);
+CHIAKI_EXPORT void chiaki_bitrate_meter_reset(ChiakiBitrateMeter *meter);
+
+/**
+ * @param now_us monotonic time of arrival, as from chiaki_time_now_monotonic_us(), must not go back
+ */
+CHIAKI_EXPORT void chiaki_bitrate_meter_frame(ChiakiBitrateMeter *meter, uint64_t now_us, size_t size);
+
+/**
+ * Drop the frames that have left the window by now_us and compute the stats of the rest
+ */
+CHIAKI_EXPORT void chiaki_bitrate_meter_get_stats(ChiakiBitrateMeter *meter, uint64_t now_us, ChiakiBitrateMeterStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_BITRATEMETER_H
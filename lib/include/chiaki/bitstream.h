@@ -23,7 +23,28 @@ typedef struct chiaki_bitstream_t
 			struct
 			{
 				uint32_t log2_max_frame_num_minus4;
+				uint32_t pic_order_cnt_type;
+				uint32_t log2_max_pic_order_cnt_lsb_minus4;
+				bool delta_pic_order_always_zero_flag;
+				uint32_t max_num_ref_frames;
+				bool frame_mbs_only_flag;
+				bool separate_colour_plane_flag;
+				uint32_t chroma_format_idc;
 			} sps;
+
+			/**
+			 * Only needed for rewriting slices, so a header without pps is accepted.
+			 */
+			struct
+			{
+				bool valid;
+				bool entropy_coding_mode_flag;
+				bool bottom_field_pic_order_in_frame_present_flag;
+				uint32_t num_ref_idx_l0_default_active_minus1;
+				bool weighted_pred_flag;
+				bool deblocking_filter_control_present_flag;
+				bool redundant_pic_cnt_present_flag;
+			} pps;
 		} h264;
 
 		struct
@@ -52,7 +73,19 @@ typedef struct chiaki_bitstream_slice_t
 CHIAKI_EXPORT void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCodec codec);
 CHIAKI_EXPORT bool chiaki_bitstream_header(ChiakiBitstream *bitstream, uint8_t *data, unsigned size);
 CHIAKI_EXPORT bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice);
-CHIAKI_EXPORT bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame);
+
+/**
+ * Make the P slices in data reference the frame reference_frame + 1 frames back instead of the one they do now.
+ *
+ * For H.265, this flips flags of the slice's short term ref pic set in place and the size never changes.
+ * For H.264, a ref_pic_list_modification is inserted or replaced, so every slice NAL unit in data
+ * is re-emitted with the rest of its bits shifted and emulation prevention redone.
+ *
+ * @param size in: size of data, out: size of the rewritten data
+ * @param capacity how many bytes may be written to data
+ * @return false if the reference could not be changed, data is left untouched then
+ */
+CHIAKI_EXPORT bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned *size, unsigned capacity, unsigned reference_frame);
 
 #ifdef __cplusplus
 }
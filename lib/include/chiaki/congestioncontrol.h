@@ -18,6 +18,10 @@ typedef struct chiaki_congestion_control_t
 	ChiakiThread thread;
 	ChiakiBoolPredCond stop_cond;
 	double packet_loss;
+
+	// last report sent to the console, written by the control thread only
+	ChiakiTakionCongestionPacket last_report;
+	uint64_t reports_sent;
 } ChiakiCongestionControl;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats);
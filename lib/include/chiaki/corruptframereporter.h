@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_CORRUPTFRAMEREPORTER_H
+#define CHIAKI_CORRUPTFRAMEREPORTER_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+#include "seqnum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// added to the rtt, the console also needs to encode the i frame before it can arrive
+#define CHIAKI_CORRUPT_FRAME_REPORTER_HOLDOFF_MARGIN_US 20000
+
+typedef ChiakiErrorCode (*ChiakiCorruptFrameSendCallback)(ChiakiSeqNum16 start, ChiakiSeqNum16 end, void *user);
+
+typedef struct chiaki_corrupt_frame_stats_t
+{
+	uint64_t reports; // ranges reported by the video receiver
+	uint64_t requests_sent;
+	uint64_t merged; // reports that only extended the outstanding request
+	uint64_t suppressed; // reports completely covered by the outstanding request
+	uint64_t answered; // requests followed by an i frame
+	uint64_t expired; // requests that got no i frame within the holdoff
+	uint64_t send_errors;
+	uint64_t answer_us_last; // time from the last answered request to its i frame
+} ChiakiCorruptFrameStats;
+
+/**
+ * Coalesces corrupt frame reports, each of which may make the console do an expensive intra refresh.
+ *
+ * While a request is outstanding and less than the holdoff (about one rtt) has passed,
+ * further losses are merged into it instead of being sent, because the console's answer
+ * will come after them anyway. The request counts as answered once an i frame after its range arrives.
+ * If none arrives within the holdoff, the next report is sent as it is, without the range of the expired request.
+ *
+ * Reports and frames must come from a single thread, only chiaki_corrupt_frame_reporter_get_stats() may be called from others.
+ */
+typedef struct chiaki_corrupt_frame_reporter_t
+{
+	ChiakiLog *log;
+	ChiakiCorruptFrameSendCallback send_cb;
+	void *send_cb_user;
+	uint64_t holdoff_us;
+
+	bool outstanding;
+	ChiakiSeqNum16 start; // range of the outstanding request, including merged reports
+	ChiakiSeqNum16 end;
+	uint64_t sent_us;
+
+	ChiakiMutex stats_mutex;
+	ChiakiCorruptFrameStats stats;
+} ChiakiCorruptFrameReporter;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_corrupt_frame_reporter_init(ChiakiCorruptFrameReporter *reporter, ChiakiLog *log, uint64_t holdoff_us,
+		ChiakiCorruptFrameSendCallback send_cb, void *send_cb_user);
+CHIAKI_EXPORT void chiaki_corrupt_frame_reporter_fini(ChiakiCorruptFrameReporter *reporter);
+
+/**
+ * Frames start to end (inclusive) are missing or corrupt.
+ *
+ * @param now_us monotonic time, as from chiaki_time_now_monotonic_us()
+ * @return the error of the send callback if a request was due and could not be sent, it will be retried on the next report then
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_corrupt_frame_reporter_report(ChiakiCorruptFrameReporter *reporter, ChiakiSeqNum16 start, ChiakiSeqNum16 end, uint64_t now_us);
+
+/**
+ * A frame has been decoded successfully.
+ *
+ * @param keyframe whether it was an i frame, which answers the outstanding request if it comes after its range
+ */
+CHIAKI_EXPORT void chiaki_corrupt_frame_reporter_frame(ChiakiCorruptFrameReporter *reporter, ChiakiSeqNum16 frame_index, bool keyframe, uint64_t now_us);
+
+CHIAKI_EXPORT void chiaki_corrupt_frame_reporter_get_stats(ChiakiCorruptFrameReporter *reporter, ChiakiCorruptFrameStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_CORRUPTFRAMEREPORTER_H
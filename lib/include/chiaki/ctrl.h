@@ -22,6 +22,12 @@
 extern "C" {
 #endif
 
+/**
+ * Largest payload that is encrypted and sent from ChiakiCtrl.send_buf.
+ * Anything bigger (only long keyboard text) gets a temporary buffer instead.
+ */
+#define CHIAKI_CTRL_SEND_PAYLOAD_MAX 504
+
 typedef void (*ChiakiCantDisplayCb)(void *user, bool cant_display);
 
 typedef struct chiaki_ctrl_message_queue_t ChiakiCtrlMessageQueue;
@@ -57,7 +63,24 @@ typedef struct chiaki_ctrl_t
 	uint8_t recv_buf[512];
 	uint8_t rudp_recv_buf[520];
 
+	/**
+	 * Received bytes that are not parsed yet are recv_buf[recv_buf_start, recv_buf_start + recv_buf_size).
+	 * Messages are handled where they lie and only a trailing partial message is ever moved to the front.
+	 */
+	size_t recv_buf_start;
 	size_t recv_buf_size;
+
+	/**
+	 * Header followed by the encrypted payload of the message being sent,
+	 * so every message goes out with a single send.
+	 * Guarded by send_mutex together with crypt_counter_local.
+	 */
+#ifdef __GNUC__
+	__attribute__((aligned(__alignof__(uint32_t))))
+#endif
+	uint8_t send_buf[8 + CHIAKI_CTRL_SEND_PAYLOAD_MAX];
+	ChiakiMutex send_mutex;
+
 	uint64_t crypt_counter_local;
 	uint64_t crypt_counter_remote;
 	uint32_t keyboard_text_counter;
@@ -15,7 +15,85 @@ extern "C" {
 #endif
 
 #define CHIAKI_FEC_WORDSIZE 8
+#define CHIAKI_FEC_MATRIX_CACHE_SIZE 8
 
+/**
+ * Cauchy coding matrices for the most recently used (k, m) pairs,
+ * so they are not rebuilt for every frame.
+ */
+typedef struct chiaki_fec_matrix_cache_t
+{
+	struct
+	{
+		unsigned int k;
+		unsigned int m;
+		int *matrix;
+		uint64_t last_used;
+	} entries[CHIAKI_FEC_MATRIX_CACHE_SIZE];
+	uint64_t uses;
+} ChiakiFecMatrixCache;
+
+CHIAKI_EXPORT void chiaki_fec_matrix_cache_init(ChiakiFecMatrixCache *cache);
+CHIAKI_EXPORT void chiaki_fec_matrix_cache_fini(ChiakiFecMatrixCache *cache);
+
+/**
+ * @return matrix owned by the cache, valid until the next call, or NULL if it could not be created
+ */
+CHIAKI_EXPORT int *chiaki_fec_matrix_cache_get(ChiakiFecMatrixCache *cache, unsigned int k, unsigned int m);
+
+/**
+ * Encoder for a fixed (k, m, unit_size), holding the coding matrix and all pointers it needs,
+ * so encoding does not allocate.
+ */
+typedef struct chiaki_fec_encoder_t
+{
+	unsigned int k;
+	unsigned int m;
+	size_t unit_size;
+	int *matrix;
+	uint8_t **data_ptrs; // k entries, followed by m coding entries
+} ChiakiFecEncoder;
+
+/**
+ * @param cache if not NULL, the matrix is taken from here, otherwise it is created for the encoder.
+ * The encoder keeps its own copy, so the cache may be used for other sizes afterwards.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encoder_init(ChiakiFecEncoder *encoder, unsigned int k, unsigned int m, size_t unit_size, ChiakiFecMatrixCache *cache);
+CHIAKI_EXPORT void chiaki_fec_encoder_fini(ChiakiFecEncoder *encoder);
+
+/**
+ * @param frame_buf k source units, parity unit i is written directly to frame_buf + (k + i) * stride
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encoder_encode(ChiakiFecEncoder *encoder, uint8_t *frame_buf, size_t stride);
+
+/**
+ * Same as chiaki_fec_encoder_encode(), for units that are not laid out with a fixed stride
+ * @param data k source units
+ * @param coding m destinations for the parity units
+ */
+CHIAKI_EXPORT void chiaki_fec_encoder_encode_units(ChiakiFecEncoder *encoder, uint8_t *const *data, uint8_t *const *coding);
+
+/**
+ * Decoder with a matrix cache and a workspace that only grows, so decoding frames of similar shape does not allocate
+ * on the chiaki side.
+ */
+typedef struct chiaki_fec_decoder_t
+{
+	ChiakiFecMatrixCache cache;
+	int *erasures;
+	uint8_t **ptrs;
+	size_t units_max;
+} ChiakiFecDecoder;
+
+CHIAKI_EXPORT void chiaki_fec_decoder_init(ChiakiFecDecoder *decoder);
+CHIAKI_EXPORT void chiaki_fec_decoder_fini(ChiakiFecDecoder *decoder);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decoder_decode(ChiakiFecDecoder *decoder, uint8_t *frame_buf, size_t unit_size, size_t stride,
+		unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count);
+
+/**
+ * One-shot variants, building the matrix and workspace on every call.
+ * Parity unit i is at frame_buf + (k + i) * stride for both.
+ */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m);
 
@@ -12,6 +12,17 @@
 extern "C" {
 #endif
 
+typedef struct chiaki_feedback_sender_stats_t
+{
+	uint64_t state_changes; // calls of chiaki_feedback_sender_set_controller_state that changed anything
+	uint64_t state_packets;
+	uint64_t history_events;
+	uint64_t history_packets;
+	uint64_t send_errors; // failed packets, or failed batches of the packets of one tick
+	double history_events_per_packet;
+	double packets_per_second; // state and history packets since init
+} ChiakiFeedbackSenderStats;
+
 typedef struct chiaki_feedback_sender_t
 {
 	ChiakiLog *log;
@@ -29,11 +40,15 @@ typedef struct chiaki_feedback_sender_t
 	bool controller_state_changed;
 	ChiakiMutex state_mutex;
 	ChiakiCond state_cond;
+
+	uint64_t start_us;
+	ChiakiFeedbackSenderStats stats; // guarded by state_mutex
 } ChiakiFeedbackSender;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *feedback_sender, ChiakiTakion *takion);
 CHIAKI_EXPORT void chiaki_feedback_sender_fini(ChiakiFeedbackSender *feedback_sender);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state);
+CHIAKI_EXPORT void chiaki_feedback_sender_get_stats(ChiakiFeedbackSender *feedback_sender, ChiakiFeedbackSenderStats *stats);
 
 #ifdef __cplusplus
 }
@@ -4,6 +4,8 @@
 #include <chiaki/config.h>
 #include <chiaki/log.h>
 #include <chiaki/thread.h>
+#include <chiaki/frameprocessor.h>
+#include <chiaki/metrics.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +17,57 @@ typedef struct chiaki_ffmpeg_decoder_t ChiakiFfmpegDecoder;
 
 typedef void (*ChiakiFfmpegFrameAvailable)(ChiakiFfmpegDecoder *decover, void *user);
 
+/**
+ * What to do when a sample arrives while the queue of the decode thread is full
+ */
+typedef enum chiaki_ffmpeg_decoder_drop_policy_t
+{
+	/**
+	 * Reject the incoming sample. chiaki_ffmpeg_decoder_video_sample_cb() returns false,
+	 * so the session requests recovery from the console.
+	 */
+	CHIAKI_FFMPEG_DECODER_DROP_NEWEST,
+
+	/**
+	 * Discard the oldest queued sample and report it through frames_lost.
+	 * The incoming sample is still queued, but chiaki_ffmpeg_decoder_video_sample_cb() returns false,
+	 * because the discarded sample may have been a reference frame, so the session requests recovery as well.
+	 */
+	CHIAKI_FFMPEG_DECODER_DROP_OLDEST
+} ChiakiFfmpegDecoderDropPolicy;
+
+/**
+ * Software decoding settings tuned for latency instead of throughput
+ */
+typedef struct chiaki_ffmpeg_decoder_low_latency_t
+{
+	/**
+	 * Number of slice threads, 0 to use one per core.
+	 * Frame threading is always disabled because every frame thread adds a frame of latency.
+	 */
+	int slice_threads;
+
+	/**
+	 * Skip the deblocking filter while at least this many samples are waiting for the
+	 * decode thread (see chiaki_ffmpeg_decoder_start_thread()), 0 to never skip.
+	 * Costs some quality, but lets an overloaded decoder catch up.
+	 */
+	size_t skip_loop_filter_queue;
+
+	/**
+	 * Like skip_loop_filter_queue, but discards non-reference frames
+	 */
+	size_t skip_frame_queue;
+} ChiakiFfmpegDecoderLowLatency;
+
+typedef struct chiaki_ffmpeg_decoder_sample_t
+{
+	AVBufferRef *buf;
+	size_t buf_size;
+	int32_t frames_lost;
+	bool frame_recovered;
+} ChiakiFfmpegDecoderSample;
+
 struct chiaki_ffmpeg_decoder_t
 {
 	ChiakiLog *log;
@@ -30,16 +83,93 @@ struct chiaki_ffmpeg_decoder_t
 	int32_t frames_lost;
 	bool frame_recovered;
 	int32_t session_bitrate_kbps;
+	bool low_latency;
+	ChiakiFfmpegDecoderLowLatency low_latency_config;
+	bool overloaded;
+	/**
+	 * Time the last sample took to decode in us, only the time to submit it for hardware decoding.
+	 * Written by the thread that decodes, so it may be read from frame_available_cb.
+	 */
+	uint64_t decode_us;
+
+	// only used after chiaki_ffmpeg_decoder_start_thread()
+	bool threaded;
+	ChiakiThread decode_thread;
+	ChiakiMutex queue_mutex;
+	ChiakiCond queue_cond;
+	ChiakiFfmpegDecoderSample *queue;
+	size_t queue_size;
+	size_t queue_begin;
+	size_t queue_count;
+	bool queue_should_stop;
+	ChiakiFfmpegDecoderDropPolicy drop_policy;
+	uint64_t samples_dropped;
+	int32_t queue_frames_lost; // dropped samples not yet reported through a queued sample
+	AVBufferPool *sample_pool;
+	size_t sample_pool_buf_size; // size of each buffer in sample_pool, without padding
+
+	// reused for every sample and pull, so steady-state decoding does not allocate
+	AVPacket *packet;
+	AVFrame *frames[2];
+
+	// backs software frames when decoding with low latency settings
+	AVBufferPool *frame_pool;
+	int frame_pool_format;
+	int frame_pool_width;
+	int frame_pool_height;
+	size_t frame_pool_buf_size;
 };
 
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_low_latency_default(ChiakiFfmpegDecoderLowLatency *low_latency);
+
+/**
+ * @param low_latency settings for software decoding, NULL to keep the FFmpeg defaults. Ignored for hardware decoding.
+ */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
 		ChiakiCodec codec, const char *hw_decoder_name, AVBufferRef *hw_device_ctx,
+		const ChiakiFfmpegDecoderLowLatency *low_latency,
 		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user);
 CHIAKI_EXPORT void chiaki_ffmpeg_decoder_fini(ChiakiFfmpegDecoder *decoder);
+
+/**
+ * Move decoding to a dedicated thread.
+ *
+ * Afterwards, chiaki_ffmpeg_decoder_video_sample_cb() only copies the sample into a pooled,
+ * refcounted buffer and queues it, so the receiving thread never waits on the codec.
+ * frame_available_cb is then called from the decode thread.
+ * Must be called after chiaki_ffmpeg_decoder_init() and before the first sample is pushed.
+ *
+ * @param queue_size maximum number of samples waiting to be decoded
+ * @param drop_policy what to do with samples arriving while the queue is full
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_start_thread(ChiakiFfmpegDecoder *decoder, size_t queue_size, ChiakiFfmpegDecoderDropPolicy drop_policy);
 CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user);
+
+/**
+ * ChiakiVideoPartialSampleCallback for chiaki_session_set_video_partial_sample_cb().
+ * The incomplete frame is decoded like a recovered one and FFmpeg's error concealment fills in the missing slices.
+ * This relies on the libavcodec defaults, which do not set AV_EF_EXPLODE and conceal with FF_EC_GUESS_MVS | FF_EC_DEBLOCK,
+ * so the codec context must not be configured to abort on errors.
+ */
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_partial_sample_cb(uint8_t *buf, size_t buf_size, const ChiakiFrameUnitMap *map, int32_t frames_lost, void *user);
 CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder, int32_t *frames_lost);
+
+/**
+ * Like chiaki_ffmpeg_decoder_pull_frame(), but moves the frame into a caller-owned AVFrame,
+ * which can be reused for every pull to avoid allocating.
+ *
+ * @param frame unreferenced and filled if a new frame is available, left untouched otherwise
+ * @return whether a new frame was available
+ */
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_pull_frame_into(ChiakiFfmpegDecoder *decoder, AVFrame *frame, int32_t *frames_lost);
 CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFfmpegDecoder *decoder);
 
+/**
+ * Fill metrics with the state of the decode queue, never waits for a decode to finish.
+ * May be called from any thread.
+ */
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_get_metrics(ChiakiFfmpegDecoder *decoder, ChiakiDecoderMetrics *metrics);
+
 #ifdef __cplusplus
 }
 #endif
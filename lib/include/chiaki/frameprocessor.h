@@ -6,6 +6,7 @@
 #include "common.h"
 #include "takion.h"
 #include "packetstats.h"
+#include "fec.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -14,18 +15,63 @@
 extern "C" {
 #endif
 
-typedef struct chiaki_stream_stats_t
+struct chiaki_frame_unit_t;
+typedef struct chiaki_frame_unit_t ChiakiFrameUnit;
+
+/**
+ * Upper bound for source + fec units of a frame, only to reject garbage headers.
+ * units_in_frame_total has 11 bits in the av packet header, plus the one fec unit that is always reserved.
+ */
+#define CHIAKI_FRAME_PROCESSOR_UNITS_MAX (0x800 + 1)
+
+/**
+ * FEC is only attempted for frames with at most this many source + fec units, bigger ones are flushed as
+ * CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED when units are missing.
+ * That is all GF(2^8) has room for, and how the console codes bigger frames is unknown. A wrong guess would decode to garbage
+ * that is passed on as recovered instead of being reported as corrupt.
+ */
+#define CHIAKI_FRAME_PROCESSOR_FEC_UNITS_MAX (1 << CHIAKI_FEC_WORDSIZE)
+#define CHIAKI_FRAME_UNIT_MAP_SLICES_MAX 64
+
+/**
+ * Describes which parts of a flushed frame are actually there,
+ * so decoders that can conceal errors get a chance to use an incomplete frame.
+ */
+typedef struct chiaki_frame_unit_map_t
 {
-	uint64_t frames;
-	uint64_t bytes;
-} ChiakiStreamStats;
+	unsigned int units_count; // source units of the frame
+	unsigned int units_missing;
+	/**
+	 * Bitmap of the units that are there, unit i is bit i % 64 of unit_valid[i / 64],
+	 * see chiaki_frame_unit_map_unit_valid().
+	 * Like unit_offset, owned by the frame processor and sized for at least units_count units.
+	 */
+	uint64_t *unit_valid;
+	/**
+	 * Offset of each unit's data in the frame.
+	 * For a missing unit, the offset where its data would have been, i.e. where the gap is.
+	 */
+	uint32_t *unit_offset;
 
-CHIAKI_EXPORT void chiaki_stream_stats_reset(ChiakiStreamStats *stats);
-CHIAKI_EXPORT void chiaki_stream_stats_frame(ChiakiStreamStats *stats, uint64_t size);
-CHIAKI_EXPORT uint64_t chiaki_stream_stats_bitrate(ChiakiStreamStats *stats, uint64_t framerate);
+	/**
+	 * Filled by chiaki_frame_unit_map_find_slices() only.
+	 * Offsets of the NAL unit start codes in the frame, and whether a gap falls into the slice starting there.
+	 */
+	unsigned int slices_count;
+	bool slices_truncated; // more than CHIAKI_FRAME_UNIT_MAP_SLICES_MAX slices
+	uint32_t slice_offset[CHIAKI_FRAME_UNIT_MAP_SLICES_MAX];
+	bool slice_damaged[CHIAKI_FRAME_UNIT_MAP_SLICES_MAX];
+} ChiakiFrameUnitMap;
 
-struct chiaki_frame_unit_t;
-typedef struct chiaki_frame_unit_t ChiakiFrameUnit;
+static inline bool chiaki_frame_unit_map_unit_valid(const ChiakiFrameUnitMap *map, unsigned int unit)
+{
+	return (map->unit_valid[unit / 64] >> (unit % 64)) & 1;
+}
+
+/**
+ * Scan a frame flushed together with map for Annex B start codes
+ */
+CHIAKI_EXPORT void chiaki_frame_unit_map_find_slices(ChiakiFrameUnitMap *map, const uint8_t *frame, size_t frame_size);
 
 typedef struct chiaki_frame_processor_t
 {
@@ -39,9 +85,12 @@ typedef struct chiaki_frame_processor_t
 	unsigned int units_source_received;
 	unsigned int units_fec_received;
 	ChiakiFrameUnit *unit_slots;
-	size_t unit_slots_size;
+	size_t unit_slots_size; // of the current frame
+	size_t unit_slots_capacity; // only grows, also for unit_present and the arrays of unit_map
+	uint64_t *unit_present; // bitmap of the received units of the current frame, including fec
+	ChiakiFecDecoder fec_decoder;
+	ChiakiFrameUnitMap unit_map; // of the last flushed frame
 	bool flushed; // whether we have already flushed the current frame, i.e. are only interested in stats, not data.
-	ChiakiStreamStats stream_stats;
 } ChiakiFrameProcessor;
 
 typedef enum chiaki_frame_flush_result_t {
@@ -64,6 +113,15 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
  */
 CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(ChiakiFrameProcessor *frame_processor, uint8_t **frame, size_t *frame_size);
 
+/**
+ * Which units made it into the frame returned by the last chiaki_frame_processor_flush().
+ * Missing units are simply left out of the frame, which is relevant with CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED.
+ */
+static inline ChiakiFrameUnitMap *chiaki_frame_processor_unit_map(ChiakiFrameProcessor *frame_processor)
+{
+	return &frame_processor->unit_map;
+}
+
 static inline bool chiaki_frame_processor_flush_possible(ChiakiFrameProcessor *frame_processor)
 {
 	return frame_processor->units_source_received + frame_processor->units_fec_received
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HAPTICS_H
+#define CHIAKI_HAPTICS_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Haptics are received as 16 bit little endian stereo at 3 kHz,
+ * the DualSense expects them on channels 3 and 4 of a 4 channel 48 kHz audio device.
+ */
+#define CHIAKI_HAPTICS_RATE_IN 3000
+#define CHIAKI_HAPTICS_RATE_OUT 48000
+#define CHIAKI_HAPTICS_CHANNELS_IN 2
+#define CHIAKI_HAPTICS_CHANNELS_OUT 4
+#define CHIAKI_HAPTICS_UPSAMPLE_FACTOR (CHIAKI_HAPTICS_RATE_OUT / CHIAKI_HAPTICS_RATE_IN)
+#define CHIAKI_HAPTICS_UPSAMPLE_TAPS 8 // filter taps per output phase
+
+/**
+ * Fixed 3 kHz -> 48 kHz polyphase interpolator with output channel remapping.
+ * The filter is computed once in init, processing never allocates.
+ */
+typedef struct chiaki_haptics_upsampler_t
+{
+	float coefs[CHIAKI_HAPTICS_UPSAMPLE_FACTOR][CHIAKI_HAPTICS_UPSAMPLE_TAPS];
+	// delay line per input channel, stored twice so the newest TAPS samples are always contiguous
+	float history[CHIAKI_HAPTICS_CHANNELS_IN][2 * CHIAKI_HAPTICS_UPSAMPLE_TAPS];
+	size_t history_pos;
+	int8_t remap[CHIAKI_HAPTICS_CHANNELS_OUT]; // input channel for each output channel, -1 for silence
+} ChiakiHapticsUpsampler;
+
+/**
+ * Initializes the remapping for the DualSense, i.e. input left/right on output channels 3/4
+ */
+CHIAKI_EXPORT void chiaki_haptics_upsampler_init(ChiakiHapticsUpsampler *upsampler);
+CHIAKI_EXPORT void chiaki_haptics_upsampler_reset(ChiakiHapticsUpsampler *upsampler);
+CHIAKI_EXPORT void chiaki_haptics_upsampler_set_remap(ChiakiHapticsUpsampler *upsampler, const int8_t remap[CHIAKI_HAPTICS_CHANNELS_OUT]);
+
+/**
+ * @param buf frames_in stereo frames as received
+ * @param out interleaved CHIAKI_HAPTICS_CHANNELS_OUT channel output
+ * @param out_frames_max capacity of out in frames, anything that does not fit is dropped
+ * @return number of output frames written, CHIAKI_HAPTICS_UPSAMPLE_FACTOR per input frame
+ */
+CHIAKI_EXPORT size_t chiaki_haptics_upsampler_process(ChiakiHapticsUpsampler *upsampler, const uint8_t *buf, size_t frames_in,
+		int16_t *out, size_t out_frames_max);
+
+/**
+ * Peak envelope of the haptics signal, for driving rumble motors that can only take an intensity
+ */
+typedef struct chiaki_haptics_envelope_t
+{
+	float attack;
+	float release;
+	float env[CHIAKI_HAPTICS_CHANNELS_IN];
+} ChiakiHapticsEnvelope;
+
+/**
+ * @param attack_ms time constant for rising intensity
+ * @param release_ms time constant for falling intensity
+ */
+CHIAKI_EXPORT void chiaki_haptics_envelope_init(ChiakiHapticsEnvelope *envelope, float attack_ms, float release_ms);
+
+/**
+ * @param buf frames stereo frames as received
+ * @param left envelope of the left channel after the last frame, scaled to the full range of uint16_t
+ * @param right same for the right channel
+ */
+CHIAKI_EXPORT void chiaki_haptics_envelope_process(ChiakiHapticsEnvelope *envelope, const uint8_t *buf, size_t frames,
+		uint16_t *left, uint16_t *right);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HAPTICS_H
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_METRICS_H
+#define CHIAKI_METRICS_H
+
+#include "common.h"
+#include "log.h"
+#include "sock.h"
+#include "stoppipe.h"
+#include "thread.h"
+#include "feedbacksender.h"
+#include "videoreceiver.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chiaki_session_t ChiakiSession;
+
+/**
+ * State of the video decoder, which lives outside of the session.
+ * Filled by the application, e.g. with chiaki_ffmpeg_decoder_get_metrics().
+ */
+typedef struct chiaki_decoder_metrics_t
+{
+	bool valid; // whether the other fields have been filled
+	bool threaded;
+	bool overloaded; // currently degrading quality to catch up
+	size_t queue_count; // samples waiting to be decoded
+	size_t queue_size;
+	uint64_t samples_dropped;
+} ChiakiDecoderMetrics;
+
+/**
+ * Snapshot of the statistics of a session, see chiaki_session_get_metrics()
+ *
+ * Counters are totals since the start of the session, gauges are the latest values.
+ */
+typedef struct chiaki_session_metrics_t
+{
+	uint64_t timestamp_us; // monotonic, as from chiaki_time_now_monotonic_us()
+	bool streaming; // whether the stream connection is currently connected
+
+	uint64_t rtt_us;
+	uint32_t mtu_in;
+	uint32_t mtu_out;
+
+	double measured_bitrate; // MBit/s of the video stream, same as video.bitrate.bitrate
+	double packet_loss; // of the last congestion control interval
+	uint64_t congestion_reports; // congestion control packets sent to the console
+	uint16_t congestion_received; // as reported in the last congestion control packet
+	uint16_t congestion_lost;
+
+	uint64_t packets_received; // av packets, from the packet stats
+	uint64_t packets_lost;
+
+	ChiakiVideoReceiverStats video;
+
+	bool feedback_valid; // feedback and takion_* are only valid while streaming
+	ChiakiFeedbackSenderStats feedback;
+	uint64_t takion_batch_packets; // datagrams that went out through the takion send batch
+	uint64_t takion_batch_flushes;
+
+	ChiakiDecoderMetrics decoder;
+} ChiakiSessionMetrics;
+
+/**
+ * Take a snapshot of the statistics of session.
+ *
+ * Every value is copied under the lock that already guards it or read as is if it is only
+ * a single word written by one thread, so this never waits on a decode or a send.
+ * May be called from any thread between chiaki_session_init() and chiaki_session_fini().
+ * metrics->decoder is left invalid.
+ */
+CHIAKI_EXPORT void chiaki_session_get_metrics(ChiakiSession *session, ChiakiSessionMetrics *metrics);
+
+/**
+ * Format metrics as a single line JSON object.
+ *
+ * @return like snprintf(), the length of the full output, which has been truncated if it is >= buf_size
+ */
+CHIAKI_EXPORT size_t chiaki_session_metrics_format_json(const ChiakiSessionMetrics *metrics, char *buf, size_t buf_size);
+
+/**
+ * Format metrics in the Prometheus text exposition format.
+ *
+ * @param labels optional labels added to every sample without braces, e.g. "host=\"ps5\"", or NULL
+ * @return like snprintf(), the length of the full output, which has been truncated if it is >= buf_size
+ */
+CHIAKI_EXPORT size_t chiaki_session_metrics_format_prometheus(const ChiakiSessionMetrics *metrics, const char *labels, char *buf, size_t buf_size);
+
+/**
+ * Fill metrics for a request to the metrics server, called from its thread
+ */
+typedef void (*ChiakiMetricsServerFillCallback)(ChiakiSessionMetrics *metrics, void *user);
+
+#define CHIAKI_METRICS_SERVER_LABELS_SIZE 128
+
+/**
+ * Tiny HTTP server on 127.0.0.1 answering GET /metrics with Prometheus text and GET /metrics.json with JSON.
+ * Requests are served one at a time on a single thread.
+ */
+typedef struct chiaki_metrics_server_t
+{
+	ChiakiLog *log;
+	chiaki_socket_t sock;
+	uint16_t port;
+	ChiakiStopPipe stop_pipe;
+	ChiakiThread thread;
+	ChiakiMetricsServerFillCallback fill_cb;
+	void *fill_cb_user;
+	char labels[CHIAKI_METRICS_SERVER_LABELS_SIZE];
+} ChiakiMetricsServer;
+
+/**
+ * @param port to listen on, 0 to pick a free one, see server->port afterwards
+ * @param labels optional, see chiaki_session_metrics_format_prometheus()
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_metrics_server_start(ChiakiMetricsServer *server, ChiakiLog *log, uint16_t port, const char *labels,
+		ChiakiMetricsServerFillCallback fill_cb, void *fill_cb_user);
+
+/**
+ * Stop the server and join its thread
+ */
+CHIAKI_EXPORT void chiaki_metrics_server_stop(ChiakiMetricsServer *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_METRICS_H
@@ -22,6 +22,10 @@ typedef struct chiaki_packet_stats_t
 	ChiakiSeqNum16 seq_min; // sequence number that was max at the last reset
 	ChiakiSeqNum16 seq_max; // currently maximal sequence number
 	uint64_t seq_received; // total received packets since the last reset
+
+	// sums of all windows that have been reset, for the totals since init
+	uint64_t total_received;
+	uint64_t total_lost;
 } ChiakiPacketStats;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_stats_init(ChiakiPacketStats *stats);
@@ -31,6 +35,11 @@ CHIAKI_EXPORT void chiaki_packet_stats_push_generation(ChiakiPacketStats *stats,
 CHIAKI_EXPORT void chiaki_packet_stats_push_seq(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num);
 CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost);
 
+/**
+ * Get the received and lost packets since init, independent of resets
+ */
+CHIAKI_EXPORT void chiaki_packet_stats_get_totals(ChiakiPacketStats *stats, uint64_t *received, uint64_t *lost);
+
 #ifdef __cplusplus
 }
 #endif
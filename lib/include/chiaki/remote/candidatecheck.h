@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_CANDIDATECHECK_H
+#define CHIAKI_CANDIDATECHECK_H
+
+#include "../common.h"
+#include "../log.h"
+#include "../sock.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Spacing of the first retransmissions of consecutive pairs in the check list */
+#define CHIAKI_CANDIDATE_CHECK_PACING_MS 5
+#define CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS 100
+#define CHIAKI_CANDIDATE_CHECK_RTO_MAX_MS 500
+
+/**
+ * A local socket paired with an address of the console, checked during holepunching
+ */
+typedef struct chiaki_candidate_pair_t
+{
+	size_t candidate_idx;
+	chiaki_socket_t sock;
+	struct sockaddr_in6 addr;
+	socklen_t addr_len;
+	uint32_t priority; // higher is checked first
+	int responses; // number of check stages answered by the console, indexes the request to send
+	bool responded; // we answered a request of the console on this pair
+	bool failed;
+	uint64_t next_send_ms;
+	uint64_t rto_ms;
+	uint64_t pacing_ms; // added to the first retransmission only
+} ChiakiCandidatePair;
+
+CHIAKI_EXPORT void chiaki_candidate_pair_init(ChiakiCandidatePair *pair, size_t candidate_idx, chiaki_socket_t sock,
+		const struct sockaddr *addr, socklen_t addr_len, uint32_t priority);
+
+/**
+ * Sort the pairs by priority and schedule the first request of every pair for now_ms.
+ *
+ * The first requests go out at once, because delaying them only delays the check.
+ * Only the retransmissions are paced, so that all pairs retransmitting at the same time
+ * do not burst through the NAT: the first retransmission of the i-th pair comes
+ * i * CHIAKI_CANDIDATE_CHECK_PACING_MS after its rto.
+ */
+CHIAKI_EXPORT void chiaki_candidate_pairs_start(ChiakiCandidatePair *pairs, size_t pairs_count, uint64_t now_ms);
+
+/**
+ * Send the request for the pair's current check stage and schedule its retransmission with exponential backoff
+ *
+ * @return false if the socket of the pair is unusable
+ */
+CHIAKI_EXPORT bool chiaki_candidate_pair_send(ChiakiCandidatePair *pair, const uint8_t *request, size_t request_size, uint64_t now_ms);
+
+/**
+ * Send the requests of all pairs that are due by now_ms.
+ * Pairs whose request could not be sent are marked as failed and not checked anymore.
+ *
+ * @param requests one request of request_size bytes per check stage, the pair's responses select the one to send
+ * @param[in,out] next_wakeup_ms lowered to the time the next request is due, if it is earlier
+ * @return number of pairs that are still checked
+ */
+CHIAKI_EXPORT size_t chiaki_candidate_pairs_send_due(ChiakiLog *log, ChiakiCandidatePair *pairs, size_t pairs_count,
+		const uint8_t *requests, size_t request_size, uint64_t now_ms, uint64_t *next_wakeup_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_CANDIDATECHECK_H
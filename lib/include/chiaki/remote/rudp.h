@@ -27,6 +27,12 @@
 extern "C" {
 #endif
 
+/** Maximum size of a serialized rudp packet that is sent from a preallocated buffer */
+#define CHIAKI_RUDP_PACKET_SIZE_MAX 1500
+
+/** Maximum number of chained rudp messages parsed from a single packet by the in-place parser */
+#define CHIAKI_RUDP_MESSAGE_CHAIN_MAX 8
+
 /** Handle to rudp session state */
 typedef struct rudp_t* ChiakiRudp;
 typedef struct rudp_message_t RudpMessage;
@@ -194,6 +200,38 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_select_recv(ChiakiRudp rudp, size_t bu
 */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(ChiakiRudp rudp, size_t buf_size,  RudpMessage *message);
 
+/**
+ * Receives the rudp message into a caller-owned buffer and parses it in place. Must use select separately from this function
+ *
+ * The returned messages are views: their data points into buf and their subMessage into messages,
+ * so they are only valid as long as buf is not reused and must not be passed to chiaki_rudp_message_pointers_free().
+ *
+ * @param rudp Pointer to the Rudp instance to use
+ * @param buf The buffer to receive into, will be modified during parsing
+ * @param[in] buf_size The size of buf
+ * @param[out] messages The chain of parsed messages, messages[0] being the outermost one
+ * @param[in] messages_max The number of elements in messages, CHIAKI_RUDP_MESSAGE_CHAIN_MAX is enough for all known packets
+ * @param[out] messages_count The number of parsed messages
+ * @return CHIAKI_ERR_SUCCESS on success, CHIAKI_ERR_BUF_TOO_SMALL if the chain was truncated to messages_max, otherwise another error code
+ *
+*/
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only_in_place(ChiakiRudp rudp, uint8_t *buf, size_t buf_size,
+    RudpMessage *messages, size_t messages_max, size_t *messages_count);
+
+/**
+ * Parses a serialized rudp packet in place without allocating, see chiaki_rudp_recv_only_in_place()
+ *
+ * @param buf The serialized packet, will be modified during parsing
+ * @param[in] buf_size The size of the serialized packet
+ * @param[out] messages The chain of parsed messages, messages[0] being the outermost one
+ * @param[in] messages_max The number of elements in messages
+ * @param[out] messages_count The number of parsed messages
+ * @return CHIAKI_ERR_SUCCESS on success, CHIAKI_ERR_BUF_TOO_SMALL if the chain was truncated to messages_max, otherwise another error code
+ *
+*/
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_message_parse_in_place(uint8_t *buf, size_t buf_size,
+    RudpMessage *messages, size_t messages_max, size_t *messages_count);
+
 /**
  * Selects a rudp message using the given stop pipe and timeout
  *
@@ -27,6 +27,10 @@ typedef struct chiaki_rudp_send_buffer_t
 	size_t packets_size; // allocated size
 	size_t packets_count; // current count
 
+	uint8_t *slots; // packets_size preallocated buffers of CHIAKI_RUDP_PACKET_SIZE_MAX bytes for chiaki_rudp_send_buffer_push_copy()
+	uint8_t **free_slots;
+	size_t free_slots_count;
+
 	ChiakiMutex mutex;
 	ChiakiCond cond;
 	bool should_stop;
@@ -49,6 +53,14 @@ CHIAKI_EXPORT void chiaki_rudp_send_buffer_fini(ChiakiRudpSendBuffer *send_buffe
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, uint8_t *buf, size_t buf_size);
 
+/**
+ * Like chiaki_rudp_send_buffer_push(), but copies buf into one of the preallocated packet slots
+ * instead of taking ownership, so no allocation happens.
+ *
+ * @param buf_size must be at most CHIAKI_RUDP_PACKET_SIZE_MAX
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push_copy(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, const uint8_t *buf, size_t buf_size);
+
 /**
  * @param acked_seq_nums optional array of size of at least send_buffer->packets_size where acked seq nums will be stored
  */
@@ -72,6 +72,20 @@ typedef enum {
 
 CHIAKI_EXPORT void chiaki_connect_video_profile_preset(ChiakiConnectVideoProfile *profile, ChiakiVideoResolutionPreset resolution, ChiakiVideoFPSPreset fps);
 
+/**
+ * Threads of a session whose scheduling can be configured through ChiakiConnectInfo.thread_sched
+ */
+typedef enum {
+	CHIAKI_THREAD_ROLE_TAKION, // receives all stream packets, drops them from the socket buffer if preempted for too long
+	CHIAKI_THREAD_ROLE_VIDEO_DECODE, // owned by the application, see chiaki_session_apply_thread_role()
+	CHIAKI_THREAD_ROLE_AUDIO, // passes audio and haptics frames to the sinks
+	CHIAKI_THREAD_ROLE_FEEDBACK, // sends controller state
+	CHIAKI_THREAD_ROLE_CTRL,
+	CHIAKI_THREAD_ROLE_COUNT
+} ChiakiThreadRole;
+
+CHIAKI_EXPORT const char *chiaki_thread_role_string(ChiakiThreadRole role);
+
 #define CHIAKI_SESSION_AUTH_SIZE 0x10
 
 typedef struct chiaki_connect_info_t
@@ -89,6 +103,7 @@ typedef struct chiaki_connect_info_t
 #endif
 	chiaki_socket_t *rudp_sock;
 	uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
+	ChiakiThreadSchedConfig thread_sched[CHIAKI_THREAD_ROLE_COUNT]; // indexed by ChiakiThreadRole, zero to leave a thread as it is
 } ChiakiConnectInfo;
 
 
@@ -189,6 +204,15 @@ typedef void (*ChiakiEventCallback)(ChiakiEvent *event, void *user);
  */
 typedef bool (*ChiakiVideoSampleCallback)(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user);
 
+/**
+ * Receives frames that could not be completed, even with FEC.
+ * buf only contains the units that did arrive, map tells which ones are missing and which slices they cut into,
+ * so a decoder that conceals errors can still show most of the frame. A corrupt frame is reported either way.
+ * buf has the same padding as for ChiakiVideoSampleCallback and map is only valid during the call.
+ * @return same as ChiakiVideoSampleCallback
+ */
+typedef bool (*ChiakiVideoPartialSampleCallback)(uint8_t *buf, size_t buf_size, const ChiakiFrameUnitMap *map, int32_t frames_lost, void *user);
+
 
 
 typedef struct chiaki_session_t
@@ -207,6 +231,7 @@ typedef struct chiaki_session_t
 		bool enable_keyboard;
 		bool enable_dualsense;
 		uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
+		ChiakiThreadSchedConfig thread_sched[CHIAKI_THREAD_ROLE_COUNT];
 	} connect_info;
 
 	ChiakiTarget target;
@@ -227,6 +252,8 @@ typedef struct chiaki_session_t
 	void *event_cb_user;
 	ChiakiVideoSampleCallback video_sample_cb;
 	void *video_sample_cb_user;
+	ChiakiVideoPartialSampleCallback video_partial_sample_cb;
+	void *video_partial_sample_cb_user;
 	ChiakiAudioSink audio_sink;
 	ChiakiAudioSink haptics_sink;
 	ChiakiCtrlDisplaySink display_sink;
@@ -276,6 +303,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_keyboard_reject(ChiakiSession *sess
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_keyboard_accept(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_go_home(ChiakiSession *session);
 
+/**
+ * Apply the scheduling configured for role to thread.
+ * Called by the session for its own threads, applications call it for threads they own,
+ * e.g. with CHIAKI_THREAD_ROLE_VIDEO_DECODE for a decode thread.
+ * Failures are only logged, the thread keeps running either way.
+ */
+CHIAKI_EXPORT void chiaki_session_apply_thread_role(ChiakiSession *session, ChiakiThread *thread, ChiakiThreadRole role);
+
 static inline void chiaki_session_set_event_cb(ChiakiSession *session, ChiakiEventCallback cb, void *user)
 {
 	session->event_cb = cb;
@@ -288,6 +323,16 @@ static inline void chiaki_session_set_video_sample_cb(ChiakiSession *session, Ch
 	session->video_sample_cb_user = user;
 }
 
+/**
+ * Opt in to getting incomplete frames instead of having them dropped.
+ * Complete frames still go to the video sample callback.
+ */
+static inline void chiaki_session_set_video_partial_sample_cb(ChiakiSession *session, ChiakiVideoPartialSampleCallback cb, void *user)
+{
+	session->video_partial_sample_cb = cb;
+	session->video_partial_sample_cb_user = user;
+}
+
 /**
  * @param sink contents are copied
  */
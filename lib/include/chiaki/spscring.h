@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_SPSCRING_H
+#define CHIAKI_SPSCRING_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_SPSC_RING_CACHE_LINE 64
+
+/**
+ * Lock-free ring buffer of fixed-size elements for exactly one producer and one consumer thread.
+ *
+ * The producer may only call the write functions, the consumer only the read functions.
+ * Neither side ever blocks, waking up the consumer is left to the user.
+ */
+typedef struct chiaki_spsc_ring_t
+{
+	uint8_t *buf;
+	size_t elem_size;
+	size_t size_exp;
+
+	// head and tail are free-running counters, kept on separate cache lines
+	uint8_t pad0[CHIAKI_SPSC_RING_CACHE_LINE];
+	size_t head; // next element to read, only written by the consumer
+	uint8_t pad1[CHIAKI_SPSC_RING_CACHE_LINE - sizeof(size_t)];
+	size_t tail; // next element to write, only written by the producer
+	uint8_t pad2[CHIAKI_SPSC_RING_CACHE_LINE - sizeof(size_t)];
+} ChiakiSpscRing;
+
+/**
+ * @param size_exp the ring holds 2^size_exp elements
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_spsc_ring_init(ChiakiSpscRing *ring, size_t elem_size, size_t size_exp);
+CHIAKI_EXPORT void chiaki_spsc_ring_fini(ChiakiSpscRing *ring);
+
+/**
+ * Drop all elements, must not be called concurrently with any other function
+ */
+CHIAKI_EXPORT void chiaki_spsc_ring_reset(ChiakiSpscRing *ring);
+
+/**
+ * @return the next element to fill, or NULL if the ring is full
+ */
+CHIAKI_EXPORT void *chiaki_spsc_ring_write_begin(ChiakiSpscRing *ring);
+
+/**
+ * Publish the element returned by the last chiaki_spsc_ring_write_begin() to the consumer
+ */
+CHIAKI_EXPORT void chiaki_spsc_ring_write_commit(ChiakiSpscRing *ring);
+
+/**
+ * Copy up to count elements into the ring
+ *
+ * @return number of elements written
+ */
+CHIAKI_EXPORT size_t chiaki_spsc_ring_write(ChiakiSpscRing *ring, const void *elems, size_t count);
+
+/**
+ * @return the oldest element, or NULL if the ring is empty
+ */
+CHIAKI_EXPORT void *chiaki_spsc_ring_read_begin(ChiakiSpscRing *ring);
+
+/**
+ * Release the element returned by the last chiaki_spsc_ring_read_begin() to the producer
+ */
+CHIAKI_EXPORT void chiaki_spsc_ring_read_commit(ChiakiSpscRing *ring);
+
+/**
+ * Copy up to count elements out of the ring
+ *
+ * @return number of elements read
+ */
+CHIAKI_EXPORT size_t chiaki_spsc_ring_read(ChiakiSpscRing *ring, void *elems, size_t count);
+
+/**
+ * Number of elements currently in the ring, only a snapshot while the other thread is active
+ */
+CHIAKI_EXPORT size_t chiaki_spsc_ring_count(ChiakiSpscRing *ring);
+
+static inline size_t chiaki_spsc_ring_size(ChiakiSpscRing *ring)
+{
+	return ((size_t)1) << ring->size_exp;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_SPSCRING_H
@@ -68,7 +68,13 @@ typedef struct chiaki_stream_connection_t
 	bool streaminfo_called_from_bang;
 	#endif
 
-	double measured_bitrate;
+	double measured_bitrate; // MBit/s over the video receiver's bitrate meter window, as of the last connection quality report
+
+	/**
+	 * protects video_stats, which is updated by the video receiver for every frame
+	 */
+	ChiakiMutex video_stats_mutex;
+	ChiakiVideoReceiverStats video_stats;
 } ChiakiStreamConnection;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session);
@@ -85,6 +91,11 @@ CHIAKI_EXPORT ChiakiErrorCode stream_connection_send_toggle_mute_direct_message(
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_stop(ChiakiStreamConnection *stream_connection);
 
+/**
+ * Thread-safe, may be called at any time between chiaki_stream_connection_init() and chiaki_stream_connection_fini()
+ */
+CHIAKI_EXPORT void chiaki_stream_connection_get_video_stats(ChiakiStreamConnection *stream_connection, ChiakiVideoReceiverStats *stats);
+
 CHIAKI_EXPORT ChiakiErrorCode stream_connection_send_corrupt_frame(ChiakiStreamConnection *stream_connection, ChiakiSeqNum16 start, ChiakiSeqNum16 end);
 
 #ifdef __cplusplus
@@ -9,7 +9,7 @@
 #include "gkcrypt.h"
 #include "seqnum.h"
 #include "stoppipe.h"
-#include "reorderqueue.h"
+#include "bitmapreorderqueue.h"
 #include "feedback.h"
 #include "takionsendbuffer.h"
 
@@ -97,6 +97,78 @@ typedef struct chiaki_takion_event_t
 
 typedef void (*ChiakiTakionCallback)(ChiakiTakionEvent *event, void *user);
 
+/**
+ * Upper bound for ChiakiTakionAckPolicy.delay_us,
+ * half of the 200 ms after which unacknowledged data is resent so a delayed ack always arrives in time.
+ */
+#define CHIAKI_TAKION_ACK_DELAY_MAX_US 100000
+
+/**
+ * When to acknowledge received data packets.
+ * Acks are cumulative, so one ack covers every data packet up to its sequence number.
+ */
+typedef struct chiaki_takion_ack_policy_t
+{
+	unsigned int packets_max; // ack as soon as this many data packets are unacknowledged, 1 or 0 acks immediately
+	uint64_t delay_us; // or as soon as the oldest unacknowledged data packet is this old
+} ChiakiTakionAckPolicy;
+
+/**
+ * Ack every data packet immediately
+ */
+CHIAKI_EXPORT void chiaki_takion_ack_policy_default(ChiakiTakionAckPolicy *policy);
+
+/**
+ * Delayed acks for received data packets according to a ChiakiTakionAckPolicy
+ */
+typedef struct chiaki_takion_delayed_ack_t
+{
+	ChiakiTakionAckPolicy policy;
+	size_t pending; // data packets received since the last ack
+	ChiakiSeqNum32 seq_num; // to be acked
+	uint64_t deadline_us;
+} ChiakiTakionDelayedAck;
+
+/**
+ * @param policy packets_max is raised to at least 1 and delay_us capped at CHIAKI_TAKION_ACK_DELAY_MAX_US
+ */
+CHIAKI_EXPORT void chiaki_takion_delayed_ack_init(ChiakiTakionDelayedAck *ack, const ChiakiTakionAckPolicy *policy);
+
+/**
+ * Record count data packets that were received, up to and including seq_num
+ *
+ * @return whether the ack is due right away
+ */
+CHIAKI_EXPORT bool chiaki_takion_delayed_ack_push(ChiakiTakionDelayedAck *ack, size_t count, ChiakiSeqNum32 seq_num, uint64_t now_us);
+
+/**
+ * @param[out] timeout_ms if no ack is due yet, how long until one is, UINT64_MAX if none is pending
+ * @return whether a pending ack is due at now_us
+ */
+CHIAKI_EXPORT bool chiaki_takion_delayed_ack_due(ChiakiTakionDelayedAck *ack, uint64_t now_us, uint64_t *timeout_ms);
+
+/**
+ * Mark the pending ack as sent
+ */
+CHIAKI_EXPORT void chiaki_takion_delayed_ack_sent(ChiakiTakionDelayedAck *ack);
+
+#define CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX 16
+#define CHIAKI_TAKION_SEND_BATCH_PACKET_SIZE_MAX 0x200
+
+/**
+ * Datagrams collected between chiaki_takion_send_batch_begin() and chiaki_takion_send_batch_end()
+ */
+typedef struct chiaki_takion_send_batch_t
+{
+	ChiakiMutex mutex;
+	unsigned int depth;
+	size_t count;
+	size_t sizes[CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX];
+	uint8_t bufs[CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX][CHIAKI_TAKION_SEND_BATCH_PACKET_SIZE_MAX];
+	uint64_t packets_sent;
+	uint64_t flushes;
+} ChiakiTakionSendBatch;
+
 typedef struct chiaki_takion_connect_info_t
 {
 	ChiakiLog *log;
@@ -109,6 +181,7 @@ typedef struct chiaki_takion_connect_info_t
 	bool enable_dualsense;
 	uint8_t protocol_version;
 	bool close_socket; // close socket when finishing takion
+	ChiakiTakionAckPolicy ack_policy;
 } ChiakiTakionConnectInfo;
 
 
@@ -142,8 +215,14 @@ typedef struct chiaki_takion_t
 
 	ChiakiGKCrypt *gkcrypt_remote; // if NULL (default), remote gmacs are IGNORED (!) and everything is expected to be unencrypted
 
-	ChiakiReorderQueue data_queue;
+	ChiakiBitmapReorderQueue data_queue;
 	ChiakiTakionSendBuffer send_buffer;
+	ChiakiTakionSendBatch send_batch;
+
+	/**
+	 * Delayed acks for received data packets, only touched by the Takion thread
+	 */
+	ChiakiTakionDelayedAck delayed_ack;
 
 	ChiakiTakionCallback cb;
 	void *cb_user;
@@ -194,11 +273,30 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_crypt_advance_key_pos(ChiakiTakion *
 
 /**
  * Send a datagram directly on the socket.
+ * While a send batch is open, small datagrams are queued instead and go out when it is closed.
  *
  * Thread-safe while Takion is running.
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_raw(ChiakiTakion *takion, const uint8_t *buf, size_t buf_size);
 
+/**
+ * Start collecting outgoing datagrams of up to CHIAKI_TAKION_SEND_BATCH_PACKET_SIZE_MAX bytes
+ * so they can be sent with a single syscall (sendmmsg where available).
+ * Batches may be nested and opened from multiple threads, everything is flushed when the last one is closed.
+ * Order of datagrams is always preserved.
+ *
+ * Thread-safe while Takion is running.
+ */
+CHIAKI_EXPORT void chiaki_takion_send_batch_begin(ChiakiTakion *takion);
+
+/**
+ * Thread-safe while Takion is running.
+ *
+ * @return the error of sending the queued datagrams if this closed the last batch,
+ * otherwise CHIAKI_ERR_SUCCESS. Errors of flushes while the batch was open are returned by chiaki_takion_send_raw().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_batch_end(ChiakiTakion *takion);
+
 /**
  * Calculate the MAC for the packet depending on the type derived from the first byte in buf,
  * assign MAC inside buf at the respective position and send the packet.
@@ -35,6 +35,12 @@ typedef struct chiaki_thread_t
 	SceUInt timeout_us;
 #else
 	pthread_t thread;
+#if defined(__linux__)
+	// niceness can only be set through the kernel thread id, which the thread publishes when it starts
+	ChiakiThreadFunc func;
+	void *arg;
+	int tid;
+#endif
 #endif
 } ChiakiThread;
 
@@ -43,6 +49,55 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_join(ChiakiThread *thread, void **re
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_timedjoin(ChiakiThread *thread, void **retval, uint64_t timeout_ms);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const char *name);
 
+typedef enum chiaki_thread_priority_t
+{
+	CHIAKI_THREAD_PRIORITY_LOW,
+	CHIAKI_THREAD_PRIORITY_NORMAL,
+	CHIAKI_THREAD_PRIORITY_HIGH,
+	/**
+	 * Realtime scheduling where the OS has it, e.g. SCHED_FIFO on Linux, which usually needs
+	 * CAP_SYS_NICE or an RLIMIT_RTPRIO. Falls back to CHIAKI_THREAD_PRIORITY_HIGH if it is not permitted.
+	 */
+	CHIAKI_THREAD_PRIORITY_REALTIME
+} ChiakiThreadPriority;
+
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority);
+
+/**
+ * Change the scheduling priority of thread.
+ *
+ * On Linux, LOW, NORMAL and HIGH map to the niceness 5, 0 and -10 under SCHED_OTHER, where HIGH needs
+ * CAP_SYS_NICE or an RLIMIT_NICE. Elsewhere the native thread priorities are used.
+ *
+ * @param applied optional, set on success to the priority that is in effect, which may be lower than requested
+ * @return CHIAKI_ERR_SUCCESS if priority or a fallback was applied, CHIAKI_ERR_THREAD if the thread is unchanged
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_priority(ChiakiThread *thread, ChiakiThreadPriority priority, ChiakiThreadPriority *applied);
+
+/**
+ * Restrict thread to a set of CPUs.
+ *
+ * @param cpu_mask bit i set to allow CPU i, must not be 0
+ * @return CHIAKI_ERR_THREAD if the mask was rejected or the platform does not support affinity
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_affinity(ChiakiThread *thread, uint64_t cpu_mask);
+
+/**
+ * Scheduling settings for a thread, zero-initialized to leave the thread as it is
+ */
+typedef struct chiaki_thread_sched_config_t
+{
+	bool set_priority;
+	ChiakiThreadPriority priority;
+	uint64_t cpu_mask; // 0 to leave the affinity unchanged
+} ChiakiThreadSchedConfig;
+
+/**
+ * Parse "priority", "priority@cpu_mask" or "@cpu_mask", e.g. "realtime@0x4",
+ * with the priorities as returned by chiaki_thread_priority_string().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_sched_config_parse(ChiakiThreadSchedConfig *config, const char *str);
+
 
 typedef struct chiaki_mutex_t
 {
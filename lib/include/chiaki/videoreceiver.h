@@ -9,6 +9,8 @@
 #include "takion.h"
 #include "frameprocessor.h"
 #include "bitstream.h"
+#include "corruptframereporter.h"
+#include "bitratemeter.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +18,20 @@ extern "C" {
 
 #define CHIAKI_VIDEO_PROFILES_MAX 8
 
+/**
+ * Counters since the start of the stream connection, see chiaki_stream_connection_get_video_stats()
+ */
+typedef struct chiaki_video_receiver_stats_t
+{
+	uint64_t frames; // passed on to the video sample callback
+	uint64_t bytes; // of these frames
+	uint64_t frames_fec_recovered; // complete only thanks to FEC
+	uint64_t frames_incomplete; // passed on to the partial sample callback
+	uint64_t frames_lost; // reported to the sample callbacks through frames_lost
+	ChiakiCorruptFrameStats corrupt_frames; // of the corrupt frame reporter, as of the last frame
+	ChiakiBitrateMeterStats bitrate; // of the bitrate meter, as of the last connection quality report
+} ChiakiVideoReceiverStats;
+
 typedef struct chiaki_video_receiver_t
 {
 	struct chiaki_session_t *session;
@@ -33,9 +49,11 @@ typedef struct chiaki_video_receiver_t
 	int32_t frames_lost;
 	int32_t reference_frames[16];
 	ChiakiBitstream bitstream;
+	ChiakiCorruptFrameReporter corrupt_frame_reporter;
+	ChiakiBitrateMeter bitrate_meter; // of all flushed frames, read by the stream connection on the takion thread
 } ChiakiVideoReceiver;
 
-CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
 CHIAKI_EXPORT void chiaki_video_receiver_fini(ChiakiVideoReceiver *video_receiver);
 
 /**
@@ -54,7 +72,11 @@ static inline ChiakiVideoReceiver *chiaki_video_receiver_new(struct chiaki_sessi
 	ChiakiVideoReceiver *video_receiver = CHIAKI_NEW(ChiakiVideoReceiver);
 	if(!video_receiver)
 		return NULL;
-	chiaki_video_receiver_init(video_receiver, session, packet_stats);
+	if(chiaki_video_receiver_init(video_receiver, session, packet_stats) != CHIAKI_ERR_SUCCESS)
+	{
+		free(video_receiver);
+		return NULL;
+	}
 	return video_receiver;
 }
 
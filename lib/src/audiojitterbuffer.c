@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audiojitterbuffer.h>
+
+#include <string.h>
+
+#define FRAME_DURATION_DEFAULT_US 10000
+#define TARGET_DELAY_JITTER_FACTOR 3
+#define TARGET_DELAY_MAX_FRAMES (CHIAKI_AUDIO_JITTER_BUFFER_SLOTS / 4)
+
+#define SLOT(jb, index) (&(jb)->slots[(index) % CHIAKI_AUDIO_JITTER_BUFFER_SLOTS])
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_jitter_buffer_init(ChiakiAudioJitterBuffer *jb,
+		ChiakiAudioJitterBufferFrameCb frame_cb, ChiakiAudioJitterBufferLostCb lost_cb, void *cb_user)
+{
+	jb->slots = calloc(CHIAKI_AUDIO_JITTER_BUFFER_SLOTS, sizeof(ChiakiAudioJitterBufferSlot));
+	if(!jb->slots)
+		return CHIAKI_ERR_MEMORY;
+	jb->frame_cb = frame_cb;
+	jb->lost_cb = lost_cb;
+	jb->cb_user = cb_user;
+	memset(&jb->stats, 0, sizeof(jb->stats));
+	chiaki_audio_jitter_buffer_set_frame_duration(jb, 0, 0);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_fini(ChiakiAudioJitterBuffer *jb)
+{
+	free(jb->slots);
+}
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_reset(ChiakiAudioJitterBuffer *jb)
+{
+	for(size_t i=0; i<CHIAKI_AUDIO_JITTER_BUFFER_SLOTS; i++)
+	{
+		jb->slots[i].set = false;
+		jb->slots[i].concealed = false;
+	}
+	jb->started = false;
+	jb->next = 0;
+	jb->end = 0;
+	jb->arrival_prev_valid = false;
+	jb->jitter_us_16 = 0;
+	jb->stats.depth = 0;
+	jb->stats.jitter_us = 0;
+	jb->stats.target_delay_us = jb->frame_duration_us;
+}
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_set_frame_duration(ChiakiAudioJitterBuffer *jb, uint32_t rate, uint32_t frame_size)
+{
+	if(rate && frame_size)
+		jb->frame_duration_us = (uint64_t)frame_size * 1000000 / rate;
+	else
+		jb->frame_duration_us = FRAME_DURATION_DEFAULT_US;
+	jb->target_delay_max_us = jb->frame_duration_us * TARGET_DELAY_MAX_FRAMES;
+	chiaki_audio_jitter_buffer_reset(jb);
+}
+
+/**
+ * Play out the frame at jb->next, concealing it if it has not been received
+ */
+static void jitter_buffer_play_next(ChiakiAudioJitterBuffer *jb)
+{
+	ChiakiAudioJitterBufferSlot *slot = SLOT(jb, jb->next);
+	if(slot->set && slot->index == jb->next)
+	{
+		slot->set = false;
+		if(jb->frame_cb)
+			jb->frame_cb(slot->buf, slot->buf_size, jb->cb_user);
+	}
+	else
+	{
+		slot->set = false;
+		slot->concealed = true;
+		slot->index = jb->next;
+
+		ChiakiSeqNum16 fec_index = jb->next + 1;
+		ChiakiAudioJitterBufferSlot *fec_slot = SLOT(jb, fec_index);
+		if(fec_slot->set && fec_slot->index == fec_index)
+		{
+			jb->stats.frames_concealed_fec++;
+			if(jb->lost_cb)
+				jb->lost_cb(fec_slot->buf, fec_slot->buf_size, jb->cb_user);
+		}
+		else
+		{
+			jb->stats.frames_concealed_plc++;
+			if(jb->lost_cb)
+				jb->lost_cb(NULL, 0, jb->cb_user);
+		}
+	}
+
+	if(jb->next == jb->end)
+		jb->end++;
+	jb->next++;
+}
+
+static void jitter_buffer_update_jitter(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 index, uint64_t now_us)
+{
+	if(jb->arrival_prev_valid)
+	{
+		// difference in relative transit time of this and the previous frame
+		int64_t d = (int64_t)(now_us - jb->arrival_prev_us)
+			- (int64_t)(int16_t)(index - jb->index_prev) * (int64_t)jb->frame_duration_us;
+		if(d < 0)
+			d = -d;
+		jb->jitter_us_16 += (uint64_t)d - ((jb->jitter_us_16 + 8) >> 4);
+	}
+	jb->arrival_prev_valid = true;
+	jb->arrival_prev_us = now_us;
+	jb->index_prev = index;
+
+	uint64_t target_delay_us = (jb->jitter_us_16 >> 4) * TARGET_DELAY_JITTER_FACTOR;
+	if(target_delay_us < jb->frame_duration_us)
+		target_delay_us = jb->frame_duration_us;
+	if(target_delay_us > jb->target_delay_max_us)
+		target_delay_us = jb->target_delay_max_us;
+
+	jb->stats.jitter_us = jb->jitter_us_16 >> 4;
+	jb->stats.target_delay_us = target_delay_us;
+}
+
+/**
+ * Play out all frames up to the first gap, and conceal the gap once the frames behind it have waited long enough
+ */
+static void jitter_buffer_drain(ChiakiAudioJitterBuffer *jb, uint64_t now_us)
+{
+	while(jb->next != jb->end)
+	{
+		ChiakiAudioJitterBufferSlot *slot = SLOT(jb, jb->next);
+		if(!slot->set || slot->index != jb->next)
+		{
+			uint64_t oldest_us = now_us;
+			for(ChiakiSeqNum16 i = jb->next + 1; i != jb->end; i++)
+			{
+				ChiakiAudioJitterBufferSlot *s = SLOT(jb, i);
+				if(s->set && s->index == i && s->arrival_us < oldest_us)
+					oldest_us = s->arrival_us;
+			}
+			if(now_us - oldest_us < jb->stats.target_delay_us)
+				break;
+		}
+		jitter_buffer_play_next(jb);
+	}
+
+	jb->stats.depth = (ChiakiSeqNum16)(jb->end - jb->next);
+	if(jb->stats.depth > jb->stats.depth_max)
+		jb->stats.depth_max = jb->stats.depth;
+}
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_push(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 index, uint8_t *buf, size_t buf_size, uint64_t now_us)
+{
+	if(buf_size > CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX)
+		return;
+
+	if(!jb->started)
+	{
+		jb->started = true;
+		jb->next = index;
+		jb->end = index;
+	}
+
+	if(chiaki_seq_num_16_lt(index, jb->next))
+	{
+		ChiakiAudioJitterBufferSlot *slot = SLOT(jb, index);
+		if((ChiakiSeqNum16)(jb->next - index) <= CHIAKI_AUDIO_JITTER_BUFFER_SLOTS
+				&& slot->concealed && slot->index == index)
+		{
+			slot->concealed = false;
+			jb->stats.frames_late++;
+		}
+		else
+			jb->stats.frames_duplicate++;
+		return;
+	}
+
+	if((ChiakiSeqNum16)(index - jb->next) >= 2 * CHIAKI_AUDIO_JITTER_BUFFER_SLOTS)
+	{
+		// too far ahead to be worth concealing everything in between
+		chiaki_audio_jitter_buffer_reset(jb);
+		jb->started = true;
+		jb->next = index;
+		jb->end = index;
+		jb->stats.resyncs++;
+	}
+
+	// make room by giving up on the oldest frames
+	while((ChiakiSeqNum16)(index - jb->next) >= CHIAKI_AUDIO_JITTER_BUFFER_SLOTS)
+		jitter_buffer_play_next(jb);
+
+	ChiakiAudioJitterBufferSlot *slot = SLOT(jb, index);
+	if(slot->set && slot->index == index)
+	{
+		jb->stats.frames_duplicate++;
+		return;
+	}
+
+	memcpy(slot->buf, buf, buf_size);
+	slot->buf_size = buf_size;
+	slot->arrival_us = now_us;
+	slot->index = index;
+	slot->set = true;
+	slot->concealed = false;
+	jb->stats.frames_received++;
+
+	if((ChiakiSeqNum16)(index - jb->next) >= (ChiakiSeqNum16)(jb->end - jb->next))
+		jb->end = index + 1;
+
+	jitter_buffer_update_jitter(jb, index, now_us);
+	jitter_buffer_drain(jb, now_us);
+}
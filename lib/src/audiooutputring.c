@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audiooutputring.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define IN_BUF_FRAMES 512
+
+// time constant of the fill level average, in multiples of the target fill
+#define FILL_AVG_TARGETS 16.0
+// proportional gain, relative speed change per relative deviation from the target fill
+#define CONTROL_P 0.005
+// integral gain per target fill worth of pulled frames, the integral converges to the clock drift
+#define CONTROL_I 0.0002
+
+#define POS_ONE ((uint64_t)1 << 32)
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_output_ring_init(ChiakiAudioOutputRing *ring, size_t channels,
+		size_t target_frames, size_t capacity_frames)
+{
+	if(!channels || !target_frames || capacity_frames < target_frames)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	size_t size_exp = 0;
+	while(((size_t)1 << size_exp) < capacity_frames)
+		size_exp++;
+
+	ChiakiErrorCode err = chiaki_spsc_ring_init(&ring->ring, channels * sizeof(int16_t), size_exp);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	ring->in_buf_frames_max = IN_BUF_FRAMES;
+	ring->in_buf = malloc(ring->in_buf_frames_max * channels * sizeof(int16_t));
+	if(!ring->in_buf)
+	{
+		chiaki_spsc_ring_fini(&ring->ring);
+		return CHIAKI_ERR_MEMORY;
+	}
+
+	ring->channels = channels;
+	ring->target_frames = target_frames;
+	ring->in_count = 0;
+	ring->pos = 0;
+	ring->playing = false;
+	ring->fill_avg = 0.0;
+	ring->drift = 0.0;
+	ring->ratio = 1.0;
+	memset(&ring->stats, 0, sizeof(ring->stats));
+	ring->stats.ratio = 1.0;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_output_ring_fini(ChiakiAudioOutputRing *ring)
+{
+	free(ring->in_buf);
+	chiaki_spsc_ring_fini(&ring->ring);
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_output_ring_push(ChiakiAudioOutputRing *ring, const int16_t *buf, size_t frames)
+{
+	size_t written = chiaki_spsc_ring_write(&ring->ring, buf, frames);
+	ring->stats.frames_pushed += written;
+	ring->stats.frames_overflow += frames - written;
+	return written;
+}
+
+static double clamp_stretch(double v)
+{
+	if(v > CHIAKI_AUDIO_OUTPUT_RING_STRETCH_MAX)
+		return CHIAKI_AUDIO_OUTPUT_RING_STRETCH_MAX;
+	if(v < -CHIAKI_AUDIO_OUTPUT_RING_STRETCH_MAX)
+		return -CHIAKI_AUDIO_OUTPUT_RING_STRETCH_MAX;
+	return v;
+}
+
+/**
+ * Adjust the playback speed so the fill level converges to the target
+ */
+static void output_ring_control(ChiakiAudioOutputRing *ring, size_t fill, size_t frames)
+{
+	double target = (double)ring->target_frames;
+	double alpha = (double)frames / (target * FILL_AVG_TARGETS);
+	if(alpha > 1.0)
+		alpha = 1.0;
+	ring->fill_avg += ((double)fill - ring->fill_avg) * alpha;
+
+	double err = (ring->fill_avg - target) / target;
+	ring->drift = clamp_stretch(ring->drift + err * CONTROL_I * (double)frames / target);
+	ring->ratio = 1.0 + clamp_stretch(ring->drift + err * CONTROL_P);
+
+	ring->stats.ratio = ring->ratio;
+	ring->stats.drift_ppm = ring->drift * 1e6;
+}
+
+/**
+ * Make sure in_buf holds at least the two frames around the current position
+ */
+static bool output_ring_refill(ChiakiAudioOutputRing *ring)
+{
+	size_t idx = (size_t)(ring->pos >> 32);
+	if(idx + 1 < ring->in_count)
+		return true;
+
+	// move the remaining frames to the front
+	if(idx)
+	{
+		size_t keep = idx < ring->in_count ? ring->in_count - idx : 0;
+		memmove(ring->in_buf, ring->in_buf + (ring->in_count - keep) * ring->channels, keep * ring->channels * sizeof(int16_t));
+		ring->in_count = keep;
+		ring->pos -= (uint64_t)idx << 32;
+	}
+
+	ring->in_count += chiaki_spsc_ring_read(&ring->ring,
+			ring->in_buf + ring->in_count * ring->channels, ring->in_buf_frames_max - ring->in_count);
+	return (size_t)(ring->pos >> 32) + 1 < ring->in_count;
+}
+
+CHIAKI_EXPORT void chiaki_audio_output_ring_pull(ChiakiAudioOutputRing *ring, int16_t *out, size_t frames)
+{
+	size_t channels = ring->channels;
+	size_t idx = (size_t)(ring->pos >> 32);
+	size_t fill = chiaki_spsc_ring_count(&ring->ring) + (ring->in_count > idx ? ring->in_count - idx : 0);
+	ring->stats.fill = fill;
+
+	if(!ring->playing)
+	{
+		if(fill < ring->target_frames)
+		{
+			memset(out, 0, frames * channels * sizeof(int16_t));
+			ring->stats.frames_silence += frames;
+			return;
+		}
+		ring->playing = true;
+		ring->fill_avg = (double)fill;
+	}
+
+	output_ring_control(ring, fill, frames);
+	uint64_t step = (uint64_t)(ring->ratio * (double)POS_ONE);
+
+	size_t i;
+	for(i=0; i<frames; i++)
+	{
+		if(!output_ring_refill(ring))
+			break;
+
+		// linear interpolation between the two frames around pos, using a 15 bit fraction to stay within int32
+		const int16_t *a = ring->in_buf + (size_t)(ring->pos >> 32) * channels;
+		const int16_t *b = a + channels;
+		int32_t frac = (int32_t)((ring->pos & (POS_ONE - 1)) >> 17);
+		for(size_t c=0; c<channels; c++)
+			out[c] = (int16_t)(a[c] + ((((int32_t)b[c] - (int32_t)a[c]) * frac) >> 15));
+		out += channels;
+		ring->pos += step;
+	}
+	ring->stats.frames_pulled += i;
+
+	if(i < frames)
+	{
+		// underrun, prebuffer again instead of stuttering on every single frame that trickles in
+		memset(out, 0, (frames - i) * channels * sizeof(int16_t));
+		ring->stats.frames_silence += frames - i;
+		ring->stats.underruns++;
+		ring->playing = false;
+	}
+}
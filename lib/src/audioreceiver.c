@@ -2,10 +2,36 @@
 
 #include <chiaki/audioreceiver.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 
-static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size);
+#define DISPATCH_RING_SIZE_EXP 6
+
+typedef enum audio_receiver_event_type_t
+{
+	AUDIO_RECEIVER_EVENT_HEADER,
+	AUDIO_RECEIVER_EVENT_FRAME,
+	AUDIO_RECEIVER_EVENT_FRAME_LOST,
+	AUDIO_RECEIVER_EVENT_HAPTICS_FRAME
+} AudioReceiverEventType;
+
+/**
+ * Element of the dispatch ring, everything the sink callbacks need
+ */
+typedef struct audio_receiver_event_t
+{
+	AudioReceiverEventType type;
+	ChiakiAudioHeader header;
+	size_t buf_size;
+	bool has_buf;
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+} AudioReceiverEvent;
+
+static void *audio_receiver_dispatch_thread_func(void *user);
+static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size, uint64_t now_us);
+static void chiaki_audio_receiver_jitter_frame(uint8_t *buf, size_t buf_size, void *user);
+static void chiaki_audio_receiver_jitter_lost(uint8_t *fec_buf, size_t fec_buf_size, void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, ChiakiSession *session, ChiakiPacketStats *packet_stats)
 {
@@ -15,26 +41,156 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *au
 
 	audio_receiver->frame_index_prev = 0;
 	audio_receiver->frame_index_startup = true;
+	audio_receiver->dispatch_should_stop = false;
+	audio_receiver->dispatch_pending = false;
+	audio_receiver->dispatch_overflow = false;
+	audio_receiver->events_dropped = 0;
+	memset(&audio_receiver->jitter_stats, 0, sizeof(audio_receiver->jitter_stats));
 
-	ChiakiErrorCode err = chiaki_mutex_init(&audio_receiver->mutex, false);
+	ChiakiErrorCode err = chiaki_mutex_init(&audio_receiver->stats_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
+	err = chiaki_audio_jitter_buffer_init(&audio_receiver->jitter_buffer,
+			chiaki_audio_receiver_jitter_frame, chiaki_audio_receiver_jitter_lost, audio_receiver);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_stats_mutex;
+
+	err = chiaki_spsc_ring_init(&audio_receiver->dispatch_ring, sizeof(AudioReceiverEvent), DISPATCH_RING_SIZE_EXP);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_jitter_buffer;
+
+	err = chiaki_bool_pred_cond_init(&audio_receiver->dispatch_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_dispatch_ring;
+
+	err = chiaki_thread_create(&audio_receiver->dispatch_thread, audio_receiver_dispatch_thread_func, audio_receiver);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_dispatch_cond;
+	chiaki_thread_set_name(&audio_receiver->dispatch_thread, "Chiaki Audio");
+
 	return CHIAKI_ERR_SUCCESS;
+error_dispatch_cond:
+	chiaki_bool_pred_cond_fini(&audio_receiver->dispatch_cond);
+error_dispatch_ring:
+	chiaki_spsc_ring_fini(&audio_receiver->dispatch_ring);
+error_jitter_buffer:
+	chiaki_audio_jitter_buffer_fini(&audio_receiver->jitter_buffer);
+error_stats_mutex:
+	chiaki_mutex_fini(&audio_receiver->stats_mutex);
+	return err;
 }
 
 CHIAKI_EXPORT void chiaki_audio_receiver_fini(ChiakiAudioReceiver *audio_receiver)
 {
-#ifdef CHIAKI_LIB_ENABLE_OPUS
-	opus_decoder_destroy(audio_receiver->opus_decoder);
-#endif
-	chiaki_mutex_fini(&audio_receiver->mutex);
+	chiaki_bool_pred_cond_lock(&audio_receiver->dispatch_cond);
+	audio_receiver->dispatch_should_stop = true;
+	chiaki_bool_pred_cond_unlock(&audio_receiver->dispatch_cond);
+	chiaki_bool_pred_cond_signal(&audio_receiver->dispatch_cond);
+	chiaki_thread_join(&audio_receiver->dispatch_thread, NULL);
+
+	if(audio_receiver->events_dropped)
+		CHIAKI_LOGW(audio_receiver->log, "Audio Receiver dropped %llu events because the sink was too slow",
+				(unsigned long long)audio_receiver->events_dropped);
+
+	chiaki_bool_pred_cond_fini(&audio_receiver->dispatch_cond);
+	chiaki_spsc_ring_fini(&audio_receiver->dispatch_ring);
+	chiaki_audio_jitter_buffer_fini(&audio_receiver->jitter_buffer);
+	chiaki_mutex_fini(&audio_receiver->stats_mutex);
 }
 
-CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_receiver, ChiakiAudioHeader *audio_header)
+/**
+ * Reserve the next event in the dispatch ring, called only from the receiving thread
+ *
+ * @return NULL if the dispatch thread is too far behind, in which case the event is dropped
+ */
+static AudioReceiverEvent *audio_receiver_event_begin(ChiakiAudioReceiver *audio_receiver, AudioReceiverEventType type)
 {
-	chiaki_mutex_lock(&audio_receiver->mutex);
+	AudioReceiverEvent *event = chiaki_spsc_ring_write_begin(&audio_receiver->dispatch_ring);
+	if(!event)
+	{
+		if(!audio_receiver->dispatch_overflow)
+			CHIAKI_LOGW(audio_receiver->log, "Audio Receiver dispatch ring overflow, dropping audio");
+		audio_receiver->dispatch_overflow = true;
+		audio_receiver->events_dropped++;
+		return NULL;
+	}
+	audio_receiver->dispatch_overflow = false;
+	event->type = type;
+	return event;
+}
+
+static void audio_receiver_event_commit(ChiakiAudioReceiver *audio_receiver)
+{
+	chiaki_spsc_ring_write_commit(&audio_receiver->dispatch_ring);
+	audio_receiver->dispatch_pending = true;
+}
+
+/**
+ * Wake up the dispatch thread if anything was committed since the last call
+ */
+static void audio_receiver_dispatch_flush(ChiakiAudioReceiver *audio_receiver)
+{
+	if(!audio_receiver->dispatch_pending)
+		return;
+	audio_receiver->dispatch_pending = false;
+	chiaki_bool_pred_cond_signal(&audio_receiver->dispatch_cond);
+}
+
+static void audio_receiver_dispatch_event(ChiakiAudioReceiver *audio_receiver, AudioReceiverEvent *event)
+{
+	ChiakiAudioSink *sink = &audio_receiver->session->audio_sink;
+	switch(event->type)
+	{
+		case AUDIO_RECEIVER_EVENT_HEADER:
+			if(sink->header_cb)
+				sink->header_cb(&event->header, sink->user);
+			break;
+		case AUDIO_RECEIVER_EVENT_FRAME:
+			if(sink->frame_cb)
+				sink->frame_cb(event->buf, event->buf_size, sink->user);
+			break;
+		case AUDIO_RECEIVER_EVENT_FRAME_LOST:
+			if(sink->frame_lost_cb)
+				sink->frame_lost_cb(event->has_buf ? event->buf : NULL, event->buf_size, sink->user);
+			break;
+		case AUDIO_RECEIVER_EVENT_HAPTICS_FRAME:
+			sink = &audio_receiver->session->haptics_sink;
+			if(sink->frame_cb)
+				sink->frame_cb(event->buf, event->buf_size, sink->user);
+			break;
+	}
+}
 
+/**
+ * Runs all sink callbacks, so decoding and audio output never hold up the receiving thread
+ */
+static void *audio_receiver_dispatch_thread_func(void *user)
+{
+	ChiakiAudioReceiver *audio_receiver = user;
+	while(true)
+	{
+		chiaki_bool_pred_cond_lock(&audio_receiver->dispatch_cond);
+		chiaki_bool_pred_cond_wait(&audio_receiver->dispatch_cond);
+		audio_receiver->dispatch_cond.pred = false;
+		bool should_stop = audio_receiver->dispatch_should_stop;
+		chiaki_bool_pred_cond_unlock(&audio_receiver->dispatch_cond);
+
+		if(should_stop)
+			break;
+
+		AudioReceiverEvent *event;
+		while((event = chiaki_spsc_ring_read_begin(&audio_receiver->dispatch_ring)))
+		{
+			audio_receiver_dispatch_event(audio_receiver, event);
+			chiaki_spsc_ring_read_commit(&audio_receiver->dispatch_ring);
+		}
+	}
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_receiver, ChiakiAudioHeader *audio_header)
+{
 	CHIAKI_LOGI(audio_receiver->log, "Audio Header:");
 	CHIAKI_LOGI(audio_receiver->log, "  channels = %d", audio_header->channels);
 	CHIAKI_LOGI(audio_receiver->log, "  bits = %d", audio_header->bits);
@@ -42,10 +198,15 @@ CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_
 	CHIAKI_LOGI(audio_receiver->log, "  frame size = %d", audio_header->frame_size);
 	CHIAKI_LOGI(audio_receiver->log, "  unknown = %d", audio_header->unknown);
 
-	if(audio_receiver->session->audio_sink.header_cb)
-		audio_receiver->session->audio_sink.header_cb(audio_header, audio_receiver->session->audio_sink.user);
+	chiaki_audio_jitter_buffer_set_frame_duration(&audio_receiver->jitter_buffer, audio_header->rate, audio_header->frame_size);
 
-	chiaki_mutex_unlock(&audio_receiver->mutex);
+	AudioReceiverEvent *event = audio_receiver_event_begin(audio_receiver, AUDIO_RECEIVER_EVENT_HEADER);
+	if(event)
+	{
+		event->header = *audio_header;
+		audio_receiver_event_commit(audio_receiver);
+	}
+	audio_receiver_dispatch_flush(audio_receiver);
 }
 
 CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_receiver, ChiakiTakionAVPacket *packet)
@@ -85,6 +246,8 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 	if(packet->frame_index > (1 << 15))
 		audio_receiver->frame_index_startup = false;
 
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+
 	for(size_t i = 0; i < source_units_count + fec_units_count; i++)
 	{
 		ChiakiSeqNum16 frame_index;
@@ -102,26 +265,71 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 			frame_index = packet->frame_index - fec_units_count + fec_index;
 		}
 
-		chiaki_audio_receiver_frame(audio_receiver, frame_index, packet->is_haptics, packet->data + unit_size * i, unit_size);
+		chiaki_audio_receiver_frame(audio_receiver, frame_index, packet->is_haptics, packet->data + unit_size * i, unit_size, now_us);
+	}
+
+	audio_receiver_dispatch_flush(audio_receiver);
+
+	// publish the stats without ever waiting for a reader
+	if(chiaki_mutex_trylock(&audio_receiver->stats_mutex) == CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_audio_jitter_buffer_get_stats(&audio_receiver->jitter_buffer, &audio_receiver->jitter_stats);
+		chiaki_mutex_unlock(&audio_receiver->stats_mutex);
 	}
 
 	if(audio_receiver->packet_stats)
 		chiaki_packet_stats_push_seq(audio_receiver->packet_stats, packet->frame_index);
 }
 
-static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size)
+CHIAKI_EXPORT void chiaki_audio_receiver_get_jitter_stats(ChiakiAudioReceiver *audio_receiver, ChiakiAudioJitterBufferStats *stats)
 {
-	chiaki_mutex_lock(&audio_receiver->mutex);
+	chiaki_mutex_lock(&audio_receiver->stats_mutex);
+	*stats = audio_receiver->jitter_stats;
+	chiaki_mutex_unlock(&audio_receiver->stats_mutex);
+}
+
+static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size, uint64_t now_us)
+{
+	if(!is_haptics)
+	{
+		chiaki_audio_jitter_buffer_push(&audio_receiver->jitter_buffer, frame_index, buf, buf_size, now_us);
+		return;
+	}
 
 	if(!chiaki_seq_num_16_gt(frame_index, audio_receiver->frame_index_prev))
-		goto beach;
+		return;
 	audio_receiver->frame_index_prev = frame_index;
 
-	if(is_haptics && audio_receiver->session->haptics_sink.frame_cb)
-		audio_receiver->session->haptics_sink.frame_cb(buf, buf_size, audio_receiver->session->haptics_sink.user);
-	else if(!is_haptics && audio_receiver->session->audio_sink.frame_cb)
-		audio_receiver->session->audio_sink.frame_cb(buf, buf_size, audio_receiver->session->audio_sink.user);
+	if(buf_size > sizeof(((AudioReceiverEvent *)NULL)->buf))
+		return;
+	AudioReceiverEvent *event = audio_receiver_event_begin(audio_receiver, AUDIO_RECEIVER_EVENT_HAPTICS_FRAME);
+	if(!event)
+		return;
+	memcpy(event->buf, buf, buf_size);
+	event->buf_size = buf_size;
+	audio_receiver_event_commit(audio_receiver);
+}
+
+static void chiaki_audio_receiver_jitter_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	ChiakiAudioReceiver *audio_receiver = user;
+	AudioReceiverEvent *event = audio_receiver_event_begin(audio_receiver, AUDIO_RECEIVER_EVENT_FRAME);
+	if(!event)
+		return;
+	memcpy(event->buf, buf, buf_size);
+	event->buf_size = buf_size;
+	audio_receiver_event_commit(audio_receiver);
+}
 
-beach:
-	chiaki_mutex_unlock(&audio_receiver->mutex);
+static void chiaki_audio_receiver_jitter_lost(uint8_t *fec_buf, size_t fec_buf_size, void *user)
+{
+	ChiakiAudioReceiver *audio_receiver = user;
+	AudioReceiverEvent *event = audio_receiver_event_begin(audio_receiver, AUDIO_RECEIVER_EVENT_FRAME_LOST);
+	if(!event)
+		return;
+	event->has_buf = fec_buf != NULL;
+	if(fec_buf)
+		memcpy(event->buf, fec_buf, fec_buf_size);
+	event->buf_size = fec_buf_size;
+	audio_receiver_event_commit(audio_receiver);
 }
@@ -5,121 +5,236 @@
 #include <stdlib.h>
 #include <chiaki/fec.h>
 
-static void chiaki_audio_sender_frame(ChiakiAudioSender *audio_sender, uint8_t *buf, size_t buf_size);
+#define AUDIO_PACKET_TYPE 3 // TAKION_PACKET_TYPE_AUDIO
+#define AUDIO_CODEC_OPUS 5
+
+static ChiakiErrorCode audio_sender_send_takion(uint8_t *buf, size_t buf_size, void *user);
+static void audio_sender_send_packet(ChiakiAudioSender *audio_sender);
+
+CHIAKI_EXPORT void chiaki_audio_sender_config_default(ChiakiAudioSenderConfig *config)
+{
+    config->redundancy = CHIAKI_AUDIO_SENDER_REDUNDANCY_REPEAT;
+    config->fec_units = 2;
+    config->frames_per_packet = 1;
+    config->parity_frames = 4;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_sender_init(ChiakiAudioSender *audio_sender, ChiakiLog *log, ChiakiSession *session)
 {
     audio_sender->log = log;
     audio_sender->ps5 = session->connect_info.ps5;
     audio_sender->takion = &(session->stream_connection.takion);
-    audio_sender->frame_index = 0;
-    audio_sender->buf_size_per_unit = 40;
-    audio_sender->buf_stride_per_unit = ((audio_sender->buf_size_per_unit + 0xf) / 0x10) * 0x10;
-    audio_sender->framea = NULL;
-    audio_sender->frameb = NULL;
-    audio_sender->frame_buf_size = 3 * audio_sender->buf_size_per_unit;
-    audio_sender->frame_buf = malloc(audio_sender->frame_buf_size);
-    if(!audio_sender->frame_buf)
-        return CHIAKI_ERR_MEMORY;
-    audio_sender->filled_packet_buf = malloc(audio_sender->frame_buf_size + 20);
-    if(!audio_sender->filled_packet_buf)
+    audio_sender->packet_cb = audio_sender_send_takion;
+    audio_sender->packet_cb_user = audio_sender;
+    chiaki_audio_sender_config_default(&audio_sender->config);
+    audio_sender->history_pos = 0;
+    audio_sender->history_count = 0;
+    audio_sender->frames_pending = 0;
+    audio_sender->packet_index = 0;
+    audio_sender->frame_index = 1;
+    memset(&audio_sender->stats, 0, sizeof(audio_sender->stats));
+
+    // everything is sized for the largest config, so changing it never allocates
+    audio_sender->history = malloc(CHIAKI_AUDIO_SENDER_HISTORY_SIZE * CHIAKI_AUDIO_SENDER_UNIT_SIZE);
+    if(!audio_sender->history)
         return CHIAKI_ERR_MEMORY;
+    audio_sender->packet_buf = malloc(CHIAKI_AUDIO_SENDER_HEADER_SIZE_MAX
+            + (CHIAKI_AUDIO_SENDER_FRAMES_PER_PACKET_MAX + CHIAKI_AUDIO_SENDER_FEC_UNITS_MAX) * CHIAKI_AUDIO_SENDER_UNIT_SIZE);
+    if(!audio_sender->packet_buf)
+        goto error_history;
+    audio_sender->silence_unit = calloc(1, CHIAKI_AUDIO_SENDER_UNIT_SIZE);
+    if(!audio_sender->silence_unit)
+        goto error_packet_buf;
+    memset(&audio_sender->fec_encoder, 0, sizeof(audio_sender->fec_encoder));
+    audio_sender->fec_encoder_valid = false;
 
     ChiakiErrorCode err = chiaki_mutex_init(&audio_sender->mutex, false);
     if(err != CHIAKI_ERR_SUCCESS)
-        return err;
+        goto error_silence_unit;
 
     return CHIAKI_ERR_SUCCESS;
+error_silence_unit:
+    free(audio_sender->silence_unit);
+error_packet_buf:
+    free(audio_sender->packet_buf);
+error_history:
+    free(audio_sender->history);
+    return CHIAKI_ERR_MEMORY;
 }
 
 CHIAKI_EXPORT void chiaki_audio_sender_fini(ChiakiAudioSender *audio_sender)
 {
-#ifdef CHIAKI_LIB_ENABLE_OPUS
-	opus_encoder_destroy(audio_sender->opus_decoder);
-#endif
-    free(audio_sender->frame_buf);
-    free(audio_sender->filled_packet_buf);
-    if(audio_sender->framea)
-        free(audio_sender->framea);
-    if(audio_sender->frameb)
-        free(audio_sender->frameb);
+    free(audio_sender->history);
+    free(audio_sender->packet_buf);
+    free(audio_sender->silence_unit);
+    if(audio_sender->fec_encoder_valid)
+        chiaki_fec_encoder_fini(&audio_sender->fec_encoder);
     chiaki_mutex_fini(&audio_sender->mutex);
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_sender_set_config(ChiakiAudioSender *audio_sender, const ChiakiAudioSenderConfig *config)
+{
+    if(config->fec_units > CHIAKI_AUDIO_SENDER_FEC_UNITS_MAX
+            || config->frames_per_packet < 1 || config->frames_per_packet > CHIAKI_AUDIO_SENDER_FRAMES_PER_PACKET_MAX)
+        return CHIAKI_ERR_INVALID_DATA;
+    if(config->redundancy == CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY
+            && (config->parity_frames < config->frames_per_packet || config->parity_frames > CHIAKI_AUDIO_SENDER_PARITY_FRAMES_MAX))
+        return CHIAKI_ERR_INVALID_DATA;
+
+    // the coding matrix is only built here, never while sending
+    ChiakiFecEncoder fec_encoder;
+    bool fec_encoder_valid = config->redundancy == CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY && config->fec_units;
+    if(fec_encoder_valid)
+    {
+        ChiakiErrorCode err = chiaki_fec_encoder_init(&fec_encoder, config->parity_frames, config->fec_units, CHIAKI_AUDIO_SENDER_UNIT_SIZE, NULL);
+        if(err != CHIAKI_ERR_SUCCESS)
+            return err;
+    }
+
+    chiaki_mutex_lock(&audio_sender->mutex);
+    audio_sender->config = *config;
+    audio_sender->frames_pending = 0;
+    ChiakiFecEncoder fec_encoder_old = audio_sender->fec_encoder;
+    bool fec_encoder_old_valid = audio_sender->fec_encoder_valid;
+    if(fec_encoder_valid)
+        audio_sender->fec_encoder = fec_encoder;
+    audio_sender->fec_encoder_valid = fec_encoder_valid;
+    chiaki_mutex_unlock(&audio_sender->mutex);
+
+    if(fec_encoder_old_valid)
+        chiaki_fec_encoder_fini(&fec_encoder_old);
+    return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_sender_set_packet_cb(ChiakiAudioSender *audio_sender, ChiakiAudioSenderPacketCb cb, void *user)
+{
+    chiaki_mutex_lock(&audio_sender->mutex);
+    audio_sender->packet_cb = cb;
+    audio_sender->packet_cb_user = user;
+    chiaki_mutex_unlock(&audio_sender->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_audio_sender_get_stats(ChiakiAudioSender *audio_sender, ChiakiAudioSenderStats *stats)
+{
+    chiaki_mutex_lock(&audio_sender->mutex);
+    *stats = audio_sender->stats;
+    chiaki_mutex_unlock(&audio_sender->mutex);
+}
+
 CHIAKI_EXPORT void chiaki_audio_sender_opus_data(ChiakiAudioSender *audio_sender, uint8_t *opus_sender, size_t opus_sender_size)
 {
+    chiaki_mutex_lock(&audio_sender->mutex);
     // skip audio packets without encoded audio
     // if no audio the packet will have only 3 encoded units because there is no entropy in the packet, otherwise should be max of 40
-    if(opus_sender_size != audio_sender->buf_size_per_unit)
-        return;
-    uint8_t packet_type = 3; // TAKION_PACKET_TYPE_AUDIO
-    uint16_t packet_index = htons(audio_sender->frame_index);
-    uint16_t frame_index = htons(audio_sender->frame_index + 1);
+    if(opus_sender_size != CHIAKI_AUDIO_SENDER_UNIT_SIZE)
+    {
+        audio_sender->stats.frames_dropped++;
+        goto beach;
+    }
+
+    memcpy(audio_sender->history + audio_sender->history_pos * CHIAKI_AUDIO_SENDER_UNIT_SIZE, opus_sender, opus_sender_size);
+    audio_sender->history_pos = (audio_sender->history_pos + 1) % CHIAKI_AUDIO_SENDER_HISTORY_SIZE;
+    if(audio_sender->history_count < CHIAKI_AUDIO_SENDER_HISTORY_SIZE)
+        audio_sender->history_count++;
+    audio_sender->frames_pending++;
+
+    if(audio_sender->frames_pending >= audio_sender->config.frames_per_packet)
+    {
+        audio_sender_send_packet(audio_sender);
+        audio_sender->frames_pending = 0;
+    }
+beach:
+    chiaki_mutex_unlock(&audio_sender->mutex);
+}
+
+/**
+ * @param age 0 for the newest frame
+ * @return the frame or NULL if it is not in the history (yet)
+ */
+static uint8_t *audio_sender_history_frame(ChiakiAudioSender *audio_sender, size_t age)
+{
+    if(age >= audio_sender->history_count)
+        return NULL;
+    size_t i = (audio_sender->history_pos + CHIAKI_AUDIO_SENDER_HISTORY_SIZE - 1 - age) % CHIAKI_AUDIO_SENDER_HISTORY_SIZE;
+    return audio_sender->history + i * CHIAKI_AUDIO_SENDER_UNIT_SIZE;
+}
+
+static void audio_sender_write_parity(ChiakiAudioSender *audio_sender, uint8_t *dst)
+{
+    size_t k = audio_sender->config.parity_frames;
+    size_t m = audio_sender->config.fec_units;
+    uint8_t *data[CHIAKI_AUDIO_SENDER_PARITY_FRAMES_MAX];
+    uint8_t *coding[CHIAKI_AUDIO_SENDER_FEC_UNITS_MAX];
+
+    // oldest frame first, frames from before the stream started are silence
+    for(size_t i=0; i<k; i++)
+    {
+        uint8_t *frame = audio_sender_history_frame(audio_sender, k - 1 - i);
+        data[i] = frame ? frame : audio_sender->silence_unit;
+    }
+    for(size_t i=0; i<m; i++)
+        coding[i] = dst + i * CHIAKI_AUDIO_SENDER_UNIT_SIZE;
+
+    chiaki_fec_encoder_encode_units(&audio_sender->fec_encoder, data, coding);
+}
+
+static void audio_sender_send_packet(ChiakiAudioSender *audio_sender)
+{
+    const size_t unit_size = CHIAKI_AUDIO_SENDER_UNIT_SIZE;
+    size_t sources = audio_sender->config.frames_per_packet;
+    size_t fec = audio_sender->config.fec_units;
+    size_t header_size = 19 + (audio_sender->ps5 ? 1 : 0);
+    uint8_t *buf = audio_sender->packet_buf;
+
     uint32_t unit_index = 0;
-    uint32_t units_in_frame_total = 3;
-    uint32_t units_in_frame_fec_raw = 10273;
-    uint32_t units_number = htonl((units_in_frame_fec_raw & 0xffff) | (((units_in_frame_total - 1) & 0xff) << 0x10) | ((unit_index & 0xff) << 0x18));
-    uint32_t key_pos = htonl(0);
-    uint8_t codec = 5;
-    uint32_t gmac = htonl(0);
-    uint8_t zero_byte = 0;
-    bool is_ps5 = audio_sender->ps5;
-    uint8_t ps5_packet = 0;
-    if(is_ps5)
-        ps5_packet = 1;
-
-    if(!audio_sender->frameb)
+    uint32_t units_in_frame_total = sources + fec;
+    uint32_t units_in_frame_fec = (unit_size << 8) | ((fec & 0xf) << 4) | (sources & 0xf);
+    buf[0] = AUDIO_PACKET_TYPE;
+    *(chiaki_unaligned_uint16_t *)(buf + 1) = htons(audio_sender->packet_index);
+    *(chiaki_unaligned_uint16_t *)(buf + 3) = htons(audio_sender->frame_index);
+    *(chiaki_unaligned_uint32_t *)(buf + 5) = htonl((units_in_frame_fec & 0xffff) | (((units_in_frame_total - 1) & 0xff) << 0x10) | ((unit_index & 0xff) << 0x18));
+    buf[9] = AUDIO_CODEC_OPUS;
+    *(chiaki_unaligned_uint32_t *)(buf + 10) = 0; // gmac, filled in when sending
+    *(chiaki_unaligned_uint32_t *)(buf + 14) = 0; // key pos, same
+    buf[18] = 0;
+    if(audio_sender->ps5)
+        buf[19] = 0;
+
+    uint8_t *unit = buf + header_size;
+    for(size_t i=0; i<sources; i++, unit += unit_size)
+        memcpy(unit, audio_sender_history_frame(audio_sender, sources - 1 - i), unit_size);
+
+    if(audio_sender->config.redundancy == CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY)
     {
-        audio_sender->frameb = malloc(audio_sender->buf_size_per_unit);
-        if(!audio_sender->frameb)
-        {
-            CHIAKI_LOGE(audio_sender->log, "Error allocating audio frameb");
-            return;
-        }
-        memcpy(audio_sender->frameb, opus_sender, opus_sender_size);
-        return;
+        if(audio_sender->fec_encoder_valid)
+            audio_sender_write_parity(audio_sender, unit);
     }
-    if(!audio_sender->framea)
+    else
     {
-        audio_sender->framea = malloc(audio_sender->buf_size_per_unit);
-        if(!audio_sender->framea)
+        // frames frame_index - fec ... frame_index - 1, the first source frame stands in for those
+        // from before the stream started, which the receiver knows to ignore
+        uint8_t *first = audio_sender_history_frame(audio_sender, sources - 1);
+        for(size_t i=0; i<fec; i++, unit += unit_size)
         {
-            CHIAKI_LOGE(audio_sender->log, "Error allocating audio framea");
-            return;
+            uint8_t *frame = audio_sender_history_frame(audio_sender, sources + fec - 1 - i);
+            memcpy(unit, frame ? frame : first, unit_size);
         }
-        memcpy(audio_sender->framea, opus_sender, opus_sender_size);
-        return;
     }
-    memcpy(audio_sender->frame_buf, audio_sender->frameb, audio_sender->buf_size_per_unit);
-    memcpy(audio_sender->frame_buf + audio_sender->buf_size_per_unit, audio_sender->framea, audio_sender->buf_size_per_unit);
-    memcpy(audio_sender->frame_buf + 2 * audio_sender->buf_size_per_unit, opus_sender, opus_sender_size);
-    memcpy(audio_sender->frame_buf, opus_sender, opus_sender_size);
-    memcpy(audio_sender->framea, opus_sender, opus_sender_size);
-    memcpy(audio_sender->frameb, audio_sender->framea, audio_sender->buf_size_per_unit);
-
-    uint32_t filled_packet_size = audio_sender->frame_buf_size + 19 + ps5_packet;
-
-    audio_sender->filled_packet_buf[0] = packet_type;
-    *(chiaki_unaligned_uint16_t *)(audio_sender->filled_packet_buf + 1) = packet_index;
-    *(chiaki_unaligned_uint16_t *)(audio_sender->filled_packet_buf + 3) = frame_index;
-    *(chiaki_unaligned_uint32_t *)(audio_sender->filled_packet_buf + 5) = units_number;
-    audio_sender->filled_packet_buf[9] = codec;
-    *(chiaki_unaligned_uint32_t *)(audio_sender->filled_packet_buf + 10) = gmac;
-    *(chiaki_unaligned_uint32_t *)(audio_sender->filled_packet_buf + 14) = key_pos;
-    audio_sender->filled_packet_buf[18] = zero_byte;
-    if(is_ps5)
-        audio_sender->filled_packet_buf[19] = zero_byte;
-    memcpy(audio_sender->filled_packet_buf + 19 + ps5_packet, audio_sender->frame_buf, audio_sender->frame_buf_size);
-	chiaki_audio_sender_frame(audio_sender, audio_sender->filled_packet_buf, filled_packet_size);
-    return;
+
+    ChiakiErrorCode err = audio_sender->packet_cb(buf, header_size + units_in_frame_total * unit_size, audio_sender->packet_cb_user);
+    if(err != CHIAKI_ERR_SUCCESS)
+        audio_sender->stats.send_errors++;
+    else
+    {
+        audio_sender->stats.packets_sent++;
+        audio_sender->stats.frames_sent += sources;
+    }
+    audio_sender->packet_index++;
+    audio_sender->frame_index += sources;
 }
 
-static void chiaki_audio_sender_frame(ChiakiAudioSender *audio_sender, uint8_t *buf, size_t buf_size)
+static ChiakiErrorCode audio_sender_send_takion(uint8_t *buf, size_t buf_size, void *user)
 {
-	chiaki_mutex_lock(&audio_sender->mutex);
-	chiaki_takion_send_mic_packet(audio_sender->takion, buf, buf_size, audio_sender->ps5);
-    if (audio_sender->frame_index == UINT16_MAX)
-        audio_sender->frame_index = 0;
-    else
-        audio_sender->frame_index++;
-    chiaki_mutex_unlock(&audio_sender->mutex);
+    ChiakiAudioSender *audio_sender = user;
+    return chiaki_takion_send_mic_packet(audio_sender->takion, buf, buf_size, audio_sender->ps5);
 }
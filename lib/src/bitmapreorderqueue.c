@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/bitmapreorderqueue.h>
+
+#include <assert.h>
+#include <string.h>
+
+#define QUEUE_SIZE (((uint64_t)1) << queue->size_exp)
+#define IDX_MASK (QUEUE_SIZE - 1)
+#define idx(seq_num) ((size_t)((seq_num) & IDX_MASK))
+#define BITMAP_WORDS(size_exp) (((((size_t)1) << (size_exp)) + 63) / 64)
+
+#define SEQ_NUM_MASK_16 ((uint64_t)0xffff)
+#define SEQ_NUM_MASK_32 ((uint64_t)0xffffffff)
+
+static inline unsigned int ctz64(uint64_t v)
+{
+	assert(v);
+#if defined(__GNUC__)
+	return (unsigned int)__builtin_ctzll(v);
+#else
+	unsigned int r = 0;
+	while(!(v & 1))
+	{
+		v >>= 1;
+		r++;
+	}
+	return r;
+#endif
+}
+
+static inline bool bit_get(ChiakiBitmapReorderQueue *queue, size_t i)
+{
+	return (queue->bitmap[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void bit_set(ChiakiBitmapReorderQueue *queue, size_t i)
+{
+	queue->bitmap[i >> 6] |= ((uint64_t)1) << (i & 63);
+}
+
+static inline void bit_clear(ChiakiBitmapReorderQueue *queue, size_t i)
+{
+	queue->bitmap[i >> 6] &= ~(((uint64_t)1) << (i & 63));
+}
+
+static ChiakiErrorCode bitmap_reorder_queue_init(ChiakiBitmapReorderQueue *queue, size_t size_exp, uint64_t seq_num_start, unsigned int seq_num_bits)
+{
+	if(size_exp >= seq_num_bits)
+		return CHIAKI_ERR_INVALID_DATA;
+	queue->size_exp = size_exp;
+	queue->begin = seq_num_start;
+	queue->count = 0;
+	queue->seq_num_bits = seq_num_bits;
+	queue->drop_strategy = CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END;
+	queue->drop_cb = NULL;
+	queue->drop_cb_user = NULL;
+	queue->users = calloc(((size_t)1) << size_exp, sizeof(void *));
+	if(!queue->users)
+		return CHIAKI_ERR_MEMORY;
+	queue->bitmap = calloc(BITMAP_WORDS(size_exp), sizeof(uint64_t));
+	if(!queue->bitmap)
+	{
+		free(queue->users);
+		return CHIAKI_ERR_MEMORY;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_bitmap_reorder_queue_init_16(ChiakiBitmapReorderQueue *queue, size_t size_exp, ChiakiSeqNum16 seq_num_start)
+{
+	return bitmap_reorder_queue_init(queue, size_exp, seq_num_start, 16);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_bitmap_reorder_queue_init_32(ChiakiBitmapReorderQueue *queue, size_t size_exp, ChiakiSeqNum32 seq_num_start)
+{
+	return bitmap_reorder_queue_init(queue, size_exp, seq_num_start, 32);
+}
+
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_fini(ChiakiBitmapReorderQueue *queue)
+{
+	if(queue->drop_cb)
+	{
+		uint64_t seq_num_mask = queue->seq_num_bits == 16 ? SEQ_NUM_MASK_16 : SEQ_NUM_MASK_32;
+		for(size_t w=0; w<BITMAP_WORDS(queue->size_exp); w++)
+		{
+			uint64_t word = queue->bitmap[w];
+			while(word)
+			{
+				size_t i = w * 64 + ctz64(word);
+				word &= word - 1;
+				// seq num of slot i is the one in [begin, begin + count) with the same index
+				uint64_t seq_num = (queue->begin + ((i - idx(queue->begin)) & IDX_MASK)) & seq_num_mask;
+				queue->drop_cb(seq_num, queue->users[i], queue->drop_cb_user);
+			}
+		}
+	}
+	free(queue->bitmap);
+	free(queue->users);
+}
+
+/**
+ * Number of subsequently set slots starting at index i, at most max
+ */
+static inline size_t run_length(ChiakiBitmapReorderQueue *queue, size_t i, size_t max)
+{
+	size_t run = 0;
+	while(run < max)
+	{
+		size_t bit = i & 63;
+		size_t avail = 64 - bit;
+		if(avail > QUEUE_SIZE - i)
+			avail = (size_t)(QUEUE_SIZE - i);
+		uint64_t zeros = ~(queue->bitmap[i >> 6] >> bit);
+		size_t ones = zeros ? ctz64(zeros) : 64;
+		if(ones > avail)
+			ones = avail;
+		if(ones > max - run)
+			ones = max - run;
+		run += ones;
+		if(ones < avail)
+			break;
+		i = (i + ones) & IDX_MASK;
+	}
+	return run;
+}
+
+static inline void drop_begin(ChiakiBitmapReorderQueue *queue, uint64_t seq_num_mask)
+{
+	size_t i = idx(queue->begin);
+	if(bit_get(queue, i))
+	{
+		bit_clear(queue, i);
+		if(queue->drop_cb)
+			queue->drop_cb(queue->begin, queue->users[i], queue->drop_cb_user);
+	}
+	queue->begin = (queue->begin + 1) & seq_num_mask;
+	queue->count--;
+}
+
+static inline void push_impl(ChiakiBitmapReorderQueue *queue, uint64_t seq_num, void *user, uint64_t seq_num_mask)
+{
+	assert(queue->count <= QUEUE_SIZE);
+	seq_num &= seq_num_mask;
+
+	// distance from begin, everything in the upper half of the sequence number space is before begin
+	uint64_t dist = (seq_num - queue->begin) & seq_num_mask;
+	if(dist < queue->count)
+	{
+		size_t i = idx(seq_num);
+		if(bit_get(queue, i)) // received twice
+			goto drop_it;
+		queue->users[i] = user;
+		bit_set(queue, i);
+		return;
+	}
+
+	if(dist > (seq_num_mask >> 1))
+		goto drop_it;
+
+	if(dist >= QUEUE_SIZE)
+	{
+		if(queue->drop_strategy == CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END)
+			goto drop_it;
+
+		// drop first until empty or enough space
+		uint64_t shift = dist + 1 - QUEUE_SIZE;
+		while(queue->count > 0 && shift > 0)
+		{
+			drop_begin(queue, seq_num_mask);
+			shift--;
+			dist--;
+		}
+
+		// empty, just shift to the seq_num
+		if(queue->count == 0)
+		{
+			queue->begin = seq_num;
+			dist = 0;
+		}
+	}
+
+	// slots between the old and the new end are already clear in the bitmap
+	queue->count = dist + 1;
+	assert(queue->count <= QUEUE_SIZE);
+
+	size_t i = idx(seq_num);
+	queue->users[i] = user;
+	bit_set(queue, i);
+	return;
+drop_it:
+	if(queue->drop_cb)
+		queue->drop_cb(seq_num, user, queue->drop_cb_user);
+}
+
+static inline bool pull_impl(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **user, uint64_t seq_num_mask)
+{
+	assert(queue->count <= QUEUE_SIZE);
+	if(queue->count == 0)
+		return false;
+
+	size_t i = idx(queue->begin);
+	if(!bit_get(queue, i))
+		return false;
+	bit_clear(queue, i);
+
+	if(seq_num)
+		*seq_num = queue->begin;
+	if(user)
+		*user = queue->users[i];
+	queue->begin = (queue->begin + 1) & seq_num_mask;
+	queue->count--;
+	return true;
+}
+
+static inline size_t pull_all_impl(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **users, size_t users_max, uint64_t seq_num_mask)
+{
+	assert(queue->count <= QUEUE_SIZE);
+	size_t max = queue->count < users_max ? (size_t)queue->count : users_max;
+	size_t i = idx(queue->begin);
+	size_t run = run_length(queue, i, max);
+	if(!run)
+		return 0;
+
+	if(seq_num)
+		*seq_num = queue->begin;
+
+	// copy and clear the run, split in two where it wraps around the end of the array
+	size_t first = run;
+	if(first > QUEUE_SIZE - i)
+		first = (size_t)(QUEUE_SIZE - i);
+	memcpy(users, queue->users + i, first * sizeof(void *));
+	memcpy(users + first, queue->users, (run - first) * sizeof(void *));
+	for(size_t k=0; k<run; k++)
+		bit_clear(queue, (i + k) & IDX_MASK);
+
+	queue->begin = (queue->begin + run) & seq_num_mask;
+	queue->count -= run;
+	return run;
+}
+
+#define BITMAP_REORDER_QUEUE_SPECIALIZE(bits) \
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_push_##bits(ChiakiBitmapReorderQueue *queue, ChiakiSeqNum##bits seq_num, void *user) \
+{ \
+	assert(queue->seq_num_bits == bits); \
+	push_impl(queue, seq_num, user, SEQ_NUM_MASK_##bits); \
+} \
+\
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_pull_##bits(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **user) \
+{ \
+	assert(queue->seq_num_bits == bits); \
+	return pull_impl(queue, seq_num, user, SEQ_NUM_MASK_##bits); \
+} \
+\
+CHIAKI_EXPORT size_t chiaki_bitmap_reorder_queue_pull_all_##bits(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **users, size_t users_max) \
+{ \
+	assert(queue->seq_num_bits == bits); \
+	return pull_all_impl(queue, seq_num, users, users_max, SEQ_NUM_MASK_##bits); \
+}
+
+BITMAP_REORDER_QUEUE_SPECIALIZE(16)
+BITMAP_REORDER_QUEUE_SPECIALIZE(32)
+
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_push(ChiakiBitmapReorderQueue *queue, uint64_t seq_num, void *user)
+{
+	if(queue->seq_num_bits == 16)
+		push_impl(queue, seq_num, user, SEQ_NUM_MASK_16);
+	else
+		push_impl(queue, seq_num, user, SEQ_NUM_MASK_32);
+}
+
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_pull(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **user)
+{
+	if(queue->seq_num_bits == 16)
+		return pull_impl(queue, seq_num, user, SEQ_NUM_MASK_16);
+	return pull_impl(queue, seq_num, user, SEQ_NUM_MASK_32);
+}
+
+CHIAKI_EXPORT size_t chiaki_bitmap_reorder_queue_pull_all(ChiakiBitmapReorderQueue *queue, uint64_t *seq_num, void **users, size_t users_max)
+{
+	if(queue->seq_num_bits == 16)
+		return pull_all_impl(queue, seq_num, users, users_max, SEQ_NUM_MASK_16);
+	return pull_all_impl(queue, seq_num, users, users_max, SEQ_NUM_MASK_32);
+}
+
+CHIAKI_EXPORT bool chiaki_bitmap_reorder_queue_peek(ChiakiBitmapReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user)
+{
+	if(index >= queue->count)
+		return false;
+
+	uint64_t seq_num_val = queue->begin + index;
+	size_t i = idx(seq_num_val);
+	if(!bit_get(queue, i))
+		return false;
+
+	if(seq_num)
+		*seq_num = seq_num_val & (queue->seq_num_bits == 16 ? SEQ_NUM_MASK_16 : SEQ_NUM_MASK_32);
+	if(user)
+		*user = queue->users[i];
+	return true;
+}
+
+CHIAKI_EXPORT void chiaki_bitmap_reorder_queue_drop(ChiakiBitmapReorderQueue *queue, uint64_t index)
+{
+	if(index >= queue->count)
+		return;
+
+	uint64_t seq_num = queue->begin + index;
+	size_t i = idx(seq_num);
+	if(!bit_get(queue, i))
+		return;
+	bit_clear(queue, i);
+
+	if(queue->drop_cb)
+		queue->drop_cb(seq_num & (queue->seq_num_bits == 16 ? SEQ_NUM_MASK_16 : SEQ_NUM_MASK_32), queue->users[i], queue->drop_cb_user);
+
+	// reduce count if necessary
+	if(index == queue->count - 1)
+	{
+		while(queue->count > 0 && !bit_get(queue, idx(queue->begin + queue->count - 1)))
+			queue->count--;
+	}
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/bitratemeter.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+CHIAKI_EXPORT void chiaki_bitrate_meter_init(ChiakiBitrateMeter *meter, uint64_t window_us, uint64_t ewma_us)
+{
+	meter->window_us = window_us ? window_us : CHIAKI_BITRATE_METER_WINDOW_US_DEFAULT;
+	meter->ewma_us = ewma_us ? ewma_us : CHIAKI_BITRATE_METER_EWMA_US_DEFAULT;
+	chiaki_bitrate_meter_reset(meter);
+}
+
+CHIAKI_EXPORT void chiaki_bitrate_meter_reset(ChiakiBitrateMeter *meter)
+{
+	meter->begin = 0;
+	meter->count = 0;
+	meter->bytes = 0;
+	meter->since_us = 0;
+	meter->started = false;
+	meter->start_us = 0;
+	meter->ewma_last_us = 0;
+	meter->ewma_bits = 0.0;
+}
+
+static void bitrate_meter_pop(ChiakiBitrateMeter *meter)
+{
+	meter->bytes -= meter->frames[meter->begin].size;
+	meter->begin = (meter->begin + 1) % CHIAKI_BITRATE_METER_FRAMES_MAX;
+	meter->count--;
+}
+
+/**
+ * Drop everything up to and including now_us - window_us, the window is (now_us - window_us, now_us]
+ */
+static void bitrate_meter_evict(ChiakiBitrateMeter *meter, uint64_t now_us)
+{
+	if(now_us <= meter->window_us)
+		return;
+	uint64_t limit = now_us - meter->window_us;
+	while(meter->count && meter->frames[meter->begin].timestamp_us <= limit)
+		bitrate_meter_pop(meter);
+	if(meter->since_us < limit)
+		meter->since_us = limit;
+}
+
+static double bitrate_meter_ewma_decay(ChiakiBitrateMeter *meter, uint64_t dt_us)
+{
+	return exp(-(double)dt_us / (double)meter->ewma_us);
+}
+
+CHIAKI_EXPORT void chiaki_bitrate_meter_frame(ChiakiBitrateMeter *meter, uint64_t now_us, size_t size)
+{
+	if(!meter->started)
+	{
+		// the time it took this frame to arrive is unknown, so it only marks the start
+		meter->started = true;
+		meter->start_us = now_us;
+		meter->since_us = now_us;
+		meter->ewma_last_us = now_us;
+		return;
+	}
+
+	bitrate_meter_evict(meter, now_us);
+	if(meter->count == CHIAKI_BITRATE_METER_FRAMES_MAX)
+	{
+		uint64_t dropped_us = meter->frames[meter->begin].timestamp_us;
+		bitrate_meter_pop(meter);
+		if(meter->since_us < dropped_us)
+			meter->since_us = dropped_us;
+	}
+
+	uint32_t size32 = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+	size_t end = (meter->begin + meter->count) % CHIAKI_BITRATE_METER_FRAMES_MAX;
+	meter->frames[end].timestamp_us = now_us;
+	meter->frames[end].size = size32;
+	meter->count++;
+	meter->bytes += size32;
+
+	meter->ewma_bits = meter->ewma_bits * bitrate_meter_ewma_decay(meter, now_us - meter->ewma_last_us) + (double)size32 * 8.0;
+	meter->ewma_last_us = now_us;
+}
+
+static int size_cmp(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t *)a;
+	uint32_t vb = *(const uint32_t *)b;
+	return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t count, unsigned int p)
+{
+	// nearest rank
+	size_t rank = (count * p + 99) / 100;
+	return sorted[rank ? rank - 1 : 0];
+}
+
+CHIAKI_EXPORT void chiaki_bitrate_meter_get_stats(ChiakiBitrateMeter *meter, uint64_t now_us, ChiakiBitrateMeterStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if(!meter->started || now_us < meter->since_us)
+		return;
+
+	bitrate_meter_evict(meter, now_us);
+	stats->span_us = now_us - meter->since_us;
+	stats->frames = meter->count;
+	stats->bytes = meter->bytes;
+	if(stats->span_us)
+	{
+		stats->bitrate = (double)meter->bytes * 8.0 * 1000000.0 / (double)stats->span_us;
+		stats->fps = (double)meter->count * 1000000.0 / (double)stats->span_us;
+	}
+
+	// the decaying sum of a constant rate r approaches r * ewma_us, from below during the first few time constants
+	uint64_t elapsed_us = now_us - meter->start_us;
+	if(elapsed_us && now_us >= meter->ewma_last_us)
+	{
+		double bits = meter->ewma_bits * bitrate_meter_ewma_decay(meter, now_us - meter->ewma_last_us);
+		double weight = 1.0 - bitrate_meter_ewma_decay(meter, elapsed_us);
+		stats->bitrate_ewma = bits * 1000000.0 / ((double)meter->ewma_us * weight);
+	}
+
+	if(!meter->count)
+		return;
+	for(size_t i=0; i<meter->count; i++)
+		meter->sizes_sorted[i] = meter->frames[(meter->begin + i) % CHIAKI_BITRATE_METER_FRAMES_MAX].size;
+	qsort(meter->sizes_sorted, meter->count, sizeof(uint32_t), size_cmp);
+	stats->frame_size_p50 = percentile(meter->sizes_sorted, meter->count, 50);
+	stats->frame_size_p95 = percentile(meter->sizes_sorted, meter->count, 95);
+	stats->frame_size_p99 = percentile(meter->sizes_sorted, meter->count, 99);
+	stats->frame_size_max = meter->sizes_sorted[meter->count - 1];
+}
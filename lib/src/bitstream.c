@@ -3,6 +3,7 @@
 #include <chiaki/bitstream.h>
 
 #include <string.h>
+#include <stdlib.h>
 
 #include "vl_rbsp.h"
 
@@ -47,6 +48,7 @@ static bool header_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 	vl_rbsp_init(&rbsp, &vlc, ~0);
 
 	unsigned profile_idc = vl_rbsp_u(&rbsp, 8);
+	bitstream->h264.sps.chroma_format_idc = 1;
 
 	vl_rbsp_u(&rbsp, 6); // constraint_set_flags
 	vl_rbsp_u(&rbsp, 2); // reserved_zero_2bits
@@ -60,8 +62,9 @@ static bool header_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 		profile_idc == 128 || profile_idc == 138 || profile_idc == 139 ||
 		profile_idc == 134 || profile_idc == 135)
 	{
-		if (vl_rbsp_ue(&rbsp) == 3) // chroma_format_idc
-			vl_rbsp_u(&rbsp, 1); // separate_colour_plane_flag
+		bitstream->h264.sps.chroma_format_idc = vl_rbsp_ue(&rbsp);
+		if (bitstream->h264.sps.chroma_format_idc == 3)
+			bitstream->h264.sps.separate_colour_plane_flag = vl_rbsp_u(&rbsp, 1);
 
 		vl_rbsp_ue(&rbsp); // bit_depth_luma_minus8
 		vl_rbsp_ue(&rbsp); // bit_depth_chroma_minus8
@@ -78,6 +81,74 @@ static bool header_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 		return false;
 	}
 
+	bitstream->h264.sps.pic_order_cnt_type = vl_rbsp_ue(&rbsp);
+	if(bitstream->h264.sps.pic_order_cnt_type == 0)
+	{
+		bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4 = vl_rbsp_ue(&rbsp);
+		if(bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4 > 12)
+		{
+			CHIAKI_LOGW(bitstream->log, "parse_sps_h264: Unexpected log2_max_pic_order_cnt_lsb_minus4 value %u", bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4);
+			return false;
+		}
+	}
+	else if(bitstream->h264.sps.pic_order_cnt_type == 1)
+	{
+		bitstream->h264.sps.delta_pic_order_always_zero_flag = vl_rbsp_u(&rbsp, 1);
+		vl_rbsp_se(&rbsp); // offset_for_non_ref_pic
+		vl_rbsp_se(&rbsp); // offset_for_top_to_bottom_field
+		unsigned num_ref_frames_in_pic_order_cnt_cycle = vl_rbsp_ue(&rbsp);
+		if(num_ref_frames_in_pic_order_cnt_cycle > 255)
+		{
+			CHIAKI_LOGW(bitstream->log, "parse_sps_h264: Unexpected num_ref_frames_in_pic_order_cnt_cycle %u", num_ref_frames_in_pic_order_cnt_cycle);
+			return false;
+		}
+		for(unsigned i=0; i<num_ref_frames_in_pic_order_cnt_cycle; i++)
+			vl_rbsp_se(&rbsp); // offset_for_ref_frame[i]
+	}
+	else if(bitstream->h264.sps.pic_order_cnt_type != 2)
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_sps_h264: Unexpected pic_order_cnt_type %u", bitstream->h264.sps.pic_order_cnt_type);
+		return false;
+	}
+
+	bitstream->h264.sps.max_num_ref_frames = vl_rbsp_ue(&rbsp);
+	vl_rbsp_u(&rbsp, 1); // gaps_in_frame_num_value_allowed_flag
+	vl_rbsp_ue(&rbsp); // pic_width_in_mbs_minus1
+	vl_rbsp_ue(&rbsp); // pic_height_in_map_units_minus1
+	bitstream->h264.sps.frame_mbs_only_flag = vl_rbsp_u(&rbsp, 1);
+
+	// the pps is optional here, vl_rbsp_init() has moved vlc to the end of the sps
+	if(!skip_startcode(&vlc))
+		return true;
+
+	vl_vlc_eatbits(&vlc, 1); // forbidden_zero_bit
+	vl_vlc_eatbits(&vlc, 2); // nal_ref_idc
+	nal_unit_type = vl_vlc_get_uimsbf(&vlc, 5);
+	if(nal_unit_type != 8)
+		return true;
+
+	vl_rbsp_init(&rbsp, &vlc, ~0);
+	vl_rbsp_ue(&rbsp); // pic_parameter_set_id
+	vl_rbsp_ue(&rbsp); // seq_parameter_set_id
+	bitstream->h264.pps.entropy_coding_mode_flag = vl_rbsp_u(&rbsp, 1);
+	bitstream->h264.pps.bottom_field_pic_order_in_frame_present_flag = vl_rbsp_u(&rbsp, 1);
+	if(vl_rbsp_ue(&rbsp)) // num_slice_groups_minus1
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_pps_h264: Slice groups are not supported");
+		return true;
+	}
+	bitstream->h264.pps.num_ref_idx_l0_default_active_minus1 = vl_rbsp_ue(&rbsp);
+	vl_rbsp_ue(&rbsp); // num_ref_idx_l1_default_active_minus1
+	bitstream->h264.pps.weighted_pred_flag = vl_rbsp_u(&rbsp, 1);
+	vl_rbsp_u(&rbsp, 2); // weighted_bipred_idc
+	vl_rbsp_se(&rbsp); // pic_init_qp_minus26
+	vl_rbsp_se(&rbsp); // pic_init_qs_minus26
+	vl_rbsp_se(&rbsp); // chroma_qp_index_offset
+	bitstream->h264.pps.deblocking_filter_control_present_flag = vl_rbsp_u(&rbsp, 1);
+	vl_rbsp_u(&rbsp, 1); // constrained_intra_pred_flag
+	bitstream->h264.pps.redundant_pic_cnt_present_flag = vl_rbsp_u(&rbsp, 1);
+	bitstream->h264.pps.valid = true;
+
 	return true;
 }
 
@@ -153,74 +224,502 @@ sps_start:
 	return true;
 }
 
-static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice)
+/**
+ * Bit reader over an escaped NAL unit payload, skipping emulation_prevention_three_bytes.
+ * Plain struct, so positions can be saved by copying it.
+ */
+typedef struct nal_reader_t
 {
-	struct vl_vlc vlc = {0};
-	vl_vlc_init(&vlc, data, size);
-	if(!skip_startcode(&vlc))
+	const uint8_t *data;
+	size_t size;
+	size_t pos; // current byte
+	unsigned bit; // bits of the current byte already read
+	unsigned zeros; // zero bytes directly before the current one
+	bool overrun;
+} NalReader;
+
+static void nal_reader_init(NalReader *reader, const uint8_t *data, size_t size)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->data = data;
+	reader->size = size;
+}
+
+static void nal_reader_next_byte(NalReader *reader)
+{
+	reader->zeros = reader->data[reader->pos] ? 0 : reader->zeros + 1;
+	reader->pos++;
+	reader->bit = 0;
+	if(reader->zeros >= 2 && reader->pos < reader->size && reader->data[reader->pos] == 3)
 	{
-		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: No startcode found");
-		return false;
+		reader->pos++;
+		reader->zeros = 0;
 	}
+}
 
-	vl_vlc_eatbits(&vlc, 1); // forbidden_zero_bit
-	vl_vlc_eatbits(&vlc, 2); // nal_ref_idc
-	unsigned nal_unit_type = vl_vlc_get_uimsbf(&vlc, 5);
+static unsigned nal_reader_u1(NalReader *reader)
+{
+	if(reader->pos >= reader->size)
+	{
+		reader->overrun = true;
+		return 0;
+	}
+	unsigned v = (reader->data[reader->pos] >> (7 - reader->bit)) & 1;
+	if(++reader->bit == 8)
+		nal_reader_next_byte(reader);
+	return v;
+}
+
+static uint32_t nal_reader_u(NalReader *reader, unsigned n)
+{
+	uint32_t v = 0;
+	for(unsigned i=0; i<n; i++)
+		v = (v << 1) | nal_reader_u1(reader);
+	return v;
+}
 
-	if(nal_unit_type != 1 && nal_unit_type != 5)
+static uint32_t nal_reader_ue(NalReader *reader)
+{
+	unsigned leading_zeros = 0;
+	while(!nal_reader_u1(reader))
 	{
-		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: Unexpected NAL unit type %u", nal_unit_type);
-		return false;
+		if(reader->overrun || ++leading_zeros > 31)
+		{
+			reader->overrun = true;
+			return 0;
+		}
 	}
+	return ((uint32_t)1 << leading_zeros) - 1 + nal_reader_u(reader, leading_zeros);
+}
 
-	struct vl_rbsp rbsp;
-	vl_rbsp_init(&rbsp, &vlc, ~0);
-	vl_rbsp_ue(&rbsp); // first_mb_in_slice
+static int32_t nal_reader_se(NalReader *reader)
+{
+	uint32_t code_num = nal_reader_ue(reader);
+	return (code_num & 1) ? (int32_t)((code_num + 1) >> 1) : -(int32_t)(code_num >> 1);
+}
 
-	switch(vl_rbsp_ue(&rbsp))
+static bool nal_reader_before(const NalReader *reader, const NalReader *target)
+{
+	return reader->pos < target->pos || (reader->pos == target->pos && reader->bit < target->bit);
+}
+
+/**
+ * Bit writer producing an escaped NAL unit, inserting emulation_prevention_three_bytes as needed.
+ */
+typedef struct nal_writer_t
+{
+	uint8_t *data;
+	size_t size;
+	size_t pos;
+	uint32_t cache;
+	unsigned cache_bits;
+	unsigned zeros;
+	bool overflow;
+} NalWriter;
+
+static void nal_writer_raw(NalWriter *writer, const uint8_t *buf, size_t buf_size)
+{
+	if(writer->size - writer->pos < buf_size)
+	{
+		writer->overflow = true;
+		return;
+	}
+	memcpy(writer->data + writer->pos, buf, buf_size);
+	writer->pos += buf_size;
+	writer->zeros = 0;
+}
+
+static void nal_writer_byte(NalWriter *writer, uint8_t b)
+{
+	bool escape = writer->zeros >= 2 && b <= 3;
+	if(writer->size - writer->pos < (escape ? 2 : 1))
+	{
+		writer->overflow = true;
+		return;
+	}
+	if(escape)
+	{
+		writer->data[writer->pos++] = 3;
+		writer->zeros = 0;
+	}
+	writer->data[writer->pos++] = b;
+	writer->zeros = b ? 0 : writer->zeros + 1;
+}
+
+static void nal_writer_u(NalWriter *writer, uint32_t v, unsigned n)
+{
+	// n <= 24, so the cache holding at most 7 more bits can not overflow
+	writer->cache = (writer->cache << n) | (v & (((uint32_t)1 << n) - 1));
+	writer->cache_bits += n;
+	while(writer->cache_bits >= 8)
+	{
+		writer->cache_bits -= 8;
+		nal_writer_byte(writer, (uint8_t)(writer->cache >> writer->cache_bits));
+	}
+	writer->cache &= ((uint32_t)1 << writer->cache_bits) - 1;
+}
+
+static void nal_writer_ue(NalWriter *writer, uint16_t v)
+{
+	uint32_t code = (uint32_t)v + 1;
+	unsigned len = 0;
+	while(code >> len)
+		len++;
+	nal_writer_u(writer, 0, len - 1);
+	nal_writer_u(writer, code, len);
+}
+
+/**
+ * Copy everything from reader up to target, which is a later state of the same reader.
+ */
+static void nal_copy_bits(NalReader *reader, const NalReader *target, NalWriter *writer)
+{
+	while(nal_reader_before(reader, target) && !reader->overrun)
+	{
+		if(!reader->bit && reader->pos < target->pos)
+		{
+			uint8_t b = reader->data[reader->pos];
+			nal_reader_next_byte(reader);
+			nal_writer_u(writer, b, 8);
+		}
+		else
+			nal_writer_u(writer, nal_reader_u1(reader), 1);
+	}
+}
+
+typedef struct slice_header_h264_t
+{
+	unsigned nal_unit_type;
+	unsigned nal_ref_idc;
+	ChiakiBitstreamSliceType slice_type;
+	unsigned reference_frame;
+	unsigned num_ref_idx_l0_active_minus1;
+	NalReader modification_start; // at ref_pic_list_modification_flag_l0
+	NalReader modification_end;
+	NalReader header_end; // only if parsed with full
+} SliceHeaderH264;
+
+/**
+ * Parse a slice header from reader, which starts after the NAL unit header.
+ * Without full, parsing stops after the ref_pic_list_modification, which does not require the pps.
+ * Only P slices in non-IDR NAL units are parsed past the slice_type.
+ */
+static bool slice_header_h264(ChiakiBitstream *bitstream, NalReader *reader, SliceHeaderH264 *header, bool full)
+{
+	nal_reader_ue(reader); // first_mb_in_slice
+	switch(nal_reader_ue(reader))
 	{
 		case 0:
 		case 5:
-			slice->slice_type = CHIAKI_BITSTREAM_SLICE_P;
+			header->slice_type = CHIAKI_BITSTREAM_SLICE_P;
 			break;
 		case 2:
 		case 7:
-			slice->slice_type = CHIAKI_BITSTREAM_SLICE_I;
+			header->slice_type = CHIAKI_BITSTREAM_SLICE_I;
 			break;
 		default:
-			slice->slice_type = CHIAKI_BITSTREAM_SLICE_UNKNOWN;
+			header->slice_type = CHIAKI_BITSTREAM_SLICE_UNKNOWN;
 			break;
 	}
+	header->reference_frame = 0;
 
-	if(nal_unit_type == 1)
+	if(header->nal_unit_type != 1 || header->slice_type != CHIAKI_BITSTREAM_SLICE_P)
+		return !reader->overrun;
+
+	nal_reader_ue(reader); // pic_parameter_set_id
+	if(bitstream->h264.sps.separate_colour_plane_flag)
+		nal_reader_u(reader, 2); // colour_plane_id
+	nal_reader_u(reader, bitstream->h264.sps.log2_max_frame_num_minus4 + 4); // frame_num
+	bool field_pic_flag = false;
+	if(!bitstream->h264.sps.frame_mbs_only_flag)
+	{
+		field_pic_flag = nal_reader_u1(reader);
+		if(field_pic_flag)
+			nal_reader_u1(reader); // bottom_field_flag
+	}
+	if(bitstream->h264.sps.pic_order_cnt_type == 0)
 	{
-		slice->reference_frame = 0;
-		vl_rbsp_ue(&rbsp); // pic_parameter_set_id
-		vl_rbsp_u(&rbsp, bitstream->h264.sps.log2_max_frame_num_minus4 + 4); // frame_num
-		if(vl_rbsp_u(&rbsp, 1)) // num_ref_idx_active_override_flag
-			if(vl_rbsp_u(&rbsp, 1)) // num_ref_idx_active_override_flag
-				vl_rbsp_ue(&rbsp); // num_ref_idx_l0_active_minus1
-		if(vl_rbsp_u(&rbsp, 1)) // ref_pic_list_modification_flag_l0
+		nal_reader_u(reader, bitstream->h264.sps.log2_max_pic_order_cnt_lsb_minus4 + 4); // pic_order_cnt_lsb
+		if(bitstream->h264.pps.bottom_field_pic_order_in_frame_present_flag && !field_pic_flag)
+			nal_reader_se(reader); // delta_pic_order_cnt_bottom
+	}
+	else if(bitstream->h264.sps.pic_order_cnt_type == 1 && !bitstream->h264.sps.delta_pic_order_always_zero_flag)
+	{
+		nal_reader_se(reader); // delta_pic_order_cnt[0]
+		if(bitstream->h264.pps.bottom_field_pic_order_in_frame_present_flag && !field_pic_flag)
+			nal_reader_se(reader); // delta_pic_order_cnt[1]
+	}
+	if(bitstream->h264.pps.redundant_pic_cnt_present_flag)
+		nal_reader_ue(reader); // redundant_pic_cnt
+
+	header->num_ref_idx_l0_active_minus1 = bitstream->h264.pps.num_ref_idx_l0_default_active_minus1;
+	if(nal_reader_u1(reader)) // num_ref_idx_active_override_flag
+		header->num_ref_idx_l0_active_minus1 = nal_reader_ue(reader);
+	if(header->num_ref_idx_l0_active_minus1 > 31)
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: Unexpected num_ref_idx_l0_active_minus1 %u", header->num_ref_idx_l0_active_minus1);
+		return false;
+	}
+
+	header->modification_start = *reader;
+	if(nal_reader_u1(reader)) // ref_pic_list_modification_flag_l0
+	{
+		unsigned i = 0;
+		for(;; i++)
+		{
+			unsigned modification_of_pic_nums_idc = nal_reader_ue(reader);
+			if(modification_of_pic_nums_idc == 3 || modification_of_pic_nums_idc > 3 || i > header->num_ref_idx_l0_active_minus1 + 1 || reader->overrun)
+				break;
+			unsigned v = nal_reader_ue(reader); // abs_diff_pic_num_minus1 or long_term_pic_num
+			// the first modification decides what ends up at index 0
+			if(i == 0 && modification_of_pic_nums_idc == 0)
+				header->reference_frame = v;
+		}
+		if(i > header->num_ref_idx_l0_active_minus1 + 1 || reader->overrun)
 		{
-			unsigned i = 0;
-			unsigned modification_of_pic_nums_idc = vl_rbsp_ue(&rbsp);
-			while(i++<3)
-			{
-				if(modification_of_pic_nums_idc == 0)
-					slice->reference_frame = vl_rbsp_ue(&rbsp); // abs_diff_pic_num_minus1
-				else if(modification_of_pic_nums_idc < 3)
-					vl_rbsp_ue(&rbsp); // abs_diff_pic_num_minus1 or long_term_pic_num
-				else if(modification_of_pic_nums_idc == 3)
-					return true;
-				else
-					break;
-				modification_of_pic_nums_idc = vl_rbsp_ue(&rbsp);
-			}
 			CHIAKI_LOGW(bitstream->log, "parse_slice_h264: Failed to parse ref_pic_list_modification");
 			return false;
 		}
 	}
+	header->modification_end = *reader;
+	if(!full)
+		return !reader->overrun;
+
+	if(bitstream->h264.pps.weighted_pred_flag)
+	{
+		unsigned chroma_array_type = bitstream->h264.sps.separate_colour_plane_flag ? 0 : bitstream->h264.sps.chroma_format_idc;
+		nal_reader_ue(reader); // luma_log2_weight_denom
+		if(chroma_array_type)
+			nal_reader_ue(reader); // chroma_log2_weight_denom
+		for(unsigned i=0; i<=header->num_ref_idx_l0_active_minus1; i++)
+		{
+			if(nal_reader_u1(reader)) // luma_weight_l0_flag
+			{
+				nal_reader_se(reader); // luma_weight_l0
+				nal_reader_se(reader); // luma_offset_l0
+			}
+			if(chroma_array_type && nal_reader_u1(reader)) // chroma_weight_l0_flag
+			{
+				for(unsigned j=0; j<2; j++)
+				{
+					nal_reader_se(reader); // chroma_weight_l0
+					nal_reader_se(reader); // chroma_offset_l0
+				}
+			}
+		}
+	}
+
+	if(header->nal_ref_idc && nal_reader_u1(reader)) // adaptive_ref_pic_marking_mode_flag
+	{
+		for(unsigned i=0;; i++)
+		{
+			unsigned memory_management_control_operation = nal_reader_ue(reader);
+			if(!memory_management_control_operation)
+				break;
+			if(memory_management_control_operation > 6 || i > 64 || reader->overrun)
+			{
+				CHIAKI_LOGW(bitstream->log, "parse_slice_h264: Failed to parse dec_ref_pic_marking");
+				return false;
+			}
+			if(memory_management_control_operation == 1 || memory_management_control_operation == 3)
+				nal_reader_ue(reader); // difference_of_pic_nums_minus1
+			if(memory_management_control_operation == 2)
+				nal_reader_ue(reader); // long_term_pic_num
+			if(memory_management_control_operation == 3 || memory_management_control_operation == 6)
+				nal_reader_ue(reader); // long_term_frame_idx
+			if(memory_management_control_operation == 4)
+				nal_reader_ue(reader); // max_long_term_frame_idx_plus1
+		}
+	}
+
+	if(bitstream->h264.pps.entropy_coding_mode_flag)
+		nal_reader_ue(reader); // cabac_init_idc
+	nal_reader_se(reader); // slice_qp_delta
+	if(bitstream->h264.pps.deblocking_filter_control_present_flag)
+	{
+		if(nal_reader_ue(reader) != 1) // disable_deblocking_filter_idc
+		{
+			nal_reader_se(reader); // slice_alpha_c0_offset_div2
+			nal_reader_se(reader); // slice_beta_offset_div2
+		}
+	}
+	header->header_end = *reader;
+	return !reader->overrun;
+}
+
+/**
+ * Offset of the next 00 00 01 start code at or after offset, size if there is none
+ */
+static size_t next_startcode(const uint8_t *data, size_t size, size_t offset)
+{
+	for(size_t i=offset; i+2<size; i++)
+	{
+		if(!data[i] && !data[i + 1] && data[i + 2] == 1)
+			return i;
+	}
+	return size;
+}
+
+static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice)
+{
+	size_t nal = next_startcode(data, size, 0) + 3;
+	if(nal >= size)
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: No startcode found");
+		return false;
+	}
+
+	SliceHeaderH264 header;
+	header.nal_ref_idc = (data[nal] >> 5) & 3;
+	header.nal_unit_type = data[nal] & 0x1f;
+	if(header.nal_unit_type != 1 && header.nal_unit_type != 5)
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: Unexpected NAL unit type %u", header.nal_unit_type);
+		return false;
+	}
+
+	NalReader reader;
+	nal_reader_init(&reader, data + nal + 1, size - nal - 1);
+	if(!slice_header_h264(bitstream, &reader, &header, false))
+		return false;
+	slice->slice_type = header.slice_type;
+	if(header.nal_unit_type == 1)
+		slice->reference_frame = header.reference_frame;
+	return true;
+}
+
+/**
+ * Re-emit one slice NAL unit (starting at its header byte) into writer with a new ref_pic_list_modification
+ */
+static bool slice_set_reference_frame_h264_nal(ChiakiBitstream *bitstream, const uint8_t *nal, size_t nal_size, NalWriter *writer, unsigned reference_frame, bool *rewritten)
+{
+	// trailing zeros and cabac_zero_words carry no slice data, they are copied as they are at the end
+	size_t end = nal_size;
+	while(end > 1)
+	{
+		if(!nal[end - 1])
+			end--;
+		else if(end >= 3 && nal[end - 1] == 3 && !nal[end - 2] && !nal[end - 3])
+			end--;
+		else
+			break;
+	}
+
+	SliceHeaderH264 header;
+	header.nal_ref_idc = (nal[0] >> 5) & 3;
+	header.nal_unit_type = nal[0] & 0x1f;
+	if(header.nal_unit_type != 1 || end < 2)
+	{
+		nal_writer_raw(writer, nal, nal_size);
+		return true;
+	}
+
+	NalReader reader;
+	nal_reader_init(&reader, nal + 1, end - 1);
+	if(!slice_header_h264(bitstream, &reader, &header, true))
+		return false;
+	if(header.slice_type != CHIAKI_BITSTREAM_SLICE_P)
+	{
+		nal_writer_raw(writer, nal, nal_size);
+		return true;
+	}
+
+	nal_writer_byte(writer, nal[0]);
+	nal_reader_init(&reader, nal + 1, end - 1);
+	nal_copy_bits(&reader, &header.modification_start, writer);
+	// move the wanted frame to index 0 of list 0
+	nal_writer_u(writer, 1, 1); // ref_pic_list_modification_flag_l0
+	nal_writer_ue(writer, 0); // modification_of_pic_nums_idc: subtract from the current pic num
+	nal_writer_ue(writer, reference_frame); // abs_diff_pic_num_minus1
+	nal_writer_ue(writer, 3); // modification_of_pic_nums_idc: end
+	reader = header.modification_end;
+	nal_copy_bits(&reader, &header.header_end, writer);
+
+	if(bitstream->h264.pps.entropy_coding_mode_flag)
+	{
+		// cabac slice data starts byte aligned, so only the cabac_alignment_one_bits change and the rest is copied bytewise
+		while(reader.bit)
+			nal_reader_u1(&reader);
+		while(writer->cache_bits)
+			nal_writer_u(writer, 1, 1);
+		while(reader.pos < reader.size)
+		{
+			uint8_t b = reader.data[reader.pos];
+			nal_reader_next_byte(&reader);
+			nal_writer_byte(writer, b);
+		}
+	}
+	else
+	{
+		// cavlc slice data is shifted bit by bit up to the rbsp_stop_one_bit, which is the last set bit
+		NalReader stop = reader;
+		stop.pos = reader.size - 1;
+		stop.bit = 7;
+		while(!((reader.data[stop.pos] >> (7 - stop.bit)) & 1))
+			stop.bit--;
+		if(nal_reader_before(&stop, &reader))
+			return false;
+		nal_copy_bits(&reader, &stop, writer);
+		nal_writer_u(writer, 1, 1); // rbsp_stop_one_bit
+		while(writer->cache_bits)
+			nal_writer_u(writer, 0, 1); // rbsp_alignment_zero_bit
+	}
+
+	nal_writer_raw(writer, nal + end, nal_size - end);
+	*rewritten = true;
+	return true;
+}
+
+static bool slice_set_reference_frame_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned *size, unsigned capacity, unsigned reference_frame)
+{
+	if(!bitstream->h264.pps.valid)
+	{
+		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h264: No pps");
+		return false;
+	}
+	if(reference_frame >= bitstream->h264.sps.max_num_ref_frames || reference_frame > UINT16_MAX)
+		return false;
 
+	size_t src_size = *size;
+	size_t start = next_startcode(data, src_size, 0);
+	if(start == src_size)
+	{
+		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h264: No startcode found");
+		return false;
+	}
+
+	// the slices grow, so they are rewritten from a copy
+	uint8_t *src = malloc(src_size);
+	if(!src)
+		return false;
+	memcpy(src, data, src_size);
+
+	NalWriter writer = { 0 };
+	writer.data = data;
+	writer.size = capacity;
+	bool succ = true;
+	bool rewritten = false;
+	// anything in front of the first start code, like the zero_byte of a 4 byte one
+	nal_writer_raw(&writer, src, start);
+	while(succ && start < src_size)
+	{
+		size_t nal = start + 3;
+		size_t nal_end = next_startcode(src, src_size, nal);
+		nal_writer_raw(&writer, src + start, 3);
+		if(nal < nal_end)
+			succ = slice_set_reference_frame_h264_nal(bitstream, src + nal, nal_end - nal, &writer, reference_frame, &rewritten);
+		start = nal_end;
+	}
+
+	if(!succ || !rewritten || writer.overflow)
+	{
+		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h264: Failed to rewrite slice");
+		memcpy(data, src, src_size);
+		free(src);
+		return false;
+	}
+	free(src);
+	*size = (unsigned)writer.pos;
 	return true;
 }
 
@@ -399,10 +898,10 @@ bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned
 		return slice_h265(bitstream, data, size, slice);
 }
 
-bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame)
+bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned *size, unsigned capacity, unsigned reference_frame)
 {
 	if(bitstream->codec == CHIAKI_CODEC_H264)
-		return false;
+		return slice_set_reference_frame_h264(bitstream, data, size, capacity, reference_frame);
 	else
-		return slice_set_reference_frame_h265(bitstream, data, size, reference_frame);
+		return slice_set_reference_frame_h265(bitstream, data, *size, reference_frame);
 }
@@ -2,6 +2,8 @@
 
 #include <chiaki/congestioncontrol.h>
 
+#include <string.h>
+
 #define CONGESTION_CONTROL_INTERVAL_MS 200
 
 static void *congestion_control_thread_func(void *user)
@@ -28,7 +30,11 @@ static void *congestion_control_thread_func(void *user)
 		control->packet_loss = total > 0 ? (double)lost / total : 0;
 		CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u",
 			(unsigned int)packet.received, (unsigned int)packet.lost);
+		// not wrapped in a send batch of its own, a single packet every 200 ms gains nothing from it.
+		// It still joins the feedback sender's batch if one happens to be open.
 		chiaki_takion_send_congestion(control->takion, &packet);
+		control->last_report = packet;
+		control->reports_sent++;
 	}
 
 	chiaki_bool_pred_cond_unlock(&control->stop_cond);
@@ -40,6 +46,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionCo
 	control->takion = takion;
 	control->stats = stats;
 	control->packet_loss = 0;
+	memset(&control->last_report, 0, sizeof(control->last_report));
+	control->reports_sent = 0;
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
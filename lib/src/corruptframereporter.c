@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/corruptframereporter.h>
+
+#include <string.h>
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_corrupt_frame_reporter_init(ChiakiCorruptFrameReporter *reporter, ChiakiLog *log, uint64_t holdoff_us,
+		ChiakiCorruptFrameSendCallback send_cb, void *send_cb_user)
+{
+	reporter->log = log;
+	reporter->send_cb = send_cb;
+	reporter->send_cb_user = send_cb_user;
+	reporter->holdoff_us = holdoff_us;
+	reporter->outstanding = false;
+	reporter->start = 0;
+	reporter->end = 0;
+	reporter->sent_us = 0;
+	memset(&reporter->stats, 0, sizeof(reporter->stats));
+	return chiaki_mutex_init(&reporter->stats_mutex, false);
+}
+
+CHIAKI_EXPORT void chiaki_corrupt_frame_reporter_fini(ChiakiCorruptFrameReporter *reporter)
+{
+	chiaki_mutex_fini(&reporter->stats_mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_corrupt_frame_reporter_report(ChiakiCorruptFrameReporter *reporter, ChiakiSeqNum16 start, ChiakiSeqNum16 end, uint64_t now_us)
+{
+	chiaki_mutex_lock(&reporter->stats_mutex);
+	reporter->stats.reports++;
+
+	if(reporter->outstanding && now_us - reporter->sent_us < reporter->holdoff_us)
+	{
+		// the console has not reacted yet, so its answer will repair these frames too
+		if(chiaki_seq_num_16_gt(end, reporter->end))
+		{
+			reporter->end = end;
+			reporter->stats.merged++;
+		}
+		else
+			reporter->stats.suppressed++;
+		chiaki_mutex_unlock(&reporter->stats_mutex);
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	if(reporter->outstanding)
+	{
+		CHIAKI_LOGW(reporter->log, "No i frame for corrupt frames %u to %u within %llu ms, requesting again",
+				(unsigned int)reporter->start, (unsigned int)reporter->end, (unsigned long long)(reporter->holdoff_us / 1000));
+		reporter->stats.expired++;
+		// the new request starts at the caller's start, because any i frame after it repairs the older frames too
+		// and widening it again on every expiry would let the range grow without bound if no i frame ever comes
+		reporter->outstanding = false;
+	}
+	chiaki_mutex_unlock(&reporter->stats_mutex);
+
+	ChiakiErrorCode err = reporter->send_cb(start, end, reporter->send_cb_user);
+
+	chiaki_mutex_lock(&reporter->stats_mutex);
+	if(err == CHIAKI_ERR_SUCCESS)
+	{
+		reporter->outstanding = true;
+		reporter->start = start;
+		reporter->end = end;
+		reporter->sent_us = now_us;
+		reporter->stats.requests_sent++;
+	}
+	else
+		reporter->stats.send_errors++;
+	chiaki_mutex_unlock(&reporter->stats_mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_corrupt_frame_reporter_frame(ChiakiCorruptFrameReporter *reporter, ChiakiSeqNum16 frame_index, bool keyframe, uint64_t now_us)
+{
+	// an i frame from within or before the range was already on its way when the request was sent
+	if(!reporter->outstanding || !keyframe || !chiaki_seq_num_16_gt(frame_index, reporter->end))
+		return;
+
+	chiaki_mutex_lock(&reporter->stats_mutex);
+	reporter->outstanding = false;
+	reporter->stats.answered++;
+	reporter->stats.answer_us_last = now_us - reporter->sent_us;
+	chiaki_mutex_unlock(&reporter->stats_mutex);
+	CHIAKI_LOGV(reporter->log, "Corrupt frames %u to %u answered by i frame %u", (unsigned int)reporter->start, (unsigned int)reporter->end, (unsigned int)frame_index);
+}
+
+CHIAKI_EXPORT void chiaki_corrupt_frame_reporter_get_stats(ChiakiCorruptFrameReporter *reporter, ChiakiCorruptFrameStats *stats)
+{
+	chiaki_mutex_lock(&reporter->stats_mutex);
+	*stats = reporter->stats;
+	chiaki_mutex_unlock(&reporter->stats_mutex);
+}
@@ -7,6 +7,7 @@
 #include <chiaki/time.h>
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -140,6 +141,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_init(ChiakiCtrl *ctrl, ChiakiSession *
 	ctrl->msg_queue = NULL;
 	ctrl->keyboard_text_counter = 0;
 	ctrl->sock = CHIAKI_INVALID_SOCKET;
+	ctrl->recv_buf_start = 0;
+	ctrl->recv_buf_size = 0;
 
 	ChiakiErrorCode err = chiaki_stop_pipe_init(&ctrl->notif_pipe);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -149,7 +152,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_init(ChiakiCtrl *ctrl, ChiakiSession *
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_notif_pipe;
 
+	err = chiaki_mutex_init(&ctrl->send_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_notif_mutex;
+
 	return err;
+error_notif_mutex:
 	chiaki_mutex_fini(&ctrl->notif_mutex);
 error_notif_pipe:
 	chiaki_stop_pipe_fini(&ctrl->notif_pipe);
@@ -183,6 +191,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_join(ChiakiCtrl *ctrl)
 CHIAKI_EXPORT void chiaki_ctrl_fini(ChiakiCtrl *ctrl)
 {
 	chiaki_stop_pipe_fini(&ctrl->notif_pipe);
+	chiaki_mutex_fini(&ctrl->send_mutex);
 	chiaki_mutex_fini(&ctrl->notif_mutex);
 	free(ctrl->login_pin);
 }
@@ -292,6 +301,36 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_keyboard_reject(ChiakiCtrl *ctrl)
 static ChiakiErrorCode ctrl_connect(ChiakiCtrl *ctrl);
 static void ctrl_message_received(ChiakiCtrl *ctrl, uint16_t msg_type, uint8_t *payload, size_t payload_size);
 
+/**
+ * Make room for size more bytes behind the unparsed data in recv_buf.
+ * The unparsed data is only moved to the front of the buffer if it would not fit otherwise.
+ *
+ * @return pointer to write the new data to or NULL if it does not fit at all
+ */
+static uint8_t *ctrl_recv_buf_reserve(ChiakiCtrl *ctrl, size_t size)
+{
+	if(ctrl->recv_buf_size + size > sizeof(ctrl->recv_buf))
+		return NULL;
+	if(ctrl->recv_buf_start + ctrl->recv_buf_size + size > sizeof(ctrl->recv_buf))
+	{
+		memmove(ctrl->recv_buf, ctrl->recv_buf + ctrl->recv_buf_start, ctrl->recv_buf_size);
+		ctrl->recv_buf_start = 0;
+	}
+	return ctrl->recv_buf + ctrl->recv_buf_start + ctrl->recv_buf_size;
+}
+
+static void ctrl_recv_buf_append(ChiakiCtrl *ctrl, const uint8_t *buf, size_t size)
+{
+	uint8_t *dst = ctrl_recv_buf_reserve(ctrl, size);
+	if(!dst)
+	{
+		CHIAKI_LOGE(ctrl->session->log, "Ctrl buffer overflow, dropping message of size %#llx", (unsigned long long)size);
+		return;
+	}
+	memcpy(dst, buf, size);
+	ctrl->recv_buf_size += size;
+}
+
 static void ctrl_failed(ChiakiCtrl *ctrl, ChiakiQuitReason reason)
 {
 	ChiakiErrorCode mutex_err = chiaki_mutex_lock(&ctrl->session->state_mutex);
@@ -324,27 +363,29 @@ static void *ctrl_thread_func(void *user)
 		bool overflow = false;
 		while(ctrl->recv_buf_size >= 8)
 		{
-			uint32_t payload_size = *((uint32_t *)ctrl->recv_buf);
+			uint8_t *msg = ctrl->recv_buf + ctrl->recv_buf_start;
+			uint32_t payload_size = *((chiaki_unaligned_uint32_t *)msg);
 			payload_size = ntohl(payload_size);
 
-			if(ctrl->recv_buf_size < 8 + payload_size)
+			if(payload_size > sizeof(ctrl->recv_buf) - 8)
 			{
-				if(8 + payload_size > sizeof(ctrl->recv_buf))
-				{
-					CHIAKI_LOGE(ctrl->session->log, "Ctrl buffer overflow!");
-					overflow = true;
-				}
+				CHIAKI_LOGE(ctrl->session->log, "Ctrl buffer overflow!");
+				overflow = true;
 				break;
 			}
 
-			uint16_t msg_type = *((chiaki_unaligned_uint16_t *)(ctrl->recv_buf + 4));
+			if(ctrl->recv_buf_size < 8 + payload_size)
+				break;
+
+			uint16_t msg_type = *((chiaki_unaligned_uint16_t *)(msg + 4));
 			msg_type = ntohs(msg_type);
 
-			ctrl_message_received(ctrl, msg_type, ctrl->recv_buf + 8, (size_t)payload_size);
+			ctrl_message_received(ctrl, msg_type, msg + 8, (size_t)payload_size);
+			ctrl->recv_buf_start += 8 + payload_size;
 			ctrl->recv_buf_size -= 8 + payload_size;
-			if(ctrl->recv_buf_size > 0)
-				memmove(ctrl->recv_buf, ctrl->recv_buf + 8 + payload_size, ctrl->recv_buf_size);
 		}
+		if(ctrl->recv_buf_size == 0)
+			ctrl->recv_buf_start = 0;
 
 		if(overflow)
 		{
@@ -400,52 +441,54 @@ static void *ctrl_thread_func(void *user)
 			break;
 		}
 
-		int received = 0;
 		if(ctrl->session->rudp)
 		{
-			RudpMessage message;
+			// parsed in place, data of the messages points into ctrl->rudp_recv_buf
+			RudpMessage messages[CHIAKI_RUDP_MESSAGE_CHAIN_MAX];
+			size_t messages_count = 0;
 			uint16_t remote_counter = 0;
 			uint16_t ack_counter = 0;
-			err = chiaki_rudp_recv_only(ctrl->session->rudp, sizeof(ctrl->rudp_recv_buf) - ctrl->recv_buf_size, &message);
-			if(err != CHIAKI_ERR_SUCCESS)
+			err = chiaki_rudp_recv_only_in_place(ctrl->session->rudp, ctrl->rudp_recv_buf, sizeof(ctrl->rudp_recv_buf),
+					messages, CHIAKI_RUDP_MESSAGE_CHAIN_MAX, &messages_count);
+			if(err == CHIAKI_ERR_BUF_TOO_SMALL)
+				CHIAKI_LOGW(ctrl->session->log, "Rudp ctrl packet contained more than %d messages, ignoring the rest", CHIAKI_RUDP_MESSAGE_CHAIN_MAX);
+			else if(err != CHIAKI_ERR_SUCCESS)
 			{
 				CHIAKI_LOGE(ctrl->session->log, "Failed to receive Rudp ctrl packet");
 				ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_UNKNOWN);
 				break;
 			}
-			if(message.data_size < 4)
+			RudpMessage *message = &messages[0];
+			if(message->data_size < 4)
 			{
 				CHIAKI_LOGE(ctrl->session->log, "Rudp ctrl message response too small");
-				chiaki_rudp_print_message(ctrl->session->rudp, &message);
+				chiaki_rudp_print_message(ctrl->session->rudp, message);
 				ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_UNKNOWN);
 				break;
 			}
-			remote_counter = message.remote_counter;
+			remote_counter = message->remote_counter;
 			while(true)
 			{
-				switch(message.subtype) // wrong but works ...
+				switch(message->subtype) // wrong but works ...
 				{
 					case 0x02:
 					case 0x12:
 					case 0x26:
 					case 0x36:
-						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message.data + 2)));
+						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message->data + 2)));
 						chiaki_rudp_ack_packet(ctrl->session->rudp, ack_counter);
 						chiaki_rudp_send_ack_message(ctrl->session->rudp, remote_counter);
-						int offset = rudp_packet_type_data_offset(message.subtype);
+						int offset = rudp_packet_type_data_offset(message->subtype);
 						// ctrl message header is 8 bytes
-						if((message.data_size - offset) < 8)
+						if((message->data_size - offset) < 8)
 							break;
 						// check if message is ctrl message by making sure the payload size (size of message - 8 byte header is correct)
-						uint32_t ctrl_payload_size = ntohl(*(uint32_t*)(message.data + offset));
-						if((message.data_size - offset - 8) == ctrl_payload_size)
-						{
-							memcpy(ctrl->recv_buf + ctrl->recv_buf_size, message.data + offset, message.data_size - offset);
-							ctrl->recv_buf_size += message.data_size - offset;
-						}
+						uint32_t ctrl_payload_size = ntohl(*(uint32_t*)(message->data + offset));
+						if((message->data_size - offset - 8) == ctrl_payload_size)
+							ctrl_recv_buf_append(ctrl, message->data + offset, message->data_size - offset);
 						break;
 					case 0x24:
-						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message.data + 2)));
+						ack_counter = ntohs(*((chiaki_unaligned_uint16_t *)(message->data + 2)));
 						chiaki_rudp_ack_packet(ctrl->session->rudp, ack_counter);
 						break;
 					case 0xC0:
@@ -453,43 +496,35 @@ static void *ctrl_thread_func(void *user)
 						ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_UNKNOWN);
 						break;
 					default:
-						CHIAKI_LOGI(ctrl->session->log, "Received message of unknown type: 0x%04x", message.type);
+						CHIAKI_LOGI(ctrl->session->log, "Received message of unknown type: 0x%04x", message->type);
 						chiaki_rudp_ack_packet(ctrl->session->rudp, ack_counter);
 						chiaki_rudp_send_ack_message(ctrl->session->rudp, remote_counter);
 						// we already checked before if data size was at least 4
 						int offset2 = 4;
 						// ctrl message header is 8 bytes
-						if((message.data_size - offset2) < 8)
+						if((message->data_size - offset2) < 8)
 							break;
-						uint32_t ctrl_payload_size2 = ntohl(*(uint32_t*)(message.data + offset2));
-						if((message.data_size - offset2 - 8) == ctrl_payload_size2)
-						{
-							memcpy(ctrl->recv_buf + ctrl->recv_buf_size, message.data + offset2, message.data_size - offset2);
-							ctrl->recv_buf_size += message.data_size - offset2;
-						}
+						uint32_t ctrl_payload_size2 = ntohl(*(uint32_t*)(message->data + offset2));
+						if((message->data_size - offset2 - 8) == ctrl_payload_size2)
+							ctrl_recv_buf_append(ctrl, message->data + offset2, message->data_size - offset2);
 						break;
 				}
-				if(message.subMessage)
-				{
-					if(message.data)
-					{
-						free(message.data);
-						message.data = NULL;
-					}
-					RudpMessage *tmp = message.subMessage;
-					memcpy(&message, message.subMessage, sizeof(RudpMessage));
-					free(tmp);
-				}
-				else
-				{
-					chiaki_rudp_message_pointers_free(&message);
+				if(!message->subMessage)
 					break;
-				}
+				message = message->subMessage;
 			}
 		}
 		else
 		{
-			received = recv(ctrl->sock, (CHIAKI_SOCKET_BUF_TYPE)ctrl->recv_buf + ctrl->recv_buf_size, sizeof(ctrl->recv_buf) - ctrl->recv_buf_size, 0);
+			// the parse loop above left at most one incomplete message that fits into recv_buf,
+			// only move it to the front if it can't be completed where it is
+			size_t pending_size = 8;
+			if(ctrl->recv_buf_size >= 8)
+				pending_size += ntohl(*((chiaki_unaligned_uint32_t *)(ctrl->recv_buf + ctrl->recv_buf_start)));
+			uint8_t *recv_ptr = ctrl_recv_buf_reserve(ctrl, pending_size - ctrl->recv_buf_size);
+			assert(recv_ptr);
+			size_t recv_size = sizeof(ctrl->recv_buf) - ctrl->recv_buf_start - ctrl->recv_buf_size;
+			int received = recv(ctrl->sock, (CHIAKI_SOCKET_BUF_TYPE)recv_ptr, recv_size, 0);
 			if(received <= 0)
 			{
 				if(received < 0)
@@ -500,11 +535,9 @@ static void *ctrl_thread_func(void *user)
 				break;
 			}
 			CHIAKI_LOGI(ctrl->session->log, "CTRL RECEIVED");
-			chiaki_log_hexdump(ctrl->session->log, CHIAKI_LOG_INFO, ctrl->recv_buf + ctrl->recv_buf_size, received);
+			chiaki_log_hexdump(ctrl->session->log, CHIAKI_LOG_INFO, recv_ptr, received);
+			ctrl->recv_buf_size += received;
 		}
-
-
-		ctrl->recv_buf_size += received;
 	}
 
 	chiaki_mutex_unlock(&ctrl->notif_mutex);
@@ -526,71 +559,68 @@ static ChiakiErrorCode ctrl_message_send(ChiakiCtrl *ctrl, uint16_t type, const
 	if(payload)
 		chiaki_log_hexdump(ctrl->session->log, CHIAKI_LOG_VERBOSE, payload, payload_size);
 
-	uint8_t *enc = NULL;
+	ChiakiErrorCode err = chiaki_mutex_lock(&ctrl->send_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	// the header goes right in front of the encrypted payload so both leave with one send
+	uint8_t *buf = ctrl->send_buf;
+	size_t buf_size = 8 + payload_size;
+	if(payload_size > CHIAKI_CTRL_SEND_PAYLOAD_MAX)
+	{
+		buf = malloc(buf_size);
+		if(!buf)
+		{
+			err = CHIAKI_ERR_MEMORY;
+			goto beach;
+		}
+	}
+
+	*((chiaki_unaligned_uint32_t *)buf) = htonl((uint32_t)payload_size);
+	*((chiaki_unaligned_uint16_t *)(buf + 4)) = htons(type);
+	*((chiaki_unaligned_uint16_t *)(buf + 6)) = 0;
+
 	if(payload && payload_size)
 	{
-		ChiakiErrorCode err;
-		enc = malloc(payload_size);
-		if(!enc)
-			return CHIAKI_ERR_MEMORY;
 		if(ctrl->session->rudp && type == CTRL_MESSAGE_TYPE_LOGIN_PIN_REP)
 		{
 			uint16_t local_counter = ctrl->crypt_counter_local++;
-			err = chiaki_rpcrypt_encrypt(&ctrl->session->rpcrypt, local_counter - 1, payload, enc, payload_size);
+			err = chiaki_rpcrypt_encrypt(&ctrl->session->rpcrypt, local_counter - 1, payload, buf + 8, payload_size);
 		}
 		else
-			err = chiaki_rpcrypt_encrypt(&ctrl->session->rpcrypt, ctrl->crypt_counter_local++, payload, enc, payload_size);
+			err = chiaki_rpcrypt_encrypt(&ctrl->session->rpcrypt, ctrl->crypt_counter_local++, payload, buf + 8, payload_size);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(ctrl->session->log, "Ctrl failed to encrypt payload");
-			free(enc);
-			return err;
+			goto beach;
 		}
 	}
 
-#ifdef __GNUC__
-	__attribute__((aligned(__alignof__(uint32_t))))
-#endif
-	uint8_t header[8];
-	*((uint32_t *)header) = htonl((uint32_t)payload_size);
-	*((uint16_t *)(header + 4)) = htons(type);
-	*((uint16_t *)(header + 6)) = 0;
-
 	if(ctrl->session->rudp)
 	{
-		uint8_t buf_size = 8 + payload_size;
-		uint8_t buf[buf_size];
-		memcpy(buf, header, 8);
-		memcpy(buf + 8, enc, payload_size);
-		ChiakiErrorCode err;
 		err = chiaki_rudp_send_ctrl_message(ctrl->session->rudp, buf, buf_size);
 		if(err != CHIAKI_ERR_SUCCESS)
-		{
 			CHIAKI_LOGE(ctrl->session->log, "Failed to send Ctrl Message");
-			return err;
-		}
+		goto beach;
 	}
-	else
+
+	size_t sent_total = 0;
+	while(sent_total < buf_size)
 	{
-		int sent = send(ctrl->sock, (CHIAKI_SOCKET_BUF_TYPE)header, sizeof(header), 0);
+		int sent = send(ctrl->sock, (CHIAKI_SOCKET_BUF_TYPE)(buf + sent_total), buf_size - sent_total, 0);
 		if(sent < 0)
 		{
-			CHIAKI_LOGE(ctrl->session->log, "Failed to send Ctrl Message Header");
-			return CHIAKI_ERR_NETWORK;
-		}
-
-		if(enc)
-		{
-			sent = send(ctrl->sock, (CHIAKI_SOCKET_BUF_TYPE)enc, payload_size, 0);
-			free(enc);
-			if(sent < 0)
-			{
-				CHIAKI_LOGE(ctrl->session->log, "Failed to send Ctrl Message Payload");
-				return CHIAKI_ERR_NETWORK;
-			}
+			CHIAKI_LOGE(ctrl->session->log, "Failed to send Ctrl Message: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+			err = CHIAKI_ERR_NETWORK;
+			goto beach;
 		}
+		sent_total += (size_t)sent;
 	}
-	return CHIAKI_ERR_SUCCESS;
+
+beach:
+	if(buf != ctrl->send_buf)
+		free(buf);
+	chiaki_mutex_unlock(&ctrl->send_mutex);
+	return err;
 }
 
 CHIAKI_EXPORT ChiakiErrorCode ctrl_message_go_home(ChiakiCtrl *ctrl)
@@ -921,15 +951,15 @@ static void ctrl_message_received_keyboard_open(ChiakiCtrl *ctrl, uint8_t *paylo
 {
 	assert(payload_size >= sizeof(CtrlKeyboardOpenMessage));
 
-	CtrlKeyboardOpenMessage *msg = (CtrlKeyboardOpenMessage *)payload;
-	msg->text_length = ntohl(msg->text_length);
-	assert(payload_size == sizeof(CtrlKeyboardOpenMessage) + msg->text_length);
+	// payload points into the receive buffer and is not necessarily aligned
+	uint32_t text_length = ntohl(*((chiaki_unaligned_uint32_t *)(payload + offsetof(CtrlKeyboardOpenMessage, text_length))));
+	assert(payload_size == sizeof(CtrlKeyboardOpenMessage) + text_length);
 
-	uint8_t *buffer = msg->text_length > 0 ? malloc((size_t)msg->text_length + 1) : NULL;
+	uint8_t *buffer = text_length > 0 ? malloc((size_t)text_length + 1) : NULL;
 	if(buffer)
 	{
-		buffer[msg->text_length] = '\0';
-		memcpy(buffer, payload + sizeof(CtrlKeyboardOpenMessage), msg->text_length);
+		buffer[text_length] = '\0';
+		memcpy(buffer, payload + sizeof(CtrlKeyboardOpenMessage), text_length);
 	}
 
 	ChiakiEvent keyboard_event;
@@ -956,15 +986,14 @@ static void ctrl_message_received_keyboard_text_change(ChiakiCtrl *ctrl, uint8_t
 {
 	assert(payload_size >= sizeof(CtrlKeyboardTextResponseMessage));
 
-	CtrlKeyboardTextResponseMessage *msg = (CtrlKeyboardTextResponseMessage *)payload;
-	msg->text_length1 = ntohl(msg->text_length1);
-	assert(payload_size == sizeof(CtrlKeyboardTextResponseMessage) + msg->text_length1);
+	uint32_t text_length = ntohl(*((chiaki_unaligned_uint32_t *)(payload + offsetof(CtrlKeyboardTextResponseMessage, text_length1))));
+	assert(payload_size == sizeof(CtrlKeyboardTextResponseMessage) + text_length);
 
-	uint8_t *buffer = msg->text_length1 > 0 ? malloc((size_t)msg->text_length1 + 1) : NULL;
+	uint8_t *buffer = text_length > 0 ? malloc((size_t)text_length + 1) : NULL;
 	if(buffer)
 	{
-		buffer[msg->text_length1] = '\0';
-		memcpy(buffer, payload + sizeof(CtrlKeyboardTextResponseMessage), msg->text_length1);
+		buffer[text_length] = '\0';
+		memcpy(buffer, payload + sizeof(CtrlKeyboardTextResponseMessage), text_length);
 	}
 
 	ChiakiEvent keyboard_event;
@@ -1356,6 +1385,7 @@ static ChiakiErrorCode ctrl_connect(ChiakiCtrl *ctrl)
 		ctrl->session->display_sink.cantdisplay_cb(ctrl->session->display_sink.user, true);
 
 	// if we already got more data than the header, put the rest in the buffer.
+	ctrl->recv_buf_start = 0;
 	ctrl->recv_buf_size = received_size - header_size;
 	if(ctrl->recv_buf_size > 0)
 		memcpy(ctrl->recv_buf, buf + header_size, ctrl->recv_buf_size);
@@ -9,121 +9,166 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-int *create_matrix(unsigned int k, unsigned int m)
+static int *create_matrix(unsigned int k, unsigned int m)
 {
 	return cauchy_original_coding_matrix(k, m, CHIAKI_FEC_WORDSIZE);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+CHIAKI_EXPORT void chiaki_fec_matrix_cache_init(ChiakiFecMatrixCache *cache)
 {
-	if(stride < unit_size)
-		return CHIAKI_ERR_INVALID_DATA;
-	int *matrix = create_matrix(k, m);
-	if(!matrix)
-		return CHIAKI_ERR_MEMORY;
+	memset(cache, 0, sizeof(*cache));
+}
 
-	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+CHIAKI_EXPORT void chiaki_fec_matrix_cache_fini(ChiakiFecMatrixCache *cache)
+{
+	for(size_t i=0; i<CHIAKI_FEC_MATRIX_CACHE_SIZE; i++)
+		free(cache->entries[i].matrix);
+}
 
-	int *jerasures = calloc(erasures_count + 1, sizeof(int));
-	if(!jerasures)
+CHIAKI_EXPORT int *chiaki_fec_matrix_cache_get(ChiakiFecMatrixCache *cache, unsigned int k, unsigned int m)
+{
+	cache->uses++;
+	size_t victim = 0;
+	for(size_t i=0; i<CHIAKI_FEC_MATRIX_CACHE_SIZE; i++)
 	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_matrix;
+		if(cache->entries[i].matrix && cache->entries[i].k == k && cache->entries[i].m == m)
+		{
+			cache->entries[i].last_used = cache->uses;
+			return cache->entries[i].matrix;
+		}
+		// empty entries have last_used == 0, so they are taken first
+		if(cache->entries[i].last_used < cache->entries[victim].last_used)
+			victim = i;
 	}
-	memcpy(jerasures, erasures, erasures_count * sizeof(int));
-	jerasures[erasures_count] = -1;
 
-	uint8_t **data_ptrs = calloc(k, sizeof(uint8_t *));
-	if(!data_ptrs)
-	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_jerasures;
-	}
+	int *matrix = create_matrix(k, m);
+	if(!matrix)
+		return NULL;
+	free(cache->entries[victim].matrix);
+	cache->entries[victim].k = k;
+	cache->entries[victim].m = m;
+	cache->entries[victim].matrix = matrix;
+	cache->entries[victim].last_used = cache->uses;
+	return matrix;
+}
 
-	uint8_t **coding_ptrs = calloc(m, sizeof(uint8_t *));
-	if(!coding_ptrs)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encoder_init(ChiakiFecEncoder *encoder, unsigned int k, unsigned int m, size_t unit_size, ChiakiFecMatrixCache *cache)
+{
+	encoder->k = k;
+	encoder->m = m;
+	encoder->unit_size = unit_size;
+
+	encoder->matrix = malloc(k * m * sizeof(int));
+	if(!encoder->matrix)
+		return CHIAKI_ERR_MEMORY;
+	int *matrix = cache ? chiaki_fec_matrix_cache_get(cache, k, m) : create_matrix(k, m);
+	if(!matrix)
 	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_data_ptrs;
+		free(encoder->matrix);
+		return CHIAKI_ERR_MEMORY;
 	}
+	memcpy(encoder->matrix, matrix, k * m * sizeof(int));
+	if(!cache)
+		free(matrix);
 
-	for(size_t i=0; i<k+m; i++)
+	encoder->data_ptrs = calloc(k + m, sizeof(uint8_t *));
+	if(!encoder->data_ptrs)
 	{
-		uint8_t *buf_ptr = frame_buf + stride * i;
-		if(i < k)
-			data_ptrs[i] = buf_ptr;
-		else
-			coding_ptrs[i - k] = buf_ptr;
+		free(encoder->matrix);
+		return CHIAKI_ERR_MEMORY;
 	}
+	return CHIAKI_ERR_SUCCESS;
+}
 
-	int res = jerasure_matrix_decode(k, m, CHIAKI_FEC_WORDSIZE, matrix, 0, jerasures,
-									 (char **)data_ptrs, (char **)coding_ptrs, unit_size);
-
-	if(res < 0)
-		err = CHIAKI_ERR_FEC_FAILED;
-	else
-		err = CHIAKI_ERR_SUCCESS;
-
-	free(coding_ptrs);
-error_data_ptrs:
-	free(data_ptrs);
-error_jerasures:
-	free(jerasures);
-error_matrix:
-	free(matrix);
-	return err;
+CHIAKI_EXPORT void chiaki_fec_encoder_fini(ChiakiFecEncoder *encoder)
+{
+	free(encoder->data_ptrs);
+	free(encoder->matrix);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encoder_encode(ChiakiFecEncoder *encoder, uint8_t *frame_buf, size_t stride)
 {
-	if(stride < unit_size)
+	if(stride < encoder->unit_size)
 		return CHIAKI_ERR_INVALID_DATA;
-	int *matrix = create_matrix(k, m);
-	if(!matrix)
-		return CHIAKI_ERR_MEMORY;
+	for(size_t i=0; i<encoder->k + encoder->m; i++)
+		encoder->data_ptrs[i] = frame_buf + stride * i;
+	chiaki_fec_encoder_encode_units(encoder, encoder->data_ptrs, encoder->data_ptrs + encoder->k);
+	return CHIAKI_ERR_SUCCESS;
+}
 
-	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+CHIAKI_EXPORT void chiaki_fec_encoder_encode_units(ChiakiFecEncoder *encoder, uint8_t *const *data, uint8_t *const *coding)
+{
+	jerasure_matrix_encode(encoder->k, encoder->m, CHIAKI_FEC_WORDSIZE, encoder->matrix,
+							(char **)data, (char **)coding, encoder->unit_size);
+}
 
-	uint8_t **data_ptrs = calloc(k, sizeof(uint8_t *));
-	if(!data_ptrs)
-	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_matrix;
-	}
+CHIAKI_EXPORT void chiaki_fec_decoder_init(ChiakiFecDecoder *decoder)
+{
+	chiaki_fec_matrix_cache_init(&decoder->cache);
+	decoder->erasures = NULL;
+	decoder->ptrs = NULL;
+	decoder->units_max = 0;
+}
 
-	uint8_t **coding_ptrs = calloc(m, sizeof(uint8_t *));
-	if(!coding_ptrs)
-	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_data_ptrs;
-	}
+CHIAKI_EXPORT void chiaki_fec_decoder_fini(ChiakiFecDecoder *decoder)
+{
+	chiaki_fec_matrix_cache_fini(&decoder->cache);
+	free(decoder->erasures);
+	free(decoder->ptrs);
+}
 
-	for(size_t i=0; i<m; i++)
-	{
-		coding_ptrs[i] = calloc(unit_size, sizeof(uint8_t));
-		if(!coding_ptrs[i])
-			goto error_coding_ptrs;
-	}
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decoder_decode(ChiakiFecDecoder *decoder, uint8_t *frame_buf, size_t unit_size, size_t stride,
+		unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+{
+	if(stride < unit_size || erasures_count > k + m)
+		return CHIAKI_ERR_INVALID_DATA;
 
-	for(size_t i=0; i<k; i++)
+	if(decoder->units_max < k + m)
 	{
-		uint8_t *buf_ptr = frame_buf + stride * i;
-		data_ptrs[i] = buf_ptr;
+		// erasures need one more for the terminating -1
+		int *erasures_new = realloc(decoder->erasures, (k + m + 1) * sizeof(int));
+		if(!erasures_new)
+			return CHIAKI_ERR_MEMORY;
+		decoder->erasures = erasures_new;
+		uint8_t **ptrs_new = realloc(decoder->ptrs, (k + m) * sizeof(uint8_t *));
+		if(!ptrs_new)
+			return CHIAKI_ERR_MEMORY;
+		decoder->ptrs = ptrs_new;
+		decoder->units_max = k + m;
 	}
 
-	jerasure_matrix_encode(k, m, CHIAKI_FEC_WORDSIZE, matrix,
-							(char **)data_ptrs, (char **)coding_ptrs, unit_size);
+	int *matrix = chiaki_fec_matrix_cache_get(&decoder->cache, k, m);
+	if(!matrix)
+		return CHIAKI_ERR_MEMORY;
+
+	for(size_t i=0; i<erasures_count; i++)
+		decoder->erasures[i] = (int)erasures[i];
+	decoder->erasures[erasures_count] = -1;
+
+	for(size_t i=0; i<k+m; i++)
+		decoder->ptrs[i] = frame_buf + stride * i;
+
+	int res = jerasure_matrix_decode(k, m, CHIAKI_FEC_WORDSIZE, matrix, 0, decoder->erasures,
+									 (char **)decoder->ptrs, (char **)(decoder->ptrs + k), unit_size);
+	return res < 0 ? CHIAKI_ERR_FEC_FAILED : CHIAKI_ERR_SUCCESS;
+}
 
-	for(int i=0; i<m; i++)
-		memcpy(frame_buf + k * unit_size + i * unit_size, coding_ptrs[i], unit_size);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+{
+	ChiakiFecDecoder decoder;
+	chiaki_fec_decoder_init(&decoder);
+	ChiakiErrorCode err = chiaki_fec_decoder_decode(&decoder, frame_buf, unit_size, stride, k, m, erasures, erasures_count);
+	chiaki_fec_decoder_fini(&decoder);
+	return err;
+}
 
-for(int i=0; i<m; i++)
-	free(coding_ptrs[i]);
-error_coding_ptrs:
-	free(coding_ptrs);
-error_data_ptrs:
-	free(data_ptrs);
-error_matrix:
-	free(matrix);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m)
+{
+	ChiakiFecEncoder encoder;
+	ChiakiErrorCode err = chiaki_fec_encoder_init(&encoder, k, m, unit_size, NULL);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = chiaki_fec_encoder_encode(&encoder, frame_buf, stride);
+	chiaki_fec_encoder_fini(&encoder);
 	return err;
 }
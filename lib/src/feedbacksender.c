@@ -1,6 +1,9 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/feedbacksender.h>
+#include <chiaki/time.h>
+
+#include <string.h>
 
 #define FEEDBACK_STATE_TIMEOUT_MIN_MS 8 // minimum time to wait between sending 2 packets
 #define FEEDBACK_STATE_TIMEOUT_MAX_MS 200 // maximum time to wait between sending 2 packets
@@ -20,6 +23,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *
 	feedback_sender->state_seq_num = 0;
 
 	feedback_sender->history_seq_num = 0;
+	feedback_sender->should_stop = false;
+	feedback_sender->controller_state_changed = false;
+	memset(&feedback_sender->stats, 0, sizeof(feedback_sender->stats));
+	feedback_sender->start_us = chiaki_time_now_monotonic_us();
 	ChiakiErrorCode err = chiaki_feedback_history_buffer_init(&feedback_sender->history_buf, FEEDBACK_HISTORY_BUFFER_SIZE);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
@@ -74,6 +81,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(Chiaki
 
 	feedback_sender->controller_state = *state;
 	feedback_sender->controller_state_changed = true;
+	feedback_sender->stats.state_changes++;
 
 	chiaki_mutex_unlock(&feedback_sender->state_mutex);
 	chiaki_cond_signal(&feedback_sender->state_cond);
@@ -81,6 +89,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(Chiaki
 	return CHIAKI_ERR_SUCCESS;
 }
 
+CHIAKI_EXPORT void chiaki_feedback_sender_get_stats(ChiakiFeedbackSender *feedback_sender, ChiakiFeedbackSenderStats *stats)
+{
+	chiaki_mutex_lock(&feedback_sender->state_mutex);
+	*stats = feedback_sender->stats;
+	chiaki_mutex_unlock(&feedback_sender->state_mutex);
+
+	stats->history_events_per_packet = stats->history_packets
+		? (double)stats->history_events / (double)stats->history_packets
+		: 0.0;
+	uint64_t elapsed_us = chiaki_time_now_monotonic_us() - feedback_sender->start_us;
+	stats->packets_per_second = elapsed_us
+		? (double)(stats->state_packets + stats->history_packets) * 1000000.0 / (double)elapsed_us
+		: 0.0;
+}
+
 static bool controller_state_equals_for_feedback_state(ChiakiControllerState *a, ChiakiControllerState *b)
 {
 	if(!(a->left_x == b->left_x
@@ -123,8 +146,12 @@ static void feedback_sender_send_state(ChiakiFeedbackSender *feedback_sender)
 	state.orient_w = feedback_sender->controller_state.orient_w;
 
 	ChiakiErrorCode err = chiaki_takion_send_feedback_state(feedback_sender->takion, feedback_sender->state_seq_num++, &state);
+	feedback_sender->stats.state_packets++;
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
 		CHIAKI_LOGE(feedback_sender->log, "FeedbackSender failed to send Feedback State");
+		feedback_sender->stats.send_errors++;
+	}
 }
 
 static bool controller_state_equals_for_feedback_history(ChiakiControllerState *a, ChiakiControllerState *b)
@@ -157,7 +184,26 @@ static void feedback_sender_send_history_packet(ChiakiFeedbackSender *feedback_s
 
 	//CHIAKI_LOGD(feedback_sender->log, "Feedback History:");
 	//chiaki_log_hexdump(feedback_sender->log, CHIAKI_LOG_DEBUG, buf, buf_size);
-	chiaki_takion_send_feedback_history(feedback_sender->takion, feedback_sender->history_seq_num++, buf, buf_size);
+	err = chiaki_takion_send_feedback_history(feedback_sender->takion, feedback_sender->history_seq_num++, buf, buf_size);
+	feedback_sender->stats.history_packets++;
+	if(err != CHIAKI_ERR_SUCCESS)
+		feedback_sender->stats.send_errors++;
+}
+
+/**
+ * Push an event and only send the history once it holds as many new events as fit,
+ * so all events of one tick share as few packets as possible.
+ *
+ * @param pending number of events pushed since the last history packet
+ */
+static void feedback_sender_push_history_event(ChiakiFeedbackSender *feedback_sender, ChiakiFeedbackHistoryEvent *event, size_t *pending)
+{
+	chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, event);
+	feedback_sender->stats.history_events++;
+	if(++(*pending) < feedback_sender->history_buf.size)
+		return;
+	feedback_sender_send_history_packet(feedback_sender);
+	*pending = 0;
 }
 
 static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
@@ -166,6 +212,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 	ChiakiControllerState *state_now = &feedback_sender->controller_state;
 	uint64_t buttons_prev = state_prev->buttons;
 	uint64_t buttons_now = state_now->buttons;
+	size_t pending = 0;
 	for(uint8_t i=0; i<CHIAKI_CONTROLLER_BUTTONS_COUNT; i++)
 	{
 		uint64_t button_id = 1 << i;
@@ -180,8 +227,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 				CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format button history event for button id %llu", (unsigned long long)button_id);
 				continue;
 			}
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history_event(feedback_sender, &event, &pending);
 		}
 	}
 
@@ -191,8 +237,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 		ChiakiErrorCode err = chiaki_feedback_history_event_set_button(&event, CHIAKI_CONTROLLER_ANALOG_BUTTON_L2, state_now->l2_state);
 		if(err == CHIAKI_ERR_SUCCESS)
 		{
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history_event(feedback_sender, &event, &pending);
 		}
 		else
 			CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format button history event for L2");
@@ -204,8 +249,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 		ChiakiErrorCode err = chiaki_feedback_history_event_set_button(&event, CHIAKI_CONTROLLER_ANALOG_BUTTON_R2, state_now->r2_state);
 		if(err == CHIAKI_ERR_SUCCESS)
 		{
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history_event(feedback_sender, &event, &pending);
 		}
 		else
 			CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format button history event for R2");
@@ -218,8 +262,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 			ChiakiFeedbackHistoryEvent event;
 			chiaki_feedback_history_event_set_touchpad(&event, false, (uint8_t)state_prev->touches[i].id,
 					state_prev->touches[i].x, state_prev->touches[i].y);
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history_event(feedback_sender, &event, &pending);
 		}
 		else if(state_now->touches[i].id >= 0
 				&& (state_prev->touches[i].id != state_now->touches[i].id
@@ -229,10 +272,12 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 			ChiakiFeedbackHistoryEvent event;
 			chiaki_feedback_history_event_set_touchpad(&event, true, (uint8_t)state_now->touches[i].id,
 					state_now->touches[i].x, state_now->touches[i].y);
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history_event(feedback_sender, &event, &pending);
 		}
 	}
+
+	if(pending)
+		feedback_sender_send_history_packet(feedback_sender);
 }
 
 static bool state_cond_check(void *user)
@@ -241,6 +286,12 @@ static bool state_cond_check(void *user)
 	return feedback_sender->should_stop || feedback_sender->controller_state_changed;
 }
 
+static bool stop_cond_check(void *user)
+{
+	ChiakiFeedbackSender *feedback_sender = user;
+	return feedback_sender->should_stop;
+}
+
 static void *feedback_sender_thread_func(void *user)
 {
 	ChiakiFeedbackSender *feedback_sender = user;
@@ -249,12 +300,27 @@ static void *feedback_sender_thread_func(void *user)
 	if(err != CHIAKI_ERR_SUCCESS)
 		return NULL;
 
-	uint64_t next_timeout = FEEDBACK_STATE_TIMEOUT_MAX_MS;
+	uint64_t last_sent_us = chiaki_time_now_monotonic_us();
 	while(true)
 	{
-		err = chiaki_cond_timedwait_pred(&feedback_sender->state_cond, &feedback_sender->state_mutex, next_timeout, state_cond_check, feedback_sender);
-		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
-			break;
+		// changes are sent FEEDBACK_STATE_TIMEOUT_MIN_MS after the last packet at the earliest,
+		// everything that changes until then goes out together.
+		// Without changes, the state is repeated every FEEDBACK_STATE_TIMEOUT_MAX_MS.
+		uint64_t deadline_us = last_sent_us + (feedback_sender->controller_state_changed
+			? FEEDBACK_STATE_TIMEOUT_MIN_MS
+			: FEEDBACK_STATE_TIMEOUT_MAX_MS) * 1000;
+		uint64_t now_us = chiaki_time_now_monotonic_us();
+		if(now_us < deadline_us)
+		{
+			uint64_t timeout_ms = (deadline_us - now_us + 999) / 1000;
+			err = chiaki_cond_timedwait_pred(&feedback_sender->state_cond, &feedback_sender->state_mutex, timeout_ms,
+					feedback_sender->controller_state_changed ? stop_cond_check : state_cond_check, feedback_sender);
+			if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
+				break;
+			if(feedback_sender->should_stop)
+				break;
+			continue;
+		}
 
 		if(feedback_sender->should_stop)
 			break;
@@ -264,7 +330,6 @@ static void *feedback_sender_thread_func(void *user)
 
 		if(feedback_sender->controller_state_changed)
 		{
-			// TODO: FEEDBACK_STATE_TIMEOUT_MIN_MS
 			feedback_sender->controller_state_changed = false;
 
 			// don't need to send feedback state if nothing relevant changed
@@ -274,11 +339,22 @@ static void *feedback_sender_thread_func(void *user)
 			send_feedback_history = !controller_state_equals_for_feedback_history(&feedback_sender->controller_state, &feedback_sender->controller_state_prev);
 		} // else: timeout
 
+		// state and history of one tick leave together
+		chiaki_takion_send_batch_begin(feedback_sender->takion);
 		if(send_feedback_state)
 			feedback_sender_send_state(feedback_sender);
 
 		if(send_feedback_history)
 			feedback_sender_send_history(feedback_sender);
+		// packets queued in the batch only fail when it is flushed here
+		if(chiaki_takion_send_batch_end(feedback_sender->takion) != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(feedback_sender->log, "FeedbackSender failed to send Feedback batch");
+			feedback_sender->stats.send_errors++;
+		}
+
+		if(send_feedback_state || send_feedback_history)
+			last_sent_us = now_us;
 
 		feedback_sender->controller_state_prev = feedback_sender->controller_state;
 	}
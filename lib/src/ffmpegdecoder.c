@@ -1,8 +1,22 @@
 
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/time.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/pixdesc.h>
+#include <libavutil/cpu.h>
+#include <libavutil/imgutils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_POOL_BUF_SIZE_MIN (256 * 1024)
+#define SLICE_THREADS_MAX 16
+#define FRAME_POOL_PREALLOC 6
+#define FRAME_BUFFER_ALIGN 64
+#define FRAME_BUFFER_PADDING (16 + FRAME_BUFFER_ALIGN)
+
+static void *ffmpeg_decoder_thread_func(void *user);
 
 static enum AVCodecID chiaki_codec_av_codec_id(ChiakiCodec codec)
 {
@@ -16,8 +30,87 @@ static enum AVCodecID chiaki_codec_av_codec_id(ChiakiCodec codec)
 	}
 }
 
+static void ffmpeg_decoder_frame_pool_reset(ChiakiFfmpegDecoder *decoder, int format, int width, int height, size_t buf_size)
+{
+	// frames still referencing buffers of the old pool keep it alive until they are freed
+	if(decoder->frame_pool)
+		av_buffer_pool_uninit(&decoder->frame_pool);
+	decoder->frame_pool_format = format;
+	decoder->frame_pool_width = width;
+	decoder->frame_pool_height = height;
+	decoder->frame_pool_buf_size = buf_size;
+	decoder->frame_pool = av_buffer_pool_init(buf_size, NULL);
+	if(!decoder->frame_pool)
+		return;
+
+	// allocate everything now instead of during the first frames
+	AVBufferRef *bufs[FRAME_POOL_PREALLOC] = { 0 };
+	for(size_t i=0; i<FRAME_POOL_PREALLOC; i++)
+		bufs[i] = av_buffer_pool_get(decoder->frame_pool);
+	for(size_t i=0; i<FRAME_POOL_PREALLOC; i++)
+		av_buffer_unref(&bufs[i]);
+	CHIAKI_LOGV(decoder->log, "Allocated frame pool for %dx%d %s, %llu bytes per frame",
+			width, height, av_get_pix_fmt_name(format), (unsigned long long)buf_size);
+}
+
+/**
+ * Allocate all planes of a software frame from one buffer of decoder->frame_pool
+ */
+static int ffmpeg_decoder_get_buffer2(AVCodecContext *codec_context, AVFrame *frame, int flags)
+{
+	ChiakiFfmpegDecoder *decoder = codec_context->opaque;
+	if(!(codec_context->codec->capabilities & AV_CODEC_CAP_DR1))
+		return avcodec_default_get_buffer2(codec_context, frame, flags);
+
+	int width = frame->width;
+	int height = frame->height;
+	int linesize_align[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2(codec_context, &width, &height, linesize_align);
+
+	int linesizes[4];
+	if(av_image_fill_linesizes(linesizes, frame->format, width) < 0)
+		return avcodec_default_get_buffer2(codec_context, frame, flags);
+	// the codec's SIMD may need a larger alignment than ours, e.g. with AVX-512
+	for(size_t i=0; i<4; i++)
+		linesizes[i] = FFALIGN(linesizes[i], FFMAX(FRAME_BUFFER_ALIGN, linesize_align[i]));
+
+	uint8_t *data[4];
+	int size = av_image_fill_pointers(data, frame->format, height, NULL, linesizes);
+	if(size < 0)
+		return avcodec_default_get_buffer2(codec_context, frame, flags);
+
+	if(!decoder->frame_pool
+			|| decoder->frame_pool_format != frame->format
+			|| decoder->frame_pool_width != width
+			|| decoder->frame_pool_height != height)
+		ffmpeg_decoder_frame_pool_reset(decoder, frame->format, width, height, (size_t)size + FRAME_BUFFER_PADDING);
+	if(!decoder->frame_pool)
+		return AVERROR(ENOMEM);
+
+	AVBufferRef *buf = av_buffer_pool_get(decoder->frame_pool);
+	if(!buf)
+		return AVERROR(ENOMEM);
+	av_image_fill_pointers(data, frame->format, height, buf->data, linesizes);
+	for(size_t i=0; i<4; i++)
+	{
+		frame->data[i] = data[i];
+		frame->linesize[i] = linesizes[i];
+	}
+	frame->buf[0] = buf;
+	frame->extended_data = frame->data;
+	return 0;
+}
+
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_low_latency_default(ChiakiFfmpegDecoderLowLatency *low_latency)
+{
+	low_latency->slice_threads = 0;
+	low_latency->skip_loop_filter_queue = 2;
+	low_latency->skip_frame_queue = 3;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
 		ChiakiCodec codec, const char *hw_decoder_name, AVBufferRef *hw_device_ctx,
+		const ChiakiFfmpegDecoderLowLatency *low_latency,
 		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user)
 {
 	decoder->log = log;
@@ -26,11 +119,36 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 	decoder->hdr_enabled = codec == CHIAKI_CODEC_H265_HDR;
 	decoder->frames_lost = 0;
 	decoder->frame_recovered = false;
+	decoder->threaded = false;
+	decoder->queue = NULL;
+	decoder->samples_dropped = 0;
+	decoder->queue_frames_lost = 0;
+	decoder->sample_pool = NULL;
+	decoder->sample_pool_buf_size = 0;
+	decoder->packet = NULL;
+	decoder->frames[0] = NULL;
+	decoder->frames[1] = NULL;
+	decoder->frame_pool = NULL;
+	decoder->frame_pool_buf_size = 0;
+	decoder->low_latency = low_latency && !hw_decoder_name;
+	if(decoder->low_latency)
+		decoder->low_latency_config = *low_latency;
+	decoder->overloaded = false;
+	decoder->decode_us = 0;
 
 	ChiakiErrorCode err = chiaki_mutex_init(&decoder->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
+	decoder->packet = av_packet_alloc();
+	decoder->frames[0] = av_frame_alloc();
+	decoder->frames[1] = av_frame_alloc();
+	if(!decoder->packet || !decoder->frames[0] || !decoder->frames[1])
+	{
+		CHIAKI_LOGE(log, "Failed to alloc AVPacket/AVFrames");
+		goto error_mutex;
+	}
+
 	decoder->hw_device_ctx = hw_device_ctx ? av_buffer_ref(hw_device_ctx) : NULL;
 	decoder->hw_pix_fmt = AV_PIX_FMT_NONE;
 
@@ -86,6 +204,22 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 		CHIAKI_LOGI(log, "Using hardware decoder \"%s\" with pix_fmt=%s", hw_decoder_name, av_get_pix_fmt_name(decoder->hw_pix_fmt));
 	}
 
+	if(decoder->low_latency)
+	{
+		int slice_threads = decoder->low_latency_config.slice_threads;
+		if(slice_threads <= 0)
+			slice_threads = av_cpu_count();
+		if(slice_threads > SLICE_THREADS_MAX)
+			slice_threads = SLICE_THREADS_MAX;
+		decoder->codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+		decoder->codec_context->thread_type = FF_THREAD_SLICE;
+		decoder->codec_context->thread_count = slice_threads;
+		// no frame threads, so get_buffer2 is never called concurrently
+		decoder->codec_context->opaque = decoder;
+		decoder->codec_context->get_buffer2 = ffmpeg_decoder_get_buffer2;
+		CHIAKI_LOGI(log, "Using low latency software decoding with %d slice threads", slice_threads);
+	}
+
 	if(avcodec_open2(decoder->codec_context, decoder->av_codec, NULL) < 0)
 	{
 		CHIAKI_LOGE(log, "Failed to open codec context");
@@ -98,28 +232,89 @@ error_codec_context:
 		av_buffer_unref(&decoder->hw_device_ctx);
 	avcodec_free_context(&decoder->codec_context);
 error_mutex:
+	av_packet_free(&decoder->packet);
+	av_frame_free(&decoder->frames[0]);
+	av_frame_free(&decoder->frames[1]);
 	chiaki_mutex_fini(&decoder->mutex);
 	return CHIAKI_ERR_UNKNOWN;
 }
 
 CHIAKI_EXPORT void chiaki_ffmpeg_decoder_fini(ChiakiFfmpegDecoder *decoder)
 {
+	if(decoder->threaded)
+	{
+		chiaki_mutex_lock(&decoder->queue_mutex);
+		decoder->queue_should_stop = true;
+		chiaki_cond_signal(&decoder->queue_cond);
+		chiaki_mutex_unlock(&decoder->queue_mutex);
+		chiaki_thread_join(&decoder->decode_thread, NULL);
+
+		for(size_t i=0; i<decoder->queue_count; i++)
+			av_buffer_unref(&decoder->queue[(decoder->queue_begin + i) % decoder->queue_size].buf);
+		free(decoder->queue);
+		chiaki_cond_fini(&decoder->queue_cond);
+		chiaki_mutex_fini(&decoder->queue_mutex);
+		decoder->threaded = false;
+	}
 	avcodec_close(decoder->codec_context);
 	avcodec_free_context(&decoder->codec_context);
 	if(decoder->hw_device_ctx)
 		av_buffer_unref(&decoder->hw_device_ctx);
+	if(decoder->sample_pool)
+		av_buffer_pool_uninit(&decoder->sample_pool);
+	if(decoder->frame_pool)
+		av_buffer_pool_uninit(&decoder->frame_pool);
+	av_packet_free(&decoder->packet);
+	av_frame_free(&decoder->frames[0]);
+	av_frame_free(&decoder->frames[1]);
 }
 
-CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_start_thread(ChiakiFfmpegDecoder *decoder, size_t queue_size, ChiakiFfmpegDecoderDropPolicy drop_policy)
 {
-	ChiakiFfmpegDecoder *decoder = user;
+	if(decoder->threaded || !queue_size)
+		return CHIAKI_ERR_INVALID_DATA;
 
-	chiaki_mutex_lock(&decoder->mutex);
-	decoder->frames_lost += frames_lost;
-	decoder->frame_recovered = frame_recovered;
-	AVPacket *packet = av_packet_alloc();
-	packet->data = buf;
-	packet->size = buf_size;
+	decoder->queue = calloc(queue_size, sizeof(ChiakiFfmpegDecoderSample));
+	if(!decoder->queue)
+		return CHIAKI_ERR_MEMORY;
+	decoder->queue_size = queue_size;
+	decoder->queue_begin = 0;
+	decoder->queue_count = 0;
+	decoder->queue_should_stop = false;
+	decoder->drop_policy = drop_policy;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&decoder->queue_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_queue;
+
+	err = chiaki_cond_init(&decoder->queue_cond, &decoder->queue_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_queue_mutex;
+
+	err = chiaki_thread_create(&decoder->decode_thread, ffmpeg_decoder_thread_func, decoder);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_queue_cond;
+
+	chiaki_thread_set_name(&decoder->decode_thread, "Chiaki FFMPEG Decoder");
+	decoder->threaded = true;
+	return CHIAKI_ERR_SUCCESS;
+
+error_queue_cond:
+	chiaki_cond_fini(&decoder->queue_cond);
+error_queue_mutex:
+	chiaki_mutex_fini(&decoder->queue_mutex);
+error_queue:
+	free(decoder->queue);
+	decoder->queue = NULL;
+	return err;
+}
+
+/**
+ * Push packet into the codec, must be called with decoder->mutex locked
+ */
+static bool ffmpeg_decoder_send_packet(ChiakiFfmpegDecoder *decoder, AVPacket *packet)
+{
+	uint64_t start_us = chiaki_time_now_monotonic_us();
 	int r;
 send_packet:
 	r = avcodec_send_packet(decoder->codec_context, packet);
@@ -128,18 +323,13 @@ send_packet:
 		if(r == AVERROR(EAGAIN))
 		{
 			CHIAKI_LOGE(decoder->log, "AVCodec internal buffer is full removing frames before pushing");
-			AVFrame *frame = av_frame_alloc();
-			if(!frame)
-			{
-				CHIAKI_LOGE(decoder->log, "Failed to alloc AVFrame");
-				goto hell;
-			}
+			AVFrame *frame = decoder->frames[0];
 			r = avcodec_receive_frame(decoder->codec_context, frame);
-			av_frame_free(&frame);
+			av_frame_unref(frame);
 			if(r != 0)
 			{
 				CHIAKI_LOGE(decoder->log, "Failed to pull frame");
-				goto hell;
+				return false;
 			}
 			goto send_packet;
 		}
@@ -148,64 +338,280 @@ send_packet:
 			char errbuf[128];
 			av_make_error_string(errbuf, sizeof(errbuf), r);
 			CHIAKI_LOGE(decoder->log, "Failed to push frame: %s", errbuf);
-			goto hell;
+			return false;
 		}
 	}
-	av_packet_free(&packet);
-	chiaki_mutex_unlock(&decoder->mutex);
-
-	decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
+	// without frame threading, the frame is decoded right in avcodec_send_packet()
+	decoder->decode_us = chiaki_time_now_monotonic_us() - start_us;
 	return true;
-hell:
-	av_packet_free(&packet);
-	chiaki_mutex_unlock(&decoder->mutex);
-	return false;
 }
 
-CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder, int32_t *frames_lost)
+/**
+ * Trade quality for speed while the decode thread is behind, must be called with decoder->mutex locked
+ *
+ * @param backlog number of samples still queued after the one about to be decoded
+ */
+static void ffmpeg_decoder_update_overload(ChiakiFfmpegDecoder *decoder, size_t backlog)
 {
-	chiaki_mutex_lock(&decoder->mutex);
-	// always try to pull as much as possible and return only the very last frame
-	AVFrame *frame_last = NULL;
-	AVFrame *frame = NULL;
-	while(true)
+	if(!decoder->low_latency)
+		return;
+	ChiakiFfmpegDecoderLowLatency *config = &decoder->low_latency_config;
+	bool skip_loop_filter = config->skip_loop_filter_queue && backlog >= config->skip_loop_filter_queue;
+	bool skip_frame = config->skip_frame_queue && backlog >= config->skip_frame_queue;
+	if(skip_loop_filter || skip_frame)
+	{
+		if(!decoder->overloaded)
+			CHIAKI_LOGW(decoder->log, "Decoder is %llu samples behind, degrading quality to catch up", (unsigned long long)backlog);
+		decoder->overloaded = true;
+	}
+	else if(decoder->overloaded && !backlog)
+	{
+		// only go back to full quality once the queue has been drained
+		CHIAKI_LOGI(decoder->log, "Decoder caught up, restoring full quality");
+		decoder->overloaded = false;
+	}
+	else
+		return;
+
+	decoder->codec_context->skip_loop_filter = skip_loop_filter ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+	decoder->codec_context->skip_frame = skip_frame ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+}
+
+/**
+ * Copy a sample into a padded buffer from the sample pool, only called from the receiving thread.
+ * The codec takes over the reference, so neither the queue nor the synchronous path allocates once the pool is warm.
+ */
+static AVBufferRef *ffmpeg_decoder_sample_buf_alloc(ChiakiFfmpegDecoder *decoder, uint8_t *buf, size_t buf_size)
+{
+	if(!decoder->sample_pool || buf_size > decoder->sample_pool_buf_size)
 	{
-		AVFrame *next_frame;
-		if(frame_last)
+		size_t pool_buf_size = decoder->sample_pool_buf_size ? decoder->sample_pool_buf_size : SAMPLE_POOL_BUF_SIZE_MIN;
+		while(pool_buf_size < buf_size)
+			pool_buf_size *= 2;
+		// buffers still held by the queue or the codec stay valid, the old pool is freed when the last one is returned
+		if(decoder->sample_pool)
+			av_buffer_pool_uninit(&decoder->sample_pool);
+		decoder->sample_pool = av_buffer_pool_init(pool_buf_size + AV_INPUT_BUFFER_PADDING_SIZE, NULL);
+		if(!decoder->sample_pool)
 		{
-			av_frame_unref(frame_last);
-			next_frame = frame_last;
+			decoder->sample_pool_buf_size = 0;
+			return NULL;
 		}
-		else
+		decoder->sample_pool_buf_size = pool_buf_size;
+	}
+
+	AVBufferRef *ref = av_buffer_pool_get(decoder->sample_pool);
+	if(!ref)
+		return NULL;
+	memcpy(ref->data, buf, buf_size);
+	memset(ref->data + buf_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	return ref;
+}
+
+static bool ffmpeg_decoder_queue_push(ChiakiFfmpegDecoder *decoder, uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered)
+{
+	AVBufferRef *ref = ffmpeg_decoder_sample_buf_alloc(decoder, buf, buf_size);
+	if(!ref)
+	{
+		CHIAKI_LOGE(decoder->log, "Failed to get buffer for sample from pool");
+		return false;
+	}
+
+	bool evicted = false;
+	chiaki_mutex_lock(&decoder->queue_mutex);
+	if(decoder->queue_count == decoder->queue_size)
+	{
+		decoder->samples_dropped++;
+		if(decoder->drop_policy == CHIAKI_FFMPEG_DECODER_DROP_NEWEST)
 		{
-			next_frame = av_frame_alloc();
-			if(!next_frame)
-				break;
+			decoder->queue_frames_lost += frames_lost;
+			chiaki_mutex_unlock(&decoder->queue_mutex);
+			av_buffer_unref(&ref);
+			CHIAKI_LOGW(decoder->log, "Decode queue is full, dropping incoming sample");
+			return false;
 		}
-		frame_last = frame;
-		frame = next_frame;
+		ChiakiFfmpegDecoderSample *oldest = &decoder->queue[decoder->queue_begin];
+		decoder->queue_frames_lost += oldest->frames_lost + 1;
+		av_buffer_unref(&oldest->buf);
+		decoder->queue_begin = (decoder->queue_begin + 1) % decoder->queue_size;
+		decoder->queue_count--;
+		evicted = true;
+		CHIAKI_LOGW(decoder->log, "Decode queue is full, dropped oldest sample");
+	}
+
+	ChiakiFfmpegDecoderSample *sample = &decoder->queue[(decoder->queue_begin + decoder->queue_count) % decoder->queue_size];
+	sample->buf = ref;
+	sample->buf_size = buf_size;
+	sample->frames_lost = frames_lost + decoder->queue_frames_lost;
+	sample->frame_recovered = frame_recovered;
+	decoder->queue_frames_lost = 0;
+	decoder->queue_count++;
+	chiaki_cond_signal(&decoder->queue_cond);
+	chiaki_mutex_unlock(&decoder->queue_mutex);
+	// the dropped sample may have been a reference, so let the session request recovery, even though this one is decoded
+	return !evicted;
+}
+
+static bool ffmpeg_decoder_queue_check_pred(void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+	return decoder->queue_should_stop || decoder->queue_count;
+}
+
+static void *ffmpeg_decoder_thread_func(void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&decoder->queue_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return NULL;
+
+	while(true)
+	{
+		err = chiaki_cond_wait_pred(&decoder->queue_cond, &decoder->queue_mutex, ffmpeg_decoder_queue_check_pred, decoder);
+		if(err != CHIAKI_ERR_SUCCESS || decoder->queue_should_stop)
+			break;
+
+		ChiakiFfmpegDecoderSample sample = decoder->queue[decoder->queue_begin];
+		decoder->queue_begin = (decoder->queue_begin + 1) % decoder->queue_size;
+		decoder->queue_count--;
+		size_t backlog = decoder->queue_count;
+		chiaki_mutex_unlock(&decoder->queue_mutex);
+
+		chiaki_mutex_lock(&decoder->mutex);
+		ffmpeg_decoder_update_overload(decoder, backlog);
+		decoder->frames_lost += sample.frames_lost;
+		decoder->frame_recovered = sample.frame_recovered;
+		AVPacket *packet = decoder->packet;
+		// the packet takes over the reference, so the codec can keep the data without copying
+		packet->buf = sample.buf;
+		packet->data = sample.buf->data;
+		packet->size = sample.buf_size;
+		bool succ = ffmpeg_decoder_send_packet(decoder, packet);
+		av_packet_unref(packet);
+		if(!succ)
+			decoder->frames_lost++;
+		chiaki_mutex_unlock(&decoder->mutex);
+
+		if(succ)
+			decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
+
+		chiaki_mutex_lock(&decoder->queue_mutex);
+	}
+
+	chiaki_mutex_unlock(&decoder->queue_mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+
+	if(decoder->threaded)
+		return ffmpeg_decoder_queue_push(decoder, buf, buf_size, frames_lost, frame_recovered);
+
+	// a packet without a reference would be copied into a freshly allocated one by avcodec_send_packet()
+	AVBufferRef *ref = ffmpeg_decoder_sample_buf_alloc(decoder, buf, buf_size);
+	if(!ref)
+	{
+		CHIAKI_LOGE(decoder->log, "Failed to get buffer for sample from pool");
+		return false;
+	}
+
+	chiaki_mutex_lock(&decoder->mutex);
+	decoder->frames_lost += frames_lost;
+	decoder->frame_recovered = frame_recovered;
+	AVPacket *packet = decoder->packet;
+	packet->buf = ref;
+	packet->data = ref->data;
+	packet->size = buf_size;
+	bool succ = ffmpeg_decoder_send_packet(decoder, packet);
+	av_packet_unref(packet);
+	chiaki_mutex_unlock(&decoder->mutex);
+
+	if(succ)
+		decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
+	return succ;
+}
+
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_partial_sample_cb(uint8_t *buf, size_t buf_size, const ChiakiFrameUnitMap *map, int32_t frames_lost, void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+	unsigned int slices_damaged = 0;
+	for(unsigned int i=0; i<map->slices_count; i++)
+		slices_damaged += map->slice_damaged[i] ? 1 : 0;
+	CHIAKI_LOGV(decoder->log, "Decoding incomplete frame, %u of %u units missing, %u of %u slices damaged",
+			map->units_missing, map->units_count, slices_damaged, map->slices_count);
+	// marked like a recovered frame, so the damage shows up in decode_error_flags
+	return chiaki_ffmpeg_decoder_video_sample_cb(buf, buf_size, frames_lost, true, user);
+}
+
+/**
+ * Receive all available frames into the scratch frames, must be called with decoder->mutex locked
+ *
+ * @return the scratch frame holding the very last frame or NULL if there was none
+ */
+static AVFrame *ffmpeg_decoder_receive_last(ChiakiFfmpegDecoder *decoder)
+{
+	AVFrame *frame_last = NULL;
+	for(size_t i=0;; i ^= 1)
+	{
+		AVFrame *frame = decoder->frames[i];
+		av_frame_unref(frame);
 		int r = avcodec_receive_frame(decoder->codec_context, frame);
 		if(r)
 		{
 			if(r != AVERROR(EAGAIN))
 				CHIAKI_LOGE(decoder->log, "Decoding with FFMPEG failed");
-			av_frame_free(&frame);
-			frame = frame_last;
 			break;
 		}
+		frame_last = frame;
 	}
-	*frames_lost = decoder->frames_lost;
-	if(frame && decoder->frame_recovered)
+	if(frame_last && decoder->frame_recovered)
 	{
 		decoder->frame_recovered = false;
-		frame->decode_error_flags |= 1;
+		frame_last->decode_error_flags |= 1;
+	}
+	return frame_last;
+}
+
+CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder, int32_t *frames_lost)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	// always try to pull as much as possible and return only the very last frame
+	AVFrame *frame = NULL;
+	AVFrame *frame_last = ffmpeg_decoder_receive_last(decoder);
+	if(frame_last)
+	{
+		frame = av_frame_alloc();
+		if(frame)
+			av_frame_move_ref(frame, frame_last);
+		else
+			av_frame_unref(frame_last);
 	}
+	*frames_lost = decoder->frames_lost;
 	decoder->frames_lost = 0;
 	chiaki_mutex_unlock(&decoder->mutex);
 
 	return frame;
 }
 
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_pull_frame_into(ChiakiFfmpegDecoder *decoder, AVFrame *frame, int32_t *frames_lost)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	AVFrame *frame_last = ffmpeg_decoder_receive_last(decoder);
+	if(frame_last)
+	{
+		av_frame_unref(frame);
+		av_frame_move_ref(frame, frame_last);
+	}
+	*frames_lost = decoder->frames_lost;
+	decoder->frames_lost = 0;
+	chiaki_mutex_unlock(&decoder->mutex);
+
+	return frame_last != NULL;
+}
+
 CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFfmpegDecoder *decoder)
 {
 	if (decoder->hw_device_ctx) {
@@ -219,3 +625,19 @@ CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFf
 	}
 }
 
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_get_metrics(ChiakiFfmpegDecoder *decoder, ChiakiDecoderMetrics *metrics)
+{
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->valid = true;
+	// written by the decode thread while it holds decoder->mutex for the whole decode, so read as is
+	metrics->overloaded = decoder->overloaded;
+	metrics->threaded = decoder->threaded;
+	if(!decoder->threaded)
+		return;
+	chiaki_mutex_lock(&decoder->queue_mutex);
+	metrics->queue_count = decoder->queue_count;
+	metrics->queue_size = decoder->queue_size;
+	metrics->samples_dropped = decoder->samples_dropped;
+	chiaki_mutex_unlock(&decoder->queue_mutex);
+}
+
@@ -13,33 +13,40 @@
 #include <arpa/inet.h>
 #endif
 
-CHIAKI_EXPORT void chiaki_stream_stats_reset(ChiakiStreamStats *stats)
+#define UNIT_SLOTS_MAX CHIAKI_FRAME_PROCESSOR_UNITS_MAX
+#define UNIT_SLOTS_CAPACITY_MIN 64
+#define BITMAP_WORDS(bits) (((bits) + 63) / 64)
+
+struct chiaki_frame_unit_t
 {
-	stats->frames = 0;
-	stats->bytes = 0;
-}
+	size_t data_size; // only meaningful if the unit's bit in unit_present is set
+};
 
-CHIAKI_EXPORT void chiaki_stream_stats_frame(ChiakiStreamStats *stats, uint64_t size)
+static inline unsigned int ctz64(uint64_t v)
 {
-	stats->frames++;
-	stats->bytes += size;
-	//float br = (float)chiaki_stream_stats_bitrate(stats, 60) / 1000000.0f;
-	//CHIAKI_LOGD(NULL, "bitrate: %f", br);
+	assert(v);
+#if defined(__GNUC__)
+	return (unsigned int)__builtin_ctzll(v);
+#else
+	unsigned int r = 0;
+	while(!(v & 1))
+	{
+		v >>= 1;
+		r++;
+	}
+	return r;
+#endif
 }
 
-CHIAKI_EXPORT uint64_t chiaki_stream_stats_bitrate(ChiakiStreamStats *stats, uint64_t framerate)
+static inline bool bit_get(const uint64_t *bitmap, size_t i)
 {
-	if (stats->frames == 0)
-		return 0;
-	return (stats->bytes * 8 * framerate) / stats->frames;
+	return (bitmap[i >> 6] >> (i & 63)) & 1;
 }
 
-#define UNIT_SLOTS_MAX 256
-
-struct chiaki_frame_unit_t
+static inline void bit_set(uint64_t *bitmap, size_t i)
 {
-	size_t data_size;
-};
+	bitmap[i >> 6] |= ((uint64_t)1) << (i & 63);
+}
 
 CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_processor, ChiakiLog *log)
 {
@@ -54,14 +61,60 @@ CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_proce
 	frame_processor->units_fec_received = 0;
 	frame_processor->unit_slots = NULL;
 	frame_processor->unit_slots_size = 0;
+	frame_processor->unit_slots_capacity = 0;
+	frame_processor->unit_present = NULL;
 	frame_processor->flushed = true;
-	chiaki_stream_stats_reset(&frame_processor->stream_stats);
+	chiaki_fec_decoder_init(&frame_processor->fec_decoder);
+	memset(&frame_processor->unit_map, 0, sizeof(frame_processor->unit_map));
 }
 
 CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_processor)
 {
 	free(frame_processor->frame_buf);
 	free(frame_processor->unit_slots);
+	free(frame_processor->unit_present);
+	free(frame_processor->unit_map.unit_valid);
+	free(frame_processor->unit_map.unit_offset);
+	chiaki_fec_decoder_fini(&frame_processor->fec_decoder);
+}
+
+/**
+ * Grow the unit slots and everything sized like them to hold at least count units.
+ * Never shrinks, so frames of changing size do not reallocate.
+ */
+static ChiakiErrorCode unit_slots_reserve(ChiakiFrameProcessor *frame_processor, size_t count)
+{
+	if(count <= frame_processor->unit_slots_capacity)
+		return CHIAKI_ERR_SUCCESS;
+
+	size_t capacity = frame_processor->unit_slots_capacity ? frame_processor->unit_slots_capacity : UNIT_SLOTS_CAPACITY_MIN;
+	while(capacity < count)
+		capacity *= 2;
+
+	// every buffer is kept as soon as it has been grown, so a failure in between leaves only some of them bigger than needed
+	ChiakiFrameUnit *slots = realloc(frame_processor->unit_slots, capacity * sizeof(ChiakiFrameUnit));
+	if(!slots)
+		return CHIAKI_ERR_MEMORY;
+	frame_processor->unit_slots = slots;
+
+	uint64_t *present = realloc(frame_processor->unit_present, BITMAP_WORDS(capacity) * sizeof(uint64_t));
+	if(!present)
+		return CHIAKI_ERR_MEMORY;
+	frame_processor->unit_present = present;
+
+	ChiakiFrameUnitMap *map = &frame_processor->unit_map;
+	uint64_t *valid = realloc(map->unit_valid, BITMAP_WORDS(capacity) * sizeof(uint64_t));
+	if(!valid)
+		return CHIAKI_ERR_MEMORY;
+	map->unit_valid = valid;
+
+	uint32_t *offset = realloc(map->unit_offset, capacity * sizeof(uint32_t));
+	if(!offset)
+		return CHIAKI_ERR_MEMORY;
+	map->unit_offset = offset;
+
+	frame_processor->unit_slots_capacity = capacity;
+	return CHIAKI_ERR_SUCCESS;
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet)
@@ -72,7 +125,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 		return CHIAKI_ERR_INVALID_DATA;
 	}
 
-	frame_processor->flushed = false;
+	// a frame that could not be set up must never be flushed
+	frame_processor->flushed = true;
 	frame_processor->units_source_expected = packet->units_in_frame_total - packet->units_in_frame_fec;
 	frame_processor->units_fec_expected = packet->units_in_frame_fec;
 	if(frame_processor->units_fec_expected < 1)
@@ -103,30 +157,17 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 	if(unit_slots_size_required > UNIT_SLOTS_MAX)
 	{
 		CHIAKI_LOGE(frame_processor->log, "Packet suggests more than %u unit slots", UNIT_SLOTS_MAX);
+		frame_processor->unit_slots_size = 0;
 		return CHIAKI_ERR_INVALID_DATA;
 	}
-	if(unit_slots_size_required != frame_processor->unit_slots_size)
+	ChiakiErrorCode err = unit_slots_reserve(frame_processor, unit_slots_size_required);
+	if(err != CHIAKI_ERR_SUCCESS)
 	{
-		void *new_ptr = NULL;
-		if(frame_processor->unit_slots)
-		{
-			new_ptr = realloc(frame_processor->unit_slots, unit_slots_size_required * sizeof(ChiakiFrameUnit));
-			if(!new_ptr)
-				free(frame_processor->unit_slots);
-		}
-		else
-			new_ptr = malloc(unit_slots_size_required * sizeof(ChiakiFrameUnit));
-
-		frame_processor->unit_slots = new_ptr;
-		if(!new_ptr)
-		{
-			frame_processor->unit_slots_size = 0;
-			return CHIAKI_ERR_MEMORY;
-		}
-		else
-			frame_processor->unit_slots_size = unit_slots_size_required;
+		frame_processor->unit_slots_size = 0;
+		return err;
 	}
-	memset(frame_processor->unit_slots, 0, frame_processor->unit_slots_size * sizeof(ChiakiFrameUnit));
+	frame_processor->unit_slots_size = unit_slots_size_required;
+	memset(frame_processor->unit_present, 0, BITMAP_WORDS(frame_processor->unit_slots_size) * sizeof(uint64_t));
 
 	if(frame_processor->unit_slots_size > SIZE_MAX / frame_processor->buf_stride_per_unit)
 		return CHIAKI_ERR_OVERFLOW;
@@ -144,12 +185,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 	}
 	memset(frame_processor->frame_buf, 0, frame_buf_size_required + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
 
+	frame_processor->flushed = false;
 	return CHIAKI_ERR_SUCCESS;
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet)
 {
-	if(packet->unit_index > frame_processor->unit_slots_size)
+	if(packet->unit_index >= frame_processor->unit_slots_size)
 	{
 		CHIAKI_LOGE(frame_processor->log, "Packet's unit index is too high");
 		return CHIAKI_ERR_INVALID_DATA;
@@ -167,14 +209,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
 		return CHIAKI_ERR_INVALID_DATA;
 	}
 
-	ChiakiFrameUnit *unit = frame_processor->unit_slots + packet->unit_index;
-	if(unit->data_size)
+	if(bit_get(frame_processor->unit_present, packet->unit_index))
 	{
 		CHIAKI_LOGW(frame_processor->log, "Received duplicate unit");
 		return CHIAKI_ERR_INVALID_DATA;
-	} else {
-		unit->data_size = packet->data_size;
 	}
+	bit_set(frame_processor->unit_present, packet->unit_index);
+	frame_processor->unit_slots[packet->unit_index].data_size = packet->data_size;
 
 	if(!frame_processor->flushed)
 	{
@@ -200,11 +241,19 @@ CHIAKI_EXPORT void chiaki_frame_processor_report_packet_stats(ChiakiFrameProcess
 
 static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_processor)
 {
+	if(frame_processor->units_source_expected + frame_processor->units_fec_expected > CHIAKI_FRAME_PROCESSOR_FEC_UNITS_MAX)
+	{
+		CHIAKI_LOGW(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, FEC over more than %u units is not supported",
+					frame_processor->units_source_received, frame_processor->units_fec_received,
+					frame_processor->units_source_expected, frame_processor->units_fec_expected,
+					(unsigned int)CHIAKI_FRAME_PROCESSOR_FEC_UNITS_MAX);
+		return CHIAKI_ERR_FEC_FAILED;
+	}
+
 	CHIAKI_LOGI(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, attempting FEC",
 				frame_processor->units_source_received, frame_processor->units_fec_received,
 				frame_processor->units_source_expected, frame_processor->units_fec_expected);
 
-
 	size_t erasures_count = (frame_processor->units_source_expected + frame_processor->units_fec_expected)
 			- (frame_processor->units_source_received + frame_processor->units_fec_received);
 	unsigned int *erasures = calloc(erasures_count, sizeof(unsigned int));
@@ -212,10 +261,13 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 		return CHIAKI_ERR_MEMORY;
 
 	size_t erasure_index = 0;
-	for(size_t i=0; i<frame_processor->units_source_expected + frame_processor->units_fec_expected; i++)
+	size_t units_count = frame_processor->units_source_expected + frame_processor->units_fec_expected;
+	for(size_t w=0; w<BITMAP_WORDS(units_count); w++)
 	{
-		ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
-		if(!slot->data_size)
+		uint64_t missing = ~frame_processor->unit_present[w];
+		if(w == units_count / 64)
+			missing &= (((uint64_t)1) << (units_count % 64)) - 1; // bits past the last unit
+		while(missing)
 		{
 			if(erasure_index >= erasures_count)
 			{
@@ -224,12 +276,13 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 				free(erasures);
 				return CHIAKI_ERR_UNKNOWN;
 			}
-			erasures[erasure_index++] = (unsigned int)i;
+			erasures[erasure_index++] = (unsigned int)(w * 64 + ctz64(missing));
+			missing &= missing - 1;
 		}
 	}
 	assert(erasure_index == erasures_count);
 
-	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->frame_buf,
+	ChiakiErrorCode err = chiaki_fec_decoder_decode(&frame_processor->fec_decoder, frame_processor->frame_buf,
 			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
 			frame_processor->units_source_expected, frame_processor->units_fec_expected,
 			erasures, erasures_count);
@@ -244,9 +297,10 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 		err = CHIAKI_ERR_SUCCESS;
 		CHIAKI_LOGI(frame_processor->log, "FEC successful");
 
-		// restore unit sizes
-		for(size_t i=0; i<frame_processor->units_source_expected; i++)
+		// restore sizes of the recovered units
+		for(size_t e=0; e<erasures_count && erasures[e] < frame_processor->units_source_expected; e++)
 		{
+			size_t i = erasures[e];
 			ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
 			uint8_t *buf_ptr = frame_processor->frame_buf + frame_processor->buf_stride_per_unit * i;
 			uint16_t padding = ntohs(*((chiaki_unaligned_uint16_t *)buf_ptr));
@@ -258,6 +312,7 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 				continue;
 			}
 			slot->data_size = frame_processor->buf_size_per_unit - padding;
+			bit_set(frame_processor->unit_present, i);
 		}
 	}
 
@@ -284,30 +339,89 @@ CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(Chiak
 			result = CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 	}
 
+	ChiakiFrameUnitMap *map = &frame_processor->unit_map;
+	map->units_count = frame_processor->units_source_expected;
+	map->units_missing = 0;
+	map->slices_count = 0;
+	map->slices_truncated = false;
+	memset(map->unit_valid, 0, BITMAP_WORDS(map->units_count) * sizeof(uint64_t));
+
 	size_t cur = 0;
 	for(size_t i=0; i<frame_processor->units_source_expected; i++)
 	{
 		ChiakiFrameUnit *unit = frame_processor->unit_slots + i;
-		if(!unit->data_size)
+		map->unit_offset[i] = (uint32_t)cur;
+		if(!bit_get(frame_processor->unit_present, i))
 		{
 			CHIAKI_LOGW(frame_processor->log, "Missing unit %#llx", (unsigned long long)i);
+			map->units_missing++;
 			continue;
 		}
 		if(unit->data_size < 2)
 		{
 			CHIAKI_LOGE(frame_processor->log, "Saved unit has size < 2");
 			chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_VERBOSE, frame_processor->frame_buf + i*frame_processor->buf_size_per_unit, 0x50);
+			map->units_missing++;
 			continue;
 		}
 		size_t part_size = unit->data_size - 2;
 		uint8_t *buf_ptr = frame_processor->frame_buf + i*frame_processor->buf_stride_per_unit;
 		memmove(frame_processor->frame_buf + cur, buf_ptr + 2, part_size);
 		cur += part_size;
+		bit_set(map->unit_valid, i);
 	}
 
-	chiaki_stream_stats_frame(&frame_processor->stream_stats, (uint64_t)cur);
-
 	*frame = frame_processor->frame_buf;
 	*frame_size = cur;
 	return result;
 }
+
+CHIAKI_EXPORT void chiaki_frame_unit_map_find_slices(ChiakiFrameUnitMap *map, const uint8_t *frame, size_t frame_size)
+{
+	map->slices_count = 0;
+	map->slices_truncated = false;
+	for(size_t i=0; i+2<frame_size; i++)
+	{
+		if(frame[i + 2] > 1)
+		{
+			// no start code can begin at i + 1 or i + 2 either
+			i += 2;
+			continue;
+		}
+		if(frame[i] || frame[i + 1] || frame[i + 2] != 1)
+			continue;
+		if(map->slices_count == CHIAKI_FRAME_UNIT_MAP_SLICES_MAX)
+		{
+			map->slices_truncated = true;
+			break;
+		}
+		// include the leading zero of a 4 byte start code
+		size_t offset = (i > 0 && !frame[i - 1]) ? i - 1 : i;
+		map->slice_offset[map->slices_count] = (uint32_t)offset;
+		map->slice_damaged[map->slices_count] = false;
+		map->slices_count++;
+		i += 2;
+	}
+
+	if(!map->slices_count)
+		return;
+
+	// a gap at offset o cuts the slice containing the byte before it,
+	// which also covers the gap right in front of the following start code.
+	// Offsets only grow with the unit index, so the slice search continues where the last gap was.
+	unsigned int slice = 0;
+	for(size_t w=0; w<BITMAP_WORDS(map->units_count); w++)
+	{
+		uint64_t missing = ~map->unit_valid[w];
+		if(w == map->units_count / 64)
+			missing &= (((uint64_t)1) << (map->units_count % 64)) - 1;
+		while(missing)
+		{
+			uint32_t gap = map->unit_offset[w * 64 + ctz64(missing)];
+			while(slice + 1 < map->slices_count && map->slice_offset[slice + 1] < gap)
+				slice++;
+			map->slice_damaged[slice] = true;
+			missing &= missing - 1;
+		}
+	}
+}
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/haptics.h>
+
+#include <math.h>
+#include <string.h>
+
+#define FILTER_LEN (CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_UPSAMPLE_TAPS)
+// cutoff relative to the input nyquist frequency, a bit below it so images are attenuated more
+#define FILTER_CUTOFF 0.9f
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static inline int16_t read_sample(const uint8_t *buf)
+{
+	return (int16_t)((uint16_t)buf[0] | ((uint16_t)buf[1] << 8));
+}
+
+static inline int16_t clamp_sample(float v)
+{
+	if(v >= 32767.0f)
+		return 32767;
+	if(v <= -32768.0f)
+		return -32768;
+	return (int16_t)lrintf(v);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_upsampler_init(ChiakiHapticsUpsampler *upsampler)
+{
+	// Blackman windowed sinc low pass at the input nyquist frequency, split into one sub-filter per output phase
+	const float center = (float)(FILTER_LEN - 1) / 2.0f;
+	const float fc = FILTER_CUTOFF / (2.0f * CHIAKI_HAPTICS_UPSAMPLE_FACTOR);
+	for(size_t p=0; p<CHIAKI_HAPTICS_UPSAMPLE_FACTOR; p++)
+	{
+		float sum = 0.0f;
+		for(size_t k=0; k<CHIAKI_HAPTICS_UPSAMPLE_TAPS; k++)
+		{
+			size_t n = p + k * CHIAKI_HAPTICS_UPSAMPLE_FACTOR;
+			float t = (float)n - center;
+			float sinc = 2.0f * fc * (t == 0.0f ? 1.0f : sinf(2.0f * (float)M_PI * fc * t) / (2.0f * (float)M_PI * fc * t));
+			float w = 0.42f
+				- 0.5f * cosf(2.0f * (float)M_PI * (float)n / (float)(FILTER_LEN - 1))
+				+ 0.08f * cosf(4.0f * (float)M_PI * (float)n / (float)(FILTER_LEN - 1));
+			upsampler->coefs[p][k] = sinc * w;
+			sum += sinc * w;
+		}
+		// unity gain for every phase, so constant input gives constant output
+		for(size_t k=0; k<CHIAKI_HAPTICS_UPSAMPLE_TAPS; k++)
+			upsampler->coefs[p][k] /= sum;
+	}
+
+	static const int8_t remap_dualsense[CHIAKI_HAPTICS_CHANNELS_OUT] = { -1, -1, 0, 1 };
+	chiaki_haptics_upsampler_set_remap(upsampler, remap_dualsense);
+	chiaki_haptics_upsampler_reset(upsampler);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_upsampler_reset(ChiakiHapticsUpsampler *upsampler)
+{
+	memset(upsampler->history, 0, sizeof(upsampler->history));
+	upsampler->history_pos = 0;
+}
+
+CHIAKI_EXPORT void chiaki_haptics_upsampler_set_remap(ChiakiHapticsUpsampler *upsampler, const int8_t remap[CHIAKI_HAPTICS_CHANNELS_OUT])
+{
+	for(size_t c=0; c<CHIAKI_HAPTICS_CHANNELS_OUT; c++)
+		upsampler->remap[c] = remap[c] < CHIAKI_HAPTICS_CHANNELS_IN ? remap[c] : -1;
+}
+
+CHIAKI_EXPORT size_t chiaki_haptics_upsampler_process(ChiakiHapticsUpsampler *upsampler, const uint8_t *buf, size_t frames_in,
+		int16_t *out, size_t out_frames_max)
+{
+	size_t frames_max = out_frames_max / CHIAKI_HAPTICS_UPSAMPLE_FACTOR;
+	if(frames_in > frames_max)
+		frames_in = frames_max;
+
+	for(size_t i=0; i<frames_in; i++)
+	{
+		// newest sample goes in front of the window
+		size_t pos = upsampler->history_pos ? upsampler->history_pos - 1 : CHIAKI_HAPTICS_UPSAMPLE_TAPS - 1;
+		upsampler->history_pos = pos;
+
+		float phases[CHIAKI_HAPTICS_CHANNELS_IN][CHIAKI_HAPTICS_UPSAMPLE_FACTOR];
+		for(size_t c=0; c<CHIAKI_HAPTICS_CHANNELS_IN; c++)
+		{
+			float x = (float)read_sample(buf + (i * CHIAKI_HAPTICS_CHANNELS_IN + c) * sizeof(int16_t));
+			float *history = upsampler->history[c];
+			history[pos] = x;
+			history[pos + CHIAKI_HAPTICS_UPSAMPLE_TAPS] = x;
+
+			const float *window = history + pos;
+			for(size_t p=0; p<CHIAKI_HAPTICS_UPSAMPLE_FACTOR; p++)
+			{
+				const float *coefs = upsampler->coefs[p];
+				float acc = 0.0f;
+				for(size_t k=0; k<CHIAKI_HAPTICS_UPSAMPLE_TAPS; k++)
+					acc += coefs[k] * window[k];
+				phases[c][p] = acc;
+			}
+		}
+
+		for(size_t p=0; p<CHIAKI_HAPTICS_UPSAMPLE_FACTOR; p++)
+		{
+			for(size_t c=0; c<CHIAKI_HAPTICS_CHANNELS_OUT; c++)
+			{
+				int8_t src = upsampler->remap[c];
+				out[c] = src < 0 ? 0 : clamp_sample(phases[src][p]);
+			}
+			out += CHIAKI_HAPTICS_CHANNELS_OUT;
+		}
+	}
+
+	return frames_in * CHIAKI_HAPTICS_UPSAMPLE_FACTOR;
+}
+
+static float envelope_coef(float ms)
+{
+	float samples = ms * (float)CHIAKI_HAPTICS_RATE_IN / 1000.0f;
+	if(samples <= 0.0f)
+		return 1.0f;
+	return 1.0f - expf(-1.0f / samples);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_envelope_init(ChiakiHapticsEnvelope *envelope, float attack_ms, float release_ms)
+{
+	envelope->attack = envelope_coef(attack_ms);
+	envelope->release = envelope_coef(release_ms);
+	memset(envelope->env, 0, sizeof(envelope->env));
+}
+
+CHIAKI_EXPORT void chiaki_haptics_envelope_process(ChiakiHapticsEnvelope *envelope, const uint8_t *buf, size_t frames,
+		uint16_t *left, uint16_t *right)
+{
+	for(size_t i=0; i<frames; i++)
+	{
+		for(size_t c=0; c<CHIAKI_HAPTICS_CHANNELS_IN; c++)
+		{
+			float x = fabsf((float)read_sample(buf + (i * CHIAKI_HAPTICS_CHANNELS_IN + c) * sizeof(int16_t))) / 32768.0f;
+			float env = envelope->env[c];
+			env += (x > env ? envelope->attack : envelope->release) * (x - env);
+			envelope->env[c] = env;
+		}
+	}
+
+	*left = (uint16_t)(envelope->env[0] >= 1.0f ? UINT16_MAX : envelope->env[0] * (float)UINT16_MAX);
+	*right = (uint16_t)(envelope->env[1] >= 1.0f ? UINT16_MAX : envelope->env[1] * (float)UINT16_MAX);
+}
@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/metrics.h>
+#include <chiaki/session.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define METRICS_SERVER_REQUEST_SIZE_MAX 1024
+#define METRICS_SERVER_REQUEST_TIMEOUT_MS 1000
+
+CHIAKI_EXPORT void chiaki_session_get_metrics(ChiakiSession *session, ChiakiSessionMetrics *metrics)
+{
+	ChiakiStreamConnection *stream_connection = &session->stream_connection;
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->timestamp_us = chiaki_time_now_monotonic_us();
+
+	// single words written by one thread only, read without locking like the gui does
+	metrics->rtt_us = session->rtt_us;
+	metrics->mtu_in = session->mtu_in;
+	metrics->mtu_out = session->mtu_out;
+	metrics->measured_bitrate = stream_connection->measured_bitrate;
+	metrics->packet_loss = stream_connection->congestion_control.packet_loss;
+	metrics->congestion_reports = stream_connection->congestion_control.reports_sent;
+	metrics->congestion_received = stream_connection->congestion_control.last_report.received;
+	metrics->congestion_lost = stream_connection->congestion_control.last_report.lost;
+
+	chiaki_packet_stats_get_totals(&stream_connection->packet_stats, &metrics->packets_received, &metrics->packets_lost);
+	chiaki_stream_connection_get_video_stats(stream_connection, &metrics->video);
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&stream_connection->feedback_sender_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	// takion is connected for as long as the feedback sender is active
+	if(stream_connection->feedback_sender_active)
+	{
+		metrics->streaming = true;
+		metrics->feedback_valid = true;
+		chiaki_feedback_sender_get_stats(&stream_connection->feedback_sender, &metrics->feedback);
+
+		ChiakiTakionSendBatch *batch = &stream_connection->takion.send_batch;
+		chiaki_mutex_lock(&batch->mutex);
+		metrics->takion_batch_packets = batch->packets_sent;
+		metrics->takion_batch_flushes = batch->flushes;
+		chiaki_mutex_unlock(&batch->mutex);
+	}
+	chiaki_mutex_unlock(&stream_connection->feedback_sender_mutex);
+}
+
+typedef struct metrics_writer_t
+{
+	char *buf;
+	size_t buf_size;
+	size_t len; // of the full output, may exceed buf_size
+} MetricsWriter;
+
+static void writer_printf(MetricsWriter *writer, const char *fmt, ...)
+{
+	char *dst = NULL;
+	size_t dst_size = 0;
+	if(writer->len < writer->buf_size)
+	{
+		dst = writer->buf + writer->len;
+		dst_size = writer->buf_size - writer->len;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int r = vsnprintf(dst, dst_size, fmt, args);
+	va_end(args);
+	if(r > 0)
+		writer->len += (size_t)r;
+}
+
+static void writer_init(MetricsWriter *writer, char *buf, size_t buf_size)
+{
+	writer->buf = buf;
+	writer->buf_size = buf_size;
+	writer->len = 0;
+	if(buf_size)
+		buf[0] = '\0';
+}
+
+#define JSON_U64(key, value) writer_printf(&w, "%s\"" key "\":%llu", sep, (unsigned long long)(value)); sep = ","
+#define JSON_DOUBLE(key, value) writer_printf(&w, "%s\"" key "\":%.6g", sep, (double)(value)); sep = ","
+#define JSON_BOOL(key, value) writer_printf(&w, "%s\"" key "\":%s", sep, (value) ? "true" : "false"); sep = ","
+
+CHIAKI_EXPORT size_t chiaki_session_metrics_format_json(const ChiakiSessionMetrics *metrics, char *buf, size_t buf_size)
+{
+	MetricsWriter w;
+	writer_init(&w, buf, buf_size);
+	const char *sep = "";
+
+	writer_printf(&w, "{");
+	JSON_U64("timestamp_us", metrics->timestamp_us);
+	JSON_BOOL("streaming", metrics->streaming);
+	JSON_U64("rtt_us", metrics->rtt_us);
+	JSON_U64("mtu_in", metrics->mtu_in);
+	JSON_U64("mtu_out", metrics->mtu_out);
+	JSON_DOUBLE("measured_bitrate_mbps", metrics->measured_bitrate);
+
+	writer_printf(&w, ",\"congestion\":{");
+	sep = "";
+	JSON_DOUBLE("packet_loss", metrics->packet_loss);
+	JSON_U64("reports", metrics->congestion_reports);
+	JSON_U64("last_received", metrics->congestion_received);
+	JSON_U64("last_lost", metrics->congestion_lost);
+	writer_printf(&w, "}");
+
+	writer_printf(&w, ",\"packets\":{");
+	sep = "";
+	JSON_U64("received", metrics->packets_received);
+	JSON_U64("lost", metrics->packets_lost);
+	writer_printf(&w, "}");
+
+	const ChiakiVideoReceiverStats *video = &metrics->video;
+	writer_printf(&w, ",\"video\":{");
+	sep = "";
+	JSON_U64("frames", video->frames);
+	JSON_U64("bytes", video->bytes);
+	JSON_U64("frames_fec_recovered", video->frames_fec_recovered);
+	JSON_U64("frames_incomplete", video->frames_incomplete);
+	JSON_U64("frames_lost", video->frames_lost);
+	writer_printf(&w, ",\"corrupt_frames\":{");
+	sep = "";
+	JSON_U64("reports", video->corrupt_frames.reports);
+	JSON_U64("requests_sent", video->corrupt_frames.requests_sent);
+	JSON_U64("merged", video->corrupt_frames.merged);
+	JSON_U64("suppressed", video->corrupt_frames.suppressed);
+	JSON_U64("answered", video->corrupt_frames.answered);
+	JSON_U64("expired", video->corrupt_frames.expired);
+	JSON_U64("send_errors", video->corrupt_frames.send_errors);
+	JSON_U64("answer_us_last", video->corrupt_frames.answer_us_last);
+	writer_printf(&w, "}");
+	writer_printf(&w, ",\"bitrate\":{");
+	sep = "";
+	JSON_U64("span_us", video->bitrate.span_us);
+	JSON_U64("frames", video->bitrate.frames);
+	JSON_DOUBLE("bitrate_mbps", video->bitrate.bitrate / 1000000.0);
+	JSON_DOUBLE("bitrate_ewma_mbps", video->bitrate.bitrate_ewma / 1000000.0);
+	JSON_DOUBLE("fps", video->bitrate.fps);
+	JSON_U64("frame_size_p50", video->bitrate.frame_size_p50);
+	JSON_U64("frame_size_p95", video->bitrate.frame_size_p95);
+	JSON_U64("frame_size_p99", video->bitrate.frame_size_p99);
+	JSON_U64("frame_size_max", video->bitrate.frame_size_max);
+	writer_printf(&w, "}}");
+
+	if(metrics->feedback_valid)
+	{
+		const ChiakiFeedbackSenderStats *feedback = &metrics->feedback;
+		writer_printf(&w, ",\"feedback\":{");
+		sep = "";
+		JSON_U64("state_changes", feedback->state_changes);
+		JSON_U64("state_packets", feedback->state_packets);
+		JSON_U64("history_events", feedback->history_events);
+		JSON_U64("history_packets", feedback->history_packets);
+		JSON_U64("send_errors", feedback->send_errors);
+		JSON_DOUBLE("packets_per_second", feedback->packets_per_second);
+		writer_printf(&w, "}");
+
+		writer_printf(&w, ",\"takion\":{");
+		sep = "";
+		JSON_U64("batch_packets", metrics->takion_batch_packets);
+		JSON_U64("batch_flushes", metrics->takion_batch_flushes);
+		writer_printf(&w, "}");
+	}
+
+	if(metrics->decoder.valid)
+	{
+		const ChiakiDecoderMetrics *decoder = &metrics->decoder;
+		writer_printf(&w, ",\"decoder\":{");
+		sep = "";
+		JSON_BOOL("threaded", decoder->threaded);
+		JSON_BOOL("overloaded", decoder->overloaded);
+		JSON_U64("queue_count", decoder->queue_count);
+		JSON_U64("queue_size", decoder->queue_size);
+		JSON_U64("samples_dropped", decoder->samples_dropped);
+		writer_printf(&w, "}");
+	}
+
+	writer_printf(&w, "}");
+	return w.len;
+}
+
+#undef JSON_U64
+#undef JSON_DOUBLE
+#undef JSON_BOOL
+
+static void prometheus_header(MetricsWriter *w, const char *name, const char *type, const char *help)
+{
+	writer_printf(w, "# HELP chiaki_%s %s\n# TYPE chiaki_%s %s\n", name, help, name, type);
+}
+
+static void prometheus_u64(MetricsWriter *w, const char *labels, const char *name, const char *type, const char *help, uint64_t value)
+{
+	prometheus_header(w, name, type, help);
+	if(labels)
+		writer_printf(w, "chiaki_%s{%s} %llu\n", name, labels, (unsigned long long)value);
+	else
+		writer_printf(w, "chiaki_%s %llu\n", name, (unsigned long long)value);
+}
+
+static void prometheus_double(MetricsWriter *w, const char *labels, const char *name, const char *help, double value)
+{
+	prometheus_header(w, name, "gauge", help);
+	if(labels)
+		writer_printf(w, "chiaki_%s{%s} %.6g\n", name, labels, value);
+	else
+		writer_printf(w, "chiaki_%s %.6g\n", name, value);
+}
+
+#define COUNTER(name, help, value) prometheus_u64(&w, labels, name, "counter", help, value)
+#define GAUGE(name, help, value) prometheus_u64(&w, labels, name, "gauge", help, value)
+#define GAUGE_DOUBLE(name, help, value) prometheus_double(&w, labels, name, help, value)
+
+CHIAKI_EXPORT size_t chiaki_session_metrics_format_prometheus(const ChiakiSessionMetrics *metrics, const char *labels, char *buf, size_t buf_size)
+{
+	MetricsWriter w;
+	writer_init(&w, buf, buf_size);
+	if(labels && !*labels)
+		labels = NULL;
+
+	GAUGE("streaming", "Whether the stream connection is connected", metrics->streaming ? 1 : 0);
+	GAUGE_DOUBLE("rtt_seconds", "Round trip time measured during the stream connection handshake", (double)metrics->rtt_us / 1000000.0);
+	GAUGE("mtu_in_bytes", "Incoming MTU", metrics->mtu_in);
+	GAUGE("mtu_out_bytes", "Outgoing MTU", metrics->mtu_out);
+	GAUGE_DOUBLE("measured_bitrate_mbps", "Bitrate of the video stream in MBit/s", metrics->measured_bitrate);
+	GAUGE_DOUBLE("packet_loss_ratio", "Packet loss of the last congestion control interval", metrics->packet_loss);
+	COUNTER("congestion_reports_total", "Congestion control packets sent to the console", metrics->congestion_reports);
+	GAUGE("congestion_received_packets", "Received packets in the last congestion control packet", metrics->congestion_received);
+	GAUGE("congestion_lost_packets", "Lost packets in the last congestion control packet", metrics->congestion_lost);
+	COUNTER("packets_received_total", "Received av packets", metrics->packets_received);
+	COUNTER("packets_lost_total", "Lost av packets", metrics->packets_lost);
+
+	const ChiakiVideoReceiverStats *video = &metrics->video;
+	COUNTER("video_frames_total", "Video frames passed on to the sample callback", video->frames);
+	COUNTER("video_bytes_total", "Bytes of video frames passed on to the sample callback", video->bytes);
+	COUNTER("video_frames_fec_recovered_total", "Video frames that were only complete thanks to FEC", video->frames_fec_recovered);
+	COUNTER("video_frames_incomplete_total", "Incomplete video frames passed on to the partial sample callback", video->frames_incomplete);
+	COUNTER("video_frames_lost_total", "Video frames that were lost entirely", video->frames_lost);
+	COUNTER("corrupt_frame_reports_total", "Ranges of missing or corrupt frames reported by the video receiver", video->corrupt_frames.reports);
+	COUNTER("corrupt_frame_requests_total", "Corrupt frame requests sent to the console", video->corrupt_frames.requests_sent);
+	COUNTER("corrupt_frame_merged_total", "Corrupt frame reports merged into the outstanding request", video->corrupt_frames.merged);
+	COUNTER("corrupt_frame_suppressed_total", "Corrupt frame reports covered by the outstanding request", video->corrupt_frames.suppressed);
+	COUNTER("corrupt_frame_answered_total", "Corrupt frame requests followed by an i frame", video->corrupt_frames.answered);
+	COUNTER("corrupt_frame_expired_total", "Corrupt frame requests that got no i frame in time", video->corrupt_frames.expired);
+	GAUGE_DOUBLE("corrupt_frame_answer_seconds", "Time from the last answered corrupt frame request to its i frame", (double)video->corrupt_frames.answer_us_last / 1000000.0);
+	GAUGE_DOUBLE("video_bitrate_ewma_mbps", "Exponentially weighted average bitrate of the video stream in MBit/s", video->bitrate.bitrate_ewma / 1000000.0);
+	GAUGE_DOUBLE("video_fps", "Measured frame rate of the video stream", video->bitrate.fps);
+	GAUGE("video_frame_size_p50_bytes", "Median size of the video frames in the bitrate window", video->bitrate.frame_size_p50);
+	GAUGE("video_frame_size_p95_bytes", "95th percentile size of the video frames in the bitrate window", video->bitrate.frame_size_p95);
+	GAUGE("video_frame_size_p99_bytes", "99th percentile size of the video frames in the bitrate window", video->bitrate.frame_size_p99);
+	GAUGE("video_frame_size_max_bytes", "Largest video frame in the bitrate window", video->bitrate.frame_size_max);
+
+	if(metrics->feedback_valid)
+	{
+		const ChiakiFeedbackSenderStats *feedback = &metrics->feedback;
+		COUNTER("feedback_state_packets_total", "Feedback state packets sent", feedback->state_packets);
+		COUNTER("feedback_history_packets_total", "Feedback history packets sent", feedback->history_packets);
+		COUNTER("feedback_history_events_total", "Feedback history events sent", feedback->history_events);
+		COUNTER("feedback_send_errors_total", "Feedback packets that could not be sent", feedback->send_errors);
+		COUNTER("takion_batch_packets_total", "Datagrams sent through the takion send batch", metrics->takion_batch_packets);
+		COUNTER("takion_batch_flushes_total", "Flushes of the takion send batch", metrics->takion_batch_flushes);
+	}
+
+	if(metrics->decoder.valid)
+	{
+		const ChiakiDecoderMetrics *decoder = &metrics->decoder;
+		GAUGE("decoder_overloaded", "Whether the decoder is degrading quality to catch up", decoder->overloaded ? 1 : 0);
+		GAUGE("decoder_queue_samples", "Samples waiting to be decoded", decoder->queue_count);
+		GAUGE("decoder_queue_size_samples", "Capacity of the decode queue", decoder->queue_size);
+		COUNTER("decoder_samples_dropped_total", "Samples dropped because the decode queue was full", decoder->samples_dropped);
+	}
+
+	return w.len;
+}
+
+#undef COUNTER
+#undef GAUGE
+#undef GAUGE_DOUBLE
+
+static ChiakiErrorCode metrics_server_send_all(chiaki_socket_t sock, const char *buf, size_t buf_size)
+{
+	while(buf_size > 0)
+	{
+		int sent = (int)send(sock, (CHIAKI_SOCKET_BUF_TYPE)buf, (int)buf_size, MSG_NOSIGNAL);
+		if(sent < 0)
+		{
+#ifndef _WIN32
+			if(errno == EINTR)
+				continue;
+#endif
+			return CHIAKI_ERR_NETWORK;
+		}
+		buf += sent;
+		buf_size -= (size_t)sent;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode metrics_server_respond(chiaki_socket_t sock, const char *status, const char *content_type, const char *body, size_t body_size)
+{
+	char header[256];
+	int header_size = snprintf(header, sizeof(header),
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %llu\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+			status, content_type, (unsigned long long)body_size);
+	if(header_size < 0 || (size_t)header_size >= sizeof(header))
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	ChiakiErrorCode err = metrics_server_send_all(sock, header, (size_t)header_size);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	return metrics_server_send_all(sock, body, body_size);
+}
+
+/**
+ * Receive the request until the end of its header and get the path of a GET request
+ *
+ * @param path filled with the path, without the query
+ * @return CHIAKI_ERR_INVALID_DATA for anything but a GET request
+ */
+static ChiakiErrorCode metrics_server_recv_request(ChiakiMetricsServer *server, chiaki_socket_t sock, char *path, size_t path_size)
+{
+	char buf[METRICS_SERVER_REQUEST_SIZE_MAX + 1];
+	size_t received = 0;
+	while(true)
+	{
+		ChiakiErrorCode err = chiaki_stop_pipe_select_single(&server->stop_pipe, sock, false, METRICS_SERVER_REQUEST_TIMEOUT_MS);
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+		int r = (int)recv(sock, (CHIAKI_SOCKET_BUF_TYPE)(buf + received), (int)(METRICS_SERVER_REQUEST_SIZE_MAX - received), 0);
+		if(r <= 0)
+			return r == 0 ? CHIAKI_ERR_DISCONNECTED : CHIAKI_ERR_NETWORK;
+		received += (size_t)r;
+		buf[received] = '\0';
+		if(strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+			break;
+		if(received == METRICS_SERVER_REQUEST_SIZE_MAX)
+			return CHIAKI_ERR_BUF_TOO_SMALL;
+	}
+
+	if(strncmp(buf, "GET ", 4) != 0)
+		return CHIAKI_ERR_INVALID_DATA;
+	const char *start = buf + 4;
+	size_t len = strcspn(start, " ?\r\n");
+	if(len >= path_size)
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	memcpy(path, start, len);
+	path[len] = '\0';
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void metrics_server_serve(ChiakiMetricsServer *server, chiaki_socket_t sock)
+{
+	char path[64];
+	ChiakiErrorCode err = metrics_server_recv_request(server, sock, path, sizeof(path));
+	if(err == CHIAKI_ERR_INVALID_DATA)
+	{
+		static const char body[] = "Method Not Allowed\n";
+		metrics_server_respond(sock, "405 Method Not Allowed", "text/plain", body, sizeof(body) - 1);
+		return;
+	}
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		if(err != CHIAKI_ERR_CANCELED)
+			CHIAKI_LOGW(server->log, "Metrics server failed to receive request: %s", chiaki_error_string(err));
+		return;
+	}
+
+	bool json = strcmp(path, "/metrics.json") == 0;
+	if(!json && strcmp(path, "/metrics") != 0)
+	{
+		static const char body[] = "Not Found, try /metrics or /metrics.json\n";
+		metrics_server_respond(sock, "404 Not Found", "text/plain", body, sizeof(body) - 1);
+		return;
+	}
+
+	ChiakiSessionMetrics metrics;
+	memset(&metrics, 0, sizeof(metrics));
+	server->fill_cb(&metrics, server->fill_cb_user);
+
+	const char *labels = server->labels[0] ? server->labels : NULL;
+	size_t body_size = json
+		? chiaki_session_metrics_format_json(&metrics, NULL, 0)
+		: chiaki_session_metrics_format_prometheus(&metrics, labels, NULL, 0);
+	char *body = malloc(body_size + 1);
+	if(!body)
+		return;
+	if(json)
+		chiaki_session_metrics_format_json(&metrics, body, body_size + 1);
+	else
+		chiaki_session_metrics_format_prometheus(&metrics, labels, body, body_size + 1);
+
+	err = metrics_server_respond(sock, "200 OK",
+			json ? "application/json" : "text/plain; version=0.0.4",
+			body, body_size);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(server->log, "Metrics server failed to send response");
+	free(body);
+}
+
+static void *metrics_server_thread_func(void *user)
+{
+	ChiakiMetricsServer *server = user;
+	while(true)
+	{
+		ChiakiErrorCode err = chiaki_stop_pipe_select_single(&server->stop_pipe, server->sock, false, UINT64_MAX);
+		if(err == CHIAKI_ERR_CANCELED)
+			break;
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(server->log, "Metrics server failed to wait for connections: %s", chiaki_error_string(err));
+			break;
+		}
+
+		chiaki_socket_t client = accept(server->sock, NULL, NULL);
+		if(CHIAKI_SOCKET_IS_INVALID(client))
+		{
+			CHIAKI_LOGW(server->log, "Metrics server failed to accept: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+			continue;
+		}
+		metrics_server_serve(server, client);
+		CHIAKI_SOCKET_CLOSE(client);
+	}
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_metrics_server_start(ChiakiMetricsServer *server, ChiakiLog *log, uint16_t port, const char *labels,
+		ChiakiMetricsServerFillCallback fill_cb, void *fill_cb_user)
+{
+	server->log = log;
+	server->fill_cb = fill_cb;
+	server->fill_cb_user = fill_cb_user;
+	server->labels[0] = '\0';
+	if(labels)
+	{
+		if(strlen(labels) >= sizeof(server->labels))
+			return CHIAKI_ERR_BUF_TOO_SMALL;
+		strcpy(server->labels, labels);
+	}
+
+	ChiakiErrorCode err = CHIAKI_ERR_NETWORK;
+	server->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(CHIAKI_SOCKET_IS_INVALID(server->sock))
+	{
+		CHIAKI_LOGE(log, "Metrics server failed to create socket: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		return CHIAKI_ERR_NETWORK;
+	}
+
+	const int reuse = 1;
+	setsockopt(server->sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&reuse, sizeof(reuse));
+
+	// only reachable from this machine, the metrics are not authenticated
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if(bind(server->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		CHIAKI_LOGE(log, "Metrics server failed to bind to port %u: " CHIAKI_SOCKET_ERROR_FMT, (unsigned int)port, CHIAKI_SOCKET_ERROR_VALUE);
+		goto error_sock;
+	}
+
+	socklen_t addr_len = sizeof(addr);
+	if(getsockname(server->sock, (struct sockaddr *)&addr, &addr_len) < 0)
+	{
+		CHIAKI_LOGE(log, "Metrics server failed to get socket name: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		goto error_sock;
+	}
+	server->port = ntohs(addr.sin_port);
+
+	if(listen(server->sock, 4) < 0)
+	{
+		CHIAKI_LOGE(log, "Metrics server failed to listen: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		goto error_sock;
+	}
+
+	err = chiaki_stop_pipe_init(&server->stop_pipe);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_sock;
+
+	err = chiaki_thread_create(&server->thread, metrics_server_thread_func, server);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_stop_pipe;
+	chiaki_thread_set_name(&server->thread, "Chiaki Metrics");
+
+	CHIAKI_LOGI(log, "Metrics server listening on http://127.0.0.1:%u/metrics", (unsigned int)server->port);
+	return CHIAKI_ERR_SUCCESS;
+
+error_stop_pipe:
+	chiaki_stop_pipe_fini(&server->stop_pipe);
+error_sock:
+	CHIAKI_SOCKET_CLOSE(server->sock);
+	server->sock = CHIAKI_INVALID_SOCKET;
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_metrics_server_stop(ChiakiMetricsServer *server)
+{
+	chiaki_stop_pipe_stop(&server->stop_pipe);
+	chiaki_thread_join(&server->thread, NULL);
+	chiaki_stop_pipe_fini(&server->stop_pipe);
+	CHIAKI_SOCKET_CLOSE(server->sock);
+	server->sock = CHIAKI_INVALID_SOCKET;
+}
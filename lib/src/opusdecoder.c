@@ -11,6 +11,7 @@
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user);
 static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user);
+static void chiaki_opus_decoder_frame_lost(uint8_t *fec_buf, size_t fec_buf_size, void *user);
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log)
 {
@@ -36,6 +37,7 @@ CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, Chia
 	sink->user = decoder;
 	sink->header_cb = chiaki_opus_decoder_header;
 	sink->frame_cb = chiaki_opus_decoder_frame;
+	sink->frame_lost_cb = chiaki_opus_decoder_frame_lost;
 }
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
@@ -95,4 +97,20 @@ static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
 		decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
 }
 
+static void chiaki_opus_decoder_frame_lost(uint8_t *fec_buf, size_t fec_buf_size, void *user)
+{
+	ChiakiOpusDecoder *decoder = user;
+	if(!decoder->opus_decoder)
+		return;
+
+	// recover from the in-band FEC data of the following frame if possible, otherwise extrapolate (PLC)
+	int r = fec_buf
+		? opus_decode(decoder->opus_decoder, fec_buf, (opus_int32)fec_buf_size, decoder->pcm_buf, decoder->audio_header.frame_size, 1)
+		: opus_decode(decoder->opus_decoder, NULL, 0, decoder->pcm_buf, decoder->audio_header.frame_size, 0);
+	if(r < 1)
+		CHIAKI_LOGE(decoder->log, "Concealing lost audio frame with opus failed: %s", opus_strerror(r));
+	else if(decoder->frame_cb)
+		decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
+}
+
 #endif
\ No newline at end of file
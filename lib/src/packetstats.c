@@ -10,6 +10,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_stats_init(ChiakiPacketStats *stats)
 	stats->seq_min = 0;
 	stats->seq_max = 0;
 	stats->seq_received = 0;
+	stats->total_received = 0;
+	stats->total_lost = 0;
 	return chiaki_mutex_init(&stats->mutex, false);
 }
 
@@ -18,8 +20,34 @@ CHIAKI_EXPORT void chiaki_packet_stats_fini(ChiakiPacketStats *stats)
 	chiaki_mutex_fini(&stats->mutex);
 }
 
-static void reset_stats(ChiakiPacketStats *stats)
+/**
+ * Get the packets of the current window, mutex must be locked
+ */
+static void window_stats(ChiakiPacketStats *stats, uint64_t *received, uint64_t *lost)
 {
+	// gen
+	*received = stats->gen_received;
+	*lost = stats->gen_lost;
+
+	//CHIAKI_LOGD(NULL, "gen received: %llu, lost: %llu",
+	//		(unsigned long long)stats->gen_received,
+	//		(unsigned long long)stats->gen_lost);
+
+	// seq
+	uint64_t seq_diff = stats->seq_max - stats->seq_min; // overflow on purpose if max < min
+	uint64_t seq_lost = stats->seq_received > seq_diff ? seq_diff : seq_diff - stats->seq_received;
+	*received += stats->seq_received;
+	*lost += seq_lost;
+
+	//CHIAKI_LOGD(NULL, "seq received: %llu, lost: %llu",
+	//		(unsigned long long)stats->seq_received,
+	//		(unsigned long long)seq_lost);
+}
+
+static void reset_stats(ChiakiPacketStats *stats, uint64_t received, uint64_t lost)
+{
+	stats->total_received += received;
+	stats->total_lost += lost;
 	stats->gen_received = 0;
 	stats->gen_lost = 0;
 	stats->seq_min = stats->seq_max;
@@ -29,7 +57,9 @@ static void reset_stats(ChiakiPacketStats *stats)
 CHIAKI_EXPORT void chiaki_packet_stats_reset(ChiakiPacketStats *stats)
 {
 	chiaki_mutex_lock(&stats->mutex);
-	reset_stats(stats);
+	uint64_t received, lost;
+	window_stats(stats, &received, &lost);
+	reset_stats(stats, received, lost);
 	chiaki_mutex_unlock(&stats->mutex);
 }
 
@@ -51,26 +81,17 @@ CHIAKI_EXPORT void chiaki_packet_stats_push_seq(ChiakiPacketStats *stats, Chiaki
 CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost)
 {
 	chiaki_mutex_lock(&stats->mutex);
-
-	// gen
-	*received = stats->gen_received;
-	*lost = stats->gen_lost;
-
-	//CHIAKI_LOGD(NULL, "gen received: %llu, lost: %llu",
-	//		(unsigned long long)stats->gen_received,
-	//		(unsigned long long)stats->gen_lost);
-
-	// seq
-	uint64_t seq_diff = stats->seq_max - stats->seq_min; // overflow on purpose if max < min
-	uint64_t seq_lost = stats->seq_received > seq_diff ? seq_diff : seq_diff - stats->seq_received;
-	*received += stats->seq_received;
-	*lost += seq_lost;
-
-	//CHIAKI_LOGD(NULL, "seq received: %llu, lost: %llu",
-	//		(unsigned long long)stats->seq_received,
-	//		(unsigned long long)seq_lost);
-
+	window_stats(stats, received, lost);
 	if(reset)
-		reset_stats(stats);
+		reset_stats(stats, *received, *lost);
+	chiaki_mutex_unlock(&stats->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_packet_stats_get_totals(ChiakiPacketStats *stats, uint64_t *received, uint64_t *lost)
+{
+	chiaki_mutex_lock(&stats->mutex);
+	window_stats(stats, received, lost);
+	*received += stats->total_received;
+	*lost += stats->total_lost;
 	chiaki_mutex_unlock(&stats->mutex);
 }
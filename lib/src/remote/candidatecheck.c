@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/remote/candidatecheck.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../utils.h"
+
+CHIAKI_EXPORT void chiaki_candidate_pair_init(ChiakiCandidatePair *pair, size_t candidate_idx, chiaki_socket_t sock,
+		const struct sockaddr *addr, socklen_t addr_len, uint32_t priority)
+{
+	memset(pair, 0, sizeof(*pair));
+	pair->candidate_idx = candidate_idx;
+	pair->sock = sock;
+	if(addr_len > sizeof(pair->addr))
+		addr_len = sizeof(pair->addr);
+	memcpy(&pair->addr, addr, addr_len);
+	pair->addr_len = addr_len;
+	pair->priority = priority;
+	pair->next_send_ms = UINT64_MAX;
+	pair->rto_ms = CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS;
+}
+
+static int candidate_pair_cmp(const void *a, const void *b)
+{
+	const ChiakiCandidatePair *pa = a;
+	const ChiakiCandidatePair *pb = b;
+	if(pa->priority != pb->priority)
+		return pa->priority > pb->priority ? -1 : 1;
+	// keep the order of the console's candidate list for equal priorities
+	if(pa->candidate_idx != pb->candidate_idx)
+		return pa->candidate_idx < pb->candidate_idx ? -1 : 1;
+	return 0;
+}
+
+CHIAKI_EXPORT void chiaki_candidate_pairs_start(ChiakiCandidatePair *pairs, size_t pairs_count, uint64_t now_ms)
+{
+	qsort(pairs, pairs_count, sizeof(ChiakiCandidatePair), candidate_pair_cmp);
+	for(size_t i=0; i<pairs_count; i++)
+	{
+		pairs[i].next_send_ms = now_ms;
+		pairs[i].pacing_ms = i * CHIAKI_CANDIDATE_CHECK_PACING_MS;
+	}
+}
+
+CHIAKI_EXPORT bool chiaki_candidate_pair_send(ChiakiCandidatePair *pair, const uint8_t *request, size_t request_size, uint64_t now_ms)
+{
+	pair->next_send_ms = now_ms + pair->rto_ms + pair->pacing_ms;
+	pair->pacing_ms = 0;
+	pair->rto_ms *= 2;
+	if(pair->rto_ms > CHIAKI_CANDIDATE_CHECK_RTO_MAX_MS)
+		pair->rto_ms = CHIAKI_CANDIDATE_CHECK_RTO_MAX_MS;
+	return sendto(pair->sock, (CHIAKI_SOCKET_BUF_TYPE)request, request_size, 0, (struct sockaddr *)&pair->addr, pair->addr_len) >= 0;
+}
+
+CHIAKI_EXPORT size_t chiaki_candidate_pairs_send_due(ChiakiLog *log, ChiakiCandidatePair *pairs, size_t pairs_count,
+		const uint8_t *requests, size_t request_size, uint64_t now_ms, uint64_t *next_wakeup_ms)
+{
+	size_t alive = 0;
+	for(size_t i=0; i<pairs_count; i++)
+	{
+		ChiakiCandidatePair *pair = &pairs[i];
+		if(pair->failed || CHIAKI_SOCKET_IS_INVALID(pair->sock))
+			continue;
+		if(pair->next_send_ms <= now_ms && !chiaki_candidate_pair_send(pair, requests + pair->responses * request_size, request_size, now_ms))
+		{
+			char addr_str[INET6_ADDRSTRLEN];
+			const char *addr = sockaddr_str((struct sockaddr *)&pair->addr, addr_str, sizeof(addr_str));
+			CHIAKI_LOGW(log, "Sending candidate check request to %s failed with error: " CHIAKI_SOCKET_ERROR_FMT,
+					addr ? addr : "(unknown)", CHIAKI_SOCKET_ERROR_VALUE);
+			pair->failed = true;
+			continue;
+		}
+		alive++;
+		if(pair->next_send_ms < *next_wakeup_ms)
+			*next_wakeup_ms = pair->next_send_ms;
+	}
+	return alive;
+}
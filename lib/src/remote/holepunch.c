@@ -50,6 +50,7 @@
 #include <miniupnpc/upnperrors.h>
 
 #include <chiaki/remote/holepunch.h>
+#include <chiaki/remote/candidatecheck.h>
 #include <chiaki/stoppipe.h>
 #include <chiaki/thread.h>
 #include <chiaki/base64.h>
@@ -77,6 +78,7 @@
 #define MSG_TYPE_REQ 0x06000000
 #define MSG_TYPE_RESP 0x07000000
 #define EXTRA_CANDIDATE_ADDRESSES 3
+#define CANDIDATE_CHECK_STAGES 3
 
 static const char oauth_header_fmt[] = "Authorization: Bearer %s";
 
@@ -247,6 +249,9 @@ typedef struct session_t
     bool stun_random_allocation;
     StunServer stun_server_list[10];
     StunServer stun_server_list_ipv6[10];
+    // builtin servers with their resolve cache, separate per session and address family
+    StunServer stun_builtin_servers[STUN_SERVERS_COUNT];
+    StunServer stun_builtin_servers_ipv6[STUN_SERVERS_COUNT];
     size_t num_stun_servers;
     size_t num_stun_servers_ipv6;
     UPNPGatewayInfo gw;
@@ -692,6 +697,10 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->stun_allocation_increment = -1;
     session->num_stun_servers = 0;
     session->num_stun_servers_ipv6 = 0;
+    memset(session->stun_server_list, 0, sizeof(session->stun_server_list));
+    memset(session->stun_server_list_ipv6, 0, sizeof(session->stun_server_list_ipv6));
+    stun_servers_init(session->stun_builtin_servers);
+    stun_servers_init(session->stun_builtin_servers_ipv6);
     session->gw.data = NULL;
 
     ChiakiErrorCode err;
@@ -3086,7 +3095,7 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
         {
             CHIAKI_LOGW(session->log, "Getting stun servers returned error %s", chiaki_error_string(err));
         }
-        if (!stun_port_allocation_test(session->log, address, port, &session->stun_allocation_increment, &session->stun_random_allocation, session->stun_server_list, session->num_stun_servers, sock))
+        if (!stun_port_allocation_test(session->log, address, port, &session->stun_allocation_increment, &session->stun_random_allocation, session->stun_server_list, session->num_stun_servers, session->stun_builtin_servers, sock))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
@@ -3095,7 +3104,7 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
     }
     if(ipv4)
     {
-        if (!stun_get_external_address(session->log, address, port, session->stun_server_list, session->num_stun_servers, sock, ipv4))
+        if (!stun_get_external_address(session->log, address, port, session->stun_server_list, session->num_stun_servers, session->stun_builtin_servers, sock, ipv4))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
@@ -3103,7 +3112,7 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
     }
     else
     {
-        if (!stun_get_external_address(session->log, address, port, session->stun_server_list_ipv6, session->num_stun_servers_ipv6, sock, ipv4))
+        if (!stun_get_external_address(session->log, address, port, session->stun_server_list_ipv6, session->num_stun_servers_ipv6, session->stun_builtin_servers_ipv6, sock, ipv4))
         {
             CHIAKI_LOGE(session->log, "get_client_addr_remote_stun: Failed to get external address");
             return false;
@@ -3162,9 +3171,72 @@ static bool get_client_addr_remote_stun(Session *session, char *address, uint16_
 //     return true;
 // }
 
+/**
+ * Priority of a candidate pair, higher is checked first
+ *
+ * Host candidates are preferred over peer-reflexive ones, which are preferred over
+ * server-reflexive ones. Pairs using one of the random allocation sockets come last.
+ */
+static uint32_t candidate_pair_priority(Candidate *candidate, int family, bool random_allocation_sock)
+{
+    uint32_t type_pref;
+    switch(candidate->type)
+    {
+        case CANDIDATE_TYPE_LOCAL:
+            type_pref = 126;
+            break;
+        case CANDIDATE_TYPE_DERIVED:
+            type_pref = 110;
+            break;
+        case CANDIDATE_TYPE_STATIC:
+            type_pref = 100;
+            break;
+        default:
+            type_pref = 90;
+            break;
+    }
+    uint32_t priority = type_pref << 24;
+    if(family == AF_INET6)
+        priority |= 1 << 16;
+    if(!random_allocation_sock)
+        priority |= 1 << 8;
+    return priority;
+}
+
+/**
+ * Sends the request for the pair's current check stage and schedules its retransmission
+ *
+ * @return false if the socket of the pair is unusable
+ */
+static bool candidate_pair_send_request(Session *session, ChiakiCandidatePair *pair, Candidate *candidate, uint8_t request_buf[][88], uint64_t now)
+{
+    if (!chiaki_candidate_pair_send(pair, request_buf[pair->responses], 88, now))
+    {
+        CHIAKI_LOGW(session->log, "check_candidate: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
+        return false;
+    }
+    return true;
+}
+
+static ChiakiCandidatePair *candidate_pair_add(ChiakiCandidatePair *pairs, size_t *pairs_count, size_t pairs_max,
+    size_t candidate_idx, Candidate *candidate, chiaki_socket_t sock, struct sockaddr *addr, socklen_t addr_len, bool random_allocation_sock)
+{
+    if(*pairs_count >= pairs_max)
+        return NULL;
+    ChiakiCandidatePair *pair = &pairs[*pairs_count];
+    chiaki_candidate_pair_init(pair, candidate_idx, sock, addr, addr_len, candidate_pair_priority(candidate, addr->sa_family, random_allocation_sock));
+    (*pairs_count)++;
+    return pair;
+}
+
 /**
  * Linking to a responsive PlayStation candidate from the available console candidates
  *
+ * All pairs of local sockets and console candidates are checked concurrently. The first
+ * requests of all pairs are sent at once, unanswered requests are retransmitted per pair
+ * with exponential backoff, paced in order of pair priority, and requests from the console
+ * trigger an immediate check of the pair they arrived on. The first pair that completes all check stages is selected.
+ *
  * @param[in] session Pointer to the session context
  * @param[in] local_candidates Pointer to the client's candidates
  * @param[in] candidates Candidates for the console to check against
@@ -3178,11 +3250,11 @@ static ChiakiErrorCode check_candidates(
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
 
     // Set up request buffer
-    uint8_t request_buf[3][88] = {0};
-    uint8_t request_id[3][5] = {0};
+    uint8_t request_buf[CANDIDATE_CHECK_STAGES][88] = {0};
+    uint8_t request_id[CANDIDATE_CHECK_STAGES][5] = {0};
 
     // send 3 requests for connection pairing with ps
-    for(int i = 0; i < 3; i++)
+    for(int i = 0; i < CANDIDATE_CHECK_STAGES; i++)
     {
         chiaki_random_bytes_crypt(request_id[i], sizeof(request_id[i]));
         *(uint32_t*)&request_buf[i][0x00] = htonl(MSG_TYPE_REQ);
@@ -3197,17 +3269,12 @@ static ChiakiErrorCode check_candidates(
     Candidate *remote_candidate = &local_candidates[1];
 
     size_t extra_addresses_used = 0;
-    // Set up addresses for each candidate + extras (use sockaddr_in6 and cast bc needs to be at least that big if we get ipv6)
-    struct sockaddr_in6 addrs[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
-    socklen_t lens[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
     Candidate candidates[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
     memcpy(candidates, candidates_received, num_candidates * sizeof(Candidate));
-    int responses_received[num_candidates + EXTRA_CANDIDATE_ADDRESSES];
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(session->ipv4_sock, &fds);
-    FD_SET(session->ipv6_sock, &fds);
-    bool failed = true;
+    // Every candidate can be paired with the socket of its address family and all random allocation sockets
+    const size_t pairs_max = (num_candidates + EXTRA_CANDIDATE_ADDRESSES) * (1 + RANDOM_ALLOCATION_SOCKS_NUMBER);
+    ChiakiCandidatePair pairs[pairs_max];
+    size_t pairs_count = 0;
     char service_remote[6];
     struct addrinfo hints;
     memset(&hints, 0, sizeof(hints));
@@ -3215,6 +3282,9 @@ static ChiakiErrorCode check_candidates(
     hints.ai_family = AF_UNSPEC;
     struct addrinfo *addr_remote;
     chiaki_socket_t socks[RANDOM_ALLOCATION_SOCKS_NUMBER];
+    bool socks_ttl_restored[RANDOM_ALLOCATION_SOCKS_NUMBER] = {0};
+    for (int i=0; i < RANDOM_ALLOCATION_SOCKS_NUMBER; i++)
+        socks[i] = CHIAKI_INVALID_SOCKET;
 
     if(session->stun_random_allocation)
     {
@@ -3276,10 +3346,11 @@ static ChiakiErrorCode check_candidates(
             }
         }
     }
+
+    // Build the check list
     for (int i=0; i < num_candidates; i++)
     {
         Candidate *candidate = &candidates[i];
-        responses_received[i] = 0;
 
         sprintf(service_remote, "%d", candidate->port);
 
@@ -3289,359 +3360,332 @@ static ChiakiErrorCode check_candidates(
             err = CHIAKI_ERR_UNKNOWN;
             continue;
         }
-        memcpy((struct sockaddr *)&addrs[i], addr_remote->ai_addr, addr_remote->ai_addrlen);
-        lens[i] = addr_remote->ai_addrlen;
 
-        switch(((struct sockaddr *)&addrs[i])->sa_family)
+        switch(addr_remote->ai_addr->sa_family)
         {
             case AF_INET:
-                if (sendto(session->ipv4_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                {
-                    CHIAKI_LOGW(session->log, "check_candidate: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                    err = CHIAKI_ERR_NETWORK;
-                    freeaddrinfo(addr_remote);
-                    continue;
-                }
+                if(CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
+                    break;
+                candidate_pair_add(pairs, &pairs_count, pairs_max, i, candidate, session->ipv4_sock, addr_remote->ai_addr, addr_remote->ai_addrlen, false);
                 if(session->stun_random_allocation && (candidate->type == CANDIDATE_TYPE_STATIC || candidate->type == CANDIDATE_TYPE_STUN))
                 {
                     for (int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
                     {
                         if(CHIAKI_SOCKET_IS_INVALID(socks[j]))
                             continue;
-                        if (sendto(socks[j], (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                        {
-                            CHIAKI_LOGW(session->log, "check_candidate: Sending request for socket %d failed for %s:%d with error, closing socket: " CHIAKI_SOCKET_ERROR_FMT, j, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                            CHIAKI_SOCKET_CLOSE(socks[j]);
-                            socks[j] = CHIAKI_INVALID_SOCKET;
-                            continue;
-                        }
-
+                        candidate_pair_add(pairs, &pairs_count, pairs_max, i, candidate, socks[j], addr_remote->ai_addr, addr_remote->ai_addrlen, true);
                     }
                 }
                 break;
             case AF_INET6:
-                if (sendto(session->ipv6_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                {
-                    CHIAKI_LOGW(session->log, "check_candidate: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                    err = CHIAKI_ERR_NETWORK;
-                    freeaddrinfo(addr_remote);
-                    continue;
-                }
+                if(CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
+                    break;
+                candidate_pair_add(pairs, &pairs_count, pairs_max, i, candidate, session->ipv6_sock, addr_remote->ai_addr, addr_remote->ai_addrlen, false);
                 break;
             default:
                 CHIAKI_LOGW(session->log, "Unsupported address family, skipping...");
         }
-        failed = false;
         freeaddrinfo(addr_remote);
     }
-    if(failed)
+    if(pairs_count == 0)
     {
         err = CHIAKI_ERR_NETWORK;
         goto cleanup_sockets;
     }
 
+    uint64_t now = chiaki_time_now_monotonic_ms();
+    chiaki_candidate_pairs_start(pairs, pairs_count, now);
+
     // Wait for responses
     uint8_t response_buf[88];
 
-    chiaki_socket_t maxfd = -1;
-    maxfd = session->ipv4_sock;
-    if(session->ipv6_sock > maxfd)
-        maxfd = session->ipv6_sock;
-    if(session->stun_random_allocation)
-    {
-        for(int i=0; i<RANDOM_ALLOCATION_SOCKS_NUMBER; i++)
-        {
-            if(socks[i] > maxfd)
-                maxfd = socks[i];
-            FD_SET(socks[i], &fds);
-        }
-    }
-    maxfd = maxfd + 1;
-
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = SELECT_CANDIDATE_TIMEOUT_SEC * SECOND_US;
-
-    chiaki_socket_t selected_sock = CHIAKI_INVALID_SOCKET;
+    uint64_t deadline = now + (uint64_t)(SELECT_CANDIDATE_TRIES * SELECT_CANDIDATE_TIMEOUT_SEC * 1000);
+    ChiakiCandidatePair *selected_pair = NULL;
     Candidate *selected_candidate = NULL;
     bool received_response = false;
     bool responded = false;
-    bool connecting = false;
-    int retry_counter = 0;
 
-    while (!selected_candidate)
+    while (!selected_pair)
     {
-        int ret = select(maxfd, &fds, NULL, NULL, &tv);
-#ifdef _WIN32
-	    if (ret < 0 && WSAGetLastError() != WSAEINTR)
-#else
-	    if (ret < 0 && errno != EINTR)
-#endif
+        now = chiaki_time_now_monotonic_ms();
+        if(now >= deadline)
         {
-            CHIAKI_LOGE(session->log, "check_candidate: Select failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            err = CHIAKI_ERR_NETWORK;
+            // No responsive candidate within timeout, terminate with error
+            CHIAKI_LOGE(session->log, "check_candidate: Select timed out");
+            err = CHIAKI_ERR_HOST_UNREACH;
             goto cleanup_sockets;
-        } else if (ret == 0)
+        }
+
+        // Send all checks that are due and find out when the next one is
+        uint64_t next_wakeup = deadline;
+        size_t pairs_alive = chiaki_candidate_pairs_send_due(session->log, pairs, pairs_count, &request_buf[0][0], sizeof(request_buf[0]), now, &next_wakeup);
+        if(pairs_alive == 0)
         {
-            if (CHIAKI_SOCKET_IS_INVALID(selected_sock))
-            {
-                if(retry_counter < SELECT_CANDIDATE_TRIES && !received_response)
-                {
-                    retry_counter++;
-                    tv.tv_sec = 0;
-                    tv.tv_usec = SELECT_CANDIDATE_TIMEOUT_SEC * SECOND_US;
-                    FD_ZERO(&fds);
-                    FD_SET(session->ipv4_sock, &fds);
-                    FD_SET(session->ipv6_sock, &fds);
-                    Candidate *candidate = NULL;
-                    chiaki_socket_t sock = CHIAKI_INVALID_SOCKET;
-                    CHIAKI_LOGI(session->log, "check_candidate: Resending requests to all candidates TRY %d... waiting for 1st response", retry_counter);
-                    for (int i=0; i < num_candidates + extra_addresses_used; i++)
-                    {
-                        if(((struct sockaddr *)&addrs[i])->sa_family == AF_INET)
-                            sock = session->ipv4_sock;
-                        else if(((struct sockaddr *)&addrs[i])->sa_family == AF_INET6)
-                            sock = session->ipv6_sock;
-                        else
-                        {
-                            CHIAKI_LOGE(session->log, "check_candidate: Got an address with an unsupported address family %d, skipping ...", ((struct sockaddr *)&addrs[i])->sa_family);
-                            continue;
-                        }
-                        candidate = &candidates[i];
-                        if (sendto(sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
-                        {
-                            CHIAKI_LOGE(session->log, "check_candidate: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                            continue;
-                        }
-                        if(session->stun_random_allocation && (candidate->type == CANDIDATE_TYPE_STATIC || candidate->type == CANDIDATE_TYPE_STUN))
-                        {
-                            for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
-                                FD_SET(socks[j], &fds);
-                        }
-                    }
-                    continue;                    
-                }
-                else if(received_response && !connecting)
-                {
-                    connecting = true;
-                    tv.tv_sec = SELECT_CANDIDATE_CONNECTION_SEC;
-                    tv.tv_usec = 0;
-                    continue;
-                }
-                // No responsive candidate within timeout, terminate with error
-                CHIAKI_LOGE(session->log, "check_candidate: Select timed out");
-                err = CHIAKI_ERR_HOST_UNREACH;
-                goto cleanup_sockets;
-            }
-            // Otherwise, we have a responsive candidate, break out of loop
-            break;
+            CHIAKI_LOGE(session->log, "check_candidate: No candidate pair left to check");
+            err = CHIAKI_ERR_NETWORK;
+            goto cleanup_sockets;
         }
 
-        Candidate *candidate = NULL;
-        chiaki_socket_t candidate_sock = CHIAKI_INVALID_SOCKET;
-        socklen_t recv_len;
-        if (!(CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock)) && FD_ISSET(session->ipv4_sock, &fds))
+        fd_set fds;
+        FD_ZERO(&fds);
+        chiaki_socket_t maxfd = 0;
+        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
         {
-            candidate_sock = session->ipv4_sock;
-            recv_len = sizeof(struct sockaddr_in);
+            FD_SET(session->ipv4_sock, &fds);
+            if(session->ipv4_sock > maxfd)
+                maxfd = session->ipv4_sock;
         }
-        else if (!(CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock)) && FD_ISSET(session->ipv6_sock, &fds))
+        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
         {
-            candidate_sock = session->ipv6_sock;
-            recv_len = sizeof(struct sockaddr_in6);
+            FD_SET(session->ipv6_sock, &fds);
+            if(session->ipv6_sock > maxfd)
+                maxfd = session->ipv6_sock;
         }
-        else
+        for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
+        {
+            if(CHIAKI_SOCKET_IS_INVALID(socks[j]))
+                continue;
+            FD_SET(socks[j], &fds);
+            if(socks[j] > maxfd)
+                maxfd = socks[j];
+        }
+
+        uint64_t wait_ms = next_wakeup > now ? next_wakeup - now : 0;
+        struct timeval tv;
+        tv.tv_sec = wait_ms / 1000;
+        tv.tv_usec = (wait_ms % 1000) * 1000;
+
+        int ret = select(maxfd + 1, &fds, NULL, NULL, &tv);
+        if (ret < 0)
         {
-            for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
-            {
-                if(!(CHIAKI_SOCKET_IS_INVALID(socks[j])) && FD_ISSET(socks[j], &fds))
-                {
-                    candidate_sock = socks[j];
-                    recv_len = sizeof(struct sockaddr_in);
 #ifdef _WIN32
-                    DWORD ttl = 64;
+            if (WSAGetLastError() == WSAEINTR)
 #else
-                    int ttl = 64;
+            if (errno == EINTR)
 #endif
-                    if (setsockopt(socks[j], IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0)
-                    {
-                        CHIAKI_LOGE(session->log, "setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-                        CHIAKI_SOCKET_CLOSE(socks[j]);
-                        socks[j] = CHIAKI_INVALID_SOCKET;
-                        err = CHIAKI_ERR_UNKNOWN;
-                        goto cleanup_sockets;
-                    }
-                    break;
-                }
-            }
-            CHIAKI_LOGE(session->log, "check_candidate: Select returned an invalid socket!");
-            err = CHIAKI_ERR_UNKNOWN;
+                continue;
+            CHIAKI_LOGE(session->log, "check_candidate: Select failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+            err = CHIAKI_ERR_NETWORK;
             goto cleanup_sockets;
         }
+        if (ret == 0)
+            continue;
 
-        struct sockaddr* recv_address;
-        // allocate up to sockaddr in6 since that's what may be needed
-        recv_address = malloc(sizeof(struct sockaddr_in6));
-        if(!recv_address)
+        // Handle every readable socket, not just the first one
+        chiaki_socket_t ready_socks[2 + RANDOM_ALLOCATION_SOCKS_NUMBER];
+        int ready_random_idx[2 + RANDOM_ALLOCATION_SOCKS_NUMBER];
+        size_t ready_count = 0;
+        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock) && FD_ISSET(session->ipv4_sock, &fds))
         {
-            err = CHIAKI_ERR_MEMORY;
-            goto cleanup_sockets;
+            ready_random_idx[ready_count] = -1;
+            ready_socks[ready_count++] = session->ipv4_sock;
         }
-        char recv_address_string[INET6_ADDRSTRLEN];
-        uint16_t recv_address_port = 0;
-        int i = 0;
-        CHIAKI_SSIZET_TYPE response_len = recvfrom(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) response_buf, sizeof(response_buf), 0, recv_address, &recv_len);
-        if (response_len < 0)
+        if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock) && FD_ISSET(session->ipv6_sock, &fds))
         {
-            CHIAKI_LOGE(session->log, "check_candidate: Receiving response failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-            free(recv_address);
-            continue;
+            ready_random_idx[ready_count] = -1;
+            ready_socks[ready_count++] = session->ipv6_sock;
         }
-        if(recv_address->sa_family == AF_INET)
+        for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
         {
-            if (!inet_ntop(AF_INET, &(((struct sockaddr_in *)recv_address)->sin_addr), recv_address_string, sizeof(recv_address_string)))
+            if(!CHIAKI_SOCKET_IS_INVALID(socks[j]) && FD_ISSET(socks[j], &fds))
             {
-                CHIAKI_LOGE(session->log, "check_candidate: Couldn't retrieve address from recv address!");
-                free(recv_address);
-                continue;
+                ready_random_idx[ready_count] = j;
+                ready_socks[ready_count++] = socks[j];
             }
-            recv_address_port = ntohs(((struct sockaddr_in *)recv_address)->sin_port);
         }
-        else if (recv_address->sa_family == AF_INET6)
+
+        for(size_t r = 0; r < ready_count && !selected_pair; r++)
         {
-            if (!inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)recv_address)->sin6_addr), recv_address_string, sizeof(recv_address_string)))
+            chiaki_socket_t candidate_sock = ready_socks[r];
+            int random_idx = ready_random_idx[r];
+            if(random_idx >= 0 && !socks_ttl_restored[random_idx])
+            {
+                // the hole is punched, packets need to reach the console from now on
+#ifdef _WIN32
+                DWORD ttl = 64;
+#else
+                int ttl = 64;
+#endif
+                if (setsockopt(candidate_sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0)
+                {
+                    CHIAKI_LOGE(session->log, "setsockopt(IP_TTL) failed with error" CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+                    CHIAKI_SOCKET_CLOSE(socks[random_idx]);
+                    socks[random_idx] = CHIAKI_INVALID_SOCKET;
+                    for(size_t i = 0; i < pairs_count; i++)
+                    {
+                        if(pairs[i].sock == candidate_sock)
+                            pairs[i].sock = CHIAKI_INVALID_SOCKET;
+                    }
+                    continue;
+                }
+                socks_ttl_restored[random_idx] = true;
+            }
+
+            // allocate up to sockaddr in6 since that's what may be needed
+            struct sockaddr_in6 recv_address_storage;
+            struct sockaddr *recv_address = (struct sockaddr *)&recv_address_storage;
+            socklen_t recv_len = sizeof(recv_address_storage);
+            char recv_address_string[INET6_ADDRSTRLEN];
+            uint16_t recv_address_port = 0;
+            CHIAKI_SSIZET_TYPE response_len = recvfrom(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) response_buf, sizeof(response_buf), 0, recv_address, &recv_len);
+            if (response_len < 0)
             {
-                CHIAKI_LOGE(session->log, "check_candidate: Couldn't retrieve address from recv address!");
-                free(recv_address);
+                CHIAKI_LOGE(session->log, "check_candidate: Receiving response failed with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
                 continue;
             }
-            recv_address_port = ntohs(((struct sockaddr_in6 *)recv_address)->sin6_port);
-        }
-        else
-        {
-            CHIAKI_LOGE(session->log, "check_candidate: Got an address with an unsupported address family %d, skipping ...", recv_address->sa_family);
-            free(recv_address);
-            continue;
-        }
-        bool existing_candidate = false;
-        for (; i < num_candidates + extra_addresses_used; i++)
-        {
-            candidate = &candidates[i];
-            if((strcmp(candidate->addr, recv_address_string) == 0) && (candidate->port == recv_address_port))
+            if(recv_address->sa_family == AF_INET)
             {
-                existing_candidate = true;
-                break;
+                if (!inet_ntop(AF_INET, &(((struct sockaddr_in *)recv_address)->sin_addr), recv_address_string, sizeof(recv_address_string)))
+                {
+                    CHIAKI_LOGE(session->log, "check_candidate: Couldn't retrieve address from recv address!");
+                    continue;
+                }
+                recv_address_port = ntohs(((struct sockaddr_in *)recv_address)->sin_port);
             }
-        }
-        if(!existing_candidate)
-        {
-            if(extra_addresses_used >= EXTRA_CANDIDATE_ADDRESSES)
+            else if (recv_address->sa_family == AF_INET6)
             {
-                CHIAKI_LOGI(session->log, "check_candidate: Received more than %d extra candidates skipping this one", EXTRA_CANDIDATE_ADDRESSES);
-                free(recv_address);
-                continue;
+                if (!inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)recv_address)->sin6_addr), recv_address_string, sizeof(recv_address_string)))
+                {
+                    CHIAKI_LOGE(session->log, "check_candidate: Couldn't retrieve address from recv address!");
+                    continue;
+                }
+                recv_address_port = ntohs(((struct sockaddr_in6 *)recv_address)->sin6_port);
             }
             else
             {
+                CHIAKI_LOGE(session->log, "check_candidate: Got an address with an unsupported address family %d, skipping ...", recv_address->sa_family);
+                continue;
+            }
+
+            size_t i = 0;
+            Candidate *candidate = NULL;
+            for (; i < num_candidates + extra_addresses_used; i++)
+            {
+                if((strcmp(candidates[i].addr, recv_address_string) == 0) && (candidates[i].port == recv_address_port))
+                {
+                    candidate = &candidates[i];
+                    break;
+                }
+            }
+            if(!candidate)
+            {
+                if(extra_addresses_used >= EXTRA_CANDIDATE_ADDRESSES)
+                {
+                    CHIAKI_LOGI(session->log, "check_candidate: Received more than %d extra candidates skipping this one", EXTRA_CANDIDATE_ADDRESSES);
+                    continue;
+                }
                 candidate = &candidates[i];
-                responses_received[i] = 0;
                 memcpy(candidate->addr, recv_address_string, sizeof(recv_address_string));
+                candidate->port = recv_address_port;
                 candidate->port_mapped = 0;
                 candidate->type = CANDIDATE_TYPE_DERIVED;
                 if(recv_address->sa_family == AF_INET)
-                {
-                    candidate->port = recv_address_port;
                     memcpy(candidate->addr_mapped, "0.0.0.0", 8);
-                }
-                else if(recv_address->sa_family == AF_INET6)
-                {
-                    candidate->port = recv_address_port;
+                else
                     memcpy(candidate->addr_mapped, "0:0:0:0:0:0:0:0", 16);
+                extra_addresses_used++;
+                CHIAKI_LOGI(session->log, "check_candidate: Received new candidate at %s:%d", candidate->addr, candidate->port);
+            }
+
+            ChiakiCandidatePair *pair = NULL;
+            for(size_t k = 0; k < pairs_count; k++)
+            {
+                if(pairs[k].candidate_idx == i && pairs[k].sock == candidate_sock)
+                {
+                    pair = &pairs[k];
+                    break;
                 }
-                else
+            }
+            if(!pair)
+            {
+                // peer-reflexive pair, will be checked right away (triggered check)
+                pair = candidate_pair_add(pairs, &pairs_count, pairs_max, i, candidate, candidate_sock, recv_address, recv_len, random_idx >= 0);
+                if(!pair)
                 {
-                    CHIAKI_LOGE(session->log, "check_candidate: Got an address with an unsupported address family %d, skipping ...", recv_address->sa_family);
-                    free(recv_address);
+                    CHIAKI_LOGW(session->log, "check_candidate: Too many candidate pairs, ignoring %s:%d", candidate->addr, candidate->port);
                     continue;
                 }
-                memcpy((struct sockaddr *)&addrs[i], recv_address, recv_len);
-                lens[i] = recv_len;
-                extra_addresses_used++;
-                CHIAKI_LOGI(session->log, "check_candidate: Received new candidate at %s:%d", candidate->addr, candidate->port);
             }
-            free(recv_address);
-        }
-        CHIAKI_LOGV(session->log, "check_candidate: Received data from %s:%d", candidate->addr, candidate->port);
-        if (response_len != sizeof(response_buf))
-        {
-            if(candidate->type == CANDIDATE_TYPE_DERIVED)
+            if(pair->failed)
                 continue;
-            CHIAKI_LOGE(session->log, "check_candidate: Received response of unexpected size %ld from %s:%d", response_len, candidate->addr, candidate->port);
-            err = CHIAKI_ERR_NETWORK;
-            goto cleanup_sockets;
-        }
-        uint32_t msg_type = ntohl(*((uint32_t*)(response_buf)));
-        if (msg_type == MSG_TYPE_REQ)
-        {
-            CHIAKI_LOGI(session->log, "Responding to request");
-            responded = true;
-            err = send_responseto_ps(session, response_buf, &candidate_sock, candidate, (struct sockaddr *)&addrs[i], lens[i]);
-            if(err != CHIAKI_ERR_SUCCESS && candidate->type != CANDIDATE_TYPE_DERIVED)
-                goto cleanup_sockets;
-            if((session->stun_random_allocation || candidate->type == CANDIDATE_TYPE_DERIVED) && responses_received[i] == 0)
+
+            CHIAKI_LOGV(session->log, "check_candidate: Received data from %s:%d", candidate->addr, candidate->port);
+            if (response_len != sizeof(response_buf))
+            {
+                CHIAKI_LOGW(session->log, "check_candidate: Received response of unexpected size %ld from %s:%d, ignoring", (long)response_len, candidate->addr, candidate->port);
+                continue;
+            }
+            now = chiaki_time_now_monotonic_ms();
+            uint32_t msg_type = ntohl(*((uint32_t*)(response_buf)));
+            if (msg_type == MSG_TYPE_REQ)
             {
-                if (sendto(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[0], sizeof(request_buf[0]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+                CHIAKI_LOGI(session->log, "Responding to request");
+                err = send_responseto_ps(session, response_buf, &candidate_sock, candidate, (struct sockaddr *)&pair->addr, pair->addr_len);
+                if(err != CHIAKI_ERR_SUCCESS)
+                    continue;
+                responded = true;
+                pair->responded = true;
+                // The console can reach us on this pair, check it immediately instead of waiting for the next retransmission
+                if(pair->responses == 0 && !candidate_pair_send_request(session, pair, candidate, request_buf, now))
+                    pair->failed = true;
+                continue;
+            }
+            if (msg_type != MSG_TYPE_RESP)
+            {
+                CHIAKI_LOGE(session->log, "check_candidate: Received response of unexpected type %lu from %s:%d", (unsigned long)msg_type, candidate->addr, candidate->port);
+                chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
+                continue;
+            }
+            // TODO: More validation of localHashedIds, sids and the weird data at 0x4b?
+            if(memcmp(response_buf + 0x4b, request_id[pair->responses], sizeof(request_id[pair->responses])) != 0)
+            {
+                bool stale = false;
+                for(int stage = 0; stage < pair->responses; stage++)
                 {
-                    CHIAKI_LOGE(session->log, "check_candidate: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                    goto cleanup_sockets;
+                    if(memcmp(response_buf + 0x4b, request_id[stage], sizeof(request_id[stage])) == 0)
+                        stale = true;
+                }
+                if(stale)
+                    CHIAKI_LOGV(session->log, "check_candidate: Received response to retransmitted request from %s:%d", candidate->addr, candidate->port);
+                else
+                {
+                    CHIAKI_LOGE(session->log, "check_candidate: Received response with unexpected request ID from %s:%d", candidate->addr, candidate->port);
+                    chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
                 }
-            }
-            continue;
-        }
-        if (msg_type != MSG_TYPE_RESP)
-        {
-            CHIAKI_LOGE(session->log, "check_candidate: Received response of unexpected type %lu from %s:%d", msg_type, candidate->addr, candidate->port);
-            chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
-            err = CHIAKI_ERR_UNKNOWN;
-            if(candidate->type == CANDIDATE_TYPE_DERIVED)
                 continue;
-            goto cleanup_sockets;
-        }
-        // TODO: More validation of localHashedIds, sids and the weird data at 0x4b?
-        int responses = responses_received[i];
-        if(memcmp(response_buf + 0x4b, request_id[responses], sizeof(request_id[responses])) != 0)
-        {
-            CHIAKI_LOGE(session->log, "check_candidate: Received response with unexpected request ID %lu from %s:%d", request_id, candidate->addr, candidate->port);
-            chiaki_log_hexdump(session->log, CHIAKI_LOG_ERROR, response_buf, 88);
-            continue;
-        }
-        received_response = true;
-        responses_received[i]++;
-        responses = responses_received[i];
-        if(responses > 2)
-        {
-            selected_sock = candidate_sock;
-            selected_candidate = candidate;
-            if (connect(selected_sock, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+            }
+            if(!received_response)
             {
-                CHIAKI_LOGE(session->log, "check_candidate: Connecting socket failed for %s:%d with error " CHIAKI_SOCKET_ERROR_FMT, selected_candidate->addr, selected_candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                err = CHIAKI_ERR_NETWORK;
-                goto cleanup_sockets;
+                received_response = true;
+                // Give the remaining check stages some time to complete
+                uint64_t connection_deadline = now + SELECT_CANDIDATE_CONNECTION_SEC * 1000;
+                if(connection_deadline > deadline)
+                    deadline = connection_deadline;
             }
-            CHIAKI_LOGV(session->log, "Selected Candidate");
-            print_candidate(session->log, selected_candidate);
-            break;
-        }
-        else
-        {
-            if (sendto(candidate_sock, (CHIAKI_SOCKET_BUF_TYPE) request_buf[responses], sizeof(request_buf[responses]), 0, (struct sockaddr *)&addrs[i], lens[i]) < 0)
+            pair->responses++;
+            if(pair->responses >= CANDIDATE_CHECK_STAGES)
             {
-                CHIAKI_LOGE(session->log, "check_candidate: Sending request failed for %s:%d with error: " CHIAKI_SOCKET_ERROR_FMT, candidate->addr, candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
-                err = CHIAKI_ERR_NETWORK;
-                    continue;
+                selected_pair = pair;
+                selected_candidate = candidate;
+                break;
             }
+            // Continue with the next stage right away
+            pair->rto_ms = CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS;
+            if(!candidate_pair_send_request(session, pair, candidate, request_buf, now))
+                pair->failed = true;
         }
     }
+
+    chiaki_socket_t selected_sock = selected_pair->sock;
+    if (connect(selected_sock, (struct sockaddr *)&selected_pair->addr, selected_pair->addr_len) < 0)
+    {
+        CHIAKI_LOGE(session->log, "check_candidate: Connecting socket failed for %s:%d with error " CHIAKI_SOCKET_ERROR_FMT, selected_candidate->addr, selected_candidate->port, CHIAKI_SOCKET_ERROR_VALUE);
+        err = CHIAKI_ERR_NETWORK;
+        goto cleanup_sockets;
+    }
+    CHIAKI_LOGV(session->log, "Selected Candidate");
+    print_candidate(session->log, selected_candidate);
+
     *out = selected_sock;
     // Close non-chosen sockets
     if (session->ipv4_sock != *out && (!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock)))
@@ -3654,26 +3698,29 @@ static ChiakiErrorCode check_candidates(
         CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
         session->ipv6_sock = CHIAKI_INVALID_SOCKET;
     }
-    if(session->stun_random_allocation)
+    for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
     {
-        for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
+        if(!CHIAKI_SOCKET_IS_INVALID(socks[j]) && socks[j] != selected_sock)
         {
-            if(!CHIAKI_SOCKET_IS_INVALID(socks[j]) && socks[j] != selected_sock)
-            {
-                CHIAKI_SOCKET_CLOSE(socks[j]);
-                socks[j] = CHIAKI_INVALID_SOCKET;
-            }
+            CHIAKI_SOCKET_CLOSE(socks[j]);
+            socks[j] = CHIAKI_INVALID_SOCKET;
         }
     }
 
-    err = receive_request_send_response_ps(session, out, selected_candidate, WAIT_RESPONSE_TIMEOUT_SEC);
-    if(err == CHIAKI_ERR_TIMEOUT)
+    // If the console already got a response from us on the selected pair, both sides have
+    // validated it and there is nothing left to wait for here. Further requests are
+    // answered after the ACCEPT exchange.
+    if(!selected_pair->responded)
     {
-        if(!responded)
+        err = receive_request_send_response_ps(session, out, selected_candidate, WAIT_RESPONSE_TIMEOUT_SEC);
+        if(err == CHIAKI_ERR_TIMEOUT)
+        {
+            if(!responded)
+                goto cleanup_sockets;
+        }
+        else if(err != CHIAKI_ERR_SUCCESS)
             goto cleanup_sockets;
     }
-    else if(err != CHIAKI_ERR_SUCCESS)
-        goto cleanup_sockets;
 
     memset(selected_candidate->addr_mapped, 0, sizeof(selected_candidate->addr_mapped));
     bool local = false;
@@ -3739,15 +3786,12 @@ cleanup_sockets:
         CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
         session->ipv6_sock = CHIAKI_INVALID_SOCKET;
     }
-    if(session->stun_random_allocation)
+    for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
     {
-        for(int j=0; j<RANDOM_ALLOCATION_SOCKS_NUMBER; j++)
+        if(!CHIAKI_SOCKET_IS_INVALID(socks[j]))
         {
-            if(!CHIAKI_SOCKET_IS_INVALID(socks[j]))
-            {
-                CHIAKI_SOCKET_CLOSE(socks[j]);
-                socks[j] = CHIAKI_INVALID_SOCKET;
-            }
+            CHIAKI_SOCKET_CLOSE(socks[j]);
+            socks[j] = CHIAKI_INVALID_SOCKET;
         }
     }
     return err;
@@ -4716,6 +4760,8 @@ static ChiakiErrorCode session_message_free(SessionMessage *message)
 /**
  * Gets stun servers from updated list of online STUN servers
  *
+ * The IPv4 and IPv6 lists are downloaded concurrently.
+ *
  * @param session Pointer to the holepunch session
  * @return ChiakiErrSuccess on success or error code on failure
 */
@@ -4723,156 +4769,191 @@ static ChiakiErrorCode get_stun_servers(Session *session)
 {
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
     const char STUN_HOSTS_URL[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_hosts.txt";
-    CURL *curl = curl_easy_init();
-    if(!curl)
-    {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
-    }
-
-    HttpResponseData response_data = {
-        .data = malloc(0),
-        .size = 0,
+    const char STUN_HOSTS_URL_IPV6[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
+    const char *urls[2] = { STUN_HOSTS_URL, STUN_HOSTS_URL_IPV6 };
+    CURL *curls[2] = { NULL, NULL };
+    CURLcode results[2] = { CURLE_FAILED_INIT, CURLE_FAILED_INIT };
+    HttpResponseData response_datas[2] = {
+        { .data = malloc(0), .size = 0 },
+        { .data = malloc(0), .size = 0 }
     };
 
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2L);
-    curl_easy_setopt(curl, CURLOPT_URL, STUN_HOSTS_URL);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    CURLM *multi = curl_multi_init();
+    if(!multi)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
-        {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with HTTP code %ld", STUN_HOSTS_URL, http_code);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", response_data.size, response_data.data);
-            err = CHIAKI_ERR_HTTP_NONOK;
-        } else {
-            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with CURL error %d", STUN_HOSTS_URL, res);
-            err = CHIAKI_ERR_NETWORK;
-        }
+        CHIAKI_LOGE(session->log, "Curl could not init");
+        err = CHIAKI_ERR_MEMORY;
         goto cleanup;
     }
-    // hostname has max of 253 chars + 1 char for colon : + port has max of 4 chars + 1 char for null termination
-    char server_strings[10][259];
-    char *ptr = strtok(response_data.data, "\n");
-    while(ptr != NULL && session->num_stun_servers <= 9)
-    {
-        strcpy(server_strings[session->num_stun_servers], ptr);
-        session->num_stun_servers++;
-		ptr = strtok(NULL, "\n");
-    }
-    ptr = NULL;
-    for(int i = 0; i < session->num_stun_servers; i++)
+    for(int i = 0; i < 2; i++)
     {
-        ptr = strtok(server_strings[i], ":");
-        if(ptr == NULL)
-        {
-            CHIAKI_LOGW(session->log, "Problem reading stun server list host");
-            session->num_stun_servers = i;
-            return CHIAKI_ERR_INVALID_DATA;
-        }
-        session->stun_server_list[i].host = malloc((strlen(ptr) + 1) * sizeof(char));
-        if(!session->stun_server_list[i].host)
+        curls[i] = curl_easy_init();
+        if(!curls[i])
         {
-            CHIAKI_LOGW(session->log, "Problem allocating memory for stun server list host");
-            session->num_stun_servers = i;
-            return CHIAKI_ERR_MEMORY;
+            CHIAKI_LOGE(session->log, "Curl could not init");
+            err = CHIAKI_ERR_MEMORY;
+            goto cleanup;
         }
-        strcpy(session->stun_server_list[i].host, ptr);
-        ptr = strtok(NULL, ":");
-        if(ptr == NULL)
+        curl_easy_setopt(curls[i], CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curls[i], CURLOPT_TIMEOUT, 2L);
+        curl_easy_setopt(curls[i], CURLOPT_URL, urls[i]);
+        curl_easy_setopt(curls[i], CURLOPT_WRITEFUNCTION, curl_write_cb);
+        curl_easy_setopt(curls[i], CURLOPT_WRITEDATA, (void*)&response_datas[i]);
+        curl_multi_add_handle(multi, curls[i]);
+    }
+
+    int still_running = 0;
+    do
+    {
+        CURLMcode mc = curl_multi_perform(multi, &still_running);
+        if(mc == CURLM_OK && still_running)
+            mc = curl_multi_wait(multi, NULL, 0, 100, NULL);
+        if(mc != CURLM_OK)
         {
-            CHIAKI_LOGW(session->log, "Problem reading stun server list port");
-            session->num_stun_servers = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            CHIAKI_LOGE(session->log, "Getting stun servers failed with CURL multi error %d", mc);
+            err = CHIAKI_ERR_NETWORK;
+            goto cleanup;
         }
-        session->stun_server_list[i].port = strtol(ptr, NULL, 10);
-        ptr = NULL;
-    }
+    } while(still_running);
 
-    free(response_data.data);
-    response_data.data = malloc(0);
-    response_data.size = 0;
-    curl_easy_cleanup(curl);
-    curl = NULL;
-    const char STUN_HOSTS_URL_IPV6[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
-    curl = curl_easy_init();
-    if(!curl)
+    CURLMsg *curl_msg;
+    int msgs_left = 0;
+    while((curl_msg = curl_multi_info_read(multi, &msgs_left)))
     {
-        CHIAKI_LOGE(session->log, "Curl could not init");
-        return CHIAKI_ERR_MEMORY;
+        if(curl_msg->msg != CURLMSG_DONE)
+            continue;
+        for(int i = 0; i < 2; i++)
+        {
+            if(curl_msg->easy_handle == curls[i])
+                results[i] = curl_msg->data.result;
+        }
     }
 
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2L);
-    curl_easy_setopt(curl, CURLOPT_URL, STUN_HOSTS_URL_IPV6);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
-
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    for(int i = 0; i < 2; i++)
     {
-        if (res == CURLE_HTTP_RETURNED_ERROR)
+        if (results[i] == CURLE_OK)
+            continue;
+        if (results[i] == CURLE_HTTP_RETURNED_ERROR)
         {
             long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            CHIAKI_LOGE(session->log, "Getting IPV6 stun servers from %s failed with HTTP code %ld", STUN_HOSTS_URL, http_code);
-            CHIAKI_LOGV(session->log, "Response Body: %.*s.", response_data.size, response_data.data);
+            curl_easy_getinfo(curls[i], CURLINFO_RESPONSE_CODE, &http_code);
+            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with HTTP code %ld", urls[i], http_code);
+            CHIAKI_LOGV(session->log, "Response Body: %.*s.", (int)response_datas[i].size, response_datas[i].data);
             err = CHIAKI_ERR_HTTP_NONOK;
         } else {
-            CHIAKI_LOGE(session->log, "Getting IPV6 stun servers from %s failed with CURL error %d", STUN_HOSTS_URL, res);
+            CHIAKI_LOGE(session->log, "Getting stun servers from %s failed with CURL error %d", urls[i], results[i]);
             err = CHIAKI_ERR_NETWORK;
         }
-        goto cleanup;
-    }
-    // ipv6 string has max of 45 chars: 39 chars + 2 chars for [] + 1 char for colon : + port has max of 4 chars + 1 char for null termination
-    char server_strings_ipv6[10][47];
-    ptr = strtok(response_data.data, "\n");
-    while(ptr != NULL && session->num_stun_servers_ipv6 <= 9)
-    {
-        // omit leading [
-        strcpy(server_strings_ipv6[session->num_stun_servers_ipv6], ptr + 1);
-        session->num_stun_servers_ipv6++;
-		ptr = strtok(NULL, "\n");
     }
-    ptr = NULL;
-    for(int i = 0; i < session->num_stun_servers_ipv6; i++)
+
+    char *ptr = NULL;
+    if(results[0] == CURLE_OK && response_datas[0].size > 0)
     {
-        ptr = strtok(server_strings_ipv6[i], "]");
-        if(ptr == NULL)
+        // hostname has max of 253 chars + 1 char for colon : + port has max of 4 chars + 1 char for null termination
+        char server_strings[10][259];
+        ptr = strtok(response_datas[0].data, "\n");
+        while(ptr != NULL && session->num_stun_servers <= 9)
         {
-            CHIAKI_LOGW(session->log, "Problem reading stun server list host");
-            session->num_stun_servers_ipv6 = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            strcpy(server_strings[session->num_stun_servers], ptr);
+            session->num_stun_servers++;
+            ptr = strtok(NULL, "\n");
         }
-        session->stun_server_list_ipv6[i].host = malloc((strlen(ptr) + 1) * sizeof(char));
-        if(!session->stun_server_list_ipv6[i].host)
+        ptr = NULL;
+        for(int i = 0; i < session->num_stun_servers; i++)
         {
-            CHIAKI_LOGW(session->log, "Problem allocating memory for stun server list host");
-            session->num_stun_servers_ipv6 = i;
-            return CHIAKI_ERR_MEMORY;
+            ptr = strtok(server_strings[i], ":");
+            if(ptr == NULL)
+            {
+                CHIAKI_LOGW(session->log, "Problem reading stun server list host");
+                session->num_stun_servers = i;
+                err = CHIAKI_ERR_INVALID_DATA;
+                break;
+            }
+            session->stun_server_list[i].host = malloc((strlen(ptr) + 1) * sizeof(char));
+            if(!session->stun_server_list[i].host)
+            {
+                CHIAKI_LOGW(session->log, "Problem allocating memory for stun server list host");
+                session->num_stun_servers = i;
+                err = CHIAKI_ERR_MEMORY;
+                break;
+            }
+            strcpy(session->stun_server_list[i].host, ptr);
+            ptr = strtok(NULL, ":");
+            if(ptr == NULL)
+            {
+                CHIAKI_LOGW(session->log, "Problem reading stun server list port");
+                free(session->stun_server_list[i].host);
+                session->stun_server_list[i].host = NULL;
+                session->num_stun_servers = i;
+                err = CHIAKI_ERR_INVALID_DATA;
+                break;
+            }
+            session->stun_server_list[i].port = strtol(ptr, NULL, 10);
+            ptr = NULL;
         }
-        strcpy(session->stun_server_list_ipv6[i].host, ptr);
-        ptr = strtok(NULL, "]");
-        if(ptr == NULL)
+    }
+
+    if(results[1] == CURLE_OK && response_datas[1].size > 0)
+    {
+        // ipv6 string has max of 45 chars: 39 chars + 2 chars for [] + 1 char for colon : + port has max of 4 chars + 1 char for null termination
+        char server_strings_ipv6[10][47];
+        ptr = strtok(response_datas[1].data, "\n");
+        while(ptr != NULL && session->num_stun_servers_ipv6 <= 9)
         {
-            CHIAKI_LOGW(session->log, "Problem reading stun server list port");
-            session->num_stun_servers_ipv6 = i;
-            return CHIAKI_ERR_INVALID_DATA;
+            // omit leading [
+            strcpy(server_strings_ipv6[session->num_stun_servers_ipv6], ptr + 1);
+            session->num_stun_servers_ipv6++;
+            ptr = strtok(NULL, "\n");
         }
-        // omit :
-        session->stun_server_list_ipv6[i].port = strtol(ptr + 1, NULL, 10);
         ptr = NULL;
+        for(int i = 0; i < session->num_stun_servers_ipv6; i++)
+        {
+            ptr = strtok(server_strings_ipv6[i], "]");
+            if(ptr == NULL)
+            {
+                CHIAKI_LOGW(session->log, "Problem reading stun server list host");
+                session->num_stun_servers_ipv6 = i;
+                err = CHIAKI_ERR_INVALID_DATA;
+                break;
+            }
+            session->stun_server_list_ipv6[i].host = malloc((strlen(ptr) + 1) * sizeof(char));
+            if(!session->stun_server_list_ipv6[i].host)
+            {
+                CHIAKI_LOGW(session->log, "Problem allocating memory for stun server list host");
+                session->num_stun_servers_ipv6 = i;
+                err = CHIAKI_ERR_MEMORY;
+                break;
+            }
+            strcpy(session->stun_server_list_ipv6[i].host, ptr);
+            ptr = strtok(NULL, "]");
+            if(ptr == NULL)
+            {
+                CHIAKI_LOGW(session->log, "Problem reading stun server list port");
+                free(session->stun_server_list_ipv6[i].host);
+                session->stun_server_list_ipv6[i].host = NULL;
+                session->num_stun_servers_ipv6 = i;
+                err = CHIAKI_ERR_INVALID_DATA;
+                break;
+            }
+            // omit :
+            session->stun_server_list_ipv6[i].port = strtol(ptr + 1, NULL, 10);
+            ptr = NULL;
+        }
     }
 
 cleanup:
-    free(response_data.data);
-    curl_easy_cleanup(curl);
+    for(int i = 0; i < 2; i++)
+    {
+        if(curls[i])
+        {
+            if(multi)
+                curl_multi_remove_handle(multi, curls[i]);
+            curl_easy_cleanup(curls[i]);
+        }
+        free(response_datas[i].data);
+    }
+    if(multi)
+        curl_multi_cleanup(multi);
     return err;
 }
 
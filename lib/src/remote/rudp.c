@@ -169,57 +169,41 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ack_message(RudpInstance *rudp, u
     message.type = ACK;
     message.subMessage = NULL;
     message.data_size = 6;
-    size_t alloc_size = 8 + message.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
-    {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
-    }
+    // sent for every received ctrl message, so keep it off the heap
+    uint8_t serialized_msg[8 + 6];
     size_t msg_size = 0;
-    message.size = (0xC << 12) | alloc_size;
-    uint8_t data[message.data_size];
+    message.size = (0xC << 12) | sizeof(serialized_msg);
+    uint8_t data[6];
     const uint8_t after_counters[0x2] = { 0x00, 0x92 };
     *(chiaki_unaligned_uint16_t *)(data) = htons(counter);
     *(chiaki_unaligned_uint16_t *)(data + 2) = htons(remote_counter);
     memcpy(data + 4, after_counters, sizeof(after_counters));
     message.data = data;
     rudp_message_serialize(&message, serialized_msg, &msg_size);
-    ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
-    free(serialized_msg);
-    return err;
+    return chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_ctrl_message(RudpInstance *rudp, uint8_t *ctrl_message, size_t ctrl_message_size)
 {
-    RudpMessage message;
-    uint16_t counter = get_then_increase_counter(rudp);
-    uint16_t counter_ack = rudp->counter;
-    message.type = CTRL_MESSAGE;
-    message.subMessage = NULL;
-    message.data_size = 2 + ctrl_message_size;
-    size_t alloc_size = 8 + message.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
+    size_t msg_size = 8 + 2 + ctrl_message_size;
+    if(msg_size > CHIAKI_RUDP_PACKET_SIZE_MAX)
     {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
+        CHIAKI_LOGE(rudp->log, "Rudp ctrl message of size %#llx is too big to send", (unsigned long long)ctrl_message_size);
+        return CHIAKI_ERR_BUF_TOO_SMALL;
     }
-    size_t msg_size = 0;
-    message.size = (0xC << 12) | alloc_size;
-    uint8_t data[message.data_size];
-    *(chiaki_unaligned_uint16_t *)(data) = htons(counter);
-    memcpy(data + 2, ctrl_message, ctrl_message_size);
-    message.data = data;
-    rudp_message_serialize(&message, serialized_msg, &msg_size);
+    uint16_t counter = get_then_increase_counter(rudp);
+    uint16_t counter_ack = rudp->counter;
+    // Serialize directly into a stack buffer, the send buffer copies it into one of its preallocated slots
+    uint8_t serialized_msg[CHIAKI_RUDP_PACKET_SIZE_MAX];
+    *(chiaki_unaligned_uint16_t *)(serialized_msg) = htons((0xC << 12) | msg_size);
+    *(chiaki_unaligned_uint32_t *)(serialized_msg + 2) = htonl(RUDP_CONSTANT);
+    *(chiaki_unaligned_uint16_t *)(serialized_msg + 6) = htons(CTRL_MESSAGE);
+    *(chiaki_unaligned_uint16_t *)(serialized_msg + 8) = htons(counter);
+    memcpy(serialized_msg + 10, ctrl_message, ctrl_message_size);
     ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
     if(err != CHIAKI_ERR_SUCCESS)
-    {
-        free(serialized_msg);
         return err;
-    }
-    err = chiaki_rudp_send_buffer_push(&rudp->send_buffer, counter_ack, serialized_msg, msg_size);
-    return err;
+    return chiaki_rudp_send_buffer_push_copy(&rudp->send_buffer, counter_ack, serialized_msg, msg_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_switch_to_stream_connection_message(RudpInstance *rudp)
@@ -230,16 +214,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_switch_to_stream_connection_messa
     message.type = CTRL_MESSAGE;
     message.subMessage = NULL;
     message.data_size = 26;
-    size_t alloc_size = 8 + message.data_size;
-    uint8_t *serialized_msg = malloc(alloc_size * sizeof(uint8_t));
-    if(!serialized_msg)
-    {
-        CHIAKI_LOGE(rudp->log, "Error allocating memory for rudp message");
-        return CHIAKI_ERR_MEMORY;
-    }
+    uint8_t serialized_msg[8 + 26];
     size_t msg_size = 0;
-    message.size = (0xC << 12) | alloc_size;
-    uint8_t data[message.data_size];
+    message.size = (0xC << 12) | sizeof(serialized_msg);
+    uint8_t data[26];
     const size_t buf_size = 16;
     uint8_t buf[buf_size];
     const uint8_t before_buf[8] = { 0x00, 0x00, 0x00, 0x10, 0x00, 0x0D, 0x00, 0x00 };
@@ -251,12 +229,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_switch_to_stream_connection_messa
     rudp_message_serialize(&message, serialized_msg, &msg_size);
     ChiakiErrorCode err = chiaki_rudp_send_raw(rudp, serialized_msg, msg_size);
     if(err != CHIAKI_ERR_SUCCESS)
-    {
-        free(serialized_msg);
         return err;
-    }
-    err = chiaki_rudp_send_buffer_push(&rudp->send_buffer, counter_ack, serialized_msg, msg_size);
-    return err;
+    return chiaki_rudp_send_buffer_push_copy(&rudp->send_buffer, counter_ack, serialized_msg, msg_size);
 }
 
 /**
@@ -333,6 +307,58 @@ static ChiakiErrorCode chiaki_rudp_message_parse(
     return err;
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_message_parse_in_place(
+    uint8_t *buf, size_t buf_size, RudpMessage *messages, size_t messages_max, size_t *messages_count)
+{
+    *messages_count = 0;
+    if(buf_size < 8 || !messages_max)
+        return CHIAKI_ERR_INVALID_DATA;
+
+    size_t count = 0;
+    while(true)
+    {
+        RudpMessage *message = &messages[count++];
+        message->data = NULL;
+        message->subMessage = NULL;
+        message->subMessage_size = 0;
+        message->data_size = 0;
+        message->size = ntohs(*(chiaki_unaligned_uint16_t *)(buf));
+        message->type = ntohs(*(chiaki_unaligned_uint16_t *)(buf + 6));
+        message->subtype = buf[6] & 0xFF;
+        // Eliminate 0xC before length (size of header + data but not submessage)
+        buf[0] = buf[0] & 0x0F;
+        message->remote_counter = 0;
+        uint16_t length = ntohs(*(chiaki_unaligned_uint16_t *)(buf));
+        size_t remaining = buf_size - 8;
+        size_t data_size = 0;
+        if(length > 8)
+        {
+            data_size = length - 8;
+            if(remaining < data_size)
+                data_size = remaining;
+            message->data_size = data_size;
+            message->data = buf + 8;
+            if(data_size >= 2)
+                message->remote_counter = ntohs(*(chiaki_unaligned_uint16_t *)(message->data)) + 1;
+        }
+
+        remaining -= data_size;
+        if(remaining < 8)
+            break;
+        if(count >= messages_max)
+        {
+            *messages_count = count;
+            return CHIAKI_ERR_BUF_TOO_SMALL;
+        }
+        message->subMessage = &messages[count];
+        message->subMessage_size = remaining;
+        buf += 8 + data_size;
+        buf_size = remaining;
+    }
+    *messages_count = count;
+    return CHIAKI_ERR_SUCCESS;
+}
+
 /**
  * Get current rudp local counter and then increase rudp local counter
  *
@@ -423,6 +449,24 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only(RudpInstance *rudp, size_t b
 	return err;
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_recv_only_in_place(RudpInstance *rudp, uint8_t *buf, size_t buf_size, RudpMessage *messages, size_t messages_max, size_t *messages_count)
+{
+	*messages_count = 0;
+	int received_sz = recv(rudp->sock, (CHIAKI_SOCKET_BUF_TYPE) buf, buf_size, 0);
+	if(received_sz <= 8)
+	{
+		if(received_sz < 0)
+			CHIAKI_LOGE(rudp->log, "Rudp recv failed: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		else
+			CHIAKI_LOGE(rudp->log, "Rudp recv returned less than the required 8 byte RUDP header");
+		return CHIAKI_ERR_NETWORK;
+	}
+    CHIAKI_LOGV(rudp->log, "Receiving message:");
+    chiaki_log_hexdump(rudp->log, CHIAKI_LOG_VERBOSE, buf, received_sz);
+
+    return chiaki_rudp_message_parse_in_place(buf, received_sz, messages, messages_max, messages_count);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_stop_pipe_select_single(RudpInstance *rudp, ChiakiStopPipe *stop_pipe, uint64_t timeout)
 {
 	ChiakiErrorCode err = chiaki_stop_pipe_select_single(stop_pipe, rudp->sock, false, timeout);
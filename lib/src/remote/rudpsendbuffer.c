@@ -27,12 +27,22 @@ struct chiaki_rudp_send_buffer_packet_t
 	uint64_t last_send_ms; // chiaki_time_now_monotonic_ms()
 	uint8_t *buf;
 	size_t buf_size;
+	bool slot; // buf is one of send_buffer->slots and must be returned instead of freed
 }; // ChiakiRudpSendBufferPacket
 
 #ifndef CHIAKI_UNIT_TEST
 
 static void *rudp_send_buffer_thread_func(void *user);
 
+static void rudp_send_buffer_packet_release(ChiakiRudpSendBuffer *send_buffer, ChiakiRudpSendBufferPacket *packet)
+{
+	if(packet->slot)
+		send_buffer->free_slots[send_buffer->free_slots_count++] = packet->buf;
+	else
+		free(packet->buf);
+	packet->buf = NULL;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_init(ChiakiRudpSendBuffer *send_buffer, ChiakiRudp rudp, ChiakiLog *log, size_t size)
 {
 	send_buffer->rudp = rudp;
@@ -44,11 +54,22 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_init(ChiakiRudpSendBuffer
 	send_buffer->packets_size = size;
 	send_buffer->packets_count = 0;
 
+	ChiakiErrorCode err = CHIAKI_ERR_MEMORY;
+	send_buffer->slots = malloc(size * CHIAKI_RUDP_PACKET_SIZE_MAX);
+	if(!send_buffer->slots)
+		goto error_packets;
+	send_buffer->free_slots = calloc(size, sizeof(uint8_t *));
+	if(!send_buffer->free_slots)
+		goto error_slots;
+	for(size_t i=0; i<size; i++)
+		send_buffer->free_slots[i] = send_buffer->slots + i * CHIAKI_RUDP_PACKET_SIZE_MAX;
+	send_buffer->free_slots_count = size;
+
 	send_buffer->should_stop = false;
 
-	ChiakiErrorCode err = chiaki_mutex_init(&send_buffer->mutex, false);
+	err = chiaki_mutex_init(&send_buffer->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_packets;
+		goto error_free_slots;
 
 	err = chiaki_cond_init(&send_buffer->cond, &send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -65,6 +86,10 @@ error_cond:
 	chiaki_cond_fini(&send_buffer->cond);
 error_mutex:
 	chiaki_mutex_fini(&send_buffer->mutex);
+error_free_slots:
+	free(send_buffer->free_slots);
+error_slots:
+	free(send_buffer->slots);
 error_packets:
 	free(send_buffer->packets);
 	return err;
@@ -79,10 +104,12 @@ CHIAKI_EXPORT void chiaki_rudp_send_buffer_fini(ChiakiRudpSendBuffer *send_buffe
 	assert(err == CHIAKI_ERR_SUCCESS);
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
-		free(send_buffer->packets[i].buf);
+		rudp_send_buffer_packet_release(send_buffer, &send_buffer->packets[i]);
 
 	chiaki_cond_fini(&send_buffer->cond);
 	chiaki_mutex_fini(&send_buffer->mutex);
+	free(send_buffer->free_slots);
+	free(send_buffer->slots);
 	free(send_buffer->packets);
 }
 
@@ -127,17 +154,15 @@ static void GetRudpPacketType(ChiakiRudpSendBuffer *send_buffer, uint16_t packet
     }
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, uint8_t *buf, size_t buf_size)
+/**
+ * Check that seq_num can be pushed and return the packet to fill, must be called with the mutex locked
+ */
+static ChiakiErrorCode rudp_send_buffer_packet_new(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, ChiakiRudpSendBufferPacket **packet)
 {
-	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
 	if(send_buffer->packets_count >= send_buffer->packets_size)
 	{
 		CHIAKI_LOGE(send_buffer->log, "Rudp Send Buffer overflow");
-		err = CHIAKI_ERR_OVERFLOW;
-		goto beach;
+		return CHIAKI_ERR_OVERFLOW;
 	}
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
@@ -145,17 +170,20 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer
 		if(send_buffer->packets[i].seq_num == seq_num)
 		{
 			CHIAKI_LOGE(send_buffer->log, "Tried to push duplicate seqnum into Rudp Send Buffer");
-			err = CHIAKI_ERR_INVALID_DATA;
-			goto beach;
+			return CHIAKI_ERR_INVALID_DATA;
 		}
 	}
 
-	ChiakiRudpSendBufferPacket *packet = &send_buffer->packets[send_buffer->packets_count++];
-	packet->seq_num = seq_num;
-	packet->tries = 0;
-	packet->last_send_ms = chiaki_time_now_monotonic_ms();
-	packet->buf = buf;
-	packet->buf_size = buf_size;
+	*packet = &send_buffer->packets[send_buffer->packets_count];
+	(*packet)->seq_num = seq_num;
+	(*packet)->tries = 0;
+	(*packet)->last_send_ms = chiaki_time_now_monotonic_ms();
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void rudp_send_buffer_packet_commit(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num)
+{
+	send_buffer->packets_count++;
 
 	CHIAKI_LOGV(send_buffer->log, "Pushed seq num %#lx into Rudp Send Buffer", (unsigned long)seq_num);
 
@@ -164,10 +192,58 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer
 		// buffer was empty before, so it will sleep without timeout => WAKE UP!!
 		chiaki_cond_signal(&send_buffer->cond);
 	}
+}
 
-beach:
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, uint8_t *buf, size_t buf_size)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
 		free(buf);
+		return err;
+	}
+
+	ChiakiRudpSendBufferPacket *packet;
+	err = rudp_send_buffer_packet_new(send_buffer, seq_num, &packet);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(buf);
+		goto beach;
+	}
+
+	packet->buf = buf;
+	packet->buf_size = buf_size;
+	packet->slot = false;
+	rudp_send_buffer_packet_commit(send_buffer, seq_num);
+
+beach:
+	chiaki_mutex_unlock(&send_buffer->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_push_copy(ChiakiRudpSendBuffer *send_buffer, ChiakiSeqNum16 seq_num, const uint8_t *buf, size_t buf_size)
+{
+	if(buf_size > CHIAKI_RUDP_PACKET_SIZE_MAX)
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	ChiakiRudpSendBufferPacket *packet;
+	err = rudp_send_buffer_packet_new(send_buffer, seq_num, &packet);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto beach;
+
+	// there is exactly one slot per packet, so a free one must exist if the packet fit
+	assert(send_buffer->free_slots_count);
+	packet->buf = send_buffer->free_slots[--send_buffer->free_slots_count];
+	memcpy(packet->buf, buf, buf_size);
+	packet->buf_size = buf_size;
+	packet->slot = true;
+	rudp_send_buffer_packet_commit(send_buffer, seq_num);
+
+beach:
 	chiaki_mutex_unlock(&send_buffer->mutex);
 	return err;
 }
@@ -191,7 +267,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_ack(ChiakiRudpSendBuffer *
 			if(acked_seq_nums)
 				acked_seq_nums[(*acked_seq_nums_count)++] = send_buffer->packets[i].seq_num;
 
-			free(send_buffer->packets[i].buf);
+			rudp_send_buffer_packet_release(send_buffer, &send_buffer->packets[i]);
 			if(shift_start == SIZE_MAX)
 			{
 				// first shift
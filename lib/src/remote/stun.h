@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -8,6 +9,7 @@
 #else
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #endif
@@ -16,8 +18,16 @@
 #include <chiaki/seqnum.h>
 #include <chiaki/sock.h>
 #include <chiaki/random.h>
+#include <chiaki/time.h>
+#include <chiaki/thread.h>
 
 #define STUN_REPLY_TIMEOUT_SEC 1
+// Max number of servers queried concurrently by stun_get_external_address
+#define STUN_RACE_SERVERS_MAX 6
+#define STUN_RACE_RTO_INITIAL_MS 100
+#define STUN_RACE_RTO_MAX_MS 400
+// How long a resolved STUN server address is reused
+#define STUN_RESOLVE_CACHE_MS (5 * 60 * 1000)
 
 #define STUN_HEADER_SIZE 20
 #define STUN_MSG_TYPE_BINDING_REQUEST 0x0001
@@ -33,9 +43,16 @@
 typedef struct stun_server_t {
     char* host;
     uint16_t port;
+    // last resolved address, see stun_resolve_servers(), owned by the thread using this StunServer
+    bool resolved;
+    bool resolved_ipv4;
+    uint64_t resolved_ms;
+    struct sockaddr_in6 addr;
+    socklen_t addr_len;
 } StunServer;
 
-StunServer STUN_SERVERS[] = {
+// Builtin servers, only ever copied with stun_servers_init() so that no resolve cache is shared
+static const StunServer STUN_SERVERS[] = {
     {"stun.moonlight-stream.org", 3478},
     {"stun.l.google.com", 19302},
     {"stun.l.google.com", 19305},
@@ -49,49 +66,82 @@ StunServer STUN_SERVERS[] = {
     {"stun4.l.google.com", 19305}
 };
 
+#define STUN_SERVERS_COUNT (sizeof(STUN_SERVERS) / sizeof(StunServer))
+
+typedef struct stun_race_server_t {
+    StunServer *server;
+    struct sockaddr_in6 addr;
+    socklen_t addr_len;
+    uint8_t binding_req[STUN_HEADER_SIZE];
+    uint64_t next_send_ms;
+    uint64_t rto_ms;
+} StunRaceServer;
+
 static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *server, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4);
+static size_t stun_resolve_servers(ChiakiLog *log, StunServer **servers, size_t num_servers, bool ipv4, bool *resolved);
+static bool stun_get_external_address_race(ChiakiLog *log, StunServer **servers, size_t num_servers, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4);
+
+/**
+ * Copy the builtin STUN servers, so the resolve cache of the copy belongs to the caller.
+ *
+ * @param[out] servers room for STUN_SERVERS_COUNT servers
+ */
+static void stun_servers_init(StunServer *servers)
+{
+    memcpy(servers, STUN_SERVERS, sizeof(STUN_SERVERS));
+}
+
+/**
+ * Order the builtin servers for a query, the Moonlight server first and the others in random order.
+ *
+ * @param[out] order STUN_SERVERS_COUNT pointers into servers
+ * @param servers copy from stun_servers_init(), left untouched
+ */
+static void stun_servers_shuffle(StunServer **order, StunServer *servers)
+{
+    for (size_t i = 0; i < STUN_SERVERS_COUNT; i++)
+        order[i] = &servers[i];
+    for (size_t i = STUN_SERVERS_COUNT - 1; i > 1; i--) {
+        size_t j = 1 + chiaki_random_32() % i;
+        StunServer *temp = order[i];
+        order[i] = order[j];
+        order[j] = temp;
+    }
+}
 
 /**
  * Get external address and port using STUN.
  *
- * This will try multiple STUN servers, preferring the STUN server of the Moonlight
- * project, and if that fails, trying other STUN servers in random order.
+ * This will query multiple STUN servers concurrently and take the first valid answer,
+ * preferring the servers passed by the caller (i.e., known to be online), then the STUN
+ * server of the Moonlight project and the other builtin STUN servers in random order.
  *
  * @param log Log context
  * @param[out] address Buffer to store address in
  * @param[out] port Buffer to store port in
+ * @param builtin_servers the caller's copy of STUN_SERVERS from stun_servers_init()
  * @return true if successful, false otherwise
  */
-static bool stun_get_external_address(ChiakiLog *log, char *address, uint16_t *port, StunServer *passed_servers, size_t num_passed_servers, chiaki_socket_t *sock, bool ipv4)
+static bool stun_get_external_address(ChiakiLog *log, char *address, uint16_t *port, StunServer *passed_servers, size_t num_passed_servers, StunServer *builtin_servers, chiaki_socket_t *sock, bool ipv4)
 {
-    // Try servers preferred by user (i.e., known to be online)
-    if(num_passed_servers > 0)
+    StunServer *servers[num_passed_servers + STUN_SERVERS_COUNT];
+    size_t servers_count = 0;
+    for (size_t i = 0; i < num_passed_servers; i++)
+        servers[servers_count++] = &passed_servers[i];
+    stun_servers_shuffle(&servers[servers_count], builtin_servers);
+    servers_count += STUN_SERVERS_COUNT;
+
+    // Race the servers in batches so that a single dead server doesn't delay us
+    for (size_t i = 0; i < servers_count; i += STUN_RACE_SERVERS_MAX)
     {
-       for (int i = 0; i < num_passed_servers; i++)
-        {
-            if(CHIAKI_SOCKET_IS_INVALID(*sock))
-                return false;
-            if (stun_get_external_address_from_server(log, &passed_servers[i], address, port, sock, ipv4))
-                return true;
-            CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", passed_servers[i].host, passed_servers[i].port);
-        }
-    }
-    // Shuffle order of servers other than moonlight server
-    size_t num_servers = sizeof(STUN_SERVERS) / sizeof(StunServer);
-    for (int i = num_servers - 1; i > 1; i--) {
-        int j = 1 + chiaki_random_32() % (i - 1);
-        StunServer temp = STUN_SERVERS[i];
-        STUN_SERVERS[i] = STUN_SERVERS[j];
-        STUN_SERVERS[j] = temp;
-    }
-    // Try other servers
-    for (int i = 0; i < num_servers; i++) {
         if(CHIAKI_SOCKET_IS_INVALID(*sock))
             return false;
-        if (stun_get_external_address_from_server(log, &STUN_SERVERS[i], address, port, sock, ipv4)) {
+        size_t batch = servers_count - i;
+        if(batch > STUN_RACE_SERVERS_MAX)
+            batch = STUN_RACE_SERVERS_MAX;
+        if (stun_get_external_address_race(log, &servers[i], batch, address, port, sock, ipv4))
             return true;
-        }
-        CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+        CHIAKI_LOGW(log, "Failed to get external address from %zu STUN servers, retrying with other STUN servers...", batch);
     }
     CHIAKI_LOGE(log, "Failed to get external address from any STUN server.");
     return false;
@@ -108,7 +158,7 @@ static bool stun_get_external_address(ChiakiLog *log, char *address, uint16_t *p
  * @param[out] port Buffer to store port in
  * @return true if successful, false otherwise
  */
-CHIAKI_EXPORT bool stun_port_allocation_test(ChiakiLog *log, char *address, uint16_t *port, int32_t *allocation_increment, bool *random_allocation, StunServer *passed_servers, size_t num_passed_servers, chiaki_socket_t *sock)
+CHIAKI_EXPORT bool stun_port_allocation_test(ChiakiLog *log, char *address, uint16_t *port, int32_t *allocation_increment, bool *random_allocation, StunServer *passed_servers, size_t num_passed_servers, StunServer *builtin_servers, chiaki_socket_t *sock)
 {
     // skip testing if outgoing port changes with same internal ip and port if send to same ip and different port bc that doesn't apply in our case (we will be using a different address anyway)
     uint16_t port1 = 0;
@@ -168,54 +218,50 @@ CHIAKI_EXPORT bool stun_port_allocation_test(ChiakiLog *log, char *address, uint
     }
     if(port4 == 0)
     {
-        size_t num_servers = sizeof(STUN_SERVERS) / sizeof(StunServer);
-        for (int i = num_servers; i > 0; i--) {
-            int j = chiaki_random_32() % i;
-            StunServer temp = STUN_SERVERS[i];
-            STUN_SERVERS[i] = STUN_SERVERS[j];
-            STUN_SERVERS[j] = temp;
-        }
+        StunServer *servers[STUN_SERVERS_COUNT];
+        stun_servers_shuffle(servers, builtin_servers);
         // Try other servers
-        for (int i = 0; i < num_servers; i++)
+        for (int i = 0; i < STUN_SERVERS_COUNT; i++)
         {
+            StunServer *server = servers[i];
             if(port1 == 0)
             {
                 if(CHIAKI_SOCKET_IS_INVALID(*sock))
                     break;
-                if (!stun_get_external_address_from_server(log, &STUN_SERVERS[i], addr1, &port1, sock, true))
-                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                if (!stun_get_external_address_from_server(log, server, addr1, &port1, sock, true))
+                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", server->host, server->port);
                 else
-                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", server->host, server->port);
             }
             else if(port2 == 0)
             {
                 if(CHIAKI_SOCKET_IS_INVALID(*sock))
                     break;
-                if (!stun_get_external_address_from_server(log, &STUN_SERVERS[i], addr2, &port2, sock, true))
-                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                if (!stun_get_external_address_from_server(log, server, addr2, &port2, sock, true))
+                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", server->host, server->port);
                 else
-                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", server->host, server->port);
             }
             else if(port3 == 0)
             {
                 if(CHIAKI_SOCKET_IS_INVALID(*sock))
                     break;
-                if (!stun_get_external_address_from_server(log, &STUN_SERVERS[i], addr3, &port3, sock, true))
-                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                if (!stun_get_external_address_from_server(log, server, addr3, &port3, sock, true))
+                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", server->host, server->port);
                 else
-                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", server->host, server->port);
             }
             else if(port4 == 0)
             {
                 if(CHIAKI_SOCKET_IS_INVALID(*sock))
                     break;
-                if (stun_get_external_address_from_server(log, &STUN_SERVERS[i], addr4, &port4, sock, true))
+                if (stun_get_external_address_from_server(log, server, addr4, &port4, sock, true))
                 {
-                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                    CHIAKI_LOGV(log, "Got response from STUN server %s:%d", server->host, server->port);
                     break;
                 }
                 else
-                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", STUN_SERVERS[i].host, STUN_SERVERS[i].port);
+                    CHIAKI_LOGW(log, "Failed to get external address from %s:%d, retrying with another STUN server...", server->host, server->port);
             }
         }
     }
@@ -436,12 +482,10 @@ CHIAKI_EXPORT bool stun_port_allocation_test(ChiakiLog *log, char *address, uint
     return true;
 }
 
-static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *server, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4)
+static bool stun_resolve_server(ChiakiLog *log, StunServer *server, struct sockaddr_in6 *addr, socklen_t *addr_len, bool ipv4)
 {
     struct addrinfo* resolved;
     struct addrinfo hints;
-    struct sockaddr_in6 *server_addr;
-    socklen_t server_addr_len;
     memset(&hints, 0, sizeof(hints));
     if(ipv4)
         hints.ai_family = AF_INET;
@@ -458,56 +502,131 @@ static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *se
         return false;
     }
 
+    memset(addr, 0, sizeof(*addr));
     if(ipv4)
+        *addr_len = sizeof(struct sockaddr_in);
+    else
+        *addr_len = sizeof(struct sockaddr_in6);
+    memcpy(addr, resolved->ai_addr, *addr_len);
+    freeaddrinfo(resolved);
+    return true;
+}
+
+typedef struct stun_resolve_job_t {
+    ChiakiLog *log;
+    StunServer *server;
+    bool ipv4;
+    struct sockaddr_in6 addr;
+    socklen_t addr_len;
+    bool success;
+    bool thread_started;
+    ChiakiThread thread;
+} StunResolveJob;
+
+static void *stun_resolve_thread_func(void *user)
+{
+    StunResolveJob *job = user;
+    job->success = stun_resolve_server(job->log, job->server, &job->addr, &job->addr_len, job->ipv4);
+    return NULL;
+}
+
+static bool stun_server_cached(StunServer *server, bool ipv4, uint64_t now)
+{
+    return server->resolved && server->resolved_ipv4 == ipv4 && now - server->resolved_ms < STUN_RESOLVE_CACHE_MS;
+}
+
+/**
+ * Resolve the addresses of servers into their cache.
+ *
+ * Servers whose cached address is still valid are not resolved again. All others are resolved
+ * concurrently, so that the slowest lookup instead of the sum of all lookups delays the query.
+ *
+ * @param[out] resolved for each server, whether its address is usable
+ * @return number of usable servers
+ */
+static size_t stun_resolve_servers(ChiakiLog *log, StunServer **servers, size_t num_servers, bool ipv4, bool *resolved)
+{
+    uint64_t now = chiaki_time_now_monotonic_ms();
+    StunResolveJob jobs[num_servers];
+    size_t jobs_count = 0;
+    for (size_t i = 0; i < num_servers; i++)
     {
-        server_addr = (struct sockaddr_in6*)resolved->ai_addr;
-        server_addr_len = sizeof(struct sockaddr_in);
+        resolved[i] = stun_server_cached(servers[i], ipv4, now);
+        if (resolved[i])
+            continue;
+        StunResolveJob *job = &jobs[jobs_count++];
+        job->log = log;
+        job->server = servers[i];
+        job->ipv4 = ipv4;
+        job->success = false;
+        job->thread_started = false;
     }
-    else
+
+    // a single lookup is not worth a thread
+    for (size_t j = 0; jobs_count > 1 && j < jobs_count; j++)
+        jobs[j].thread_started = chiaki_thread_create(&jobs[j].thread, stun_resolve_thread_func, &jobs[j]) == CHIAKI_ERR_SUCCESS;
+    for (size_t j = 0; j < jobs_count; j++)
     {
-        server_addr = (struct sockaddr_in6*)resolved->ai_addr;
-        server_addr_len = sizeof(struct sockaddr_in6);
+        if (jobs[j].thread_started)
+            chiaki_thread_join(&jobs[j].thread, NULL);
+        else
+            stun_resolve_thread_func(&jobs[j]);
     }
 
-    uint8_t binding_req[STUN_HEADER_SIZE];
-    memset(binding_req, 0, sizeof(binding_req));
+    now = chiaki_time_now_monotonic_ms();
+    size_t resolved_count = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < num_servers; i++)
+    {
+        if (!resolved[i])
+        {
+            StunResolveJob *job = &jobs[j++];
+            if (job->success)
+            {
+                job->server->addr = job->addr;
+                job->server->addr_len = job->addr_len;
+                job->server->resolved_ipv4 = ipv4;
+                job->server->resolved_ms = now;
+            }
+            job->server->resolved = job->success;
+            resolved[i] = job->success;
+        }
+        if (resolved[i])
+            resolved_count++;
+    }
+    return resolved_count;
+}
+
+static void stun_build_binding_request(uint8_t *binding_req)
+{
+    memset(binding_req, 0, STUN_HEADER_SIZE);
     *(uint16_t*)(&binding_req[0]) = htons(STUN_MSG_TYPE_BINDING_REQUEST);
     *(uint16_t*)(&binding_req[2]) = htons(0);  // Length
     *(int*)(&binding_req[4]) = htonl(STUN_MAGIC_COOKIE);
     chiaki_random_bytes_crypt(&binding_req[8], STUN_TRANSACTION_ID_LENGTH);
+}
 
-    CHIAKI_SSIZET_TYPE sent = sendto(*sock, (CHIAKI_SOCKET_BUF_TYPE)binding_req, sizeof(binding_req), 0, (struct sockaddr*)server_addr, server_addr_len);
-    if (sent != sizeof(binding_req)) {
-        CHIAKI_LOGE(log, "remote/stun.h: Failed to send STUN request, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        CHIAKI_SOCKET_CLOSE(*sock);
-        *sock = CHIAKI_INVALID_SOCKET;
-        freeaddrinfo(resolved);
-        return false;
-    }
-    freeaddrinfo(resolved);
-
-#ifdef _WIN32
-    int timeout = STUN_REPLY_TIMEOUT_SEC * 1000;
-#else
-    struct timeval timeout;
-    timeout.tv_sec = STUN_REPLY_TIMEOUT_SEC;
-    timeout.tv_usec = 0;
-#endif
-    if (setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, (const CHIAKI_SOCKET_BUF_TYPE)&timeout, sizeof(timeout)) < 0) {
-        CHIAKI_LOGE(log, "remote/stun.h: Failed to set socket timeout, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-        CHIAKI_SOCKET_CLOSE(*sock);
-        *sock = CHIAKI_INVALID_SOCKET;
-        return false;
-    }
-
-    uint8_t binding_resp[256];
-    CHIAKI_SSIZET_TYPE received = recvfrom(*sock, (CHIAKI_SOCKET_BUF_TYPE)binding_resp, sizeof(binding_resp), 0, NULL, NULL);
-    if (received < 0) {
-        CHIAKI_LOGE(log, "remote/stun.h: Failed to receive STUN response, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+/**
+ * Check whether a received datagram is a STUN response to the given binding request.
+ */
+static bool stun_response_matches_request(uint8_t *binding_resp, CHIAKI_SSIZET_TYPE received, uint8_t *binding_req)
+{
+    if (received < STUN_HEADER_SIZE)
         return false;
-    }
-
+    return memcmp(&binding_resp[8], &binding_req[8], STUN_TRANSACTION_ID_LENGTH) == 0;
+}
 
+/**
+ * Parse a STUN binding response and extract the (XOR-)mapped address from it.
+ *
+ * @param binding_resp The received response, must belong to binding_req
+ * @param binding_req The request the response belongs to, needed to un-XOR IPv6 addresses
+ * @param[out] address Buffer to store address in
+ * @param[out] port Buffer to store port in
+ * @return true if successful, false otherwise
+ */
+static bool stun_parse_binding_response(ChiakiLog *log, uint8_t *binding_resp, CHIAKI_SSIZET_TYPE received, uint8_t *binding_req, char *address, uint16_t *port)
+{
     if (*(uint16_t*)(&binding_resp[0]) != htons(STUN_MSG_TYPE_BINDING_RESPONSE)) {
         CHIAKI_LOGE(log, "remote/stun.h: Received STUN response with invalid message type");
         return false;
@@ -516,7 +635,7 @@ static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *se
     // Verify length stored in binding_resp[2] is correct
     size_t expected_size = ntohs(*(uint16_t*)(&binding_resp[2])) + STUN_HEADER_SIZE;
     if (received != ntohs(*(uint16_t*)(&binding_resp[2])) + STUN_HEADER_SIZE) {
-        CHIAKI_LOGE(log, "remote/stun.h: Received STUN response with invalid length: %d received, %d expected", received, expected_size);
+        CHIAKI_LOGE(log, "remote/stun.h: Received STUN response with invalid length: %d received, %d expected", (int)received, (int)expected_size);
         return false;
     }
 
@@ -525,14 +644,9 @@ static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *se
         return false;
     }
 
-    if (memcmp(&binding_resp[8], &binding_req[8], STUN_TRANSACTION_ID_LENGTH) != 0) {
-        CHIAKI_LOGE(log, "remote/stun.h: Received STUN response with invalid transaction ID");
-        return false;
-    }
-
     //uint16_t response_attrs_length = ntohs(*(uint16_t*)(&binding_resp[2]));
     uint16_t response_pos = STUN_HEADER_SIZE;
-    while (response_pos < received)
+    while (response_pos + 8 <= received)
     {
         uint16_t attr_type = ntohs(*(uint16_t*)(&binding_resp[response_pos]));
         uint16_t attr_length = ntohs(*(uint16_t*)(&binding_resp[response_pos + 2]));
@@ -558,6 +672,10 @@ static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *se
                 inet_ntop(AF_INET, &addr, address, INET_ADDRSTRLEN);
             }
         } else if (family == STUN_MAPPED_ADDR_FAMILY_IPV6) {
+            if (response_pos + 24 > received) {
+                CHIAKI_LOGE(log, "remote/stun.h: Received truncated STUN IPv6 mapped address");
+                return false;
+            }
             if (xored) {
                 uint16_t xored_port = *(uint16_t*)(&binding_resp[response_pos + 6]) ^ (uint16_t)(htonl(STUN_MAGIC_COOKIE));
                 *port = ntohs(xored_port);
@@ -584,4 +702,164 @@ static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *se
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+static bool stun_get_external_address_from_server(ChiakiLog *log, StunServer *server, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4)
+{
+    bool resolved;
+    if (!stun_resolve_servers(log, &server, 1, ipv4, &resolved))
+        return false;
+    struct sockaddr_in6 server_addr = server->addr;
+    socklen_t server_addr_len = server->addr_len;
+
+    uint8_t binding_req[STUN_HEADER_SIZE];
+    stun_build_binding_request(binding_req);
+
+    CHIAKI_SSIZET_TYPE sent = sendto(*sock, (CHIAKI_SOCKET_BUF_TYPE)binding_req, sizeof(binding_req), 0, (struct sockaddr*)&server_addr, server_addr_len);
+    if (sent != sizeof(binding_req)) {
+        CHIAKI_LOGE(log, "remote/stun.h: Failed to send STUN request, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        CHIAKI_SOCKET_CLOSE(*sock);
+        *sock = CHIAKI_INVALID_SOCKET;
+        return false;
+    }
+
+#ifdef _WIN32
+    int timeout = STUN_REPLY_TIMEOUT_SEC * 1000;
+#else
+    struct timeval timeout;
+    timeout.tv_sec = STUN_REPLY_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+#endif
+    if (setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, (const CHIAKI_SOCKET_BUF_TYPE)&timeout, sizeof(timeout)) < 0) {
+        CHIAKI_LOGE(log, "remote/stun.h: Failed to set socket timeout, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+        CHIAKI_SOCKET_CLOSE(*sock);
+        *sock = CHIAKI_INVALID_SOCKET;
+        return false;
+    }
+
+    uint8_t binding_resp[256];
+    CHIAKI_SSIZET_TYPE received;
+    while (true)
+    {
+        received = recvfrom(*sock, (CHIAKI_SOCKET_BUF_TYPE)binding_resp, sizeof(binding_resp), 0, NULL, NULL);
+        if (received < 0) {
+            CHIAKI_LOGE(log, "remote/stun.h: Failed to receive STUN response, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+            return false;
+        }
+        // late answers of servers from a previous race may still arrive on this socket
+        if (stun_response_matches_request(binding_resp, received, binding_req))
+            break;
+        CHIAKI_LOGV(log, "remote/stun.h: Ignoring STUN response with unknown transaction ID");
+    }
+
+    return stun_parse_binding_response(log, binding_resp, received, binding_req, address, port);
+}
+
+/**
+ * Send binding requests to all given servers at once and take the first valid answer.
+ *
+ * Requests that are not answered are retransmitted with exponential backoff until
+ * STUN_REPLY_TIMEOUT_SEC has passed.
+ *
+ * @param servers Servers to query, in order of preference
+ * @param[out] address Buffer to store address in
+ * @param[out] port Buffer to store port in
+ * @return true if successful, false otherwise
+ */
+static bool stun_get_external_address_race(ChiakiLog *log, StunServer **servers, size_t num_servers, char *address, uint16_t *port, chiaki_socket_t *sock, bool ipv4)
+{
+    StunRaceServer race[STUN_RACE_SERVERS_MAX];
+    size_t race_count = 0;
+    if (num_servers > STUN_RACE_SERVERS_MAX)
+        num_servers = STUN_RACE_SERVERS_MAX;
+    bool resolved[STUN_RACE_SERVERS_MAX];
+    stun_resolve_servers(log, servers, num_servers, ipv4, resolved);
+    uint64_t now = chiaki_time_now_monotonic_ms();
+    for (size_t i = 0; i < num_servers; i++)
+    {
+        if (!resolved[i])
+            continue;
+        StunRaceServer *entry = &race[race_count];
+        entry->addr = servers[i]->addr;
+        entry->addr_len = servers[i]->addr_len;
+        entry->server = servers[i];
+        stun_build_binding_request(entry->binding_req);
+        entry->next_send_ms = now;
+        entry->rto_ms = STUN_RACE_RTO_INITIAL_MS;
+        race_count++;
+    }
+    if (race_count == 0)
+        return false;
+
+    uint64_t deadline = now + STUN_REPLY_TIMEOUT_SEC * 1000;
+    uint8_t binding_resp[256];
+    while (true)
+    {
+        if(CHIAKI_SOCKET_IS_INVALID(*sock))
+            return false;
+        now = chiaki_time_now_monotonic_ms();
+        if (now >= deadline)
+            return false;
+
+        uint64_t next_wakeup = deadline;
+        for (size_t i = 0; i < race_count; i++)
+        {
+            StunRaceServer *entry = &race[i];
+            if (entry->next_send_ms <= now)
+            {
+                CHIAKI_SSIZET_TYPE sent = sendto(*sock, (CHIAKI_SOCKET_BUF_TYPE)entry->binding_req, sizeof(entry->binding_req), 0, (struct sockaddr*)&entry->addr, entry->addr_len);
+                if (sent != sizeof(entry->binding_req))
+                    CHIAKI_LOGW(log, "remote/stun.h: Failed to send STUN request to %s:%d, error was " CHIAKI_SOCKET_ERROR_FMT, entry->server->host, entry->server->port, CHIAKI_SOCKET_ERROR_VALUE);
+                entry->next_send_ms = now + entry->rto_ms;
+                entry->rto_ms *= 2;
+                if (entry->rto_ms > STUN_RACE_RTO_MAX_MS)
+                    entry->rto_ms = STUN_RACE_RTO_MAX_MS;
+            }
+            if (entry->next_send_ms < next_wakeup)
+                next_wakeup = entry->next_send_ms;
+        }
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(*sock, &fds);
+        uint64_t wait_ms = next_wakeup > now ? next_wakeup - now : 0;
+        struct timeval tv;
+        tv.tv_sec = wait_ms / 1000;
+        tv.tv_usec = (wait_ms % 1000) * 1000;
+        int ret = select((int)*sock + 1, &fds, NULL, NULL, &tv);
+        if (ret < 0)
+        {
+#ifdef _WIN32
+            if (WSAGetLastError() == WSAEINTR)
+#else
+            if (errno == EINTR)
+#endif
+                continue;
+            CHIAKI_LOGE(log, "remote/stun.h: Select failed with error " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+            return false;
+        }
+        if (ret == 0)
+            continue;
+
+        CHIAKI_SSIZET_TYPE received = recvfrom(*sock, (CHIAKI_SOCKET_BUF_TYPE)binding_resp, sizeof(binding_resp), 0, NULL, NULL);
+        if (received < 0)
+        {
+            CHIAKI_LOGE(log, "remote/stun.h: Failed to receive STUN response, error was " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+            continue;
+        }
+        for (size_t i = 0; i < race_count; i++)
+        {
+            StunRaceServer *entry = &race[i];
+            if (!stun_response_matches_request(binding_resp, received, entry->binding_req))
+                continue;
+            if (stun_parse_binding_response(log, binding_resp, received, entry->binding_req, address, port))
+            {
+                CHIAKI_LOGV(log, "remote/stun.h: Got first response from STUN server %s:%d", entry->server->host, entry->server->port);
+                return true;
+            }
+            // broken answer, stop asking this server
+            entry->next_send_ms = UINT64_MAX;
+            break;
+        }
+    }
+}
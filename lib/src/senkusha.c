@@ -153,6 +153,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	takion_info.enable_crypt = false;
 	takion_info.protocol_version = 7;
+	chiaki_takion_ack_policy_default(&takion_info.ack_policy);
 
 	takion_info.cb = senkusha_takion_cb;
 	takion_info.cb_user = senkusha;
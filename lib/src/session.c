@@ -136,6 +136,25 @@ CHIAKI_EXPORT void chiaki_connect_video_profile_preset(ChiakiConnectVideoProfile
 	}
 }
 
+CHIAKI_EXPORT const char *chiaki_thread_role_string(ChiakiThreadRole role)
+{
+	switch(role)
+	{
+		case CHIAKI_THREAD_ROLE_TAKION:
+			return "takion";
+		case CHIAKI_THREAD_ROLE_VIDEO_DECODE:
+			return "video-decode";
+		case CHIAKI_THREAD_ROLE_AUDIO:
+			return "audio";
+		case CHIAKI_THREAD_ROLE_FEEDBACK:
+			return "feedback";
+		case CHIAKI_THREAD_ROLE_CTRL:
+			return "ctrl";
+		default:
+			return "unknown";
+	}
+}
+
 CHIAKI_EXPORT const char *chiaki_quit_reason_string(ChiakiQuitReason reason)
 {
 	switch(reason)
@@ -261,6 +280,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.video_profile_auto_downgrade = connect_info->video_profile_auto_downgrade;
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
+	memcpy(session->connect_info.thread_sched, connect_info->thread_sched, sizeof(session->connect_info.thread_sched));
 
 	return CHIAKI_ERR_SUCCESS;
 
@@ -509,6 +529,7 @@ static void *session_thread_func(void *arg)
 	err = chiaki_ctrl_start(&session->ctrl);
 	if(err != CHIAKI_ERR_SUCCESS)
 		QUIT(quit);
+	chiaki_session_apply_thread_role(session, &session->ctrl.thread, CHIAKI_THREAD_ROLE_CTRL);
 
 	err = chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, SESSION_EXPECT_TIMEOUT_MS, session_check_state_pred_ctrl_start, session);
 	CHECK_STOP(quit_ctrl);
@@ -1196,3 +1217,36 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_go_home(ChiakiSession *session)
 	err = ctrl_message_go_home(&session->ctrl);
 	return err;
 }
+
+CHIAKI_EXPORT void chiaki_session_apply_thread_role(ChiakiSession *session, ChiakiThread *thread, ChiakiThreadRole role)
+{
+	if(role < 0 || role >= CHIAKI_THREAD_ROLE_COUNT)
+		return;
+	const ChiakiThreadSchedConfig *config = &session->connect_info.thread_sched[role];
+	const char *role_str = chiaki_thread_role_string(role);
+
+	if(config->set_priority)
+	{
+		ChiakiThreadPriority applied;
+		ChiakiErrorCode err = chiaki_thread_set_priority(thread, config->priority, &applied);
+		if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGW(session->log, "Failed to set %s priority for %s thread, missing privileges?",
+					chiaki_thread_priority_string(config->priority), role_str);
+		else if(applied != config->priority)
+			CHIAKI_LOGW(session->log, "Set %s priority for %s thread instead of %s, missing privileges?",
+					chiaki_thread_priority_string(applied), role_str, chiaki_thread_priority_string(config->priority));
+		else
+			CHIAKI_LOGI(session->log, "Set %s priority for %s thread", chiaki_thread_priority_string(applied), role_str);
+	}
+
+	if(config->cpu_mask)
+	{
+		ChiakiErrorCode err = chiaki_thread_set_affinity(thread, config->cpu_mask);
+		if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGW(session->log, "Failed to set CPU affinity 0x%llx for %s thread",
+					(unsigned long long)config->cpu_mask, role_str);
+		else
+			CHIAKI_LOGI(session->log, "Set CPU affinity 0x%llx for %s thread",
+					(unsigned long long)config->cpu_mask, role_str);
+	}
+}
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/spscring.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+// volatile only implies acquire/release with /volatile:ms, which is not the default on ARM,
+// so plain accesses are ordered with explicit barriers instead
+#if defined(_M_ARM64)
+#define load_relaxed(p) ((size_t)__iso_volatile_load64((const volatile __int64 *)(p)))
+#define store_relaxed(p, v) __iso_volatile_store64((volatile __int64 *)(p), (__int64)(v))
+#define barrier() __dmb(_ARM64_BARRIER_ISH)
+#elif defined(_M_ARM)
+#define load_relaxed(p) ((size_t)__iso_volatile_load32((const volatile __int32 *)(p)))
+#define store_relaxed(p, v) __iso_volatile_store32((volatile __int32 *)(p), (__int32)(v))
+#define barrier() __dmb(_ARM_BARRIER_ISH)
+#else
+// x86 and x64 never reorder a load with later accesses or a store with earlier ones, only the compiler might
+#define load_relaxed(p) (*(const volatile size_t *)(p))
+#define store_relaxed(p, v) (*(volatile size_t *)(p) = (v))
+#define barrier() _ReadWriteBarrier()
+#endif
+static __forceinline size_t load_acquire(const size_t *p)
+{
+	size_t v = load_relaxed(p);
+	barrier();
+	return v;
+}
+static __forceinline void store_release(size_t *p, size_t v)
+{
+	barrier();
+	store_relaxed(p, v);
+}
+#else
+#include <stdatomic.h>
+static inline size_t load_acquire(const size_t *p)
+{
+	size_t v = *(const volatile size_t *)p;
+	atomic_thread_fence(memory_order_acquire);
+	return v;
+}
+static inline void store_release(size_t *p, size_t v)
+{
+	atomic_thread_fence(memory_order_release);
+	*(volatile size_t *)p = v;
+}
+#endif
+
+#define RING_SIZE ((size_t)1 << ring->size_exp)
+#define IDX_MASK (RING_SIZE - 1)
+#define elem(i) (ring->buf + ((i) & IDX_MASK) * ring->elem_size)
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_spsc_ring_init(ChiakiSpscRing *ring, size_t elem_size, size_t size_exp)
+{
+	ring->elem_size = elem_size;
+	ring->size_exp = size_exp;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->buf = malloc(elem_size << size_exp);
+	if(!ring->buf)
+		return CHIAKI_ERR_MEMORY;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_spsc_ring_fini(ChiakiSpscRing *ring)
+{
+	free(ring->buf);
+}
+
+CHIAKI_EXPORT void chiaki_spsc_ring_reset(ChiakiSpscRing *ring)
+{
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+CHIAKI_EXPORT void *chiaki_spsc_ring_write_begin(ChiakiSpscRing *ring)
+{
+	size_t tail = ring->tail;
+	if(tail - load_acquire(&ring->head) >= RING_SIZE)
+		return NULL;
+	return elem(tail);
+}
+
+CHIAKI_EXPORT void chiaki_spsc_ring_write_commit(ChiakiSpscRing *ring)
+{
+	store_release(&ring->tail, ring->tail + 1);
+}
+
+CHIAKI_EXPORT size_t chiaki_spsc_ring_write(ChiakiSpscRing *ring, const void *elems, size_t count)
+{
+	size_t tail = ring->tail;
+	size_t free_count = RING_SIZE - (tail - load_acquire(&ring->head));
+	if(count > free_count)
+		count = free_count;
+	if(!count)
+		return 0;
+
+	// copy in at most two parts around the end of the buffer
+	size_t first = RING_SIZE - (tail & IDX_MASK);
+	if(first > count)
+		first = count;
+	memcpy(elem(tail), elems, first * ring->elem_size);
+	if(count > first)
+		memcpy(ring->buf, (const uint8_t *)elems + first * ring->elem_size, (count - first) * ring->elem_size);
+
+	store_release(&ring->tail, tail + count);
+	return count;
+}
+
+CHIAKI_EXPORT void *chiaki_spsc_ring_read_begin(ChiakiSpscRing *ring)
+{
+	size_t head = ring->head;
+	if(load_acquire(&ring->tail) == head)
+		return NULL;
+	return elem(head);
+}
+
+CHIAKI_EXPORT void chiaki_spsc_ring_read_commit(ChiakiSpscRing *ring)
+{
+	store_release(&ring->head, ring->head + 1);
+}
+
+CHIAKI_EXPORT size_t chiaki_spsc_ring_read(ChiakiSpscRing *ring, void *elems, size_t count)
+{
+	size_t head = ring->head;
+	size_t available = load_acquire(&ring->tail) - head;
+	if(count > available)
+		count = available;
+	if(!count)
+		return 0;
+
+	size_t first = RING_SIZE - (head & IDX_MASK);
+	if(first > count)
+		first = count;
+	memcpy(elems, elem(head), first * ring->elem_size);
+	if(count > first)
+		memcpy((uint8_t *)elems + first * ring->elem_size, ring->buf, (count - first) * ring->elem_size);
+
+	store_release(&ring->head, head + count);
+	return count;
+}
+
+CHIAKI_EXPORT size_t chiaki_spsc_ring_count(ChiakiSpscRing *ring)
+{
+	size_t head = load_acquire(&ring->head);
+	return load_acquire(&ring->tail) - head;
+}
@@ -8,6 +8,7 @@
 #include <chiaki/base64.h>
 #include <chiaki/audio.h>
 #include <chiaki/video.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
@@ -33,6 +34,10 @@
 
 #define HEARTBEAT_INTERVAL_MS 1000
 
+// data acks are cumulative, so bursts of data messages only need one
+#define ACK_PACKETS_MAX 4
+#define ACK_DELAY_US 5000
+
 
 typedef enum {
 	STATE_IDLE,
@@ -88,6 +93,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_packet_stats;
 
+	err = chiaki_mutex_init(&stream_connection->video_stats_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_feedback_sender_mutex;
+	memset(&stream_connection->video_stats, 0, sizeof(stream_connection->video_stats));
+
 	stream_connection->state = STATE_IDLE;
 	stream_connection->state_finished = false;
 	stream_connection->state_failed = false;
@@ -97,6 +107,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 
 	return CHIAKI_ERR_SUCCESS;
 
+error_feedback_sender_mutex:
+	chiaki_mutex_fini(&stream_connection->feedback_sender_mutex);
 error_packet_stats:
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 error_state_cond:
@@ -125,11 +137,19 @@ CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 
 	chiaki_mutex_fini(&stream_connection->feedback_sender_mutex);
+	chiaki_mutex_fini(&stream_connection->video_stats_mutex);
 
 	chiaki_cond_fini(&stream_connection->state_cond);
 	chiaki_mutex_fini(&stream_connection->state_mutex);
 }
 
+CHIAKI_EXPORT void chiaki_stream_connection_get_video_stats(ChiakiStreamConnection *stream_connection, ChiakiVideoReceiverStats *stats)
+{
+	chiaki_mutex_lock(&stream_connection->video_stats_mutex);
+	*stats = stream_connection->video_stats;
+	chiaki_mutex_unlock(&stream_connection->video_stats_mutex);
+}
+
 static bool state_finished_cond_check(void *user)
 {
 	ChiakiStreamConnection *stream_connection = user;
@@ -158,6 +178,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 
 	takion_info.enable_crypt = true;
 	takion_info.enable_dualsense = session->connect_info.enable_dualsense;
+	takion_info.ack_policy.packets_max = ACK_PACKETS_MAX;
+	takion_info.ack_policy.delay_us = ACK_DELAY_US;
 	takion_info.protocol_version = chiaki_target_is_ps5(session->target) ? 12 : 9;
 
 	takion_info.cb = stream_connection_takion_cb;
@@ -178,6 +200,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize Audio Receiver");
 		return CHIAKI_ERR_UNKNOWN;
 	}
+	chiaki_session_apply_thread_role(session, &stream_connection->audio_receiver->dispatch_thread, CHIAKI_THREAD_ROLE_AUDIO);
 
 	stream_connection->haptics_receiver = chiaki_audio_receiver_new(session, NULL);
 	if(!stream_connection->haptics_receiver)
@@ -186,6 +209,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		err = CHIAKI_ERR_UNKNOWN;
 		goto err_audio_receiver;
 	}
+	chiaki_session_apply_thread_role(session, &stream_connection->haptics_receiver->dispatch_thread, CHIAKI_THREAD_ROLE_AUDIO);
 
 	stream_connection->video_receiver = chiaki_video_receiver_new(session, &stream_connection->packet_stats);
 	if(!stream_connection->video_receiver)
@@ -208,6 +232,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		chiaki_mutex_unlock(&stream_connection->state_mutex);
 		goto err_video_receiver;
 	}
+	chiaki_session_apply_thread_role(session, &stream_connection->takion.thread, CHIAKI_THREAD_ROLE_TAKION);
 
 	err = chiaki_congestion_control_start(&stream_connection->congestion_control, &stream_connection->takion, &stream_connection->packet_stats);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -292,6 +317,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		goto disconnect;
 	}
 	stream_connection->feedback_sender_active = true;
+	chiaki_session_apply_thread_role(session, &stream_connection->feedback_sender.thread, CHIAKI_THREAD_ROLE_FEEDBACK);
 	chiaki_feedback_sender_set_controller_state(&stream_connection->feedback_sender, &session->controller_state);
 	chiaki_mutex_unlock(&stream_connection->feedback_sender_mutex);
 
@@ -541,9 +567,14 @@ static void stream_connection_takion_data_idle(ChiakiStreamConnection *stream_co
 			 q.target_bitrate, q.upstream_bitrate,
 			 q.upstream_loss,
 			 q.disable_upstream_audio, q.rtt, q.loss);
-		stream_connection->measured_bitrate = chiaki_stream_stats_bitrate(&stream_connection->video_receiver->frame_processor.stream_stats, stream_connection->session->connect_info.video_profile.max_fps) / 1000000.0;
-		CHIAKI_LOGV(stream_connection->log, "StreamConnection measured bitrate: %.4f MBit/s", stream_connection->measured_bitrate);
-		chiaki_stream_stats_reset(&stream_connection->video_receiver->frame_processor.stream_stats);
+		ChiakiBitrateMeterStats bitrate;
+		chiaki_bitrate_meter_get_stats(&stream_connection->video_receiver->bitrate_meter, chiaki_time_now_monotonic_us(), &bitrate);
+		stream_connection->measured_bitrate = bitrate.bitrate / 1000000.0;
+		CHIAKI_LOGV(stream_connection->log, "StreamConnection measured bitrate: %.4f MBit/s (average %.4f MBit/s), %.2f fps",
+			stream_connection->measured_bitrate, bitrate.bitrate_ewma / 1000000.0, bitrate.fps);
+		chiaki_mutex_lock(&stream_connection->video_stats_mutex);
+		stream_connection->video_stats.bitrate = bitrate;
+		chiaki_mutex_unlock(&stream_connection->video_stats_mutex);
 		break;
 	}
 	case tkproto_TakionMessage_PayloadType_CORRUPTFRAME:
@@ -1,5 +1,10 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
+#if defined(__linux__)
+#define _GNU_SOURCE // sendmmsg
+#define TAKION_SENDMMSG
+#endif
+
 #include "chiaki/feedback.h"
 #include <chiaki/takion.h>
 #include <chiaki/congestioncontrol.h>
@@ -172,6 +177,7 @@ static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t ba
 static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
 static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size);
 static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t flags, uint8_t *buf, size_t buf_size);
+static void takion_send_pending_ack(ChiakiTakion *takion);
 static ChiakiErrorCode takion_parse_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, TakionMessage *msg);
 static void takion_write_message_header(uint8_t *buf, uint32_t tag, uint64_t key_pos, uint8_t chunk_type, uint8_t chunk_flags, size_t payload_data_size);
 static ChiakiErrorCode takion_send_message_init(ChiakiTakion *takion, TakionMessagePayloadInit *payload);
@@ -231,6 +237,16 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	takion->postponed_packets_count = 0;
 	takion->enable_dualsense = info->enable_dualsense;
 
+	chiaki_takion_delayed_ack_init(&takion->delayed_ack, &info->ack_policy);
+
+	takion->send_batch.depth = 0;
+	takion->send_batch.count = 0;
+	takion->send_batch.packets_sent = 0;
+	takion->send_batch.flushes = 0;
+	ret = chiaki_mutex_init(&takion->send_batch.mutex, false);
+	if(ret != CHIAKI_ERR_SUCCESS)
+		goto error_seq_num_local_mutex;
+
 	CHIAKI_LOGI(takion->log, "Takion connecting (version %u)", (unsigned int)info->protocol_version);
 	bool mac_dontfrag = true;
 
@@ -238,7 +254,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to create stop pipe");
-		goto error_seq_num_local_mutex;
+		goto error_send_batch_mutex;
 	}
 
 	if(sock)
@@ -417,6 +433,8 @@ error_sock:
 	takion->sock = CHIAKI_INVALID_SOCKET;
 error_pipe:
 	chiaki_stop_pipe_fini(&takion->stop_pipe);
+error_send_batch_mutex:
+	chiaki_mutex_fini(&takion->send_batch.mutex);
 error_seq_num_local_mutex:
 	chiaki_mutex_fini(&takion->seq_num_local_mutex);
 error_gkcrypt_local_mutex:
@@ -429,10 +447,56 @@ CHIAKI_EXPORT void chiaki_takion_close(ChiakiTakion *takion)
 	chiaki_stop_pipe_stop(&takion->stop_pipe);
 	chiaki_thread_join(&takion->thread, NULL);
 	chiaki_stop_pipe_fini(&takion->stop_pipe);
+	chiaki_mutex_fini(&takion->send_batch.mutex);
 	chiaki_mutex_fini(&takion->seq_num_local_mutex);
 	chiaki_mutex_fini(&takion->gkcrypt_local_mutex);
 }
 
+CHIAKI_EXPORT void chiaki_takion_ack_policy_default(ChiakiTakionAckPolicy *policy)
+{
+	policy->packets_max = 1;
+	policy->delay_us = 0;
+}
+
+CHIAKI_EXPORT void chiaki_takion_delayed_ack_init(ChiakiTakionDelayedAck *ack, const ChiakiTakionAckPolicy *policy)
+{
+	ack->policy = *policy;
+	if(ack->policy.packets_max < 1)
+		ack->policy.packets_max = 1;
+	if(ack->policy.delay_us > CHIAKI_TAKION_ACK_DELAY_MAX_US)
+		ack->policy.delay_us = CHIAKI_TAKION_ACK_DELAY_MAX_US;
+	ack->pending = 0;
+	ack->seq_num = 0;
+	ack->deadline_us = 0;
+}
+
+CHIAKI_EXPORT bool chiaki_takion_delayed_ack_push(ChiakiTakionDelayedAck *ack, size_t count, ChiakiSeqNum32 seq_num, uint64_t now_us)
+{
+	if(!count)
+		return false;
+	if(!ack->pending)
+		ack->deadline_us = now_us + ack->policy.delay_us;
+	ack->pending += count;
+	ack->seq_num = seq_num;
+	return ack->pending >= ack->policy.packets_max || !ack->policy.delay_us;
+}
+
+CHIAKI_EXPORT bool chiaki_takion_delayed_ack_due(ChiakiTakionDelayedAck *ack, uint64_t now_us, uint64_t *timeout_ms)
+{
+	*timeout_ms = UINT64_MAX;
+	if(!ack->pending)
+		return false;
+	if(now_us >= ack->deadline_us)
+		return true;
+	*timeout_ms = (ack->deadline_us - now_us + 999) / 1000;
+	return false;
+}
+
+CHIAKI_EXPORT void chiaki_takion_delayed_ack_sent(ChiakiTakionDelayedAck *ack)
+{
+	ack->pending = 0;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_crypt_advance_key_pos(ChiakiTakion *takion, size_t data_size, uint64_t *key_pos)
 {
 	data_size += data_size % CHIAKI_GKCRYPT_BLOCK_SIZE;
@@ -459,7 +523,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_crypt_advance_key_pos(ChiakiTakion *
 	return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_raw(ChiakiTakion *takion, const uint8_t *buf, size_t buf_size)
+static ChiakiErrorCode takion_send_raw_now(ChiakiTakion *takion, const uint8_t *buf, size_t buf_size)
 {
 	// #ifdef __PSVITA__
 	// 	int r = sceNetSend(takion->sock, buf, buf_size, 0);
@@ -474,6 +538,101 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_raw(ChiakiTakion *takion, const
 	return CHIAKI_ERR_SUCCESS;
 }
 
+/**
+ * Send everything queued in takion->send_batch, send_batch.mutex must be locked
+ */
+static ChiakiErrorCode takion_send_batch_flush(ChiakiTakion *takion)
+{
+	ChiakiTakionSendBatch *batch = &takion->send_batch;
+	if(!batch->count)
+		return CHIAKI_ERR_SUCCESS;
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+#ifdef TAKION_SENDMMSG
+	struct mmsghdr msgs[CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX];
+	struct iovec iovs[CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX];
+	memset(msgs, 0, batch->count * sizeof(struct mmsghdr));
+	for(size_t i=0; i<batch->count; i++)
+	{
+		iovs[i].iov_base = batch->bufs[i];
+		iovs[i].iov_len = batch->sizes[i];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	size_t sent = 0;
+	while(sent < batch->count)
+	{
+		int r = sendmmsg(takion->sock, msgs + sent, (unsigned int)(batch->count - sent), 0);
+		if(r <= 0)
+		{
+			CHIAKI_LOGE(takion->log, "Takion failed to send batch: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+			err = CHIAKI_ERR_NETWORK;
+			break;
+		}
+		sent += (size_t)r;
+	}
+#else
+	for(size_t i=0; i<batch->count; i++)
+	{
+		ChiakiErrorCode send_err = takion_send_raw_now(takion, batch->bufs[i], batch->sizes[i]);
+		if(send_err != CHIAKI_ERR_SUCCESS)
+			err = send_err;
+	}
+#endif
+	batch->packets_sent += batch->count;
+	batch->flushes++;
+	batch->count = 0;
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_raw(ChiakiTakion *takion, const uint8_t *buf, size_t buf_size)
+{
+	ChiakiTakionSendBatch *batch = &takion->send_batch;
+	ChiakiErrorCode err = chiaki_mutex_lock(&batch->mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	if(!batch->depth)
+	{
+		chiaki_mutex_unlock(&batch->mutex);
+		return takion_send_raw_now(takion, buf, buf_size);
+	}
+
+	if(buf_size > CHIAKI_TAKION_SEND_BATCH_PACKET_SIZE_MAX)
+	{
+		// too big to queue, but everything queued before has to go out first
+		err = takion_send_batch_flush(takion);
+		ChiakiErrorCode send_err = takion_send_raw_now(takion, buf, buf_size);
+		chiaki_mutex_unlock(&batch->mutex);
+		return send_err != CHIAKI_ERR_SUCCESS ? send_err : err;
+	}
+
+	if(batch->count == CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX)
+		err = takion_send_batch_flush(takion);
+	memcpy(batch->bufs[batch->count], buf, buf_size);
+	batch->sizes[batch->count] = buf_size;
+	batch->count++;
+	chiaki_mutex_unlock(&batch->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_takion_send_batch_begin(ChiakiTakion *takion)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&takion->send_batch.mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	takion->send_batch.depth++;
+	chiaki_mutex_unlock(&takion->send_batch.mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_batch_end(ChiakiTakion *takion)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&takion->send_batch.mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	assert(takion->send_batch.depth > 0);
+	if(--takion->send_batch.depth == 0)
+		err = takion_send_batch_flush(takion);
+	chiaki_mutex_unlock(&takion->send_batch.mutex);
+	return err;
+}
+
 static ChiakiErrorCode chiaki_takion_packet_read_key_pos(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint64_t *key_pos_out)
 {
 	if(buf_size < 1)
@@ -886,10 +1045,10 @@ static void *takion_thread_func(void *user)
 	if(takion_handshake(takion, &seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
 		goto beach;
 
-	if(chiaki_reorder_queue_init_32(&takion->data_queue, TAKION_REORDER_QUEUE_SIZE_EXP, seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
+	if(chiaki_bitmap_reorder_queue_init_32(&takion->data_queue, TAKION_REORDER_QUEUE_SIZE_EXP, seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
 		goto beach;
 
-	chiaki_reorder_queue_set_drop_cb(&takion->data_queue, takion_data_drop, takion);
+	chiaki_bitmap_reorder_queue_set_drop_cb(&takion->data_queue, takion_data_drop, takion);
 
 	// The send buffer size MUST be consistent with the acked seqnums array size in takion_handle_packet_message_data_ack()
 	if(chiaki_takion_send_buffer_init(&takion->send_buffer, takion, TAKION_SEND_BUFFER_SIZE) != CHIAKI_ERR_SUCCESS)
@@ -910,11 +1069,11 @@ static void *takion_thread_func(void *user)
 		if(takion->enable_crypt && !crypt_available && takion->gkcrypt_remote)
 		{
 			crypt_available = true;
-			CHIAKI_LOGI(takion->log, "Crypt has become available. Re-checking MACs of %llu packets", (unsigned long long)chiaki_reorder_queue_count(&takion->data_queue));
-			for(uint64_t i=0; i<chiaki_reorder_queue_count(&takion->data_queue); i++)
+			CHIAKI_LOGI(takion->log, "Crypt has become available. Re-checking MACs of %llu packets", (unsigned long long)chiaki_bitmap_reorder_queue_count(&takion->data_queue));
+			for(uint64_t i=0; i<chiaki_bitmap_reorder_queue_count(&takion->data_queue); i++)
 			{
 				TakionDataPacketEntry *packet;
-				bool peeked = chiaki_reorder_queue_peek(&takion->data_queue, i, NULL, (void **)&packet);
+				bool peeked = chiaki_bitmap_reorder_queue_peek(&takion->data_queue, i, NULL, (void **)&packet);
 				if(!peeked)
 					continue;
 				if(packet->packet_size == 0)
@@ -923,7 +1082,7 @@ static void *takion_thread_func(void *user)
 				if(takion_handle_packet_mac(takion, base_type, packet->packet_buf, packet->packet_size) != CHIAKI_ERR_SUCCESS)
 				{
 					CHIAKI_LOGW(takion->log, "Found an invalid MAC");
-					chiaki_reorder_queue_drop(&takion->data_queue, i);
+					chiaki_bitmap_reorder_queue_drop(&takion->data_queue, i);
 				}
 			}
 
@@ -946,11 +1105,21 @@ static void *takion_thread_func(void *user)
 			takion->postponed_packets_count = 0;
 		}
 
+		// wake up in time for a delayed ack
+		uint64_t timeout_ms;
+		if(chiaki_takion_delayed_ack_due(&takion->delayed_ack, chiaki_time_now_monotonic_us(), &timeout_ms))
+			takion_send_pending_ack(takion);
+
 		size_t received_size = 1500;
 		uint8_t *buf = malloc(received_size); // TODO: no malloc?
 		if(!buf)
 			break;
-		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, UINT64_MAX);
+		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, timeout_ms);
+		if(err == CHIAKI_ERR_TIMEOUT)
+		{
+			free(buf);
+			continue;
+		}
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			free(buf);
@@ -970,7 +1139,7 @@ static void *takion_thread_func(void *user)
 	chiaki_takion_send_buffer_fini(&takion->send_buffer);
 
 error_reoder_queue:
-	chiaki_reorder_queue_fini(&takion->data_queue);
+	chiaki_bitmap_reorder_queue_fini(&takion->data_queue);
 
 beach:
 	if(takion->cb)
@@ -1142,55 +1311,66 @@ static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, siz
 	}
 }
 
+static void takion_handle_data_entry(ChiakiTakion *takion, TakionDataPacketEntry *entry)
+{
+	if(entry->payload_size < 9)
+		goto beach;
+
+	uint16_t zero_a = *((chiaki_unaligned_uint16_t *)(entry->payload + 6));
+	uint8_t data_type = entry->payload[8]; // & 0xf
+
+	if(zero_a != 0)
+		CHIAKI_LOGW(takion->log, "Takion received data with unexpected nonzero %#x at buf+6", zero_a);
+
+	if(data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_PROTOBUF
+			&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_RUMBLE
+			&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_TRIGGER_EFFECTS
+			&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_9)
+	{
+		CHIAKI_LOGW(takion->log, "Takion received data with unexpected data type %#x", data_type);
+		chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, entry->packet_buf, entry->packet_size);
+	}
+	else if(takion->cb)
+	{
+		ChiakiTakionEvent event = { 0 };
+		event.type = CHIAKI_TAKION_EVENT_TYPE_DATA;
+		event.data.data_type = (ChiakiTakionMessageDataType)data_type;
+		event.data.buf = entry->payload + 9;
+		event.data.buf_size = (size_t)(entry->payload_size - 9);
+		takion->cb(&event, takion->cb_user);
+	}
+
+beach:
+	free(entry->packet_buf);
+	free(entry);
+}
+
+static void takion_send_pending_ack(ChiakiTakion *takion)
+{
+	// one cumulative ack covers everything up to its seq_num
+	chiaki_takion_send_message_data_ack(takion, takion->delayed_ack.seq_num);
+	chiaki_takion_delayed_ack_sent(&takion->delayed_ack);
+}
+
 static void takion_flush_data_queue(ChiakiTakion *takion)
 {
 	uint64_t seq_num = 0;
-	bool ack = false;
+	size_t pulled_total = 0;
+	TakionDataPacketEntry *entries[1 << TAKION_REORDER_QUEUE_SIZE_EXP];
 	while(true)
 	{
-		TakionDataPacketEntry *entry;
-		bool pulled = chiaki_reorder_queue_pull(&takion->data_queue, &seq_num, (void **)&entry);
+		// everything that is available in order comes out as one run
+		size_t pulled = chiaki_bitmap_reorder_queue_pull_all_32(&takion->data_queue, &seq_num, (void **)entries, sizeof(entries) / sizeof(entries[0]));
 		if(!pulled)
 			break;
-		ack = true;
-
-		if(entry->payload_size < 9)
-		{
-			free(entry->packet_buf);
-			free(entry);
-			continue;
-		}
-
-		uint16_t zero_a = *((chiaki_unaligned_uint16_t *)(entry->payload + 6));
-		uint8_t data_type = entry->payload[8]; // & 0xf
-
-		if(zero_a != 0)
-			CHIAKI_LOGW(takion->log, "Takion received data with unexpected nonzero %#x at buf+6", zero_a);
-
-		if(data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_PROTOBUF
-				&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_RUMBLE
-				&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_TRIGGER_EFFECTS
-				&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_9)
-		{
-			CHIAKI_LOGW(takion->log, "Takion received data with unexpected data type %#x", data_type);
-			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, entry->packet_buf, entry->packet_size);
-		}
-		else if(takion->cb)
-		{
-			ChiakiTakionEvent event = { 0 };
-			event.type = CHIAKI_TAKION_EVENT_TYPE_DATA;
-			event.data.data_type = (ChiakiTakionMessageDataType)data_type;
-			event.data.buf = entry->payload + 9;
-			event.data.buf_size = (size_t)(entry->payload_size - 9);
-			takion->cb(&event, takion->cb_user);
-		}
-
-		free(entry->packet_buf);
-		free(entry);
+		pulled_total += pulled;
+		for(size_t i=0; i<pulled; i++)
+			takion_handle_data_entry(takion, entries[i]);
+		seq_num += pulled - 1;
 	}
 
-	if(ack)
-		chiaki_takion_send_message_data_ack(takion, (uint32_t)seq_num);
+	if(chiaki_takion_delayed_ack_push(&takion->delayed_ack, pulled_total, (ChiakiSeqNum32)seq_num, chiaki_time_now_monotonic_us()))
+		takion_send_pending_ack(takion);
 }
 
 static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size)
@@ -1216,7 +1396,7 @@ static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *pac
 	entry->channel = ntohs(*((chiaki_unaligned_uint16_t *)(payload + 4)));
 	ChiakiSeqNum32 seq_num = ntohl(*((chiaki_unaligned_uint32_t *)(payload + 0)));
 
-	chiaki_reorder_queue_push(&takion->data_queue, seq_num, entry);
+	chiaki_bitmap_reorder_queue_push_32(&takion->data_queue, seq_num, entry);
 	takion_flush_data_queue(takion);
 }
 
@@ -8,11 +8,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 
 #ifdef __SWITCH__
 #include <switch.h>
 #endif
 
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#elif !defined(_WIN32) && !defined(__PSVITA__)
+#include <sched.h>
+#endif
+
 #ifdef __PSVITA__
 #include <psp2/kernel/processmgr.h>
 #include <psp2/kernel/error.h>
@@ -27,6 +37,24 @@ static DWORD WINAPI win32_thread_func(LPVOID param)
 }
 #endif
 
+#if defined(__linux__)
+static void *linux_thread_func(void *param)
+{
+	ChiakiThread *thread = (ChiakiThread *)param;
+	__atomic_store_n(&thread->tid, (int)syscall(SYS_gettid), __ATOMIC_RELEASE);
+	return thread->func(thread->arg);
+}
+
+static int linux_thread_tid(ChiakiThread *thread)
+{
+	// published as the very first thing in the thread, so this only spins right after creation
+	int tid;
+	while(!(tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE)))
+		sched_yield();
+	return tid;
+}
+#endif
+
 #ifdef __SWITCH__
 int64_t get_thread_limit()
 {
@@ -81,7 +109,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create(ChiakiThread *thread, ChiakiT
 	if(get_thread_limit() <= 1)
 		return CHIAKI_ERR_THREAD;
 #endif
+#if defined(__linux__)
+	thread->func = func;
+	thread->arg = arg;
+	thread->tid = 0;
+	int r = pthread_create(&thread->thread, NULL, linux_thread_func, thread);
+#else
 	int r = pthread_create(&thread->thread, NULL, func, arg);
+#endif
 	if(r != 0)
 		return CHIAKI_ERR_THREAD;
 #endif
@@ -141,6 +176,153 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const
 	return CHIAKI_ERR_SUCCESS;
 }
 
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority)
+{
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_LOW:
+			return "low";
+		case CHIAKI_THREAD_PRIORITY_NORMAL:
+			return "normal";
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			return "high";
+		case CHIAKI_THREAD_PRIORITY_REALTIME:
+			return "realtime";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_sched_config_parse(ChiakiThreadSchedConfig *config, const char *str)
+{
+	memset(config, 0, sizeof(*config));
+	const char *at = strchr(str, '@');
+	size_t priority_len = at ? (size_t)(at - str) : strlen(str);
+	if(priority_len)
+	{
+		ChiakiThreadPriority priority;
+		for(priority = CHIAKI_THREAD_PRIORITY_LOW; priority <= CHIAKI_THREAD_PRIORITY_REALTIME; priority++)
+		{
+			const char *name = chiaki_thread_priority_string(priority);
+			if(strlen(name) == priority_len && strncmp(name, str, priority_len) == 0)
+				break;
+		}
+		if(priority > CHIAKI_THREAD_PRIORITY_REALTIME)
+			return CHIAKI_ERR_INVALID_DATA;
+		config->set_priority = true;
+		config->priority = priority;
+	}
+	if(at)
+	{
+		char *end;
+		errno = 0;
+		unsigned long long mask = strtoull(at + 1, &end, 0);
+		if(!at[1] || *end || errno || !mask)
+			return CHIAKI_ERR_INVALID_DATA;
+		config->cpu_mask = (uint64_t)mask;
+	}
+	else if(!priority_len)
+		return CHIAKI_ERR_INVALID_DATA;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static bool thread_set_priority(ChiakiThread *thread, ChiakiThreadPriority priority)
+{
+#if defined(_WIN32)
+	static const int priorities[] = {
+		THREAD_PRIORITY_BELOW_NORMAL,
+		THREAD_PRIORITY_NORMAL,
+		THREAD_PRIORITY_HIGHEST,
+		THREAD_PRIORITY_TIME_CRITICAL
+	};
+	return SetThreadPriority(thread->thread, priorities[priority]) != 0;
+#elif defined(__PSVITA__)
+	// lower is more important, 64 to 191 for user threads, 0x10000100 is the default chiaki_thread_create() uses
+	static const int priorities[] = { 191, 0x10000100, 96, 64 };
+	return sceKernelChangeThreadPriority(thread->thread_id, priorities[priority]) >= 0;
+#else
+	struct sched_param param = { 0 };
+	if(priority == CHIAKI_THREAD_PRIORITY_REALTIME)
+	{
+		int min = sched_get_priority_min(SCHED_FIFO);
+		int max = sched_get_priority_max(SCHED_FIFO);
+		// low end of the range, so kernel threads and audio servers still preempt us
+		param.sched_priority = min + (max - min) / 8;
+		return pthread_setschedparam(thread->thread, SCHED_FIFO, &param) == 0;
+	}
+#if defined(__linux__)
+	// SCHED_OTHER has no static priorities here, only the niceness of the kernel thread
+	if(pthread_setschedparam(thread->thread, SCHED_OTHER, &param) != 0)
+		return false;
+	int nice = priority == CHIAKI_THREAD_PRIORITY_LOW ? 5 : (priority == CHIAKI_THREAD_PRIORITY_HIGH ? -10 : 0);
+	return setpriority(PRIO_PROCESS, (id_t)linux_thread_tid(thread), nice) == 0;
+#else
+	int min = sched_get_priority_min(SCHED_OTHER);
+	int max = sched_get_priority_max(SCHED_OTHER);
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_LOW:
+			param.sched_priority = min;
+			break;
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			param.sched_priority = max;
+			break;
+		default:
+			param.sched_priority = min + (max - min) / 2;
+			break;
+	}
+	return pthread_setschedparam(thread->thread, SCHED_OTHER, &param) == 0;
+#endif
+#endif
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_priority(ChiakiThread *thread, ChiakiThreadPriority priority, ChiakiThreadPriority *applied)
+{
+	if(priority < CHIAKI_THREAD_PRIORITY_LOW || priority > CHIAKI_THREAD_PRIORITY_REALTIME)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!thread_set_priority(thread, priority))
+	{
+		// realtime usually needs privileges, high might still be granted
+		if(priority != CHIAKI_THREAD_PRIORITY_REALTIME || !thread_set_priority(thread, CHIAKI_THREAD_PRIORITY_HIGH))
+			return CHIAKI_ERR_THREAD;
+		priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	}
+	if(applied)
+		*applied = priority;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_affinity(ChiakiThread *thread, uint64_t cpu_mask)
+{
+	if(!cpu_mask)
+		return CHIAKI_ERR_INVALID_DATA;
+#if defined(_WIN32)
+	if(!SetThreadAffinityMask(thread->thread, (DWORD_PTR)cpu_mask))
+		return CHIAKI_ERR_THREAD;
+#elif defined(__PSVITA__)
+	// user threads may run on the first 3 cores, the mask starts at bit 16
+	if(cpu_mask & ~(uint64_t)0x7)
+		return CHIAKI_ERR_THREAD;
+	if(sceKernelChangeThreadCpuAffinityMask(thread->thread_id, (int)(cpu_mask << 16)) < 0)
+		return CHIAKI_ERR_THREAD;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(unsigned int i=0; i<64 && i<CPU_SETSIZE; i++)
+	{
+		if(cpu_mask & ((uint64_t)1 << i))
+			CPU_SET(i, &set);
+	}
+	// by kernel thread id instead of pthread_setaffinity_np(), which is missing from bionic
+	if(sched_setaffinity((pid_t)linux_thread_tid(thread), sizeof(set), &set) != 0)
+		return CHIAKI_ERR_THREAD;
+#else
+	(void)thread;
+	return CHIAKI_ERR_THREAD;
+#endif
+	return CHIAKI_ERR_SUCCESS;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_init(ChiakiMutex *mutex, bool rec)
 {
 #if _WIN32
@@ -2,6 +2,7 @@
 
 #include <chiaki/videoreceiver.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 
@@ -33,7 +34,37 @@ static bool have_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
 	return false;
 }
 
-CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
+static ChiakiErrorCode send_corrupt_frame(ChiakiSeqNum16 start, ChiakiSeqNum16 end, void *user)
+{
+	ChiakiVideoReceiver *video_receiver = user;
+	return stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, start, end);
+}
+
+static void update_stats(ChiakiVideoReceiver *video_receiver, size_t frame_size, ChiakiFrameProcessorFlushResult flush_result, bool partial)
+{
+	ChiakiStreamConnection *stream_connection = &video_receiver->session->stream_connection;
+	ChiakiCorruptFrameStats corrupt_frames;
+	chiaki_corrupt_frame_reporter_get_stats(&video_receiver->corrupt_frame_reporter, &corrupt_frames);
+	chiaki_mutex_lock(&stream_connection->video_stats_mutex);
+	ChiakiVideoReceiverStats *stats = &stream_connection->video_stats;
+	stats->frames++;
+	stats->bytes += frame_size;
+	if(partial)
+		stats->frames_incomplete++;
+	else if(flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS)
+		stats->frames_fec_recovered++;
+	if(video_receiver->frames_lost > 0)
+		stats->frames_lost += (uint64_t)video_receiver->frames_lost;
+	stats->corrupt_frames = corrupt_frames;
+	chiaki_mutex_unlock(&stream_connection->video_stats_mutex);
+}
+
+static void report_corrupt_frames(ChiakiVideoReceiver *video_receiver, ChiakiSeqNum16 start, ChiakiSeqNum16 end)
+{
+	chiaki_corrupt_frame_reporter_report(&video_receiver->corrupt_frame_reporter, start, end, chiaki_time_now_monotonic_us());
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
 {
 	video_receiver->session = session;
 	video_receiver->log = session->log;
@@ -51,6 +82,13 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 	video_receiver->frames_lost = 0;
 	memset(video_receiver->reference_frames, -1, sizeof(video_receiver->reference_frames));
 	chiaki_bitstream_init(&video_receiver->bitstream, video_receiver->log, video_receiver->session->connect_info.video_profile.codec);
+	chiaki_bitrate_meter_init(&video_receiver->bitrate_meter, CHIAKI_BITRATE_METER_WINDOW_US_DEFAULT, CHIAKI_BITRATE_METER_EWMA_US_DEFAULT);
+
+	ChiakiErrorCode err = chiaki_corrupt_frame_reporter_init(&video_receiver->corrupt_frame_reporter, video_receiver->log,
+			session->rtt_us + CHIAKI_CORRUPT_FRAME_REPORTER_HOLDOFF_MARGIN_US, send_corrupt_frame, video_receiver);
+	if(err != CHIAKI_ERR_SUCCESS)
+		chiaki_frame_processor_fini(&video_receiver->frame_processor);
+	return err;
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_fini(ChiakiVideoReceiver *video_receiver)
@@ -58,6 +96,7 @@ CHIAKI_EXPORT void chiaki_video_receiver_fini(ChiakiVideoReceiver *video_receive
 	for(size_t i=0; i<video_receiver->profiles_count; i++)
 		free(video_receiver->profiles[i].header);
 	chiaki_frame_processor_fini(&video_receiver->frame_processor);
+	chiaki_corrupt_frame_reporter_fini(&video_receiver->corrupt_frame_reporter);
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_receiver, ChiakiVideoProfile *profiles, size_t profiles_count)
@@ -127,7 +166,7 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 			&& !(frame_index == 1 && video_receiver->frame_index_cur < 0)) // ok for frame 1
 		{
 			CHIAKI_LOGW(video_receiver->log, "Detected missing or corrupt frame(s) from %d to %d", next_frame_expected, (int)frame_index);
-			stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, frame_index - 1);
+			report_corrupt_frames(video_receiver, next_frame_expected, frame_index - 1);
 		}
 
 		video_receiver->frame_index_cur = frame_index;
@@ -150,14 +189,32 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 	uint8_t *frame;
 	size_t frame_size;
 	ChiakiFrameProcessorFlushResult flush_result = chiaki_frame_processor_flush(&video_receiver->frame_processor, &frame, &frame_size);
+	if(flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED)
+		chiaki_bitrate_meter_frame(&video_receiver->bitrate_meter, chiaki_time_now_monotonic_us(), frame_size);
+
+	// with a partial sample callback, frames that could not be recovered are still passed on
+	bool partial = flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED
+		&& video_receiver->session->video_partial_sample_cb
+		&& frame_size;
 
-	if(flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED
+	if(partial)
+	{
+		// still ask for recovery, but the current frame is not lost
+		ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(video_receiver->frame_index_prev_complete + 1);
+		report_corrupt_frames(video_receiver, next_frame_expected, video_receiver->frame_index_cur);
+		video_receiver->frames_lost += video_receiver->frame_index_cur - next_frame_expected;
+		CHIAKI_LOGW(video_receiver->log, "Passing on incomplete frame %d with %u of %u units missing",
+				(int)video_receiver->frame_index_cur,
+				video_receiver->frame_processor.unit_map.units_missing,
+				video_receiver->frame_processor.unit_map.units_count);
+	}
+	else if(flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED
 		|| flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED)
 	{
 		if (flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED)
 		{
 			ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(video_receiver->frame_index_prev_complete + 1);
-			stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, video_receiver->frame_index_cur);
+			report_corrupt_frames(video_receiver, next_frame_expected, video_receiver->frame_index_cur);
 			video_receiver->frames_lost += video_receiver->frame_index_cur - next_frame_expected + 1;
 			video_receiver->frame_index_prev = video_receiver->frame_index_cur;
 		}
@@ -165,12 +222,14 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		return CHIAKI_ERR_UNKNOWN;
 	}
 
-	bool succ = flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
+	bool succ = partial || flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 	bool recovered = false;
 
 	ChiakiBitstreamSlice slice;
+	bool keyframe = false;
 	if(chiaki_bitstream_slice(&video_receiver->bitstream, frame, frame_size, &slice))
 	{
+		keyframe = slice.slice_type == CHIAKI_BITSTREAM_SLICE_I;
 		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P)
 		{
 			ChiakiSeqNum16 ref_frame_index = video_receiver->frame_index_cur - slice.reference_frame - 1;
@@ -181,8 +240,13 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 					ChiakiSeqNum16 ref_frame_index_new = video_receiver->frame_index_cur - i - 1;
 					if(have_ref_frame(video_receiver, ref_frame_index_new))
 					{
-						if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame, frame_size, i))
+						// H.264 slices grow when rewritten, they may use all of the frame buffer except the padding
+						unsigned size = (unsigned)frame_size;
+						unsigned capacity = (unsigned)video_receiver->frame_processor.frame_buf_size;
+						if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame, &size, capacity, i))
 						{
+							frame_size = size;
+							memset(frame + frame_size, 0, CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
 							recovered = true;
 							CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d -> changed to %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur, (int)ref_frame_index_new);
 						}
@@ -199,9 +263,18 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		}
 	}
 
-	if(succ && video_receiver->session->video_sample_cb)
+	if(succ && (partial || video_receiver->session->video_sample_cb))
 	{
-		bool cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->frames_lost, recovered, video_receiver->session->video_sample_cb_user);
+		bool cb_succ;
+		if(partial)
+		{
+			ChiakiFrameUnitMap *map = chiaki_frame_processor_unit_map(&video_receiver->frame_processor);
+			chiaki_frame_unit_map_find_slices(map, frame, frame_size);
+			cb_succ = video_receiver->session->video_partial_sample_cb(frame, frame_size, map, video_receiver->frames_lost, video_receiver->session->video_partial_sample_cb_user);
+		}
+		else
+			cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->frames_lost, recovered, video_receiver->session->video_sample_cb_user);
+		update_stats(video_receiver, frame_size, flush_result, partial);
 		video_receiver->frames_lost = 0;
 		if(!cb_succ)
 		{
@@ -211,6 +284,8 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		else
 		{
 			add_ref_frame(video_receiver, video_receiver->frame_index_cur);
+			chiaki_corrupt_frame_reporter_frame(&video_receiver->corrupt_frame_reporter, (ChiakiSeqNum16)video_receiver->frame_index_cur,
+					keyframe && !partial, chiaki_time_now_monotonic_us());
 			CHIAKI_LOGV(video_receiver->log, "Added reference %c frame %d", slice.slice_type == CHIAKI_BITSTREAM_SLICE_I ? 'I' : 'P', (int)video_receiver->frame_index_cur);
 		}
 	}
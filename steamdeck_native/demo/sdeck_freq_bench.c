@@ -0,0 +1,157 @@
+// Headless benchmark of the haptics frequency tracker, no Steam Deck needed.
+// Feeds a synthetic 3 kHz haptics stream through every tracker mode
+// and reports the time per packet and how far the detected frequency is off.
+#include <sdeck_freq.h>
+#include <fftw3.h>
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SAMPLING_RATE 3000
+#define PACKET_SAMPLES 30 // 10 ms, as sent by the console
+#define PACKETS_PER_TONE 20
+#define BATCH_PACKETS 1000
+
+typedef struct bench_config_t
+{
+	const char *name;
+	int window;
+	int hop;
+	SDeckFreqMode mode;
+} BenchConfig;
+
+static const BenchConfig configs[] = {
+	{ "fft", 120, 120, SDECK_FREQ_MODE_FFT },
+	{ "fft-overlap", 120, 30, SDECK_FREQ_MODE_FFT },
+	{ "goertzel", 120, 120, SDECK_FREQ_MODE_GOERTZEL },
+	{ "goertzel-overlap", 120, 30, SDECK_FREQ_MODE_GOERTZEL },
+};
+
+static const double tones[] = { 40.0, 80.0, 125.0, 200.0, 60.0, 160.0 };
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static double percentile(const double *sorted, size_t count, double p)
+{
+	size_t i = (size_t)(p / 100.0 * (double)(count - 1) + 0.5);
+	return sorted[i];
+}
+
+// one tone per PACKETS_PER_TONE packets with a bit of noise on top
+static int16_t *generate_stream(size_t packets)
+{
+	int16_t *stream = malloc(packets * PACKET_SAMPLES * sizeof(int16_t));
+	if (!stream)
+		return NULL;
+	double phase = 0;
+	srand(1);
+	for (size_t p = 0; p < packets; p++)
+	{
+		double freq = tones[(p / PACKETS_PER_TONE) % (sizeof(tones) / sizeof(tones[0]))];
+		for (size_t i = 0; i < PACKET_SAMPLES; i++)
+		{
+			phase += 2.0 * M_PI * freq / SAMPLING_RATE;
+			double noise = (double)(rand() % 2001 - 1000);
+			stream[p * PACKET_SAMPLES + i] = (int16_t)(12000.0 * sin(phase) + noise);
+		}
+	}
+	return stream;
+}
+
+static int run_config(const BenchConfig *config, const int16_t *stream, unsigned long batches, double *ns)
+{
+	SDeckFreqTracker *tracker = sdeck_freq_tracker_new(config->window, config->hop, SAMPLING_RATE, config->mode);
+	if (!tracker)
+	{
+		fprintf(stderr, "Failed to create tracker for %s\n", config->name);
+		return -1;
+	}
+
+	// the estimate is only judged once the window lies entirely within the current tone
+	const size_t settle_packets = (config->window + PACKET_SAMPLES - 1) / PACKET_SAMPLES;
+	double error_sum = 0;
+	unsigned long estimates = 0, judged = 0;
+	for (unsigned long b = 0; b < batches; b++)
+	{
+		const int16_t *packet = stream;
+		uint64_t start = now_ns();
+		for (size_t p = 0; p < BATCH_PACKETS; p++)
+		{
+			double freq = 0, freq_power = 0;
+			if (sdeck_freq_tracker_push(tracker, packet, PACKET_SAMPLES, &freq, &freq_power))
+			{
+				estimates++;
+				if (p % PACKETS_PER_TONE >= settle_packets - 1)
+				{
+					double tone = tones[(p / PACKETS_PER_TONE) % (sizeof(tones) / sizeof(tones[0]))];
+					error_sum += fabs(freq - tone);
+					judged++;
+				}
+			}
+			packet += PACKET_SAMPLES;
+		}
+		ns[b] = (double)(now_ns() - start) / BATCH_PACKETS;
+	}
+	sdeck_freq_tracker_free(tracker);
+
+	qsort(ns, batches, sizeof(double), cmp_double);
+	printf("%-17s window %3d hop %3d  ns/packet: min %.0f, p50 %.0f, p99 %.0f, max %.0f  estimates/packet %.2f, mean error %.1f Hz\n",
+			config->name, config->window, config->hop,
+			ns[0], percentile(ns, batches, 50.0), percentile(ns, batches, 99.0), ns[batches - 1],
+			(double)estimates / ((double)batches * BATCH_PACKETS),
+			judged ? error_sum / judged : 0.0);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long batches = 200;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--batches") == 0 && i + 1 < argc)
+			batches = strtoul(argv[++i], NULL, 0);
+		else
+			batches = 0;
+	}
+	if (!batches)
+	{
+		fprintf(stderr, "Usage: %s [--batches N]\n  N timed batches of %d packets (default 200)\n", argv[0], BATCH_PACKETS);
+		return 1;
+	}
+
+	int16_t *stream = generate_stream(BATCH_PACKETS);
+	double *ns = malloc(batches * sizeof(double));
+	if (!stream || !ns)
+		return 1;
+
+	printf("%d samples per packet at %d Hz, %lu batches of %d packets\n", PACKET_SAMPLES, SAMPLING_RATE, batches, BATCH_PACKETS);
+	int res = 0;
+	for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+	{
+		if (run_config(&configs[i], stream, batches, ns) < 0)
+			res = 1;
+	}
+
+	free(ns);
+	free(stream);
+	fftw_cleanup();
+	return res;
+}
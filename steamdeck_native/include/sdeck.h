@@ -9,6 +9,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sdeck_freq.h>
 
 typedef struct sdeck_t SDeck;
 
@@ -111,6 +112,9 @@ int sdeck_haptic(SDeck *sdeck, uint8_t position, double frequency, uint32_t inte
 int sdeck_haptic_ratio(SDeck *sdeck, uint8_t position, double frequency, uint32_t interval, double ratio, const uint16_t repeat);
 int send_haptic(SDeck* sdeck, uint8_t position, uint16_t period_high, uint16_t period_low, uint16_t repeat_count);
 int sdeck_haptic_init(SDeck * sdeck, int samples);
+// window and hop in samples, analysis runs every hop samples on the newest window
+int sdeck_haptic_init_tracker(SDeck *sdeck, int window, int hop, SDeckFreqMode mode);
+void sdeck_haptic_set_mode(SDeck *sdeck, SDeckFreqMode mode);
 int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int32_t num_elements, const int sampling_rate);
 
 #ifdef __cplusplus
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef _SDECK_FREQ_H
+#define _SDECK_FREQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// most frequencies a goertzel bank can hold
+#define SDECK_FREQ_BANK_MAX 32
+
+typedef enum {
+    /* Full spectrum of the zero-padded window, the strongest bin wins */
+    SDECK_FREQ_MODE_FFT,
+    /* Only evaluate the frequencies in the bank, much cheaper for a handful of them */
+    SDECK_FREQ_MODE_GOERTZEL
+} SDeckFreqMode;
+
+// Streaming dominant frequency tracker for haptics pcm.
+// Samples are low pass filtered as they arrive (filter state is kept across calls)
+// and the newest window of them is analyzed every hop samples,
+// so windows overlap whenever hop < window.
+// All buffers and the fft plan are created once in sdeck_freq_tracker_new.
+typedef struct sdeck_freq_tracker_t SDeckFreqTracker;
+
+SDeckFreqTracker *sdeck_freq_tracker_new(int window, int hop, double sampling_rate, SDeckFreqMode mode);
+void sdeck_freq_tracker_free(SDeckFreqTracker *tracker);
+// forget all samples and filter state, e.g. after a gap in the stream
+void sdeck_freq_tracker_reset(SDeckFreqTracker *tracker);
+void sdeck_freq_tracker_set_mode(SDeckFreqTracker *tracker, SDeckFreqMode mode);
+SDeckFreqMode sdeck_freq_tracker_get_mode(SDeckFreqTracker *tracker);
+// replace the frequencies (Hz) evaluated in goertzel mode, returns -1 if count is out of range
+int sdeck_freq_tracker_set_bank(SDeckFreqTracker *tracker, const double *freqs, int count);
+// feed count new samples
+// returns 1 if a new window was analyzed and frequency/freq_power were written, 0 otherwise.
+// frequency is 0 if the window has no content above dc.
+int sdeck_freq_tracker_push(SDeckFreqTracker *tracker, const int16_t *buf, int count, double *frequency, double *freq_power);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,17 +32,8 @@
 #define STEAM_DECK_HAPTIC_COMMAND 0x8f
 #define STEAM_DECK_HAPTIC_LENGTH 0x07
 #define STEAM_DECK_HAPTIC_INTENSITY 0.38f
-#define STEAM_DECK_CUTOFF_FREQ 250.0f
 #define STEAM_DECK_HAPTIC_SAMPLING_FREQ 3000.0f
 
-typedef struct freq_t
-{
-	int N;
-	fftw_plan fft;
-	double *hann, *butterworth, *pcm_data;
-	fftw_complex *freq_data;
-} FreqFinder;
-
 struct sdeck_t
 {
 	// Steam Deck only one device and doesn't hotplug (you're either using i)
@@ -50,7 +41,8 @@ struct sdeck_t
 	SDeckMotion prev_motion;
 	int gyro;
 	bool motion_dirty;
-	FreqFinder *freqfinder;
+	// one per trackpad, the trackers keep filter state between packets
+	SDeckFreqTracker *freqtracker[2];
 };
 
 hid_device *is_steam_deck();
@@ -58,9 +50,7 @@ void movemult_accel(float *accel, float mult);
 void calc_powers(fftw_complex *data, int N);
 void max_power_freq(const int N, const double sampling_rate, double *frequency, double *freq_power, fftw_complex *power);
 void generate_event(SDeck *sdeck, SDeckEventType type, SDeckEventCb cb, void *user);
-double * butterworth_init();
-void lpf_apply(double * pcm_data, double * butterworth, int N);
-FreqFinder *freqfinder_new(int samples);
+void haptic_free(SDeck *sdeck);
 
 SDeck *sdeck_new()
 {
@@ -85,41 +75,45 @@ SDeck *sdeck_new()
 	memset(&sdeck->prev_motion, 0, sizeof(SDeckMotion));
 	sdeck->motion_dirty = false;
 	sdeck->gyro = STEAM_DECK_MOTION_COOLDOWN;
-	sdeck->freqfinder = NULL;
 	return sdeck;
 }
 
 int sdeck_haptic_init(SDeck *sdeck, int samples)
 {
-	sdeck->freqfinder = freqfinder_new(samples);
-	if (!sdeck->freqfinder)
-		return -1;
-	return 0;
+	return sdeck_haptic_init_tracker(sdeck, samples, samples, SDECK_FREQ_MODE_FFT);
 }
 
-FreqFinder *freqfinder_new(int samples)
+int sdeck_haptic_init_tracker(SDeck *sdeck, int window, int hop, SDeckFreqMode mode)
 {
-	FreqFinder *freqfinder = fftw_malloc(sizeof(FreqFinder));
-	freqfinder->N = samples;
-	freqfinder->hann = hann_init(samples);
-	freqfinder->butterworth = butterworth_init();
-	freqfinder->pcm_data = fftw_malloc(2 * samples * sizeof(double));
-	freqfinder->freq_data = fftw_malloc((samples + 1) * sizeof(fftw_complex));
-	freqfinder->fft = fftw_plan_dft_r2c_1d(2 * samples, freqfinder->pcm_data, freqfinder->freq_data, FFTW_MEASURE);
-	return freqfinder;
+	haptic_free(sdeck);
+	for (int i = 0; i < 2; i++)
+	{
+		sdeck->freqtracker[i] = sdeck_freq_tracker_new(window, hop, STEAM_DECK_HAPTIC_SAMPLING_FREQ, mode);
+		if (!sdeck->freqtracker[i])
+		{
+			haptic_free(sdeck);
+			return -1;
+		}
+	}
+	return 0;
 }
 
-void haptic_free(FreqFinder *freqfinder)
+void sdeck_haptic_set_mode(SDeck *sdeck, SDeckFreqMode mode)
 {
-	fftw_destroy_plan(freqfinder->fft);
-
-	fftw_free(freqfinder->hann);
-	fftw_free(freqfinder->butterworth);
-	fftw_free(freqfinder->pcm_data);
-	fftw_free(freqfinder->freq_data);
-	fftw_free(freqfinder);
+	for (int i = 0; i < 2; i++)
+	{
+		if (sdeck->freqtracker[i])
+			sdeck_freq_tracker_set_mode(sdeck->freqtracker[i], mode);
+	}
+}
 
-	fftw_cleanup();
+void haptic_free(SDeck *sdeck)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		sdeck_freq_tracker_free(sdeck->freqtracker[i]);
+		sdeck->freqtracker[i] = NULL;
+	}
 }
 
 void sdeck_free(SDeck *sdeck)
@@ -128,8 +122,8 @@ void sdeck_free(SDeck *sdeck)
 		return;
 	hid_close(sdeck->hiddev);
 	hid_exit();
-	if (sdeck->freqfinder)
-		haptic_free(sdeck->freqfinder);
+	haptic_free(sdeck);
+	fftw_cleanup();
 	free(sdeck);
 }
 
@@ -225,33 +219,6 @@ double *hann_init(int N) // calc hann coefficients (once per array size and can
 		han[i] = 0.5 * (1 - cos(2 * M_PI * i / (N - 1)));
 	return han;
 }
-double *butterworth_init()
-{
-	double *butterworth = fftw_malloc(5 * sizeof(double));
-	const double ff = STEAM_DECK_CUTOFF_FREQ / STEAM_DECK_HAPTIC_SAMPLING_FREQ;
-	const double ita = 1.0/tan(M_PI * ff);
-	const double q = sqrt(2.0);
-	butterworth[0] = 1.0 / (1.0 + q*ita + ita*ita);
-	butterworth[1] = 2 * butterworth[0];
-	butterworth[2] = butterworth[0];
-	butterworth[3] = 2.0 * (ita * ita - 1.0) * butterworth[0];
-	butterworth[4] = -(1.0 - q * ita + ita * ita) * butterworth[0];
-	return butterworth;
-}
-
-void lpf_apply(double *buf, double * butterworth, int buf_count)
-{
-	double holder_buffer[buf_count];
-	holder_buffer[0] = buf[0];
-	holder_buffer[1] = buf[1];
-	for (int i = 2; i < buf_count; i++)
-		holder_buffer[i] = butterworth[0] * buf[i] + butterworth[1] * buf[i - 1] + butterworth[2] * buf[i - 2] + butterworth[3] * holder_buffer[i - 1] + butterworth[4] * holder_buffer[i - 2];
-	for (int i = 2; i < buf_count; i++)
-	{
-		buf[i] = holder_buffer[i];
-	}
-}
-
 void hann_apply(double *data, double *han, int N) // apply hann window to data
 {
 	for (int i = 0; i < N; i++)
@@ -309,81 +276,23 @@ void max_power_freq(const int N, const double sampling_rate, double *frequency,
 	*freq_power = ((2 * sqrt(power[max_pos][0])) / originalN);
 }
 
-void calc_freqs(FreqFinder *freqfinder, const int sampling_rate, double *freq, double *freq_power)
-{
-	int N = freqfinder->N;
-	int complexN = freqfinder->N + 1;
-	lpf_apply(freqfinder->pcm_data, freqfinder->butterworth, N);
-	hann_apply(freqfinder->pcm_data, freqfinder->hann, N);
-	zero_pad(freqfinder->pcm_data, N);
-	fftw_execute(freqfinder->fft);
-	calc_powers(freqfinder->freq_data, complexN);
-	max_power_freq(complexN, sampling_rate, freq, freq_power, freqfinder->freq_data);
-}
-
-int get_data(FreqFinder *freqfinder, int16_t *buf, const int num_elements)
-{
-	if (freqfinder->N != num_elements)
-	{
-		SDECK_LOG("\nBuffer size mismatch...initialized buffer is not right size!\n");
-		return -1;
-	}
-	for (int i = 0; i < num_elements; i++)
-	{
-		freqfinder->pcm_data[i] = buf[i];
-	}
-	return 0;
-}
-
-void find_repeat(double * data, const int num_samples, const double frequency, const int sampling_rate, const double avg_min, double * total_avg, int * repeat_count)
-{
-	int counter = 0;
-	int interval_length = sampling_rate / frequency;
-	double avg = 0;
-	const int repeat_max = 20;
-	*total_avg = 0;
-	*repeat_count = 0;
-	printf("\ninterval length is %i, num_samples is: %i\n", interval_length, num_samples);
-	for (int i = 0; i < num_samples; i++)
-	{
-		avg += abs(data[i]);
-		if ((i + 1) % interval_length == 0)
-		{
-			avg /= interval_length;
-			if (avg > avg_min)
-			{
-				(*repeat_count)++;
-				(*total_avg) += avg;
-			}
-			avg = 0; 
-		}
-	}
-	if ((*repeat_count) == 0)
-	{
-		int leftover = num_samples % interval_length;
-		if (leftover)
-			avg /= leftover;
-		if(avg < avg_min)
-			return;
-		(*repeat_count) = 1;
-		(*total_avg) = avg;
-	}
-	(*total_avg) /= (*repeat_count);
-	(*repeat_count) = ((*repeat_count) > repeat_max) ? repeat_max : (*repeat_count); 
-}
-
 int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int num_elements, const int sampling_rate)
 {
 	uint32_t interval = 0;
 	const int avg_min = 50; // don't play samples that are less than 1% volume
 	int repeat = 0;
 	int32_t playtime = 0;
-	double freq = 0, avg = 0, ratio = 0, freq_power = 0;
-	if (get_data(sdeck->freqfinder, buf, num_elements))
+	double freq = 0, avg = 0, freq_power = 0;
+	SDeckFreqTracker *tracker = sdeck->freqtracker[position == TRACKPAD_LEFT ? 1 : 0];
+	if (!tracker)
+	{
+		SDECK_LOG("\nHaptics not initialized...call sdeck_haptic_init first!\n");
 		return -1;
+	}
 	// interval in microseconds
 	interval = 1000000 * ((double)num_elements / (double)sampling_rate);
-	calc_freqs(sdeck->freqfinder, sampling_rate, &freq, &freq_power);
+	if (!sdeck_freq_tracker_push(tracker, buf, num_elements, &freq, &freq_power))
+		return 0;
 	if (!freq)
 		return 0;
 	avg = 5 * freq_power;
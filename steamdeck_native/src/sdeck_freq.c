@@ -0,0 +1,222 @@
+#include <sdeck_freq.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fftw3.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SDECK_FREQ_CUTOFF 250.0
+
+// frequencies the trackpad actuators reproduce well, roughly third octave spaced up to the low pass cutoff
+static const double freq_bank_default[] = { 20.0, 25.0, 32.0, 40.0, 50.0, 63.0, 80.0, 100.0, 125.0, 160.0, 200.0, 250.0 };
+
+struct sdeck_freq_tracker_t
+{
+	SDeckFreqMode mode;
+	int window;
+	int hop;
+	double sampling_rate;
+
+	// 2nd order butterworth low pass, transposed direct form II
+	double b0, b1, b2, a1, a2;
+	double z1, z2;
+
+	// filtered samples, stored twice so the newest window is always contiguous
+	double *history;
+	int history_pos;
+	int filled;
+	int since_analysis;
+
+	double *hann;
+	// fft input, only the first window samples are ever written so the zero padding stays in place
+	double *pcm_data;
+	fftw_complex *freq_data;
+	fftw_plan fft;
+
+	int bank_count;
+	double bank_freq[SDECK_FREQ_BANK_MAX];
+	double bank_coef[SDECK_FREQ_BANK_MAX];
+};
+
+static void butterworth_init(SDeckFreqTracker *tracker)
+{
+	const double ff = SDECK_FREQ_CUTOFF / tracker->sampling_rate;
+	const double ita = 1.0 / tan(M_PI * ff);
+	const double q = sqrt(2.0);
+	tracker->b0 = 1.0 / (1.0 + q * ita + ita * ita);
+	tracker->b1 = 2 * tracker->b0;
+	tracker->b2 = tracker->b0;
+	tracker->a1 = 2.0 * (ita * ita - 1.0) * tracker->b0;
+	tracker->a2 = -(1.0 - q * ita + ita * ita) * tracker->b0;
+}
+
+SDeckFreqTracker *sdeck_freq_tracker_new(int window, int hop, double sampling_rate, SDeckFreqMode mode)
+{
+	if (window < 2 || hop < 1 || hop > window || sampling_rate <= 0)
+		return NULL;
+	SDeckFreqTracker *tracker = calloc(1, sizeof(SDeckFreqTracker));
+	if (!tracker)
+		return NULL;
+	tracker->mode = mode;
+	tracker->window = window;
+	tracker->hop = hop;
+	tracker->sampling_rate = sampling_rate;
+	butterworth_init(tracker);
+
+	tracker->history = fftw_malloc(2 * window * sizeof(double));
+	tracker->hann = fftw_malloc(window * sizeof(double));
+	tracker->pcm_data = fftw_malloc(2 * window * sizeof(double));
+	tracker->freq_data = fftw_malloc((window + 1) * sizeof(fftw_complex));
+	if (!tracker->history || !tracker->hann || !tracker->pcm_data || !tracker->freq_data)
+		goto error;
+	// planning with FFTW_MEASURE overwrites the arrays, so it has to happen before they are initialized
+	tracker->fft = fftw_plan_dft_r2c_1d(2 * window, tracker->pcm_data, tracker->freq_data, FFTW_MEASURE);
+	if (!tracker->fft)
+		goto error;
+
+	for (int i = 0; i < window; i++)
+		tracker->hann[i] = 0.5 * (1 - cos(2 * M_PI * i / (window - 1)));
+	memset(tracker->pcm_data, 0, 2 * window * sizeof(double));
+	sdeck_freq_tracker_set_bank(tracker, freq_bank_default, sizeof(freq_bank_default) / sizeof(freq_bank_default[0]));
+	sdeck_freq_tracker_reset(tracker);
+	return tracker;
+error:
+	sdeck_freq_tracker_free(tracker);
+	return NULL;
+}
+
+void sdeck_freq_tracker_free(SDeckFreqTracker *tracker)
+{
+	if (!tracker)
+		return;
+	if (tracker->fft)
+		fftw_destroy_plan(tracker->fft);
+	fftw_free(tracker->history);
+	fftw_free(tracker->hann);
+	fftw_free(tracker->pcm_data);
+	fftw_free(tracker->freq_data);
+	free(tracker);
+}
+
+void sdeck_freq_tracker_reset(SDeckFreqTracker *tracker)
+{
+	tracker->z1 = 0;
+	tracker->z2 = 0;
+	memset(tracker->history, 0, 2 * tracker->window * sizeof(double));
+	tracker->history_pos = 0;
+	tracker->filled = 0;
+	tracker->since_analysis = 0;
+}
+
+void sdeck_freq_tracker_set_mode(SDeckFreqTracker *tracker, SDeckFreqMode mode)
+{
+	tracker->mode = mode;
+}
+
+SDeckFreqMode sdeck_freq_tracker_get_mode(SDeckFreqTracker *tracker)
+{
+	return tracker->mode;
+}
+
+int sdeck_freq_tracker_set_bank(SDeckFreqTracker *tracker, const double *freqs, int count)
+{
+	if (count < 1 || count > SDECK_FREQ_BANK_MAX)
+		return -1;
+	for (int i = 0; i < count; i++)
+	{
+		tracker->bank_freq[i] = freqs[i];
+		tracker->bank_coef[i] = 2.0 * cos(2.0 * M_PI * freqs[i] / tracker->sampling_rate);
+	}
+	tracker->bank_count = count;
+	return 0;
+}
+
+static void analyze_fft(SDeckFreqTracker *tracker, double *frequency, double *freq_power)
+{
+	fftw_execute(tracker->fft);
+	// magnitudes are only compared, so the square root is only taken for the winner
+	int max_pos = 0;
+	double max_power = 0;
+	for (int i = 0; i <= tracker->window; i++)
+	{
+		double power = tracker->freq_data[i][0] * tracker->freq_data[i][0] + tracker->freq_data[i][1] * tracker->freq_data[i][1];
+		if (power > max_power)
+		{
+			max_power = power;
+			max_pos = i;
+		}
+	}
+	const int originalN = 2 * tracker->window;
+	*frequency = max_pos ? (max_pos * tracker->sampling_rate) / originalN : 0;
+	*freq_power = max_pos ? (2 * sqrt(max_power)) / originalN : 0;
+}
+
+static void analyze_goertzel(SDeckFreqTracker *tracker, double *frequency, double *freq_power)
+{
+	// evaluates the same spectrum as the zero-padded fft, only at the bank frequencies
+	const double *data = tracker->pcm_data;
+	int max_pos = -1;
+	double max_power = 0;
+	for (int k = 0; k < tracker->bank_count; k++)
+	{
+		const double coef = tracker->bank_coef[k];
+		double s1 = 0, s2 = 0;
+		for (int i = 0; i < tracker->window; i++)
+		{
+			double s = data[i] + coef * s1 - s2;
+			s2 = s1;
+			s1 = s;
+		}
+		double power = s1 * s1 + s2 * s2 - coef * s1 * s2;
+		if (power > max_power)
+		{
+			max_power = power;
+			max_pos = k;
+		}
+	}
+	const int originalN = 2 * tracker->window;
+	*frequency = max_pos >= 0 ? tracker->bank_freq[max_pos] : 0;
+	*freq_power = max_pos >= 0 ? (2 * sqrt(max_power)) / originalN : 0;
+}
+
+int sdeck_freq_tracker_push(SDeckFreqTracker *tracker, const int16_t *buf, int count, double *frequency, double *freq_power)
+{
+	const int window = tracker->window;
+	double *history = tracker->history;
+	int pos = tracker->history_pos;
+	double z1 = tracker->z1, z2 = tracker->z2;
+	for (int i = 0; i < count; i++)
+	{
+		double x = buf[i];
+		double y = tracker->b0 * x + z1;
+		z1 = tracker->b1 * x + tracker->a1 * y + z2;
+		z2 = tracker->b2 * x + tracker->a2 * y;
+		history[pos] = y;
+		history[pos + window] = y;
+		pos = (pos + 1 == window) ? 0 : pos + 1;
+	}
+	tracker->z1 = z1;
+	tracker->z2 = z2;
+	tracker->history_pos = pos;
+
+	tracker->filled = (count >= window - tracker->filled) ? window : tracker->filled + count;
+	tracker->since_analysis = (count >= tracker->hop - tracker->since_analysis) ? tracker->hop : tracker->since_analysis + count;
+	if (tracker->filled < window || tracker->since_analysis < tracker->hop)
+		return 0;
+	// only the newest window matters, hops skipped within one call are not analyzed separately
+	tracker->since_analysis = 0;
+
+	// oldest sample is at pos now
+	const double *newest = history + pos;
+	for (int i = 0; i < window; i++)
+		tracker->pcm_data[i] = newest[i] * tracker->hann[i];
+
+	if (tracker->mode == SDECK_FREQ_MODE_GOERTZEL)
+		analyze_goertzel(tracker, frequency, freq_power);
+	else
+		analyze_fft(tracker, frequency, freq_power);
+	return 1;
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audiojitterbuffer.h>
+
+#define RECORD_MAX 16
+#define LOST_PLC 0xff
+
+typedef struct record_t
+{
+	// first byte of each played frame, or of the FEC frame for concealed ones
+	uint8_t frames[RECORD_MAX];
+	bool lost[RECORD_MAX];
+	size_t count;
+} Record;
+
+static void frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	Record *record = user;
+	munit_assert_size(buf_size, ==, 1);
+	munit_assert_size(record->count, <, RECORD_MAX);
+	record->frames[record->count] = buf[0];
+	record->lost[record->count] = false;
+	record->count++;
+}
+
+static void lost_cb(uint8_t *fec_buf, size_t fec_buf_size, void *user)
+{
+	Record *record = user;
+	munit_assert_size(record->count, <, RECORD_MAX);
+	record->frames[record->count] = fec_buf ? fec_buf[0] : LOST_PLC;
+	record->lost[record->count] = true;
+	record->count++;
+}
+
+static void push(ChiakiAudioJitterBuffer *jb, ChiakiSeqNum16 index, uint64_t now_us)
+{
+	uint8_t buf = (uint8_t)index;
+	chiaki_audio_jitter_buffer_push(jb, index, &buf, 1, now_us);
+}
+
+static MunitResult test_reorder(const MunitParameter params[], void *user)
+{
+	Record record = { 0 };
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, frame_cb, lost_cb, &record);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// frame index wraps around in between
+	push(&jb, 0xfffe, 0);
+	munit_assert_size(record.count, ==, 1);
+	push(&jb, 0, 1000);
+	munit_assert_size(record.count, ==, 1);
+	push(&jb, 1, 2000);
+	munit_assert_size(record.count, ==, 1);
+	munit_assert_size(jb.stats.depth, ==, 3);
+	push(&jb, 0xffff, 2100);
+	munit_assert_size(record.count, ==, 4);
+	munit_assert_size(jb.stats.depth, ==, 0);
+
+	munit_assert_uint8(record.frames[0], ==, 0xfe);
+	munit_assert_uint8(record.frames[1], ==, 0xff);
+	munit_assert_uint8(record.frames[2], ==, 0);
+	munit_assert_uint8(record.frames[3], ==, 1);
+	for(size_t i=0; i<record.count; i++)
+		munit_assert(!record.lost[i]);
+
+	munit_assert_uint64(jb.stats.frames_received, ==, 4);
+	munit_assert_uint64(jb.stats.frames_concealed_fec + jb.stats.frames_concealed_plc, ==, 0);
+	munit_assert_size(jb.stats.depth_max, ==, 3);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+static MunitResult test_conceal(const MunitParameter params[], void *user)
+{
+	Record record = { 0 };
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, frame_cb, lost_cb, &record);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_audio_jitter_buffer_set_frame_duration(&jb, 48000, 480);
+	munit_assert_uint64(jb.frame_duration_us, ==, 10000);
+
+	push(&jb, 10, 0);
+	// 11 and 12 are lost
+	push(&jb, 13, 30000);
+	munit_assert_size(record.count, ==, 1);
+	uint64_t target_delay_us = jb.stats.target_delay_us;
+	munit_assert_uint64(target_delay_us, >=, jb.frame_duration_us);
+
+	// 13 has waited long enough, so 11 is concealed without and 12 with FEC data from 13
+	push(&jb, 14, 30000 + target_delay_us);
+	munit_assert_size(record.count, ==, 5);
+	munit_assert(record.lost[1]);
+	munit_assert_uint8(record.frames[1], ==, LOST_PLC);
+	munit_assert(record.lost[2]);
+	munit_assert_uint8(record.frames[2], ==, 13);
+	munit_assert(!record.lost[3]);
+	munit_assert_uint8(record.frames[3], ==, 13);
+	munit_assert(!record.lost[4]);
+	munit_assert_uint8(record.frames[4], ==, 14);
+
+	munit_assert_uint64(jb.stats.frames_concealed_plc, ==, 1);
+	munit_assert_uint64(jb.stats.frames_concealed_fec, ==, 1);
+
+	// a redundant copy of 14 and the original 12 arriving too late
+	push(&jb, 14, 60000);
+	push(&jb, 12, 60000);
+	push(&jb, 12, 60000);
+	munit_assert_size(record.count, ==, 5);
+	munit_assert_uint64(jb.stats.frames_late, ==, 1);
+	munit_assert_uint64(jb.stats.frames_duplicate, ==, 2);
+	munit_assert_uint64(jb.stats.frames_received, ==, 3);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+static MunitResult test_resync(const MunitParameter params[], void *user)
+{
+	Record record = { 0 };
+	ChiakiAudioJitterBuffer jb;
+	ChiakiErrorCode err = chiaki_audio_jitter_buffer_init(&jb, frame_cb, lost_cb, &record);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	push(&jb, 100, 0);
+	push(&jb, 102, 0);
+	munit_assert_size(record.count, ==, 1);
+
+	// too far ahead of the missing 101, everything buffered is dropped
+	push(&jb, 101 + 2 * CHIAKI_AUDIO_JITTER_BUFFER_SLOTS, 10000);
+	munit_assert_size(record.count, ==, 2);
+	munit_assert_uint8(record.frames[1], ==, (uint8_t)(101 + 2 * CHIAKI_AUDIO_JITTER_BUFFER_SLOTS));
+	munit_assert_uint64(jb.stats.resyncs, ==, 1);
+	munit_assert_size(jb.stats.depth, ==, 0);
+
+	chiaki_audio_jitter_buffer_fini(&jb);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_jitter_buffer[] = {
+	{
+		"/reorder",
+		test_reorder,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/conceal",
+		test_conceal,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/resync",
+		test_resync,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
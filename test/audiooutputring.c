@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audiooutputring.h>
+
+static MunitResult test_prebuffer(const MunitParameter params[], void *user)
+{
+	ChiakiAudioOutputRing ring;
+	ChiakiErrorCode err = chiaki_audio_output_ring_init(&ring, 2, 64, 256);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t in[64 * 2];
+	for(size_t i=0; i<64; i++)
+	{
+		in[i * 2] = (int16_t)i;
+		in[i * 2 + 1] = (int16_t)-i;
+	}
+
+	int16_t out[32 * 2];
+	munit_assert_size(chiaki_audio_output_ring_push(&ring, in, 32), ==, 32);
+	chiaki_audio_output_ring_pull(&ring, out, 32);
+	for(size_t i=0; i<32 * 2; i++)
+		munit_assert_int16(out[i], ==, 0);
+	munit_assert_uint64(ring.stats.frames_silence, ==, 32);
+
+	// with exactly the target fill, the audio passes through unmodified
+	munit_assert_size(chiaki_audio_output_ring_push(&ring, in + 32 * 2, 32), ==, 32);
+	chiaki_audio_output_ring_pull(&ring, out, 32);
+	munit_assert(ring.ratio == 1.0);
+	for(size_t i=0; i<32; i++)
+	{
+		munit_assert_int16(out[i * 2], ==, (int16_t)i);
+		munit_assert_int16(out[i * 2 + 1], ==, (int16_t)-i);
+	}
+	munit_assert_uint64(ring.stats.underruns, ==, 0);
+
+	// running dry starts prebuffering again
+	int16_t out_big[64 * 2];
+	chiaki_audio_output_ring_pull(&ring, out_big, 64);
+	munit_assert_uint64(ring.stats.underruns, ==, 1);
+	munit_assert(!ring.playing);
+
+	chiaki_audio_output_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_overflow(const MunitParameter params[], void *user)
+{
+	ChiakiAudioOutputRing ring;
+	ChiakiErrorCode err = chiaki_audio_output_ring_init(&ring, 1, 16, 64);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t in[100] = { 0 };
+	munit_assert_size(chiaki_audio_output_ring_push(&ring, in, 100), ==, 64);
+	munit_assert_uint64(ring.stats.frames_overflow, ==, 36);
+
+	chiaki_audio_output_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+#define DRIFT_RATE 48000
+#define DRIFT_PPM 500
+#define DRIFT_PUSH_FRAMES 480
+#define DRIFT_PULL_FRAMES 256
+#define DRIFT_SECONDS 120
+
+/**
+ * Sender clock running faster than the device, which would accumulate latency without compensation
+ */
+static MunitResult test_drift(const MunitParameter params[], void *user)
+{
+	ChiakiAudioOutputRing ring;
+	ChiakiErrorCode err = chiaki_audio_output_ring_init(&ring, 2, 960, 4096);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	static int16_t in[DRIFT_PUSH_FRAMES * 2];
+	static int16_t out[DRIFT_PULL_FRAMES * 2];
+	for(size_t i=0; i<DRIFT_PUSH_FRAMES; i++)
+		in[i * 2] = in[i * 2 + 1] = (int16_t)(i * 64);
+
+	double push_interval = (double)DRIFT_PUSH_FRAMES / (DRIFT_RATE * (1.0 + DRIFT_PPM * 1e-6));
+	double pull_interval = (double)DRIFT_PULL_FRAMES / DRIFT_RATE;
+	double push_next = 0.0;
+	double pull_next = pull_interval;
+	uint64_t underruns_settled = 0;
+	while(pull_next < DRIFT_SECONDS)
+	{
+		if(push_next <= pull_next)
+		{
+			chiaki_audio_output_ring_push(&ring, in, DRIFT_PUSH_FRAMES);
+			push_next += push_interval;
+		}
+		else
+		{
+			chiaki_audio_output_ring_pull(&ring, out, DRIFT_PULL_FRAMES);
+			pull_next += pull_interval;
+			if(pull_next < 1.0)
+				underruns_settled = ring.stats.underruns;
+		}
+	}
+
+	munit_assert_uint64(ring.stats.frames_overflow, ==, 0);
+	munit_assert_uint64(ring.stats.underruns, ==, underruns_settled);
+	munit_assert_double(ring.stats.drift_ppm, >, DRIFT_PPM * 0.8);
+	munit_assert_double(ring.stats.drift_ppm, <, DRIFT_PPM * 1.2);
+	munit_assert_size(ring.stats.fill, <, 960 * 2);
+
+	chiaki_audio_output_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_output_ring[] = {
+	{
+		"/prebuffer",
+		test_prebuffer,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/overflow",
+		test_overflow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/drift",
+		test_drift,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
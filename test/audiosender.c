@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audiosender.h>
+#include <chiaki/fec.h>
+
+#define UNIT_SIZE CHIAKI_AUDIO_SENDER_UNIT_SIZE
+#define HEADER_SIZE 19
+#define PACKETS_MAX 16
+
+typedef struct captured_packets_t
+{
+	size_t count;
+	uint8_t buf[PACKETS_MAX][CHIAKI_AUDIO_SENDER_HEADER_SIZE_MAX + (CHIAKI_AUDIO_SENDER_FRAMES_PER_PACKET_MAX + CHIAKI_AUDIO_SENDER_FEC_UNITS_MAX) * UNIT_SIZE];
+	size_t size[PACKETS_MAX];
+} CapturedPackets;
+
+static ChiakiErrorCode capture_packet(uint8_t *buf, size_t buf_size, void *user)
+{
+	CapturedPackets *packets = user;
+	munit_assert_size(packets->count, <, PACKETS_MAX);
+	memcpy(packets->buf[packets->count], buf, buf_size);
+	packets->size[packets->count] = buf_size;
+	packets->count++;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void sender_init(ChiakiAudioSender *sender, CapturedPackets *packets)
+{
+	static ChiakiSession session;
+	memset(&session, 0, sizeof(session));
+	ChiakiErrorCode err = chiaki_audio_sender_init(sender, NULL, &session);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	memset(packets, 0, sizeof(*packets));
+	chiaki_audio_sender_set_packet_cb(sender, capture_packet, packets);
+}
+
+static void push_frame(ChiakiAudioSender *sender, uint8_t value)
+{
+	uint8_t frame[UNIT_SIZE];
+	for(size_t i=0; i<UNIT_SIZE; i++)
+		frame[i] = (uint8_t)(value * 7 + i);
+	chiaki_audio_sender_opus_data(sender, frame, sizeof(frame));
+}
+
+static bool unit_is_frame(const uint8_t *unit, uint8_t value)
+{
+	for(size_t i=0; i<UNIT_SIZE; i++)
+	{
+		if(unit[i] != (uint8_t)(value * 7 + i))
+			return false;
+	}
+	return true;
+}
+
+static MunitResult test_repeat(const MunitParameter params[], void *user)
+{
+	static ChiakiAudioSender sender;
+	static CapturedPackets packets;
+	sender_init(&sender, &packets);
+
+	uint8_t short_frame[3] = { 0 };
+	chiaki_audio_sender_opus_data(&sender, short_frame, sizeof(short_frame));
+	munit_assert_size(packets.count, ==, 0);
+
+	for(uint8_t i=0; i<4; i++)
+		push_frame(&sender, i);
+	munit_assert_size(packets.count, ==, 4);
+
+	for(size_t p=0; p<4; p++)
+	{
+		uint8_t *buf = packets.buf[p];
+		munit_assert_size(packets.size[p], ==, HEADER_SIZE + 3 * UNIT_SIZE);
+		munit_assert_uint8(buf[0], ==, 3);
+		munit_assert_uint16(ntohs(*(chiaki_unaligned_uint16_t *)(buf + 1)), ==, p);
+		munit_assert_uint16(ntohs(*(chiaki_unaligned_uint16_t *)(buf + 3)), ==, p + 1);
+		// unit size 40, 2 fec units, 1 source unit, 3 units in total
+		munit_assert_uint32(ntohl(*(chiaki_unaligned_uint32_t *)(buf + 5)), ==, 0x00022821);
+		munit_assert_uint8(buf[9], ==, 5);
+
+		uint8_t *units = buf + HEADER_SIZE;
+		munit_assert_true(unit_is_frame(units, p));
+		// the two preceding frames, or the current one before there are any
+		munit_assert_true(unit_is_frame(units + UNIT_SIZE, p >= 2 ? p - 2 : p));
+		munit_assert_true(unit_is_frame(units + 2 * UNIT_SIZE, p >= 1 ? p - 1 : p));
+	}
+
+	ChiakiAudioSenderStats stats;
+	chiaki_audio_sender_get_stats(&sender, &stats);
+	munit_assert_uint64(stats.frames_sent, ==, 4);
+	munit_assert_uint64(stats.frames_dropped, ==, 1);
+	munit_assert_uint64(stats.packets_sent, ==, 4);
+
+	chiaki_audio_sender_fini(&sender);
+	return MUNIT_OK;
+}
+
+static MunitResult test_pacing(const MunitParameter params[], void *user)
+{
+	static ChiakiAudioSender sender;
+	static CapturedPackets packets;
+	sender_init(&sender, &packets);
+
+	ChiakiAudioSenderConfig config;
+	chiaki_audio_sender_config_default(&config);
+	config.frames_per_packet = 2;
+	config.fec_units = 1;
+	munit_assert_int(chiaki_audio_sender_set_config(&sender, &config), ==, CHIAKI_ERR_SUCCESS);
+
+	for(uint8_t i=0; i<5; i++)
+		push_frame(&sender, i);
+	munit_assert_size(packets.count, ==, 2);
+
+	uint8_t *buf = packets.buf[1];
+	munit_assert_size(packets.size[1], ==, HEADER_SIZE + 3 * UNIT_SIZE);
+	munit_assert_uint16(ntohs(*(chiaki_unaligned_uint16_t *)(buf + 1)), ==, 1);
+	munit_assert_uint16(ntohs(*(chiaki_unaligned_uint16_t *)(buf + 3)), ==, 3);
+	munit_assert_uint32(ntohl(*(chiaki_unaligned_uint32_t *)(buf + 5)), ==, 0x00022812);
+	munit_assert_true(unit_is_frame(buf + HEADER_SIZE, 2));
+	munit_assert_true(unit_is_frame(buf + HEADER_SIZE + UNIT_SIZE, 3));
+	munit_assert_true(unit_is_frame(buf + HEADER_SIZE + 2 * UNIT_SIZE, 1));
+
+	config.frames_per_packet = CHIAKI_AUDIO_SENDER_FRAMES_PER_PACKET_MAX + 1;
+	munit_assert_int(chiaki_audio_sender_set_config(&sender, &config), ==, CHIAKI_ERR_INVALID_DATA);
+
+	chiaki_audio_sender_fini(&sender);
+	return MUNIT_OK;
+}
+
+#define PARITY_FRAMES 4
+
+static MunitResult test_parity(const MunitParameter params[], void *user)
+{
+	static ChiakiAudioSender sender;
+	static CapturedPackets packets;
+	sender_init(&sender, &packets);
+
+	ChiakiAudioSenderConfig config;
+	chiaki_audio_sender_config_default(&config);
+	config.redundancy = CHIAKI_AUDIO_SENDER_REDUNDANCY_PARITY;
+	config.fec_units = 1;
+	config.parity_frames = PARITY_FRAMES;
+	munit_assert_int(chiaki_audio_sender_set_config(&sender, &config), ==, CHIAKI_ERR_SUCCESS);
+
+	for(uint8_t i=0; i<8; i++)
+		push_frame(&sender, i);
+	munit_assert_size(packets.count, ==, 8);
+
+	// packet 6 is lost, rebuild its frame from the sources of packets 4, 5, 7 and the parity of packet 7
+	uint8_t frame_buf[(PARITY_FRAMES + 1) * UNIT_SIZE];
+	memcpy(frame_buf + 0 * UNIT_SIZE, packets.buf[4] + HEADER_SIZE, UNIT_SIZE);
+	memcpy(frame_buf + 1 * UNIT_SIZE, packets.buf[5] + HEADER_SIZE, UNIT_SIZE);
+	memset(frame_buf + 2 * UNIT_SIZE, 0x42, UNIT_SIZE);
+	memcpy(frame_buf + 3 * UNIT_SIZE, packets.buf[7] + HEADER_SIZE, UNIT_SIZE);
+	memcpy(frame_buf + 4 * UNIT_SIZE, packets.buf[7] + HEADER_SIZE + UNIT_SIZE, UNIT_SIZE);
+
+	const unsigned int erasures[] = { 2 };
+	ChiakiErrorCode err = chiaki_fec_decode(frame_buf, UNIT_SIZE, UNIT_SIZE, PARITY_FRAMES, 1, erasures, 1);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_true(unit_is_frame(frame_buf + 2 * UNIT_SIZE, 6));
+
+	chiaki_audio_sender_fini(&sender);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_sender[] = {
+	{
+		"/repeat",
+		test_repeat,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/pacing",
+		test_pacing,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/parity",
+		test_parity,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/bitratemeter.h>
+
+#include <math.h>
+
+#define FRAME_INTERVAL_60_US 16667
+
+#define assert_near(value, expected, ratio) munit_assert_double(fabs((double)(value) - (double)(expected)), <=, (double)(expected) * (ratio))
+
+/**
+ * Frames of constant size and interval, starting at *now_us, which is left at the last frame
+ */
+static void push_frames(ChiakiBitrateMeter *meter, uint64_t *now_us, size_t count, uint64_t interval_us, size_t size)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		chiaki_bitrate_meter_frame(meter, *now_us, size);
+		if(i + 1 < count)
+			*now_us += interval_us;
+	}
+}
+
+static MunitResult test_steady(const MunitParameter params[], void *user)
+{
+	static ChiakiBitrateMeter meter;
+	chiaki_bitrate_meter_init(&meter, 1000000, 1000000);
+
+	ChiakiBitrateMeterStats stats;
+	chiaki_bitrate_meter_get_stats(&meter, 1000, &stats);
+	munit_assert_uint64(stats.frames, ==, 0);
+	munit_assert_double(stats.bitrate, ==, 0.0);
+
+	uint64_t now_us = 1000;
+	push_frames(&meter, &now_us, 60 * 5, FRAME_INTERVAL_60_US, 10000);
+	chiaki_bitrate_meter_get_stats(&meter, now_us, &stats);
+	munit_assert_uint64(stats.span_us, ==, 1000000);
+	munit_assert_uint64(stats.frames, ==, 60);
+	munit_assert_uint64(stats.bytes, ==, 600000);
+	assert_near(stats.bitrate, 4800000.0, 0.001);
+	assert_near(stats.bitrate_ewma, 4800000.0, 0.02);
+	assert_near(stats.fps, 60.0, 0.001);
+	munit_assert_uint32(stats.frame_size_p50, ==, 10000);
+	munit_assert_uint32(stats.frame_size_max, ==, 10000);
+
+	// right after the start, the values are taken over the time since the first frame
+	chiaki_bitrate_meter_reset(&meter);
+	now_us = 1000;
+	push_frames(&meter, &now_us, 16, FRAME_INTERVAL_60_US, 10000);
+	chiaki_bitrate_meter_get_stats(&meter, now_us, &stats);
+	munit_assert_uint64(stats.span_us, ==, 15 * FRAME_INTERVAL_60_US);
+	munit_assert_uint64(stats.frames, ==, 15);
+	assert_near(stats.bitrate, 4800000.0, 0.001);
+	assert_near(stats.bitrate_ewma, 4800000.0, 0.02);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_rate_change(const MunitParameter params[], void *user)
+{
+	static ChiakiBitrateMeter meter;
+	chiaki_bitrate_meter_init(&meter, 1000000, 2000000);
+
+	// the console drops from 60 to 30 fps with the same frame size
+	uint64_t now_us = 0;
+	push_frames(&meter, &now_us, 60 * 10, FRAME_INTERVAL_60_US, 20000);
+	now_us += FRAME_INTERVAL_60_US * 2;
+	push_frames(&meter, &now_us, 30 * 2, FRAME_INTERVAL_60_US * 2, 20000);
+
+	ChiakiBitrateMeterStats stats;
+	chiaki_bitrate_meter_get_stats(&meter, now_us, &stats);
+	assert_near(stats.fps, 30.0, 0.001);
+	assert_near(stats.bitrate, 4800000.0, 0.001);
+	// still on the way down from 9.6 MBit/s
+	munit_assert_double(stats.bitrate_ewma, >, 4800000.0);
+	munit_assert_double(stats.bitrate_ewma, <, 9600000.0);
+
+	// a stall empties the window, while the average decays
+	chiaki_bitrate_meter_get_stats(&meter, now_us + 1500000, &stats);
+	munit_assert_uint64(stats.frames, ==, 0);
+	munit_assert_double(stats.bitrate, ==, 0.0);
+	munit_assert_double(stats.fps, ==, 0.0);
+	munit_assert_uint32(stats.frame_size_max, ==, 0);
+	munit_assert_double(stats.bitrate_ewma, <, 4800000.0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_percentiles(const MunitParameter params[], void *user)
+{
+	static ChiakiBitrateMeter meter;
+	chiaki_bitrate_meter_init(&meter, 1000000, 0);
+
+	uint64_t now_us = 0;
+	chiaki_bitrate_meter_frame(&meter, now_us, 1); // start
+	for(size_t size=100; size>0; size--)
+	{
+		now_us += 1000;
+		chiaki_bitrate_meter_frame(&meter, now_us, size * 100);
+	}
+
+	ChiakiBitrateMeterStats stats;
+	chiaki_bitrate_meter_get_stats(&meter, now_us, &stats);
+	munit_assert_uint64(stats.frames, ==, 100);
+	munit_assert_uint32(stats.frame_size_p50, ==, 5000);
+	munit_assert_uint32(stats.frame_size_p95, ==, 9500);
+	munit_assert_uint32(stats.frame_size_p99, ==, 9900);
+	munit_assert_uint32(stats.frame_size_max, ==, 10000);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_full(const MunitParameter params[], void *user)
+{
+	static ChiakiBitrateMeter meter;
+	chiaki_bitrate_meter_init(&meter, 1000000, 0);
+
+	// more frames than fit into the ring within one window
+	uint64_t now_us = 0;
+	push_frames(&meter, &now_us, 2000, 1000, 500);
+
+	ChiakiBitrateMeterStats stats;
+	chiaki_bitrate_meter_get_stats(&meter, now_us, &stats);
+	munit_assert_uint64(stats.frames, ==, CHIAKI_BITRATE_METER_FRAMES_MAX);
+	munit_assert_uint64(stats.span_us, ==, CHIAKI_BITRATE_METER_FRAMES_MAX * 1000);
+	assert_near(stats.fps, 1000.0, 0.001);
+	assert_near(stats.bitrate, 4000000.0, 0.001);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_bitrate_meter[] = {
+	{
+		"/steady",
+		test_steady,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/rate_change",
+		test_rate_change,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/percentiles",
+		test_percentiles,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/full",
+		test_full,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
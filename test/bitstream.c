@@ -158,14 +158,143 @@ static MunitResult test_bitstream_set_ref_h265(const MunitParameter params[], vo
 
 	for(unsigned i=0; i<9; i++)
 	{
-		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, slice_p, ARRAY_SIZE(slice_p), i));
+		unsigned size = ARRAY_SIZE(slice_p);
+		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, slice_p, &size, ARRAY_SIZE(slice_p), i));
+		munit_assert(size == ARRAY_SIZE(slice_p));
 		memset(&slice, -1, sizeof(slice));
 		munit_assert(chiaki_bitstream_slice(&bs, slice_p, ARRAY_SIZE(slice_p), &slice));
 		munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
 		munit_assert(slice.reference_frame == i);
 	}
 	// Slice have 9 reference frames
-	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, slice_p, ARRAY_SIZE(slice_p), 10));
+	unsigned size = ARRAY_SIZE(slice_p);
+	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, slice_p, &size, ARRAY_SIZE(slice_p), 10));
+
+	return MUNIT_OK;
+}
+
+static const uint8_t h264_header[] = {
+	0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+	0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+	0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+};
+
+static const uint8_t h264_slice_p[] = {
+	0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41, 0x5b, 0xf4, 0x65, 0xb4, 0x3e, 0x1a,
+	0xd3, 0xa0, 0x28, 0x1f, 0x83, 0x63, 0x0e, 0xc2, 0xfc, 0x9d, 0x7a, 0xc7, 0xc4, 0x7d, 0xf9, 0x18,
+};
+
+static bool h264_escaped(const uint8_t *buf, size_t size)
+{
+	for(size_t i=4; i+2<size; i++)
+	{
+		if(!buf[i] && !buf[i + 1] && buf[i + 2] <= 2)
+			return false;
+	}
+	return true;
+}
+
+static MunitResult test_bitstream_set_ref_h264(const MunitParameter params[], void *fixture)
+{
+	ChiakiBitstream bs;
+	ChiakiBitstreamSlice slice;
+
+	chiaki_bitstream_init(&bs, NULL, CHIAKI_CODEC_H264);
+	memset(&bs.h264, -1, sizeof(bs.h264));
+	munit_assert(chiaki_bitstream_header(&bs, (uint8_t *)h264_header, ARRAY_SIZE(h264_header)));
+	munit_assert(bs.h264.pps.valid);
+	munit_assert(bs.h264.pps.entropy_coding_mode_flag);
+	munit_assert(bs.h264.sps.max_num_ref_frames > 5);
+
+	uint8_t buf[ARRAY_SIZE(h264_slice_p) + 16];
+	for(unsigned i=0; i<bs.h264.sps.max_num_ref_frames; i++)
+	{
+		memcpy(buf, h264_slice_p, ARRAY_SIZE(h264_slice_p));
+		unsigned size = ARRAY_SIZE(h264_slice_p);
+		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), i));
+		// the modification is inserted, with cabac the slice data after the header only moves by whole bytes
+		munit_assert(size > ARRAY_SIZE(h264_slice_p));
+		munit_assert(size <= sizeof(buf));
+		munit_assert(!memcmp(buf + size - 16, h264_slice_p + ARRAY_SIZE(h264_slice_p) - 16, 16));
+		munit_assert(h264_escaped(buf, size));
+
+		memset(&slice, -1, sizeof(slice));
+		munit_assert(chiaki_bitstream_slice(&bs, buf, size, &slice));
+		munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
+		munit_assert(slice.reference_frame == i);
+
+		// replacing an existing modification again
+		unsigned size_prev = size;
+		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), 0));
+		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), i));
+		munit_assert(size == size_prev);
+		munit_assert(chiaki_bitstream_slice(&bs, buf, size, &slice));
+		munit_assert(slice.reference_frame == i);
+	}
+
+	// not enough room, nothing is touched
+	memcpy(buf, h264_slice_p, ARRAY_SIZE(h264_slice_p));
+	unsigned size = ARRAY_SIZE(h264_slice_p);
+	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, ARRAY_SIZE(h264_slice_p), 1));
+	munit_assert(size == ARRAY_SIZE(h264_slice_p));
+	munit_assert(!memcmp(buf, h264_slice_p, ARRAY_SIZE(h264_slice_p)));
+
+	munit_assert(!chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), bs.h264.sps.max_num_ref_frames));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_bitstream_set_ref_h264_cavlc(const MunitParameter params[], void *fixture)
+{
+	ChiakiBitstream bs;
+	ChiakiBitstreamSlice slice;
+
+	chiaki_bitstream_init(&bs, NULL, CHIAKI_CODEC_H264);
+	// same as above, but entropy_coding_mode_flag cleared in the pps
+	uint8_t header[ARRAY_SIZE(h264_header)];
+	memcpy(header, h264_header, sizeof(header));
+	header[ARRAY_SIZE(h264_header) - 3] = 0xce;
+	munit_assert(chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)));
+	munit_assert(bs.h264.pps.valid);
+	munit_assert(!bs.h264.pps.entropy_coding_mode_flag);
+
+	// slice data with zero runs, which need emulation prevention once shifted
+	uint8_t slice_p[] = {
+		0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41, 0x5b, 0xf4, 0x65, 0x00, 0x00, 0x03,
+		0x01, 0x80, 0x00, 0x00, 0x03, 0x00, 0x40, 0x0e, 0xc2, 0xfc, 0x00, 0x00, 0x03, 0x02, 0x7d, 0x80,
+	};
+	munit_assert(h264_escaped(slice_p, ARRAY_SIZE(slice_p)));
+
+	uint8_t buf[ARRAY_SIZE(slice_p) + 16];
+	uint8_t first[ARRAY_SIZE(buf)];
+	unsigned first_size = 0;
+	for(unsigned i=0; i<4; i++)
+	{
+		memcpy(buf, slice_p, ARRAY_SIZE(slice_p));
+		unsigned size = ARRAY_SIZE(slice_p);
+		munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), i));
+		munit_assert(h264_escaped(buf, size));
+		munit_assert(buf[size - 1] != 0);
+
+		memset(&slice, -1, sizeof(slice));
+		munit_assert(chiaki_bitstream_slice(&bs, buf, size, &slice));
+		munit_assert(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P);
+		munit_assert(slice.reference_frame == i);
+
+		if(!i)
+		{
+			memcpy(first, buf, size);
+			first_size = size;
+		}
+	}
+
+	// rewriting back must reproduce the exact same bits
+	unsigned size = first_size;
+	memcpy(buf, first, first_size);
+	munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), 3));
+	munit_assert(chiaki_bitstream_slice_set_reference_frame(&bs, buf, &size, sizeof(buf), 0));
+	munit_assert(size == first_size);
+	munit_assert(!memcmp(buf, first, first_size));
 
 	return MUNIT_OK;
 }
@@ -195,6 +324,22 @@ MunitTest tests_bitstream[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/bitstream_set_ref_h264",
+		test_bitstream_set_ref_h264,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/bitstream_set_ref_h264_cavlc",
+		test_bitstream_set_ref_h264_cavlc,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{
 		"/bitstream_set_ref_h265",
 		test_bitstream_set_ref_h265,
@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/candidatecheck.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/select.h>
+#endif
+
+#define PAIRS_COUNT 8
+#define REQUEST_SIZE 16
+#define STAGES 3
+
+typedef struct loopback_t
+{
+	chiaki_socket_t console;
+	struct sockaddr_in console_addr;
+	chiaki_socket_t socks[PAIRS_COUNT];
+	ChiakiCandidatePair pairs[PAIRS_COUNT];
+	uint8_t requests[STAGES][REQUEST_SIZE];
+} Loopback;
+
+static chiaki_socket_t loopback_socket(struct sockaddr_in *addr)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(CHIAKI_SOCKET_IS_INVALID(sock))
+		return sock;
+	struct sockaddr_in bind_addr;
+	memset(&bind_addr, 0, sizeof(bind_addr));
+	bind_addr.sin_family = AF_INET;
+	bind_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_len = sizeof(bind_addr);
+	if(bind(sock, (struct sockaddr *)&bind_addr, addr_len) < 0
+			|| getsockname(sock, (struct sockaddr *)addr, &addr_len) < 0)
+	{
+		CHIAKI_SOCKET_CLOSE(sock);
+		return CHIAKI_INVALID_SOCKET;
+	}
+	return sock;
+}
+
+static bool loopback_init(Loopback *lo)
+{
+	memset(lo, 0, sizeof(*lo));
+	for(size_t i=0; i<PAIRS_COUNT; i++)
+		lo->socks[i] = CHIAKI_INVALID_SOCKET;
+	lo->console = loopback_socket(&lo->console_addr);
+	if(CHIAKI_SOCKET_IS_INVALID(lo->console))
+		return false;
+	for(size_t i=0; i<PAIRS_COUNT; i++)
+	{
+		struct sockaddr_in addr;
+		lo->socks[i] = loopback_socket(&addr);
+		if(CHIAKI_SOCKET_IS_INVALID(lo->socks[i]))
+			return false;
+		// added in reverse priority order, so starting the check has to sort them
+		chiaki_candidate_pair_init(&lo->pairs[i], i, lo->socks[i], (struct sockaddr *)&lo->console_addr, sizeof(lo->console_addr), (uint32_t)i);
+	}
+	for(size_t stage=0; stage<STAGES; stage++)
+		memset(lo->requests[stage], 0x10 + (int)stage, REQUEST_SIZE);
+	return true;
+}
+
+static void loopback_fini(Loopback *lo)
+{
+	if(!CHIAKI_SOCKET_IS_INVALID(lo->console))
+		CHIAKI_SOCKET_CLOSE(lo->console);
+	for(size_t i=0; i<PAIRS_COUNT; i++)
+	{
+		if(!CHIAKI_SOCKET_IS_INVALID(lo->socks[i]))
+			CHIAKI_SOCKET_CLOSE(lo->socks[i]);
+	}
+}
+
+/**
+ * Receive everything that arrives at the console within a short time
+ *
+ * @param from_pair[out] for every request, the candidate_idx of the pair it was sent on
+ * @param stage[out] for every request, the check stage it belongs to
+ */
+static size_t console_receive(Loopback *lo, size_t *from_pair, uint8_t *stage, size_t max)
+{
+	size_t count = 0;
+	while(true)
+	{
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(lo->console, &fds);
+		struct timeval tv = { 0, 50000 };
+		if(select((int)lo->console + 1, &fds, NULL, NULL, &tv) <= 0)
+			return count;
+		uint8_t buf[REQUEST_SIZE * 2];
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+		int received = (int)recvfrom(lo->console, (CHIAKI_SOCKET_BUF_TYPE)buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addr_len);
+		munit_assert_int(received, ==, REQUEST_SIZE);
+		munit_assert_size(count, <, max);
+		from_pair[count] = PAIRS_COUNT;
+		for(size_t i=0; i<PAIRS_COUNT; i++)
+		{
+			struct sockaddr_in sock_addr;
+			socklen_t sock_addr_len = sizeof(sock_addr);
+			if(CHIAKI_SOCKET_IS_INVALID(lo->socks[i]) || getsockname(lo->socks[i], (struct sockaddr *)&sock_addr, &sock_addr_len) < 0)
+				continue;
+			if(sock_addr.sin_port == addr.sin_port)
+				from_pair[count] = i;
+		}
+		munit_assert_size(from_pair[count], <, PAIRS_COUNT);
+		stage[count] = buf[0] - 0x10;
+		count++;
+	}
+}
+
+static MunitResult test_first_requests_at_once(const MunitParameter params[], void *user)
+{
+	Loopback lo;
+	if(!loopback_init(&lo))
+	{
+		loopback_fini(&lo);
+		return MUNIT_SKIP;
+	}
+
+	uint64_t now = 1000000;
+	chiaki_candidate_pairs_start(lo.pairs, PAIRS_COUNT, now);
+	for(size_t i=0; i<PAIRS_COUNT; i++)
+		munit_assert_size(lo.pairs[i].candidate_idx, ==, PAIRS_COUNT - 1 - i);
+
+	// every pair sends its first request right away
+	uint64_t next_wakeup = UINT64_MAX;
+	size_t alive = chiaki_candidate_pairs_send_due(NULL, lo.pairs, PAIRS_COUNT, &lo.requests[0][0], REQUEST_SIZE, now, &next_wakeup);
+	munit_assert_size(alive, ==, PAIRS_COUNT);
+	munit_assert_uint64(next_wakeup, ==, now + CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS);
+
+	size_t from_pair[PAIRS_COUNT * 2];
+	uint8_t stage[PAIRS_COUNT * 2];
+	size_t received = console_receive(&lo, from_pair, stage, PAIRS_COUNT * 2);
+	munit_assert_size(received, ==, PAIRS_COUNT);
+	bool seen[PAIRS_COUNT] = { 0 };
+	for(size_t i=0; i<received; i++)
+	{
+		munit_assert_uint8(stage[i], ==, 0);
+		munit_assert_false(seen[from_pair[i]]);
+		seen[from_pair[i]] = true;
+	}
+
+	// nothing is due before the first retransmission
+	next_wakeup = UINT64_MAX;
+	chiaki_candidate_pairs_send_due(NULL, lo.pairs, PAIRS_COUNT, &lo.requests[0][0], REQUEST_SIZE, now + CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS - 1, &next_wakeup);
+	munit_assert_size(console_receive(&lo, from_pair, stage, PAIRS_COUNT * 2), ==, 0);
+
+	loopback_fini(&lo);
+	return MUNIT_OK;
+}
+
+static MunitResult test_retransmissions_paced(const MunitParameter params[], void *user)
+{
+	Loopback lo;
+	if(!loopback_init(&lo))
+	{
+		loopback_fini(&lo);
+		return MUNIT_SKIP;
+	}
+
+	uint64_t start = 1000000;
+	chiaki_candidate_pairs_start(lo.pairs, PAIRS_COUNT, start);
+	uint64_t next_wakeup = UINT64_MAX;
+	chiaki_candidate_pairs_send_due(NULL, lo.pairs, PAIRS_COUNT, &lo.requests[0][0], REQUEST_SIZE, start, &next_wakeup);
+	size_t from_pair[PAIRS_COUNT * 2];
+	uint8_t stage[PAIRS_COUNT * 2];
+	munit_assert_size(console_receive(&lo, from_pair, stage, PAIRS_COUNT * 2), ==, PAIRS_COUNT);
+
+	// the second stage of one pair was answered in the meantime
+	lo.pairs[3].responses = 1;
+
+	// first retransmissions come one pacing interval apart, in order of priority
+	for(size_t i=0; i<PAIRS_COUNT; i++)
+	{
+		uint64_t now = start + CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS + i * CHIAKI_CANDIDATE_CHECK_PACING_MS;
+		next_wakeup = UINT64_MAX;
+		size_t alive = chiaki_candidate_pairs_send_due(NULL, lo.pairs, PAIRS_COUNT, &lo.requests[0][0], REQUEST_SIZE, now, &next_wakeup);
+		munit_assert_size(alive, ==, PAIRS_COUNT);
+		size_t received = console_receive(&lo, from_pair, stage, PAIRS_COUNT * 2);
+		munit_assert_size(received, ==, 1);
+		munit_assert_size(from_pair[0], ==, lo.pairs[i].candidate_idx);
+		munit_assert_uint8(stage[0], ==, i == 3 ? 1 : 0);
+		if(i + 1 < PAIRS_COUNT)
+			munit_assert_uint64(next_wakeup, ==, now + CHIAKI_CANDIDATE_CHECK_PACING_MS);
+	}
+
+	// later ones back off without pacing again
+	munit_assert_uint64(lo.pairs[0].next_send_ms, ==, start + 3 * CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS);
+	munit_assert_uint64(lo.pairs[PAIRS_COUNT - 1].next_send_ms, ==,
+			start + 3 * CHIAKI_CANDIDATE_CHECK_RTO_INITIAL_MS + (PAIRS_COUNT - 1) * CHIAKI_CANDIDATE_CHECK_PACING_MS);
+
+	// a pair whose socket is gone is not checked anymore
+	CHIAKI_SOCKET_CLOSE(lo.socks[0]);
+	lo.pairs[PAIRS_COUNT - 1].sock = CHIAKI_INVALID_SOCKET;
+	lo.socks[0] = CHIAKI_INVALID_SOCKET;
+	next_wakeup = UINT64_MAX;
+	size_t alive = chiaki_candidate_pairs_send_due(NULL, lo.pairs, PAIRS_COUNT, &lo.requests[0][0], REQUEST_SIZE, start + 10000, &next_wakeup);
+	munit_assert_size(alive, ==, PAIRS_COUNT - 1);
+	munit_assert_size(console_receive(&lo, from_pair, stage, PAIRS_COUNT * 2), ==, PAIRS_COUNT - 1);
+
+	loopback_fini(&lo);
+	return MUNIT_OK;
+}
+
+MunitTest tests_candidate_check[] = {
+	{
+		"/first_requests_at_once",
+		test_first_requests_at_once,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/retransmissions_paced",
+		test_retransmissions_paced,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
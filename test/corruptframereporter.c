@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/corruptframereporter.h>
+
+#define HOLDOFF_US 30000
+#define REQUESTS_MAX 8
+
+typedef struct sent_requests_t
+{
+	size_t count;
+	ChiakiSeqNum16 start[REQUESTS_MAX];
+	ChiakiSeqNum16 end[REQUESTS_MAX];
+	ChiakiErrorCode result;
+} SentRequests;
+
+static ChiakiErrorCode send_request(ChiakiSeqNum16 start, ChiakiSeqNum16 end, void *user)
+{
+	SentRequests *requests = user;
+	if(requests->result != CHIAKI_ERR_SUCCESS)
+		return requests->result;
+	munit_assert_size(requests->count, <, REQUESTS_MAX);
+	requests->start[requests->count] = start;
+	requests->end[requests->count] = end;
+	requests->count++;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static MunitResult test_coalesce(const MunitParameter params[], void *user)
+{
+	ChiakiCorruptFrameReporter reporter;
+	SentRequests requests = { 0 };
+	munit_assert_int(chiaki_corrupt_frame_reporter_init(&reporter, NULL, HOLDOFF_US, send_request, &requests), ==, CHIAKI_ERR_SUCCESS);
+
+	uint64_t now = 1000000;
+	munit_assert_int(chiaki_corrupt_frame_reporter_report(&reporter, 10, 12, now), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(requests.count, ==, 1);
+	munit_assert_uint16(requests.start[0], ==, 10);
+	munit_assert_uint16(requests.end[0], ==, 12);
+
+	// burst loss before the console could react
+	chiaki_corrupt_frame_reporter_report(&reporter, 10, 12, now + 1000);
+	chiaki_corrupt_frame_reporter_report(&reporter, 10, 14, now + 2000);
+	chiaki_corrupt_frame_reporter_report(&reporter, 13, 13, now + 3000);
+	munit_assert_size(requests.count, ==, 1);
+
+	// a p frame does not answer, an i frame from before the request does not either
+	chiaki_corrupt_frame_reporter_frame(&reporter, 15, false, now + 10000);
+	chiaki_corrupt_frame_reporter_frame(&reporter, 14, true, now + 11000);
+	chiaki_corrupt_frame_reporter_frame(&reporter, 16, true, now + 12000);
+
+	ChiakiCorruptFrameStats stats;
+	chiaki_corrupt_frame_reporter_get_stats(&reporter, &stats);
+	munit_assert_uint64(stats.reports, ==, 4);
+	munit_assert_uint64(stats.requests_sent, ==, 1);
+	munit_assert_uint64(stats.merged, ==, 1);
+	munit_assert_uint64(stats.suppressed, ==, 2);
+	munit_assert_uint64(stats.answered, ==, 1);
+	munit_assert_uint64(stats.answer_us_last, ==, 12000);
+
+	// answered, so the next loss is requested right away
+	chiaki_corrupt_frame_reporter_report(&reporter, 20, 20, now + 13000);
+	munit_assert_size(requests.count, ==, 2);
+	munit_assert_uint16(requests.start[1], ==, 20);
+
+	chiaki_corrupt_frame_reporter_fini(&reporter);
+	return MUNIT_OK;
+}
+
+static MunitResult test_expire(const MunitParameter params[], void *user)
+{
+	ChiakiCorruptFrameReporter reporter;
+	SentRequests requests = { 0 };
+	munit_assert_int(chiaki_corrupt_frame_reporter_init(&reporter, NULL, HOLDOFF_US, send_request, &requests), ==, CHIAKI_ERR_SUCCESS);
+
+	uint64_t now = 1000000;
+	chiaki_corrupt_frame_reporter_report(&reporter, 0xfffe, 0xffff, now);
+	chiaki_corrupt_frame_reporter_report(&reporter, 0xffff, 2, now + HOLDOFF_US - 1);
+	munit_assert_size(requests.count, ==, 1);
+
+	// no i frame in time, the new report is requested on its own
+	chiaki_corrupt_frame_reporter_report(&reporter, 3, 4, now + HOLDOFF_US + 1000);
+	munit_assert_size(requests.count, ==, 2);
+	munit_assert_uint16(requests.start[1], ==, 3);
+	munit_assert_uint16(requests.end[1], ==, 4);
+
+	// a failed send is retried with the next report
+	requests.result = CHIAKI_ERR_UNKNOWN;
+	uint64_t later = now + 3 * HOLDOFF_US;
+	munit_assert_int(chiaki_corrupt_frame_reporter_report(&reporter, 5, 5, later), ==, CHIAKI_ERR_UNKNOWN);
+	requests.result = CHIAKI_ERR_SUCCESS;
+	chiaki_corrupt_frame_reporter_report(&reporter, 5, 6, later + 1000);
+	munit_assert_size(requests.count, ==, 3);
+	munit_assert_uint16(requests.end[2], ==, 6);
+
+	ChiakiCorruptFrameStats stats;
+	chiaki_corrupt_frame_reporter_get_stats(&reporter, &stats);
+	munit_assert_uint64(stats.requests_sent, ==, 3);
+	munit_assert_uint64(stats.expired, ==, 2);
+	munit_assert_uint64(stats.send_errors, ==, 1);
+	munit_assert_uint64(stats.answered, ==, 0);
+
+	chiaki_corrupt_frame_reporter_fini(&reporter);
+	return MUNIT_OK;
+}
+
+static MunitResult test_never_answered(const MunitParameter params[], void *user)
+{
+	ChiakiCorruptFrameReporter reporter;
+	SentRequests requests = { 0 };
+	munit_assert_int(chiaki_corrupt_frame_reporter_init(&reporter, NULL, HOLDOFF_US, send_request, &requests), ==, CHIAKI_ERR_SUCCESS);
+
+	// a frame is lost every 10 ms for longer than half the sequence space, only p frames ever arrive
+	uint64_t now = 1000000;
+	ChiakiSeqNum16 frame = 0xff00;
+	uint64_t reports = 0;
+	for(size_t i=0; i<0x9000; i++)
+	{
+		size_t count_before = requests.count;
+		chiaki_corrupt_frame_reporter_report(&reporter, frame, frame, now);
+		reports++;
+		if(requests.count != count_before)
+		{
+			// every request covers at most the reports merged within one holdoff
+			ChiakiSeqNum16 start = requests.start[requests.count - 1];
+			ChiakiSeqNum16 end = requests.end[requests.count - 1];
+			munit_assert_uint16(start, ==, frame);
+			munit_assert_uint16(end, ==, frame);
+			requests.count = 0;
+		}
+		chiaki_corrupt_frame_reporter_frame(&reporter, (ChiakiSeqNum16)(frame + 1), false, now + 1000);
+		munit_assert_true(chiaki_seq_num_16_lt(reporter.start, frame) || reporter.start == frame);
+		munit_assert_uint16((ChiakiSeqNum16)(reporter.end - reporter.start), <=, HOLDOFF_US / 10000);
+		frame++;
+		now += 10000;
+	}
+
+	ChiakiCorruptFrameStats stats;
+	chiaki_corrupt_frame_reporter_get_stats(&reporter, &stats);
+	munit_assert_uint64(stats.reports, ==, reports);
+	munit_assert_uint64(stats.answered, ==, 0);
+	munit_assert_uint64(stats.expired, ==, stats.requests_sent - 1);
+	munit_assert_uint64(stats.requests_sent + stats.merged + stats.suppressed, ==, reports);
+
+	chiaki_corrupt_frame_reporter_fini(&reporter);
+	return MUNIT_OK;
+}
+
+MunitTest tests_corrupt_frame_reporter[] = {
+	{
+		"/coalesce",
+		test_coalesce,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/expire",
+		test_expire,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/never_answered",
+		test_never_answered,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
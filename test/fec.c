@@ -67,6 +67,59 @@ static MunitResult test_fec(const MunitParameter params[], void *test_user)
 	return test_fec_case(&fec_test_cases[test_case_id]);
 }
 
+#define ENCODER_K 5
+#define ENCODER_M 3
+#define ENCODER_UNIT_SIZE 40
+#define ENCODER_STRIDE 48
+
+static MunitResult test_fec_encoder(const MunitParameter params[], void *test_user)
+{
+	ChiakiFecMatrixCache cache;
+	chiaki_fec_matrix_cache_init(&cache);
+	int *matrix = chiaki_fec_matrix_cache_get(&cache, ENCODER_K, ENCODER_M);
+	munit_assert_not_null(matrix);
+	munit_assert_ptr_equal(chiaki_fec_matrix_cache_get(&cache, ENCODER_K, ENCODER_M), matrix);
+
+	ChiakiFecEncoder encoder;
+	ChiakiErrorCode err = chiaki_fec_encoder_init(&encoder, ENCODER_K, ENCODER_M, ENCODER_UNIT_SIZE, &cache);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint8_t frame_buffer_ref[(ENCODER_K + ENCODER_M) * ENCODER_STRIDE];
+	munit_rand_memory(sizeof(frame_buffer_ref), frame_buffer_ref);
+	err = chiaki_fec_encoder_encode(&encoder, frame_buffer_ref, ENCODER_STRIDE);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// parity written in place must match the one-shot encoder
+	uint8_t frame_buffer[sizeof(frame_buffer_ref)];
+	memcpy(frame_buffer, frame_buffer_ref, sizeof(frame_buffer));
+	for(size_t i=ENCODER_K; i<ENCODER_K + ENCODER_M; i++)
+		memset(frame_buffer + i * ENCODER_STRIDE, 0, ENCODER_UNIT_SIZE);
+	err = chiaki_fec_encode(frame_buffer, ENCODER_UNIT_SIZE, ENCODER_STRIDE, ENCODER_K, ENCODER_M);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	for(size_t i=ENCODER_K; i<ENCODER_K + ENCODER_M; i++)
+		munit_assert_memory_equal(ENCODER_UNIT_SIZE, frame_buffer + i * ENCODER_STRIDE, frame_buffer_ref + i * ENCODER_STRIDE);
+
+	// the decoder can be reused for several frames
+	ChiakiFecDecoder decoder;
+	chiaki_fec_decoder_init(&decoder);
+	const unsigned int erasures[][ENCODER_M] = { { 0, 2, 6 }, { 1, 3, 4 } };
+	for(size_t e=0; e<2; e++)
+	{
+		memcpy(frame_buffer, frame_buffer_ref, sizeof(frame_buffer));
+		for(size_t i=0; i<ENCODER_M; i++)
+			memset(frame_buffer + erasures[e][i] * ENCODER_STRIDE, 0x42, ENCODER_UNIT_SIZE);
+		err = chiaki_fec_decoder_decode(&decoder, frame_buffer, ENCODER_UNIT_SIZE, ENCODER_STRIDE, ENCODER_K, ENCODER_M, erasures[e], ENCODER_M);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		for(size_t i=0; i<ENCODER_K; i++)
+			munit_assert_memory_equal(ENCODER_UNIT_SIZE, frame_buffer + i * ENCODER_STRIDE, frame_buffer_ref + i * ENCODER_STRIDE);
+	}
+
+	chiaki_fec_decoder_fini(&decoder);
+	chiaki_fec_encoder_fini(&encoder);
+	chiaki_fec_matrix_cache_fini(&cache);
+	return MUNIT_OK;
+}
+
 MunitTest tests_fec[] = {
 	{
 		"/fec",
@@ -76,5 +129,13 @@ MunitTest tests_fec[] = {
 		MUNIT_TEST_OPTION_NONE,
 		fec_params
 	},
+	{
+		"/encoder",
+		test_fec_encoder,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
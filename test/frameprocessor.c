@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/frameprocessor.h>
+#include <chiaki/fec.h>
+
+static MunitResult test_unit_map_slices(const MunitParameter params[], void *user)
+{
+	// three slices, the second one has a 4 byte start code
+	uint8_t frame[] = {
+		0x00, 0x00, 0x01, 0x65, 0x11, 0x22, 0x33, 0x00,
+		0x00, 0x00, 0x01, 0x41, 0x44, 0x55, 0x66, 0x77,
+		0x00, 0x00, 0x01, 0x41, 0x88, 0x99, 0x00, 0x02
+	};
+
+	uint64_t unit_valid[1];
+	uint32_t unit_offset[4];
+	static ChiakiFrameUnitMap map;
+	memset(&map, 0, sizeof(map));
+	map.unit_valid = unit_valid;
+	map.unit_offset = unit_offset;
+	map.units_count = 4;
+	map.units_missing = 1;
+	// unit 2 went missing right in front of the third start code
+	unit_valid[0] = 0xb; // 1011
+	unit_offset[0] = 0;
+	unit_offset[1] = 8;
+	unit_offset[2] = 16;
+	unit_offset[3] = 16;
+
+	chiaki_frame_unit_map_find_slices(&map, frame, sizeof(frame));
+	munit_assert_uint(map.slices_count, ==, 3);
+	munit_assert_false(map.slices_truncated);
+	munit_assert_uint32(map.slice_offset[0], ==, 0);
+	munit_assert_uint32(map.slice_offset[1], ==, 7);
+	munit_assert_uint32(map.slice_offset[2], ==, 16);
+	munit_assert_false(map.slice_damaged[0]);
+	munit_assert_true(map.slice_damaged[1]);
+	munit_assert_false(map.slice_damaged[2]);
+
+	// a gap inside the first slice
+	unit_valid[0] = 0xd; // 1101
+	unit_offset[1] = 5;
+	chiaki_frame_unit_map_find_slices(&map, frame, sizeof(frame));
+	munit_assert_uint(map.slices_count, ==, 3);
+	munit_assert_true(map.slice_damaged[0]);
+	munit_assert_false(map.slice_damaged[1]);
+	munit_assert_false(map.slice_damaged[2]);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_unit_map_slices_truncated(const MunitParameter params[], void *user)
+{
+	static uint8_t frame[(CHIAKI_FRAME_UNIT_MAP_SLICES_MAX + 1) * 4];
+	for(size_t i=0; i<CHIAKI_FRAME_UNIT_MAP_SLICES_MAX + 1; i++)
+	{
+		frame[i * 4 + 0] = 0x00;
+		frame[i * 4 + 1] = 0x00;
+		frame[i * 4 + 2] = 0x01;
+		frame[i * 4 + 3] = 0x41;
+	}
+
+	uint64_t unit_valid[1] = { 1 };
+	uint32_t unit_offset[1] = { 0 };
+	static ChiakiFrameUnitMap map;
+	memset(&map, 0, sizeof(map));
+	map.unit_valid = unit_valid;
+	map.unit_offset = unit_offset;
+	map.units_count = 1;
+
+	chiaki_frame_unit_map_find_slices(&map, frame, sizeof(frame));
+	munit_assert_uint(map.slices_count, ==, CHIAKI_FRAME_UNIT_MAP_SLICES_MAX);
+	munit_assert_true(map.slices_truncated);
+	munit_assert_uint32(map.slice_offset[CHIAKI_FRAME_UNIT_MAP_SLICES_MAX - 1], ==, (CHIAKI_FRAME_UNIT_MAP_SLICES_MAX - 1) * 4);
+
+	return MUNIT_OK;
+}
+
+#define FRAME_UNIT_SIZE 64 // including the 2 byte padding header
+#define BIG_FRAME_SOURCE_UNITS 2000
+#define BIG_FRAME_FEC_UNITS 48
+#define FEC_FRAME_SOURCE_UNITS 240
+#define FEC_FRAME_FEC_UNITS (CHIAKI_FRAME_PROCESSOR_FEC_UNITS_MAX - FEC_FRAME_SOURCE_UNITS)
+
+typedef struct test_frame_t
+{
+	unsigned int source_units;
+	unsigned int fec_units;
+	uint8_t *units;
+} TestFrame;
+
+/**
+ * Source units with padding 0 and a payload derived from the unit index, followed by parity units if fec is set
+ */
+static void test_frame_init(TestFrame *frame, unsigned int source_units, unsigned int fec_units, bool fec)
+{
+	frame->source_units = source_units;
+	frame->fec_units = fec_units;
+	frame->units = calloc(source_units + fec_units, FRAME_UNIT_SIZE);
+	munit_assert_not_null(frame->units);
+	for(size_t i=0; i<source_units; i++)
+	{
+		uint8_t *unit = frame->units + i * FRAME_UNIT_SIZE;
+		for(size_t j=2; j<FRAME_UNIT_SIZE; j++)
+			unit[j] = (uint8_t)(i * 7 + j + (i >> 8));
+	}
+	if(fec)
+	{
+		ChiakiErrorCode err = chiaki_fec_encode(frame->units, FRAME_UNIT_SIZE, FRAME_UNIT_SIZE, source_units, fec_units);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+}
+
+static void test_frame_packet(TestFrame *frame, ChiakiTakionAVPacket *packet, unsigned int unit_index)
+{
+	memset(packet, 0, sizeof(*packet));
+	packet->is_video = true;
+	packet->unit_index = unit_index;
+	packet->units_in_frame_total = frame->source_units + frame->fec_units;
+	packet->units_in_frame_fec = frame->fec_units;
+	packet->data = frame->units + unit_index * FRAME_UNIT_SIZE;
+	packet->data_size = FRAME_UNIT_SIZE;
+}
+
+/**
+ * Put all units of frame except the ones in dropped, allocating the frame with the first one
+ */
+static void test_frame_put(TestFrame *frame, ChiakiFrameProcessor *frame_processor, const bool *dropped)
+{
+	bool allocated = false;
+	// back to front, so the first packet is not unit 0
+	for(size_t i=frame->source_units + frame->fec_units; i>0; i--)
+	{
+		unsigned int unit_index = (unsigned int)(i - 1);
+		if(dropped && dropped[unit_index])
+			continue;
+		ChiakiTakionAVPacket packet;
+		test_frame_packet(frame, &packet, unit_index);
+		if(!allocated)
+		{
+			munit_assert_int(chiaki_frame_processor_alloc_frame(frame_processor, &packet), ==, CHIAKI_ERR_SUCCESS);
+			allocated = true;
+		}
+		munit_assert_int(chiaki_frame_processor_put_unit(frame_processor, &packet), ==, CHIAKI_ERR_SUCCESS);
+	}
+}
+
+static void test_frame_assert_unit(TestFrame *frame, uint8_t *buf, size_t offset, size_t unit_index)
+{
+	munit_assert_memory_equal(FRAME_UNIT_SIZE - 2, buf + offset, frame->units + unit_index * FRAME_UNIT_SIZE + 2);
+}
+
+static MunitResult test_big_frame(const MunitParameter params[], void *user)
+{
+	TestFrame test_frame;
+	test_frame_init(&test_frame, BIG_FRAME_SOURCE_UNITS, BIG_FRAME_FEC_UNITS, false);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, NULL);
+
+	test_frame_put(&test_frame, &frame_processor, NULL);
+	munit_assert_uint(frame_processor.units_source_received, ==, BIG_FRAME_SOURCE_UNITS);
+	munit_assert_true(chiaki_frame_processor_flush_possible(&frame_processor));
+
+	// duplicates and units past the end of the frame are rejected
+	ChiakiTakionAVPacket packet;
+	test_frame_packet(&test_frame, &packet, 1234);
+	munit_assert_int(chiaki_frame_processor_put_unit(&frame_processor, &packet), ==, CHIAKI_ERR_INVALID_DATA);
+	packet.unit_index = BIG_FRAME_SOURCE_UNITS + BIG_FRAME_FEC_UNITS;
+	packet.data = test_frame.units;
+	munit_assert_int(chiaki_frame_processor_put_unit(&frame_processor, &packet), ==, CHIAKI_ERR_INVALID_DATA);
+
+	uint8_t *frame;
+	size_t frame_size;
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush(&frame_processor, &frame, &frame_size);
+	munit_assert_int(result, ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_SUCCESS);
+	munit_assert_size(frame_size, ==, BIG_FRAME_SOURCE_UNITS * (FRAME_UNIT_SIZE - 2));
+	for(size_t i=0; i<BIG_FRAME_SOURCE_UNITS; i++)
+		test_frame_assert_unit(&test_frame, frame, i * (FRAME_UNIT_SIZE - 2), i);
+
+	ChiakiFrameUnitMap *map = chiaki_frame_processor_unit_map(&frame_processor);
+	munit_assert_uint(map->units_count, ==, BIG_FRAME_SOURCE_UNITS);
+	munit_assert_uint(map->units_missing, ==, 0);
+	for(unsigned int i=0; i<BIG_FRAME_SOURCE_UNITS; i++)
+		munit_assert_true(chiaki_frame_unit_map_unit_valid(map, i));
+
+	// a smaller frame afterwards reuses the slots
+	size_t capacity = frame_processor.unit_slots_capacity;
+	test_frame_packet(&test_frame, &packet, 0);
+	packet.units_in_frame_total = 3;
+	packet.units_in_frame_fec = 1;
+	munit_assert_int(chiaki_frame_processor_alloc_frame(&frame_processor, &packet), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(frame_processor.unit_slots_size, ==, 3);
+	munit_assert_size(frame_processor.unit_slots_capacity, ==, capacity);
+	munit_assert_int(chiaki_frame_processor_put_unit(&frame_processor, &packet), ==, CHIAKI_ERR_SUCCESS);
+	packet.unit_index = 1;
+	packet.data = test_frame.units + FRAME_UNIT_SIZE;
+	munit_assert_int(chiaki_frame_processor_put_unit(&frame_processor, &packet), ==, CHIAKI_ERR_SUCCESS);
+	result = chiaki_frame_processor_flush(&frame_processor, &frame, &frame_size);
+	munit_assert_int(result, ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_SUCCESS);
+	munit_assert_size(frame_size, ==, 2 * (FRAME_UNIT_SIZE - 2));
+
+	chiaki_frame_processor_fini(&frame_processor);
+	free(test_frame.units);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fec(const MunitParameter params[], void *user)
+{
+	TestFrame test_frame;
+	test_frame_init(&test_frame, FEC_FRAME_SOURCE_UNITS, FEC_FRAME_FEC_UNITS, true);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, NULL);
+
+	// the largest frame FEC is done for, losses spread over several bitmap words, including the first and last source unit and some parity
+	static bool dropped[CHIAKI_FRAME_PROCESSOR_FEC_UNITS_MAX];
+	memset(dropped, 0, sizeof(dropped));
+	const unsigned int dropped_units[] = { 0, 63, 64, 65, 128, 200, 239, 241, 255 };
+	for(size_t i=0; i<sizeof(dropped_units) / sizeof(dropped_units[0]); i++)
+		dropped[dropped_units[i]] = true;
+
+	test_frame_put(&test_frame, &frame_processor, dropped);
+
+	uint8_t *frame;
+	size_t frame_size;
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush(&frame_processor, &frame, &frame_size);
+	munit_assert_int(result, ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS);
+	munit_assert_size(frame_size, ==, FEC_FRAME_SOURCE_UNITS * (FRAME_UNIT_SIZE - 2));
+	for(size_t i=0; i<FEC_FRAME_SOURCE_UNITS; i++)
+		test_frame_assert_unit(&test_frame, frame, i * (FRAME_UNIT_SIZE - 2), i);
+	munit_assert_uint(chiaki_frame_processor_unit_map(&frame_processor)->units_missing, ==, 0);
+
+	chiaki_frame_processor_fini(&frame_processor);
+	free(test_frame.units);
+	return MUNIT_OK;
+}
+
+static MunitResult test_big_frame_fec_unsupported(const MunitParameter params[], void *user)
+{
+	TestFrame test_frame;
+	test_frame_init(&test_frame, BIG_FRAME_SOURCE_UNITS, BIG_FRAME_FEC_UNITS, false);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, NULL);
+
+	// there would be enough parity, but FEC is not done for this many units
+	static bool dropped[BIG_FRAME_SOURCE_UNITS + BIG_FRAME_FEC_UNITS];
+	memset(dropped, 0, sizeof(dropped));
+	const unsigned int dropped_units[] = { 0, 63, 64, 65, 300, 1023, 1024, 1500, 1999, 2001, 2040 };
+	unsigned int dropped_source = 0;
+	for(size_t i=0; i<sizeof(dropped_units) / sizeof(dropped_units[0]); i++)
+	{
+		dropped[dropped_units[i]] = true;
+		if(dropped_units[i] < BIG_FRAME_SOURCE_UNITS)
+			dropped_source++;
+	}
+
+	test_frame_put(&test_frame, &frame_processor, dropped);
+
+	uint8_t *frame;
+	size_t frame_size;
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush(&frame_processor, &frame, &frame_size);
+	munit_assert_int(result, ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED);
+	munit_assert_size(frame_size, ==, (BIG_FRAME_SOURCE_UNITS - dropped_source) * (FRAME_UNIT_SIZE - 2));
+
+	// the units that arrived are still there for the partial sample callback
+	ChiakiFrameUnitMap *map = chiaki_frame_processor_unit_map(&frame_processor);
+	munit_assert_uint(map->units_count, ==, BIG_FRAME_SOURCE_UNITS);
+	munit_assert_uint(map->units_missing, ==, dropped_source);
+	size_t offset = 0;
+	for(unsigned int i=0; i<BIG_FRAME_SOURCE_UNITS; i++)
+	{
+		munit_assert_uint32(map->unit_offset[i], ==, offset);
+		munit_assert(chiaki_frame_unit_map_unit_valid(map, i) == !dropped[i]);
+		if(dropped[i])
+			continue;
+		test_frame_assert_unit(&test_frame, frame, offset, i);
+		offset += FRAME_UNIT_SIZE - 2;
+	}
+
+	chiaki_frame_processor_fini(&frame_processor);
+	free(test_frame.units);
+	return MUNIT_OK;
+}
+
+MunitTest tests_frame_processor[] = {
+	{
+		"/unit_map_slices",
+		test_unit_map_slices,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/unit_map_slices_truncated",
+		test_unit_map_slices_truncated,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/big_frame",
+		test_big_frame,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fec",
+		test_fec,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/big_frame_fec_unsupported",
+		test_big_frame_fec_unsupported,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
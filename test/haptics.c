@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/haptics.h>
+
+#define PACKET_FRAMES 30
+
+static void fill_packet(uint8_t *buf, int16_t left, int16_t right)
+{
+	for(size_t i=0; i<PACKET_FRAMES; i++)
+	{
+		buf[i * 4 + 0] = (uint8_t)((uint16_t)left & 0xff);
+		buf[i * 4 + 1] = (uint8_t)((uint16_t)left >> 8);
+		buf[i * 4 + 2] = (uint8_t)((uint16_t)right & 0xff);
+		buf[i * 4 + 3] = (uint8_t)((uint16_t)right >> 8);
+	}
+}
+
+static MunitResult test_upsampler(const MunitParameter params[], void *user)
+{
+	static ChiakiHapticsUpsampler upsampler;
+	chiaki_haptics_upsampler_init(&upsampler);
+
+	uint8_t buf[PACKET_FRAMES * 4];
+	fill_packet(buf, 10000, -20000);
+
+	static int16_t out[PACKET_FRAMES * CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_CHANNELS_OUT];
+	size_t out_frames = chiaki_haptics_upsampler_process(&upsampler, buf, PACKET_FRAMES, out, PACKET_FRAMES * CHIAKI_HAPTICS_UPSAMPLE_FACTOR);
+	munit_assert_size(out_frames, ==, PACKET_FRAMES * CHIAKI_HAPTICS_UPSAMPLE_FACTOR);
+
+	// once the filter is filled, constant input stays constant, on channels 3 and 4 only
+	for(size_t i=CHIAKI_HAPTICS_UPSAMPLE_TAPS * CHIAKI_HAPTICS_UPSAMPLE_FACTOR; i<out_frames; i++)
+	{
+		int16_t *frame = out + i * CHIAKI_HAPTICS_CHANNELS_OUT;
+		munit_assert_int16(frame[0], ==, 0);
+		munit_assert_int16(frame[1], ==, 0);
+		munit_assert_int(frame[2], >=, 10000 - 1);
+		munit_assert_int(frame[2], <=, 10000 + 1);
+		munit_assert_int(frame[3], >=, -20000 - 1);
+		munit_assert_int(frame[3], <=, -20000 + 1);
+	}
+
+	// output that does not fit is dropped in whole input frames
+	out_frames = chiaki_haptics_upsampler_process(&upsampler, buf, PACKET_FRAMES, out, CHIAKI_HAPTICS_UPSAMPLE_FACTOR * 2 + 3);
+	munit_assert_size(out_frames, ==, CHIAKI_HAPTICS_UPSAMPLE_FACTOR * 2);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_envelope(const MunitParameter params[], void *user)
+{
+	ChiakiHapticsEnvelope envelope;
+	chiaki_haptics_envelope_init(&envelope, 1.0f, 50.0f);
+
+	uint8_t buf[PACKET_FRAMES * 4];
+	uint16_t left, right;
+
+	fill_packet(buf, 16384, -32768);
+	chiaki_haptics_envelope_process(&envelope, buf, PACKET_FRAMES, &left, &right);
+	munit_assert_int(left, >, 32000);
+	munit_assert_int(left, <, 33000);
+	munit_assert_int(right, >, 65000);
+
+	// decays slowly after the signal stops
+	fill_packet(buf, 0, 0);
+	chiaki_haptics_envelope_process(&envelope, buf, PACKET_FRAMES, &left, &right);
+	munit_assert_int(left, >, 16000);
+	munit_assert_int(left, <, 32000);
+	munit_assert_int(right, >, 32000);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_haptics[] = {
+	{
+		"/upsampler",
+		test_upsampler,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/envelope",
+		test_envelope,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
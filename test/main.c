@@ -12,6 +12,18 @@ extern MunitTest tests_takion[];
 extern MunitTest tests_fec[];
 extern MunitTest tests_regist[];
 extern MunitTest tests_bitstream[];
+extern MunitTest tests_rudp[];
+extern MunitTest tests_audio_jitter_buffer[];
+extern MunitTest tests_spsc_ring[];
+extern MunitTest tests_audio_output_ring[];
+extern MunitTest tests_haptics[];
+extern MunitTest tests_audio_sender[];
+extern MunitTest tests_frame_processor[];
+extern MunitTest tests_corrupt_frame_reporter[];
+extern MunitTest tests_metrics[];
+extern MunitTest tests_bitrate_meter[];
+extern MunitTest tests_candidate_check[];
+extern MunitTest tests_thread_sched[];
 
 static MunitSuite suites[] = {
 	{
@@ -84,6 +96,90 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/rudp",
+		tests_rudp,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_jitter_buffer",
+		tests_audio_jitter_buffer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/spsc_ring",
+		tests_spsc_ring,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_output_ring",
+		tests_audio_output_ring,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/haptics",
+		tests_haptics,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_sender",
+		tests_audio_sender,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/frame_processor",
+		tests_frame_processor,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/corrupt_frame_reporter",
+		tests_corrupt_frame_reporter,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/metrics",
+		tests_metrics,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/bitrate_meter",
+		tests_bitrate_meter,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/candidate_check",
+		tests_candidate_check,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/thread_sched",
+		tests_thread_sched,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 	{ NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
 
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/metrics.h>
+#include <chiaki/packetstats.h>
+
+#include <string.h>
+
+static MunitResult test_packet_stats_totals(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	ChiakiErrorCode err = chiaki_packet_stats_init(&stats);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_packet_stats_push_generation(&stats, 10, 2);
+	uint64_t received, lost;
+	chiaki_packet_stats_get(&stats, true, &received, &lost);
+	munit_assert_uint64(received, ==, 10);
+	munit_assert_uint64(lost, ==, 2);
+
+	chiaki_packet_stats_push_generation(&stats, 5, 1);
+	chiaki_packet_stats_get(&stats, false, &received, &lost);
+	munit_assert_uint64(received, ==, 5);
+	munit_assert_uint64(lost, ==, 1);
+
+	// totals include the reset window and the current one
+	chiaki_packet_stats_get_totals(&stats, &received, &lost);
+	munit_assert_uint64(received, ==, 15);
+	munit_assert_uint64(lost, ==, 3);
+
+	chiaki_packet_stats_reset(&stats);
+	chiaki_packet_stats_get(&stats, false, &received, &lost);
+	munit_assert_uint64(received, ==, 0);
+	munit_assert_uint64(lost, ==, 0);
+	chiaki_packet_stats_get_totals(&stats, &received, &lost);
+	munit_assert_uint64(received, ==, 15);
+	munit_assert_uint64(lost, ==, 3);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+static MunitResult test_format_json(const MunitParameter params[], void *user)
+{
+	ChiakiSessionMetrics metrics;
+	memset(&metrics, 0, sizeof(metrics));
+	metrics.rtt_us = 4242;
+	metrics.video.frames = 600;
+	metrics.video.corrupt_frames.requests_sent = 3;
+
+	char buf[4096];
+	size_t len = chiaki_session_metrics_format_json(&metrics, buf, sizeof(buf));
+	munit_assert_size(len, ==, strlen(buf));
+	munit_assert_char(buf[0], ==, '{');
+	munit_assert_char(buf[len - 1], ==, '}');
+	munit_assert_not_null(strstr(buf, "\"rtt_us\":4242"));
+	munit_assert_not_null(strstr(buf, "\"video\":{\"frames\":600,"));
+	munit_assert_not_null(strstr(buf, "\"requests_sent\":3"));
+	// only present once filled
+	munit_assert_null(strstr(buf, "\"feedback\""));
+	munit_assert_null(strstr(buf, "\"decoder\""));
+
+	metrics.decoder.valid = true;
+	metrics.decoder.samples_dropped = 7;
+	len = chiaki_session_metrics_format_json(&metrics, buf, sizeof(buf));
+	munit_assert_not_null(strstr(buf, "\"decoder\":{"));
+	munit_assert_not_null(strstr(buf, "\"samples_dropped\":7}"));
+
+	// truncated output is terminated and the full length is still returned
+	char small[16];
+	size_t small_len = chiaki_session_metrics_format_json(&metrics, small, sizeof(small));
+	munit_assert_size(small_len, ==, len);
+	munit_assert_size(strlen(small), ==, sizeof(small) - 1);
+	munit_assert_memory_equal(sizeof(small) - 1, small, buf);
+	munit_assert_size(chiaki_session_metrics_format_json(&metrics, NULL, 0), ==, len);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_format_prometheus(const MunitParameter params[], void *user)
+{
+	ChiakiSessionMetrics metrics;
+	memset(&metrics, 0, sizeof(metrics));
+	metrics.streaming = true;
+	metrics.packets_lost = 12;
+
+	char buf[8192];
+	size_t len = chiaki_session_metrics_format_prometheus(&metrics, NULL, buf, sizeof(buf));
+	munit_assert_size(len, <, sizeof(buf));
+	munit_assert_not_null(strstr(buf, "# TYPE chiaki_packets_lost_total counter\nchiaki_packets_lost_total 12\n"));
+	munit_assert_not_null(strstr(buf, "\nchiaki_streaming 1\n"));
+	munit_assert_null(strstr(buf, "chiaki_decoder_"));
+
+	len = chiaki_session_metrics_format_prometheus(&metrics, "host=\"ps5\"", buf, sizeof(buf));
+	munit_assert_size(len, <, sizeof(buf));
+	munit_assert_not_null(strstr(buf, "\nchiaki_packets_lost_total{host=\"ps5\"} 12\n"));
+	munit_assert_char(buf[len - 1], ==, '\n');
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_metrics[] = {
+	{
+		"/packet_stats_totals",
+		test_packet_stats_totals,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/format_json",
+		test_format_json,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/format_prometheus",
+		test_format_prometheus,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
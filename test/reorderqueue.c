@@ -3,6 +3,7 @@
 #include <munit.h>
 
 #include <chiaki/reorderqueue.h>
+#include <chiaki/bitmapreorderqueue.h>
 
 #define DROP_RECORD_MAX 16
 
@@ -172,6 +173,292 @@ static MunitResult test_reorder_queue_16(const MunitParameter params[], void *te
 }
 
 
+static MunitResult test_bitmap_reorder_queue_16(const MunitParameter params[], void *test_user)
+{
+	ChiakiBitmapReorderQueue queue;
+	ChiakiErrorCode err = chiaki_bitmap_reorder_queue_init_16(&queue, 2, 42);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(chiaki_bitmap_reorder_queue_size(&queue), ==, 4);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+
+	chiaki_bitmap_reorder_queue_set_drop_strategy(&queue, CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END);
+
+	DropRecord drop_record = { 0 };
+	chiaki_bitmap_reorder_queue_set_drop_cb(&queue, drop, &drop_record);
+
+	uint64_t seq_num = 0;
+	void *user = NULL;
+
+	// pull from empty
+	bool pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(!pulled);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+	munit_assert(!drop_record.failed);
+
+	// push one
+	chiaki_bitmap_reorder_queue_push(&queue, 42, (void *)0);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 1);
+
+	// pull one
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+	munit_assert(!drop_record.failed);
+	munit_assert_uint64(drop_record.count[0], ==, 0);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 0);
+	munit_assert_uint64(seq_num, ==, 42);
+
+	// push outdated
+	chiaki_bitmap_reorder_queue_push(&queue, 42, (void *)0);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+	munit_assert(!drop_record.failed);
+	munit_assert_uint64(drop_record.count[0], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[0], ==, 42);
+	memset(&drop_record, 0, sizeof(drop_record));
+
+	// push until full out of order and try to pull in between
+	chiaki_bitmap_reorder_queue_push(&queue, 46, (void *)1);
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(!pulled);
+	chiaki_bitmap_reorder_queue_push(&queue, 45, (void *)2);
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(!pulled);
+	chiaki_bitmap_reorder_queue_push(&queue, 44, (void *)3);
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(!pulled);
+	chiaki_bitmap_reorder_queue_push(&queue, 43, (void *)4);
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, 0);
+
+	// push more, because of CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END this should be dropped
+	chiaki_bitmap_reorder_queue_push(&queue, 47, (void *)5);
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, i == 5 ? 1 : 0);
+	munit_assert_uint64(drop_record.seq_num[5], ==, 47);
+	memset(&drop_record, 0, sizeof(drop_record));
+
+	// push more with CHIAKI_REORDER_QUEUE_DROP_STRATEGY_BEGIN, so older elements should be dropped
+	chiaki_bitmap_reorder_queue_set_drop_strategy(&queue, CHIAKI_REORDER_QUEUE_DROP_STRATEGY_BEGIN);
+	chiaki_bitmap_reorder_queue_push(&queue, 47, (void *)5);
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, i == 4 ? 1 : 0);
+	munit_assert_uint64(drop_record.seq_num[4], ==, 43);
+	memset(&drop_record, 0, sizeof(drop_record));
+	
+	// pull all, elements should arrive in order
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(seq_num, ==, 44);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 3);
+
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(seq_num, ==, 45);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 2);
+
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(seq_num, ==, 46);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 1);
+
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(seq_num, ==, 47);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 5);
+
+	// should be empty now again
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(!pulled);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, 0);
+
+	// now push something much higher, because of CHIAKI_REORDER_QUEUE_DROP_STRATEGY_BEGIN, the queue should be relocated
+	chiaki_bitmap_reorder_queue_push(&queue, 1337, (void *)6);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 1);
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, 0);
+
+	// and pull again
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(seq_num, ==, 1337);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 6);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+
+	// same as before, but with an element in the queue that will be dropped
+	chiaki_bitmap_reorder_queue_push(&queue, 1338, (void *)7);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 1);
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, 0);
+
+	chiaki_bitmap_reorder_queue_push(&queue, 2000, (void *)8);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 1);
+	munit_assert(!drop_record.failed);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, i == 7 ? 1 : 0);
+	munit_assert_uint64(drop_record.seq_num[7], ==, 1338);
+
+	// pull again
+	pulled = chiaki_bitmap_reorder_queue_pull(&queue, &seq_num, &user);
+	munit_assert(pulled);
+	munit_assert_uint64(seq_num, ==, 2000);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 8);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+
+	chiaki_bitmap_reorder_queue_fini(&queue);
+
+	return MUNIT_OK;
+}
+
+
+static MunitResult test_bitmap_reorder_queue_32_wrap(const MunitParameter params[], void *test_user)
+{
+	ChiakiBitmapReorderQueue queue;
+	ChiakiErrorCode err = chiaki_bitmap_reorder_queue_init_32(&queue, 3, 0xfffffffd);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	DropRecord drop_record = { 0 };
+	chiaki_bitmap_reorder_queue_set_drop_cb(&queue, drop, &drop_record);
+
+	// out of order across the wraparound of the sequence numbers
+	chiaki_bitmap_reorder_queue_push_32(&queue, 1, (void *)4);
+	chiaki_bitmap_reorder_queue_push_32(&queue, 0xfffffffe, (void *)1);
+	chiaki_bitmap_reorder_queue_push_32(&queue, 0, (void *)3);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 5);
+
+	void *users[8];
+	uint64_t seq_num = 0;
+	size_t pulled = chiaki_bitmap_reorder_queue_pull_all_32(&queue, &seq_num, users, 8);
+	munit_assert_size(pulled, ==, 0);
+
+	chiaki_bitmap_reorder_queue_push_32(&queue, 0xfffffffd, (void *)0);
+	pulled = chiaki_bitmap_reorder_queue_pull_all_32(&queue, &seq_num, users, 8);
+	munit_assert_size(pulled, ==, 2);
+	munit_assert_uint64(seq_num, ==, 0xfffffffd);
+	munit_assert_uint64((uint64_t)(size_t)users[0], ==, 0);
+	munit_assert_uint64((uint64_t)(size_t)users[1], ==, 1);
+
+	// the run continues over the end of the slot array, limited by users_max
+	chiaki_bitmap_reorder_queue_push_32(&queue, 0xffffffff, (void *)2);
+	chiaki_bitmap_reorder_queue_push_32(&queue, 2, (void *)5);
+	pulled = chiaki_bitmap_reorder_queue_pull_all_32(&queue, &seq_num, users, 3);
+	munit_assert_size(pulled, ==, 3);
+	munit_assert_uint64(seq_num, ==, 0xffffffff);
+	for(size_t i=0; i<3; i++)
+		munit_assert_uint64((uint64_t)(size_t)users[i], ==, 2 + i);
+	pulled = chiaki_bitmap_reorder_queue_pull_all_32(&queue, &seq_num, users, 8);
+	munit_assert_size(pulled, ==, 1);
+	munit_assert_uint64(seq_num, ==, 2);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 0);
+
+	// behind begin
+	chiaki_bitmap_reorder_queue_push_32(&queue, 0xffffffff, (void *)6);
+	munit_assert_uint64(drop_record.count[6], ==, 1);
+
+	// dropping the last element shrinks the queue, remaining ones go to the drop cb in fini
+	chiaki_bitmap_reorder_queue_push_32(&queue, 4, (void *)7);
+	chiaki_bitmap_reorder_queue_push_32(&queue, 6, (void *)8);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 4);
+	chiaki_bitmap_reorder_queue_drop(&queue, 3);
+	munit_assert_uint64(drop_record.count[8], ==, 1);
+	munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, 2);
+
+	chiaki_bitmap_reorder_queue_fini(&queue);
+	munit_assert_uint64(drop_record.count[7], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[7], ==, 4);
+	munit_assert(!drop_record.failed);
+
+	return MUNIT_OK;
+}
+
+typedef struct drop_log_t
+{
+	uint64_t seq_nums[0x400];
+	size_t count;
+} DropLog;
+
+static void drop_log(uint64_t seq_num, void *elem_user, void *cb_user)
+{
+	DropLog *log = cb_user;
+	munit_assert_uint64((uint64_t)(size_t)elem_user, ==, seq_num);
+	munit_assert_size(log->count, <, sizeof(log->seq_nums) / sizeof(log->seq_nums[0]));
+	log->seq_nums[log->count++] = seq_num;
+}
+
+static MunitResult test_bitmap_reorder_queue_compare(const MunitParameter params[], void *test_user)
+{
+	for(int strategy=0; strategy<2; strategy++)
+	{
+		ChiakiReorderQueue reference;
+		ChiakiBitmapReorderQueue queue;
+		munit_assert_int(chiaki_reorder_queue_init_16(&reference, 5, 0xffc0), ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_int(chiaki_bitmap_reorder_queue_init_16(&queue, 5, 0xffc0), ==, CHIAKI_ERR_SUCCESS);
+		chiaki_reorder_queue_set_drop_strategy(&reference, (ChiakiReorderQueueDropStrategy)strategy);
+		chiaki_bitmap_reorder_queue_set_drop_strategy(&queue, (ChiakiReorderQueueDropStrategy)strategy);
+		static DropLog reference_drops, drops;
+		memset(&reference_drops, 0, sizeof(reference_drops));
+		memset(&drops, 0, sizeof(drops));
+		chiaki_reorder_queue_set_drop_cb(&reference, drop_log, &reference_drops);
+		chiaki_bitmap_reorder_queue_set_drop_cb(&queue, drop_log, &drops);
+
+		munit_rand_seed(1337 + strategy);
+		ChiakiSeqNum16 next = 0xffc0;
+		for(size_t round=0; round<0x400; round++)
+		{
+			// mostly slightly reordered packets, sometimes duplicates, old ones or big jumps
+			ChiakiSeqNum16 seq_num = next + munit_rand_int_range(-4, 12);
+			if(munit_rand_int_range(0, 50) == 0)
+				seq_num += munit_rand_int_range(0, 100);
+			next++;
+			void *user = (void *)(size_t)seq_num;
+			chiaki_reorder_queue_push(&reference, seq_num, user);
+			chiaki_bitmap_reorder_queue_push(&queue, seq_num, user);
+			munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, chiaki_reorder_queue_count(&reference));
+
+			if(munit_rand_int_range(0, 40) == 0 && chiaki_reorder_queue_count(&reference) > 0)
+			{
+				uint64_t index = (uint64_t)munit_rand_int_range(0, (int)chiaki_reorder_queue_count(&reference) - 1);
+				chiaki_reorder_queue_drop(&reference, index);
+				chiaki_bitmap_reorder_queue_drop(&queue, index);
+				munit_assert_uint64(chiaki_bitmap_reorder_queue_count(&queue), ==, chiaki_reorder_queue_count(&reference));
+			}
+
+			if(munit_rand_int_range(0, 3) != 0)
+				continue;
+
+			void *users[0x20];
+			uint64_t first = 0;
+			size_t pulled = chiaki_bitmap_reorder_queue_pull_all(&queue, &first, users, sizeof(users) / sizeof(users[0]));
+			for(size_t i=0; i<pulled; i++)
+			{
+				uint64_t reference_seq_num;
+				void *reference_user;
+				munit_assert_true(chiaki_reorder_queue_pull(&reference, &reference_seq_num, &reference_user));
+				munit_assert_uint64(reference_seq_num, ==, (ChiakiSeqNum16)(first + i));
+				munit_assert_ptr_equal(users[i], reference_user);
+			}
+			munit_assert_false(chiaki_reorder_queue_pull(&reference, NULL, NULL));
+		}
+
+		munit_assert_size(drops.count, ==, reference_drops.count);
+		for(size_t i=0; i<drops.count; i++)
+			munit_assert_uint64(drops.seq_nums[i], ==, reference_drops.seq_nums[i]);
+
+		chiaki_reorder_queue_fini(&reference);
+		chiaki_bitmap_reorder_queue_fini(&queue);
+	}
+
+	return MUNIT_OK;
+}
+
 MunitTest tests_reorder_queue[] = {
 	{
 		"/reorder_queue_16",
@@ -181,5 +468,29 @@ MunitTest tests_reorder_queue[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/bitmap_reorder_queue_16",
+		test_bitmap_reorder_queue_16,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/bitmap_reorder_queue_32_wrap",
+		test_bitmap_reorder_queue_32_wrap,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/bitmap_reorder_queue_compare",
+		test_bitmap_reorder_queue_compare,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/remote/rudp.h>
+
+static MunitResult test_parse_in_place(const MunitParameter params[], void *user)
+{
+	uint8_t packet[] = {
+		// ack: length 0xC00e, 6 bytes data
+		0xc0, 0x0e, 0x24, 0x4f, 0x24, 0x4f, 0x24, 0x30,
+		0x12, 0x34, 0x56, 0x78, 0x00, 0x92,
+		// ctrl message: length 0xC00c, 4 bytes data
+		0xc0, 0x0c, 0x24, 0x4f, 0x24, 0x4f, 0x02, 0x30,
+		0x00, 0x41, 0xde, 0xad
+	};
+
+	RudpMessage messages[CHIAKI_RUDP_MESSAGE_CHAIN_MAX];
+	size_t messages_count = 0;
+	ChiakiErrorCode err = chiaki_rudp_message_parse_in_place(packet, sizeof(packet), messages, CHIAKI_RUDP_MESSAGE_CHAIN_MAX, &messages_count);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(messages_count, ==, 2);
+
+	munit_assert_int(messages[0].type, ==, ACK);
+	munit_assert_uint8(messages[0].subtype, ==, 0x24);
+	munit_assert_size(messages[0].data_size, ==, 6);
+	munit_assert_ptr_equal(messages[0].data, packet + 8);
+	munit_assert_uint16(messages[0].remote_counter, ==, 0x1235);
+	munit_assert_ptr_equal(messages[0].subMessage, &messages[1]);
+	munit_assert_uint16(messages[0].subMessage_size, ==, 12);
+
+	munit_assert_int(messages[1].type, ==, CTRL_MESSAGE);
+	munit_assert_uint8(messages[1].subtype, ==, 0x02);
+	munit_assert_size(messages[1].data_size, ==, 4);
+	munit_assert_ptr_equal(messages[1].data, packet + 22);
+	munit_assert_uint16(messages[1].remote_counter, ==, 0x42);
+	munit_assert_null(messages[1].subMessage);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_parse_in_place_truncated(const MunitParameter params[], void *user)
+{
+	uint8_t packet[] = {
+		0xc0, 0x0a, 0x24, 0x4f, 0x24, 0x4f, 0x24, 0x30, 0x00, 0x01,
+		0xc0, 0x0a, 0x24, 0x4f, 0x24, 0x4f, 0x24, 0x30, 0x00, 0x02,
+		0xc0, 0x0a, 0x24, 0x4f, 0x24, 0x4f, 0x24, 0x30, 0x00, 0x03
+	};
+
+	RudpMessage messages[2];
+	size_t messages_count = 0;
+	ChiakiErrorCode err = chiaki_rudp_message_parse_in_place(packet, sizeof(packet), messages, 2, &messages_count);
+	munit_assert_int(err, ==, CHIAKI_ERR_BUF_TOO_SMALL);
+	munit_assert_size(messages_count, ==, 2);
+	munit_assert_ptr_equal(messages[0].subMessage, &messages[1]);
+	munit_assert_null(messages[1].subMessage);
+	munit_assert_uint16(messages[1].remote_counter, ==, 3);
+
+	err = chiaki_rudp_message_parse_in_place(packet, 4, messages, 2, &messages_count);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_size(messages_count, ==, 0);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_rudp[] = {
+	{
+		"/parse_in_place",
+		test_parse_in_place,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/parse_in_place_truncated",
+		test_parse_in_place_truncated,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
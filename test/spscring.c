@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/spscring.h>
+#include <chiaki/thread.h>
+
+static MunitResult test_spsc_ring_elements(const MunitParameter params[], void *user)
+{
+	ChiakiSpscRing ring;
+	ChiakiErrorCode err = chiaki_spsc_ring_init(&ring, sizeof(uint32_t), 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(chiaki_spsc_ring_size(&ring), ==, 4);
+	munit_assert_ptr_null(chiaki_spsc_ring_read_begin(&ring));
+
+	for(uint32_t i=0; i<4; i++)
+	{
+		uint32_t *v = chiaki_spsc_ring_write_begin(&ring);
+		munit_assert_ptr_not_null(v);
+		*v = i;
+		chiaki_spsc_ring_write_commit(&ring);
+	}
+	munit_assert_ptr_null(chiaki_spsc_ring_write_begin(&ring));
+	munit_assert_size(chiaki_spsc_ring_count(&ring), ==, 4);
+
+	uint32_t *v = chiaki_spsc_ring_read_begin(&ring);
+	munit_assert_ptr_not_null(v);
+	munit_assert_uint32(*v, ==, 0);
+	chiaki_spsc_ring_read_commit(&ring);
+
+	// bulk write wraps around the end of the buffer and stops when full
+	uint32_t in[3] = { 4, 5, 6 };
+	munit_assert_size(chiaki_spsc_ring_write(&ring, in, 3), ==, 1);
+	munit_assert_size(chiaki_spsc_ring_count(&ring), ==, 4);
+
+	uint32_t out[8];
+	munit_assert_size(chiaki_spsc_ring_read(&ring, out, 8), ==, 4);
+	munit_assert_uint32(out[0], ==, 1);
+	munit_assert_uint32(out[1], ==, 2);
+	munit_assert_uint32(out[2], ==, 3);
+	munit_assert_uint32(out[3], ==, 4);
+	munit_assert_size(chiaki_spsc_ring_count(&ring), ==, 0);
+	munit_assert_size(chiaki_spsc_ring_read(&ring, out, 8), ==, 0);
+
+	chiaki_spsc_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+#define THREADED_COUNT 100000
+
+static void *producer_thread_func(void *user)
+{
+	ChiakiSpscRing *ring = user;
+	uint32_t v = 0;
+	while(v < THREADED_COUNT)
+	{
+		uint32_t buf[7];
+		size_t count = 0;
+		while(count < 7 && v + count < THREADED_COUNT)
+		{
+			buf[count] = v + (uint32_t)count;
+			count++;
+		}
+		v += (uint32_t)chiaki_spsc_ring_write(ring, buf, count);
+	}
+	return NULL;
+}
+
+static MunitResult test_spsc_ring_threaded(const MunitParameter params[], void *user)
+{
+	ChiakiSpscRing ring;
+	ChiakiErrorCode err = chiaki_spsc_ring_init(&ring, sizeof(uint32_t), 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiThread thread;
+	err = chiaki_thread_create(&thread, producer_thread_func, &ring);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint32_t expected = 0;
+	while(expected < THREADED_COUNT)
+	{
+		uint32_t *v = chiaki_spsc_ring_read_begin(&ring);
+		if(!v)
+			continue;
+		munit_assert_uint32(*v, ==, expected);
+		chiaki_spsc_ring_read_commit(&ring);
+		expected++;
+	}
+
+	chiaki_thread_join(&thread, NULL);
+	munit_assert_size(chiaki_spsc_ring_count(&ring), ==, 0);
+	chiaki_spsc_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+MunitTest tests_spsc_ring[] = {
+	{
+		"/elements",
+		test_spsc_ring_elements,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/threaded",
+		test_spsc_ring_threaded,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -11,6 +11,15 @@
 
 #include "test_log.h"
 
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/select.h>
+#endif
+
 
 static MunitResult test_av_packet_parse(const MunitParameter params[], void *user)
 {
@@ -195,6 +204,197 @@ static MunitResult test_takion_format_congestion(const MunitParameter params[],
 	return MUNIT_OK;
 }
 
+static MunitResult test_takion_delayed_ack_count(const MunitParameter params[], void *user)
+{
+	ChiakiTakionAckPolicy policy = { 4, 5000 };
+	ChiakiTakionDelayedAck ack;
+	chiaki_takion_delayed_ack_init(&ack, &policy);
+
+	uint64_t timeout_ms;
+	munit_assert_false(chiaki_takion_delayed_ack_due(&ack, 0, &timeout_ms));
+	munit_assert_uint64(timeout_ms, ==, UINT64_MAX);
+
+	munit_assert_false(chiaki_takion_delayed_ack_push(&ack, 1, 10, 1000));
+	munit_assert_false(chiaki_takion_delayed_ack_push(&ack, 2, 12, 2000));
+	munit_assert_false(chiaki_takion_delayed_ack_due(&ack, 2000, &timeout_ms));
+	munit_assert_uint64(timeout_ms, ==, 4);
+
+	// the fourth packet triggers one cumulative ack before the deadline
+	munit_assert_true(chiaki_takion_delayed_ack_push(&ack, 1, 13, 3000));
+	munit_assert_uint32(ack.seq_num, ==, 13);
+	chiaki_takion_delayed_ack_sent(&ack);
+	munit_assert_false(chiaki_takion_delayed_ack_due(&ack, 1000000, &timeout_ms));
+	munit_assert_uint64(timeout_ms, ==, UINT64_MAX);
+
+	// a burst of more than packets_max at once is acked right away too
+	munit_assert_true(chiaki_takion_delayed_ack_push(&ack, 6, 19, 4000));
+	munit_assert_uint32(ack.seq_num, ==, 19);
+
+	// the default acks every packet
+	chiaki_takion_ack_policy_default(&policy);
+	chiaki_takion_delayed_ack_init(&ack, &policy);
+	munit_assert_true(chiaki_takion_delayed_ack_push(&ack, 1, 20, 0));
+	chiaki_takion_delayed_ack_sent(&ack);
+	munit_assert_true(chiaki_takion_delayed_ack_push(&ack, 1, 21, 0));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_takion_delayed_ack_deadline(const MunitParameter params[], void *user)
+{
+	ChiakiTakionAckPolicy policy = { 4, 5000 };
+	ChiakiTakionDelayedAck ack;
+	chiaki_takion_delayed_ack_init(&ack, &policy);
+
+	// the deadline is counted from the oldest unacknowledged packet
+	munit_assert_false(chiaki_takion_delayed_ack_push(&ack, 1, 30, 1000));
+	munit_assert_false(chiaki_takion_delayed_ack_push(&ack, 1, 31, 4000));
+	uint64_t timeout_ms;
+	munit_assert_false(chiaki_takion_delayed_ack_due(&ack, 5001, &timeout_ms));
+	munit_assert_uint64(timeout_ms, ==, 1);
+	munit_assert_true(chiaki_takion_delayed_ack_due(&ack, 6000, &timeout_ms));
+	munit_assert_uint32(ack.seq_num, ==, 31);
+	chiaki_takion_delayed_ack_sent(&ack);
+
+	// and starts over after an ack
+	munit_assert_false(chiaki_takion_delayed_ack_push(&ack, 1, 32, 7000));
+	munit_assert_false(chiaki_takion_delayed_ack_due(&ack, 11999, &timeout_ms));
+	munit_assert_true(chiaki_takion_delayed_ack_due(&ack, 12000, &timeout_ms));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_takion_delayed_ack_clamp(const MunitParameter params[], void *user)
+{
+	// an ack must never be delayed into the console's resend timeout
+	ChiakiTakionAckPolicy policy = { 100, 10 * 1000 * 1000 };
+	ChiakiTakionDelayedAck ack;
+	chiaki_takion_delayed_ack_init(&ack, &policy);
+	munit_assert_uint64(ack.policy.delay_us, ==, CHIAKI_TAKION_ACK_DELAY_MAX_US);
+	munit_assert_false(chiaki_takion_delayed_ack_push(&ack, 1, 40, 0));
+	uint64_t timeout_ms;
+	munit_assert_false(chiaki_takion_delayed_ack_due(&ack, 0, &timeout_ms));
+	munit_assert_uint64(timeout_ms, ==, CHIAKI_TAKION_ACK_DELAY_MAX_US / 1000);
+	munit_assert_true(chiaki_takion_delayed_ack_due(&ack, CHIAKI_TAKION_ACK_DELAY_MAX_US, &timeout_ms));
+
+	// no packets_max acks immediately
+	policy.packets_max = 0;
+	policy.delay_us = 5000;
+	chiaki_takion_delayed_ack_init(&ack, &policy);
+	munit_assert_uint(ack.policy.packets_max, ==, 1);
+	munit_assert_true(chiaki_takion_delayed_ack_push(&ack, 1, 41, 0));
+
+	return MUNIT_OK;
+}
+
+static chiaki_socket_t udp_loopback_socket(struct sockaddr_in *addr)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(CHIAKI_SOCKET_IS_INVALID(sock))
+		return sock;
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_len = sizeof(*addr);
+	if(bind(sock, (struct sockaddr *)addr, addr_len) < 0 || getsockname(sock, (struct sockaddr *)addr, &addr_len) < 0)
+	{
+		CHIAKI_SOCKET_CLOSE(sock);
+		return CHIAKI_INVALID_SOCKET;
+	}
+	return sock;
+}
+
+/**
+ * @return size of the next datagram on sock, or 0 if none arrives within timeout_ms
+ */
+static size_t udp_recv(chiaki_socket_t sock, uint8_t *buf, size_t buf_size, unsigned int timeout_ms)
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(sock, &fds);
+	struct timeval tv = { 0, timeout_ms * 1000 };
+	if(select((int)sock + 1, &fds, NULL, NULL, &tv) <= 0)
+		return 0;
+	int r = (int)recv(sock, (CHIAKI_SOCKET_BUF_TYPE)buf, buf_size, 0);
+	return r > 0 ? (size_t)r : 0;
+}
+
+static MunitResult test_takion_send_batch(const MunitParameter params[], void *user)
+{
+	// only what chiaki_takion_send_raw() and the batch need, no connection
+	static ChiakiTakion takion;
+	memset(&takion, 0, sizeof(takion));
+	takion.log = get_test_log();
+	struct sockaddr_in peer_addr, local_addr;
+	chiaki_socket_t peer = udp_loopback_socket(&peer_addr);
+	takion.sock = udp_loopback_socket(&local_addr);
+	if(CHIAKI_SOCKET_IS_INVALID(peer) || CHIAKI_SOCKET_IS_INVALID(takion.sock)
+			|| connect(takion.sock, (struct sockaddr *)&peer_addr, sizeof(peer_addr)) < 0)
+	{
+		if(!CHIAKI_SOCKET_IS_INVALID(peer))
+			CHIAKI_SOCKET_CLOSE(peer);
+		if(!CHIAKI_SOCKET_IS_INVALID(takion.sock))
+			CHIAKI_SOCKET_CLOSE(takion.sock);
+		return MUNIT_SKIP;
+	}
+	munit_assert_int(chiaki_mutex_init(&takion.send_batch.mutex, false), ==, CHIAKI_ERR_SUCCESS);
+
+	// small datagrams wait for the last batch to close, a big one in between keeps its place
+	static const size_t sizes[] = { 100, 200, CHIAKI_TAKION_SEND_BATCH_PACKET_SIZE_MAX + 1, 1200, 300, CHIAKI_TAKION_SEND_BATCH_PACKET_SIZE_MAX };
+	const size_t count = sizeof(sizes) / sizeof(sizes[0]);
+	uint8_t buf[1500];
+	chiaki_takion_send_batch_begin(&takion);
+	chiaki_takion_send_batch_begin(&takion);
+	for(size_t i=0; i<count; i++)
+	{
+		memset(buf, (int)i, sizes[i]);
+		munit_assert_int(chiaki_takion_send_raw(&takion, buf, sizes[i]), ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_int(chiaki_takion_send_batch_end(&takion), ==, CHIAKI_ERR_SUCCESS);
+	// the big ones pushed out everything before them
+	for(size_t i=0; i<4; i++)
+	{
+		munit_assert_size(udp_recv(peer, buf, sizeof(buf), 100), ==, sizes[i]);
+		munit_assert_uint8(buf[0], ==, (uint8_t)i);
+	}
+	munit_assert_size(udp_recv(peer, buf, sizeof(buf), 10), ==, 0);
+	munit_assert_int(chiaki_takion_send_batch_end(&takion), ==, CHIAKI_ERR_SUCCESS);
+	for(size_t i=4; i<count; i++)
+	{
+		munit_assert_size(udp_recv(peer, buf, sizeof(buf), 100), ==, sizes[i]);
+		munit_assert_uint8(buf[0], ==, (uint8_t)i);
+	}
+
+	// more than fit into one batch still arrive in order
+	const size_t many = CHIAKI_TAKION_SEND_BATCH_PACKETS_MAX * 2 + 3;
+	chiaki_takion_send_batch_begin(&takion);
+	for(size_t i=0; i<many; i++)
+	{
+		memset(buf, (int)i, 64);
+		munit_assert_int(chiaki_takion_send_raw(&takion, buf, 64), ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_int(chiaki_takion_send_batch_end(&takion), ==, CHIAKI_ERR_SUCCESS);
+	for(size_t i=0; i<many; i++)
+	{
+		munit_assert_size(udp_recv(peer, buf, sizeof(buf), 100), ==, 64);
+		munit_assert_uint8(buf[0], ==, (uint8_t)i);
+	}
+	munit_assert_uint64(takion.send_batch.packets_sent, ==, 4 + many);
+
+	// a failed flush is reported when the batch is closed
+	chiaki_takion_send_batch_begin(&takion);
+	munit_assert_int(chiaki_takion_send_raw(&takion, buf, 64), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_socket_t sock = takion.sock;
+	takion.sock = CHIAKI_INVALID_SOCKET;
+	munit_assert_int(chiaki_takion_send_batch_end(&takion), ==, CHIAKI_ERR_NETWORK);
+	takion.sock = sock;
+
+	chiaki_mutex_fini(&takion.send_batch.mutex);
+	CHIAKI_SOCKET_CLOSE(takion.sock);
+	CHIAKI_SOCKET_CLOSE(peer);
+	return MUNIT_OK;
+}
+
 MunitTest tests_takion[] = {
 	{
 		"/av_packet_parse",
@@ -228,5 +428,37 @@ MunitTest tests_takion[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/delayed_ack_count",
+		test_takion_delayed_ack_count,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/delayed_ack_deadline",
+		test_takion_delayed_ack_deadline,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/delayed_ack_clamp",
+		test_takion_delayed_ack_clamp,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/send_batch",
+		test_takion_send_batch,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
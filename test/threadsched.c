@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/thread.h>
+
+static MunitResult test_parse_priority(const MunitParameter params[], void *user)
+{
+	ChiakiThreadSchedConfig config;
+	for(ChiakiThreadPriority priority = CHIAKI_THREAD_PRIORITY_LOW; priority <= CHIAKI_THREAD_PRIORITY_REALTIME; priority++)
+	{
+		ChiakiErrorCode err = chiaki_thread_sched_config_parse(&config, chiaki_thread_priority_string(priority));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_true(config.set_priority);
+		munit_assert_int(config.priority, ==, priority);
+		munit_assert_uint64(config.cpu_mask, ==, 0);
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_parse_cpu_mask(const MunitParameter params[], void *user)
+{
+	ChiakiThreadSchedConfig config;
+	ChiakiErrorCode err = chiaki_thread_sched_config_parse(&config, "realtime@0x4");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_true(config.set_priority);
+	munit_assert_int(config.priority, ==, CHIAKI_THREAD_PRIORITY_REALTIME);
+	munit_assert_uint64(config.cpu_mask, ==, 0x4);
+
+	// only the affinity
+	err = chiaki_thread_sched_config_parse(&config, "@12");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_false(config.set_priority);
+	munit_assert_uint64(config.cpu_mask, ==, 12);
+
+	err = chiaki_thread_sched_config_parse(&config, "low@0xffffffffffffffff");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(config.priority, ==, CHIAKI_THREAD_PRIORITY_LOW);
+	munit_assert_uint64(config.cpu_mask, ==, UINT64_MAX);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_parse_invalid(const MunitParameter params[], void *user)
+{
+	static const char *invalid[] = {
+		"",
+		"@",
+		"high@",
+		"@0",
+		"high@0",
+		"@0x",
+		"@4x",
+		"@0x10000000000000000",
+		"fast",
+		"Realtime",
+		"real",
+		"realtime ",
+		"realtime@0x4@0x4"
+	};
+	for(size_t i=0; i<sizeof(invalid) / sizeof(invalid[0]); i++)
+	{
+		ChiakiThreadSchedConfig config;
+		ChiakiErrorCode err = chiaki_thread_sched_config_parse(&config, invalid[i]);
+		if(err == CHIAKI_ERR_SUCCESS)
+			munit_errorf("\"%s\" was accepted", invalid[i]);
+	}
+	return MUNIT_OK;
+}
+
+MunitTest tests_thread_sched[] = {
+	{
+		"/parse_priority",
+		test_parse_priority,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/parse_cpu_mask",
+		test_parse_cpu_mask,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/parse_invalid",
+		test_parse_invalid,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};